@@ -1,16 +1,37 @@
 #include "Bitmap.h"
 
+#include "Group.h"
+#include "Utils/BitScan.h"
+#include "Utils/Math.h"
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <memory.h>
+
+block_t FsBitmapFirstBlock(const FsMeta* pMeta)
+{
+    // Revision 0 starts tracking blocks from AddrNodeTable, all blocks before are untracked (including metadata and bitmap itself).
+    // Groups track every one of their blocks, their bitmap block included, and the first group starts at AddrBitmap.
+    return FsHasGroups(pMeta) ? pMeta->AddrBitmap : pMeta->AddrNodeTable;
+}
+
+uint64_t FsBitmapNumBlocks(const FsMeta* pMeta)
+{
+    return FsHasGroups(pMeta) ? pMeta->NumGroups : pMeta->AddrNodeTable - pMeta->AddrBitmap;
+}
+
+block_t FsBitmapBlockAddress(const FsMeta* pMeta, uint64_t index)
+{
+    return FsHasGroups(pMeta) ? FsGroupStart(pMeta, (uint32_t) index) : pMeta->AddrBitmap + index;
+}
 
 bitmappos_t FsBitmapResolveFromBlock(const FsMeta* pMeta, block_t block)
 {
     uint32_t blocksPerBitmapBlock = pMeta->BlockSize * 8;
-    // The bitmap starts tracking blocks from AddrNodeTable, all blocks before are untracked (including metadata and bitmap itself).
-    block_t offsetedBlock = block - pMeta->AddrNodeTable;
+    block_t offsetedBlock = block - FsBitmapFirstBlock(pMeta);
     
     bitmappos_t pos;
-    pos.Block = pMeta->AddrBitmap + (offsetedBlock / blocksPerBitmapBlock);
+    pos.Block = FsBitmapBlockAddress(pMeta, offsetedBlock / blocksPerBitmapBlock);
     pos.ByteOffset = (offsetedBlock % blocksPerBitmapBlock) / 8;
     pos.BitOffset = offsetedBlock % 8;
     
@@ -20,109 +41,439 @@ bitmappos_t FsBitmapResolveFromBlock(const FsMeta* pMeta, block_t block)
 block_t FsBitmapResolveToBlock(const FsMeta* pMeta, bitmappos_t pos)
 {
     uint32_t blocksPerBitmapBlock = pMeta->BlockSize * 8;
-    uint64_t blockIndex = pos.Block - pMeta->AddrBitmap;
-    return pMeta->AddrNodeTable + ((blockIndex * blocksPerBitmapBlock) + (pos.ByteOffset * 8) + pos.BitOffset);
+    uint64_t blockIndex = FsHasGroups(pMeta) ? FsGroupOfBlock(pMeta, pos.Block) : pos.Block - pMeta->AddrBitmap;
+    return FsBitmapFirstBlock(pMeta) + ((blockIndex * blocksPerBitmapBlock) + (pos.ByteOffset * 8) + pos.BitOffset);
 }
 
-uint8_t FsBitmapCheckBlock(FILE* pDisk, const FsMeta* pMeta, block_t block)
+bool FsBitmapCacheLoad(FsDevice* pDevice, const FsMeta* pMeta, FsBitmapCache* pCache)
 {
-    if (block < pMeta->AddrNodeTable)
+    memset(pCache, 0, sizeof(FsBitmapCache));
+    pCache->NumBlocks = FsBitmapNumBlocks(pMeta);
+
+    pCache->pDirty = calloc(pCache->NumBlocks, sizeof(uint8_t));
+    if (!pCache->pDirty)
     {
-        printf("FsBitmapCheckBlock failed, the bitmap doesn't track any blocks before AddrNodeTable (on this FS, block %lu), however "
-               "the function was to check the block %lu, which is before the node table.\n", pMeta->AddrNodeTable, block);
-        return FS_BITMAP_BLOCK_IVLD;
+        puts("FsBitmapCacheLoad failed, couldn't allocate space for the dirty block table.");
+        return false;
     }
 
-    bitmappos_t pos = FsBitmapResolveFromBlock(pMeta, block);
-    if (fseek(pDisk, pos.Block * pMeta->BlockSize + pos.ByteOffset, SEEK_SET) != 0)
+    pCache->pFreeCount = malloc(pCache->NumBlocks * sizeof(uint32_t));
+    pCache->pHasFree   = calloc(FS_DIV(pCache->NumBlocks, 8), sizeof(uint8_t));
+    if (!pCache->pFreeCount || !pCache->pHasFree)
     {
-        printf("FsBitmapCheckBlock failed, couldn't seek to block %lu's position on disk.\n", block);
-        return FS_BITMAP_BLOCK_IVLD;
+        puts("FsBitmapCacheLoad failed, couldn't allocate space for the free space summary.");
+        FsBitmapCacheRelease(pCache);
+        return false;
+    }
+
+    pCache->NumOnDisk = FsHasLazyInit(pMeta) ? pMeta->BitmapWatermark : pCache->NumBlocks;
+    pCache->pBitmap = FsLoadBitmap(pDevice, pMeta);
+    if (!pCache->pBitmap)
+    {
+        puts("FsBitmapCacheLoad failed due to FsLoadBitmap failing.");
+        FsBitmapCacheRelease(pCache);
+        return false;
+    }
+
+    uint64_t bitsPerBitmapBlock = pMeta->BlockSize * 8;
+    uint64_t totalBits   = pCache->NumBlocks * bitsPerBitmapBlock;
+    uint64_t trackedBits = pMeta->Size - FsBitmapFirstBlock(pMeta);
+    for (uint64_t bit = trackedBits; bit < totalBits; bit++)
+    {
+        pCache->pBitmap[bit / 8] |= 1 << (bit % 8);
+    }
+
+    for (uint64_t i = 0; i < pCache->NumBlocks; i++)
+    {
+        pCache->pFreeCount[i] = bitsPerBitmapBlock - BitScanCountSet(pCache->pBitmap, i * bitsPerBitmapBlock, (i + 1) * bitsPerBitmapBlock);
+        if (pCache->pFreeCount[i])
+        {
+            pCache->pHasFree[i / 8] |= 1 << (i % 8);
+        }
+    }
+
+    return true;
+}
+
+bool FsBitmapCacheFlush(FsDevice* pDevice, const FsMeta* pMeta, FsBitmapCache* pCache)
+{
+    for (uint64_t i = 0; i < pCache->NumBlocks && pCache->NumDirty; i++)
+    {
+        if (!pCache->pDirty[i])
+        {
+            continue;
+        }
+
+        block_t bitmapBlock = FsBitmapBlockAddress(pMeta, i);
+        if (!FsDeviceWrite(pDevice, bitmapBlock * pMeta->BlockSize, pCache->pBitmap + i * pMeta->BlockSize, pMeta->BlockSize))
+        {
+            printf("FsBitmapCacheFlush failed, couldn't write bitmap block %lu.\n", bitmapBlock);
+            return false;
+        }
+
+        pCache->pDirty[i] = FS_BITMAP_CLEAN;
+        pCache->NumDirty--;
+        pCache->NumOnDisk = FS_MAX(pCache->NumOnDisk, i + 1);
+    }
+
+    return true;
+}
+
+bool FsBitmapCacheFlushAllocations(FsDevice* pDevice, const FsMeta* pMeta, FsBitmapCache* pCache, bool* pWrote)
+{
+    *pWrote = false;
+    if (pCache->NumDirty == 0)
+    {
+        return true;
     }
 
-    uint8_t byte;
-    if (fread(&byte, 1, sizeof(uint8_t), pDisk) != sizeof(uint8_t))
+    uint8_t* pOnDisk = malloc(pMeta->BlockSize);
+    if (!pOnDisk)
     {
-        printf("FsBitmapCheckBlock failed, couldn't read bitmap byte %u in block %lu.", pos.ByteOffset, pos.Block);
+        puts("FsBitmapCacheFlushAllocations failed, couldn't allocate memory for a bitmap block.");
+        return false;
+    }
+
+    bool bResult = true;
+    for (uint64_t i = 0; i < pCache->NumBlocks; i++)
+    {
+        if (!pCache->pDirty[i])
+        {
+            continue;
+        }
+
+        block_t bitmapBlock = FsBitmapBlockAddress(pMeta, i);
+        const uint8_t* pInMemory = pCache->pBitmap + i * pMeta->BlockSize;
+        if (i >= pCache->NumOnDisk)
+        {
+            memset(pOnDisk, 0, pMeta->BlockSize);
+        }
+        else if (!FsDeviceRead(pDevice, bitmapBlock * pMeta->BlockSize, pOnDisk, pMeta->BlockSize))
+        {
+            printf("FsBitmapCacheFlushAllocations failed, couldn't read bitmap block %lu.\n", bitmapBlock);
+            bResult = false;
+            break;
+        }
+
+        // A block that only gained set bits is written as it is, one that lost some keeps them set on the disk for now.
+        bool bFreed = false;
+        for (uint16_t byte = 0; byte < pMeta->BlockSize; byte++)
+        {
+            bFreed |= (pOnDisk[byte] & ~pInMemory[byte]) != 0;
+            pOnDisk[byte] |= pInMemory[byte];
+        }
+
+        if (!FsDeviceWrite(pDevice, bitmapBlock * pMeta->BlockSize, pOnDisk, pMeta->BlockSize))
+        {
+            printf("FsBitmapCacheFlushAllocations failed, couldn't write bitmap block %lu.\n", bitmapBlock);
+            bResult = false;
+            break;
+        }
+        *pWrote = true;
+        pCache->NumOnDisk = FS_MAX(pCache->NumOnDisk, i + 1);
+
+        if (!bFreed)
+        {
+            pCache->pDirty[i] = FS_BITMAP_CLEAN;
+            pCache->NumDirty--;
+        }
+    }
+
+    free(pOnDisk);
+    return bResult;
+}
+
+void FsBitmapCacheRelease(FsBitmapCache* pCache)
+{
+    free(pCache->pBitmap);
+    free(pCache->pDirty);
+    free(pCache->pFreeCount);
+    free(pCache->pHasFree);
+    memset(pCache, 0, sizeof(FsBitmapCache));
+}
+
+uint8_t FsBitmapCheckBlock(const FsBitmapCache* pCache, const FsMeta* pMeta, block_t block)
+{
+    block_t firstBlock = FsBitmapFirstBlock(pMeta);
+    if (block < firstBlock || block >= pMeta->Size)
+    {
+        printf("FsBitmapCheckBlock failed, the bitmap only tracks blocks from block %lu up to the end of the disk, "
+               "however the function was to check the block %lu.\n", firstBlock, block);
         return FS_BITMAP_BLOCK_IVLD;
     }
 
-    return byte & (1 << pos.BitOffset);
+    // The in-memory bitmap blocks are laid out one after another, wherever they are on the disk.
+    uint64_t bit = block - firstBlock;
+    return (pCache->pBitmap[bit / 8] >> (bit % 8)) & 1;
 }
 
-uint8_t FsBitmapSetBlock(FILE* pDisk, const FsMeta* pMeta, block_t block, uint8_t status)
+uint8_t FsBitmapSetBlock(FsBitmapCache* pCache, const FsMeta* pMeta, block_t block, uint8_t status)
 {
     if (!block)
     {
         return FS_BITMAP_BLOCK_IVLD;
     }
-    if (block < pMeta->AddrNodeTable)
+    block_t firstBlock = FsBitmapFirstBlock(pMeta);
+    if (block < firstBlock || block >= pMeta->Size)
     {
-        printf("FsBitmapSetBlock failed, the bitmap doesn't track any blocks before AddrNodeTable (on this FS, block %lu), however "
-               "the function was to check the block %lu, which is before the node table.\n", pMeta->AddrNodeTable, block);
+        printf("FsBitmapSetBlock failed, the bitmap only tracks blocks from block %lu up to the end of the disk, "
+               "however the function was to set the block %lu.\n", firstBlock, block);
         return FS_BITMAP_BLOCK_IVLD;
     }
 
-    bitmappos_t pos = FsBitmapResolveFromBlock(pMeta, block);
-    if (fseek(pDisk, pos.Block * pMeta->BlockSize + pos.ByteOffset, SEEK_SET) != 0)
+    uint64_t bit = block - firstBlock;
+    uint64_t bitmapBlockIndex = bit / (pMeta->BlockSize * 8);
+    uint8_t* pByte = &pCache->pBitmap[bit / 8];
+
+    uint8_t byte = *pByte;
+    if (status)
     {
-        printf("FsBitmapCheckBlock failed, couldn't seek to block %lu's position on disk.\n", block);
-        return 0;
+        byte |= (1 << (bit % 8));
+    }
+    else
+    {
+        byte &= ~(1 << (bit % 8));
     }
 
-    uint8_t byte;
-    if (fread(&byte, 1, sizeof(uint8_t), pDisk) != sizeof(uint8_t))
+    if (byte != *pByte)
+    {
+        *pByte = byte;
+        if (pCache->pDirty[bitmapBlockIndex] != FS_BITMAP_DIRTY)
+        {
+            if (pCache->pDirty[bitmapBlockIndex] == FS_BITMAP_CLEAN)
+            {
+                pCache->NumDirty++;
+            }
+            pCache->pDirty[bitmapBlockIndex] = FS_BITMAP_DIRTY;
+        }
+
+        uint8_t hasFreeMask = 1 << (bitmapBlockIndex % 8);
+        if (status)
+        {
+            if (--pCache->pFreeCount[bitmapBlockIndex] == 0)
+            {
+                pCache->pHasFree[bitmapBlockIndex / 8] &= ~hasFreeMask;
+            }
+        }
+        else
+        {
+            if (pCache->pFreeCount[bitmapBlockIndex]++ == 0)
+            {
+                pCache->pHasFree[bitmapBlockIndex / 8] |= hasFreeMask;
+            }
+        }
+    }
+
+    return 1;
+}
+
+block_t FsBitmapFindFree(const FsBitmapCache* pCache, const FsMeta* pMeta, block_t from, block_t to)
+{
+    block_t firstBlock = FsBitmapFirstBlock(pMeta);
+    from = FS_MAX(from, firstBlock);
+    to   = FS_MIN(to, pMeta->Size);
+    if (from >= to)
     {
-        printf("FsBitmapCheckBlock failed, couldn't read bitmap byte %u in block %lu.", pos.ByteOffset, pos.Block);
         return 0;
     }
 
-    if (status)
+    uint64_t bitsPerBitmapBlock = pMeta->BlockSize * 8;
+    uint64_t bit    = from - firstBlock;
+    uint64_t bitEnd = to - firstBlock;
+
+    while (bit < bitEnd)
     {
-        byte |= (1 << pos.BitOffset);
+        // Step over bitmap blocks without a single clear bit using the superbitmap.
+        uint64_t bitmapBlock = bit / bitsPerBitmapBlock;
+        uint64_t withFree = BitScanFindSet(pCache->pHasFree, bitmapBlock, pCache->NumBlocks);
+        if (withFree != bitmapBlock)
+        {
+            if (withFree >= pCache->NumBlocks)
+            {
+                break;
+            }
+
+            bitmapBlock = withFree;
+            bit = bitmapBlock * bitsPerBitmapBlock;
+            continue;
+        }
+
+        uint64_t searchEnd = FS_MIN((bitmapBlock + 1) * bitsPerBitmapBlock, bitEnd);
+        uint64_t found = BitScanFindClear(pCache->pBitmap, bit, searchEnd);
+        if (found < searchEnd)
+        {
+            return firstBlock + found;
+        }
+        bit = searchEnd;
     }
-    else
+
+    return 0;
+}
+
+block_t FsBitmapFindFreeFrom(const FsBitmapCache* pCache, const FsMeta* pMeta, block_t from, block_t to, block_t cursor)
+{
+    if (cursor < from || cursor >= to)
     {
-        byte &= ~(1 << pos.BitOffset);
+        cursor = from;
     }
 
-    if (fseek(pDisk, pos.Block * pMeta->BlockSize + pos.ByteOffset, SEEK_SET) != 0)
+    block_t found = FsBitmapFindFree(pCache, pMeta, cursor, to);
+    if (!found && cursor > from)
     {
-        printf("FsBitmapCheckBlock failed, couldn't seek to block %lu's position on disk.\n", block);
-        return 0;
+        found = FsBitmapFindFree(pCache, pMeta, from, cursor);
+    }
+
+    return found;
+}
+
+// Returns the first run of free blocks that starts within [from, to), clipped to `to`.
+static fsextent_t FsiBitmapNextRun(const FsBitmapCache* pCache, const FsMeta* pMeta, block_t from, block_t to)
+{
+    fsextent_t run = { .Start = FsBitmapFindFree(pCache, pMeta, from, to), .Length = 0 };
+    if (run.Start)
+    {
+        block_t  firstBlock = FsBitmapFirstBlock(pMeta);
+        uint64_t bitEnd = FS_MIN(to, pMeta->Size) - firstBlock;
+        uint64_t runEnd = BitScanFindSet(pCache->pBitmap, run.Start - firstBlock, bitEnd);
+        run.Length = runEnd - (run.Start - firstBlock);
     }
 
-    if (fwrite(&byte, 1, sizeof(uint8_t), pDisk) != sizeof(uint8_t))
+    return run;
+}
+
+uint64_t FsBitmapCountFree(const FsBitmapCache* pCache, const FsMeta* pMeta, block_t from, block_t to)
+{
+    block_t firstBlock = FsBitmapFirstBlock(pMeta);
+    from = FS_MAX(from, firstBlock);
+    to   = FS_MIN(to, pMeta->Size);
+    if (from >= to)
     {
-        printf("FsBitmapCheckBlock failed, couldn't write to block %lu's position on disk.\n", block);
         return 0;
     }
 
+    uint64_t bitsPerBitmapBlock = pMeta->BlockSize * 8;
+    uint64_t fromBit = from - firstBlock;
+    uint64_t toBit   = to - firstBlock;
+
+    // Whole bitmap blocks come straight from the summary, only the partial ones at either end are counted bit by bit.
+    uint64_t numFree = 0;
+    for (uint64_t bit = fromBit; bit < toBit; )
+    {
+        uint64_t index    = bit / bitsPerBitmapBlock;
+        uint64_t blockEnd = (index + 1) * bitsPerBitmapBlock;
+        if (bit == index * bitsPerBitmapBlock && blockEnd <= toBit)
+        {
+            numFree += pCache->pFreeCount[index];
+            bit = blockEnd;
+            continue;
+        }
+
+        uint64_t end = FS_MIN(blockEnd, toBit);
+        numFree += (end - bit) - BitScanCountSet(pCache->pBitmap, bit, end);
+        bit = end;
+    }
+
+    return numFree;
+}
+
+fsextent_t FsBitmapFindExtent(const FsBitmapCache* pCache, const FsMeta* pMeta, block_t from, block_t to, block_t cursor,
+                              uint64_t length, allocation_policy_t policy)
+{
+    if (cursor < from || cursor >= to)
+    {
+        cursor = from;
+    }
+
+    fsextent_t best    = { 0, 0 }; // Best run that is long enough, per the policy.
+    fsextent_t longest = { 0, 0 }; // Fallback when no run is long enough.
+
+    // First [cursor, to), then wrap around to [from, cursor).
+    for (int pass = 0; pass < 2; pass++)
+    {
+        block_t start = pass ? from : cursor;
+        block_t end   = pass ? cursor : to;
+
+        while (start < end)
+        {
+            fsextent_t run = FsiBitmapNextRun(pCache, pMeta, start, end);
+            if (!run.Length)
+            {
+                break;
+            }
+            start = run.Start + run.Length;
+
+            if (run.Length < length)
+            {
+                if (run.Length > longest.Length)
+                {
+                    longest = run;
+                }
+                continue;
+            }
+
+            if (!best.Length || run.Length < best.Length)
+            {
+                best = run;
+            }
+            if (policy == FS_ALLOCATION_FIRST_FIT || run.Length == length)
+            {
+                goto Found;
+            }
+        }
+    }
+
+Found:
+    if (best.Length)
+    {
+        best.Length = length;
+        return best;
+    }
+
+    return longest;
+}
+
+uint8_t FsBitmapSetExtent(FsBitmapCache* pCache, const FsMeta* pMeta, fsextent_t extent, uint8_t status)
+{
+    for (uint64_t i = 0; i < extent.Length; i++)
+    {
+        uint8_t result = FsBitmapSetBlock(pCache, pMeta, extent.Start + i, status);
+        if (result != 1)
+        {
+            return result;
+        }
+    }
+
     return 1;
 }
 
-uint8_t* FsLoadBitmap(FILE* pDisk, const FsMeta* pMeta)
+uint8_t* FsLoadBitmap(FsDevice* pDevice, const FsMeta* pMeta)
 {
-    uint64_t rawBitmapSize = (pMeta->AddrNodeTable - pMeta->AddrBitmap) * pMeta->BlockSize;
-    uint8_t* bitmap = malloc(rawBitmapSize);
+    uint64_t numBlocks = FsBitmapNumBlocks(pMeta);
+    uint8_t* bitmap = malloc(numBlocks * pMeta->BlockSize);
 
     if (!bitmap)
     {
         puts("FsLoadBitmap failed, couldn't allocate space for intermediate bitmap representation.");
         return NULL;
     }
-    
-    if (fseek(pDisk, pMeta->AddrBitmap * pMeta->BlockSize, SEEK_SET) != 0)
+
+    // Revision 0 reads its bitmap in one go, the group bitmaps are one block at the start of each group.
+    uint64_t numContiguous = FsHasGroups(pMeta) ? 1 : numBlocks;
+    uint64_t numWritten    = FsHasLazyInit(pMeta) ? FS_MIN(pMeta->BitmapWatermark, numBlocks) : numBlocks;
+    for (uint64_t i = numWritten; i < numBlocks; i++)
     {
-        printf("FsLoadBitmap failed, couldn't seek to bitmap at block %lu\n", pMeta->AddrBitmap);
-        return NULL;
+        FsGroupInitBitmap(pMeta, (uint32_t) i, bitmap + i * pMeta->BlockSize);
     }
 
-    if (fread(bitmap, 1, rawBitmapSize, pDisk) != rawBitmapSize)
+    for (uint64_t i = 0; i < numWritten; i += numContiguous)
     {
-        printf("FsLoadBitmap failed, couldn't read bitmap at block %lu\n", pMeta->AddrBitmap);
-        free(bitmap);
-        return NULL;
+        block_t bitmapBlock = FsBitmapBlockAddress(pMeta, i);
+        if (!FsDeviceRead(pDevice, bitmapBlock * pMeta->BlockSize, bitmap + i * pMeta->BlockSize, numContiguous * pMeta->BlockSize))
+        {
+            printf("FsLoadBitmap failed, couldn't read bitmap at block %lu\n", bitmapBlock);
+            free(bitmap);
+            return NULL;
+        }
     }
 
     return bitmap;
@@ -6,13 +6,19 @@
 #define MYTH_BITMAP_H
 
 #include "FileSystem.h"
+#include "Device.h"
 
-#include <stdio.h>
+#include <stdbool.h>
 
 #define FS_BITMAP_BLOCK_FREE      UINT8_C(0)
 #define FS_BITMAP_BLOCK_ALLOCATED UINT8_C(1)
 #define FS_BITMAP_BLOCK_IVLD      UINT8_C(2) // Non-possible value, used to indicate errors from FS functions.
 
+// Values of FsBitmapCache.pDirty.
+#define FS_BITMAP_CLEAN        UINT8_C(0)
+#define FS_BITMAP_DIRTY        UINT8_C(1)
+#define FS_BITMAP_DIRTY_LOGGED UINT8_C(2) // Modified, but the modifications are already in the journal.
+
 /** Structure representing a positin within the bitmap. */
 typedef struct
 {
@@ -21,13 +27,91 @@ typedef struct
     uint8_t  BitOffset;
 } bitmappos_t;
 
+/** A run of physically contiguous blocks. */
+typedef struct
+{
+    block_t  Start;
+    uint64_t Length;
+} fsextent_t;
+
+/** A window of the volume allocations look into first, with a next-fit cursor of its own. */
+typedef struct
+{
+    block_t From;   // First block of the window.
+    block_t To;     // Block past the window.
+    block_t Cursor; // Last block allocated from the window, searches resume here.
+} allocation_region_t;
+
+typedef enum
+{
+    FS_ALLOCATION_FIRST_FIT = 0, // First run long enough, searching from the allocation cursor onwards.
+    FS_ALLOCATION_BEST_FIT  = 1  // Shortest run that is still long enough, leaves long runs intact for big nodes.
+} allocation_policy_t;
+
+/**
+ * In-memory copy of the entire bitmap section. It is loaded once per session, all bitmap reads and writes
+ * operate on it and only the bitmap blocks that were modified are written back when the cache is flushed.
+ *
+ * Alongside the raw bitmap the cache keeps a two level free space summary: the number of clear bits per bitmap block
+ * and a superbitmap with one bit per bitmap block that is set while that block has any clear bit left. Searches use the
+ * superbitmap to step over completely allocated regions without looking at their bytes.
+ */
+typedef struct
+{
+    uint8_t*  pBitmap;    // Raw bitmap, NumBlocks * BlockSize bytes. Byte layout is identical to the on-disk bitmap.
+    uint8_t*  pDirty;     // One entry per bitmap block, nonzero (FS_BITMAP_DIRTY*) when the block was modified since the last flush.
+    uint32_t* pFreeCount; // Number of clear bits within each bitmap block.
+    uint8_t*  pHasFree;   // Superbitmap, bit i is set when pFreeCount[i] is nonzero.
+    uint64_t  NumBlocks;  // Number of bitmap blocks, FsBitmapNumBlocks.
+    uint64_t  NumDirty;   // Number of nonzero entries within pDirty.
+    uint64_t  NumOnDisk;  // Bitmap blocks up to here were written at some point, the later ones never were.
+} FsBitmapCache;
+
+// First block the bitmap tracks, bit 0 of the in-memory bitmap.
+block_t FsBitmapFirstBlock(const FsMeta* pMeta);
+// Number of bitmap blocks, one per group when the file system has groups.
+uint64_t FsBitmapNumBlocks(const FsMeta* pMeta);
+// Location on the disk of the index-th bitmap block.
+block_t FsBitmapBlockAddress(const FsMeta* pMeta, uint64_t index);
+
 bitmappos_t FsBitmapResolveFromBlock(const FsMeta* pMeta, block_t block);
 block_t FsBitmapResolveToBlock(const FsMeta* pMeta, bitmappos_t pos);
 
-uint8_t FsBitmapCheckBlock(FILE* pDisk, const FsMeta* pMeta, block_t block);
-uint8_t FsBitmapSetBlock(FILE* pDisk, const FsMeta* pMeta, block_t block, uint8_t status);
+// Loads the bitmap section into pCache and builds its summary. The cache must be released with FsBitmapCacheRelease.
+// Bits past the end of the volume are set in memory so they are never handed out.
+bool FsBitmapCacheLoad(FsDevice* pDevice, const FsMeta* pMeta, FsBitmapCache* pCache);
+// Writes every dirty bitmap block back to the disk, one write per block.
+bool FsBitmapCacheFlush(FsDevice* pDevice, const FsMeta* pMeta, FsBitmapCache* pCache);
+// First half of an ordered flush. Writes every dirty bitmap block with the bits set on the disk kept set, so blocks
+// allocated since the last flush are marked while blocks freed since then aren't released yet. Blocks without frees are
+// clean afterwards, the others stay dirty for the FsBitmapCacheFlush that follows. pWrote tells whether anything was written.
+// Blocks past NumOnDisk are written as they are, there is nothing on the disk to keep.
+bool FsBitmapCacheFlushAllocations(FsDevice* pDevice, const FsMeta* pMeta, FsBitmapCache* pCache, bool* pWrote);
+void FsBitmapCacheRelease(FsBitmapCache* pCache);
+
+uint8_t FsBitmapCheckBlock(const FsBitmapCache* pCache, const FsMeta* pMeta, block_t block);
+uint8_t FsBitmapSetBlock(FsBitmapCache* pCache, const FsMeta* pMeta, block_t block, uint8_t status);
+
+// Finds the first free block within [from, to). Returns 0 if there is none, block 0 is never tracked by the bitmap.
+block_t FsBitmapFindFree(const FsBitmapCache* pCache, const FsMeta* pMeta, block_t from, block_t to);
+
+// Next-fit variant of FsBitmapFindFree, searches [cursor, to) first and wraps around to [from, cursor) afterwards.
+block_t FsBitmapFindFreeFrom(const FsBitmapCache* pCache, const FsMeta* pMeta, block_t from, block_t to, block_t cursor);
+
+// Finds a run of up to `length` free blocks within [from, to), searching from cursor and wrapping around like FsBitmapFindFreeFrom.
+// When no run is long enough the longest run available is returned instead so the caller can allocate in pieces.
+// A returned Length of 0 means there are no free blocks at all.
+fsextent_t FsBitmapFindExtent(const FsBitmapCache* pCache, const FsMeta* pMeta, block_t from, block_t to, block_t cursor,
+                              uint64_t length, allocation_policy_t policy);
+
+// Number of free blocks within [from, to).
+uint64_t FsBitmapCountFree(const FsBitmapCache* pCache, const FsMeta* pMeta, block_t from, block_t to);
+
+// Sets the status of every block within the extent.
+uint8_t FsBitmapSetExtent(FsBitmapCache* pCache, const FsMeta* pMeta, fsextent_t extent, uint8_t status);
 
 // Loads entire bitmap section from the disk. Must be free'd manually by the caller.
-uint8_t* FsLoadBitmap(FILE* pDisk, const FsMeta* pMeta);
+// Group bitmaps at or past BitmapWatermark aren't read, FsGroupInitBitmap fills them in.
+uint8_t* FsLoadBitmap(FsDevice* pDevice, const FsMeta* pMeta);
 
 #endif // !MYTH_BITMAP_H
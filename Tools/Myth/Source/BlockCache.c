@@ -0,0 +1,381 @@
+#include "BlockCache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t FsiBlockCacheBucket(const FsBlockCache* pCache, block_t block)
+{
+    // Fibonacci hashing, consecutive block addresses end up spread over the whole table.
+    return (uint32_t) ((block * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & pCache->BucketMask;
+}
+
+static void FsiBlockCacheLruUnlink(FsBlockCache* pCache, uint32_t index)
+{
+    FsBlockCacheEntry* pEntry = &pCache->pEntries[index];
+
+    if (pEntry->Prev != FS_BLOCK_CACHE_NONE) pCache->pEntries[pEntry->Prev].Next = pEntry->Next;
+    else                                     pCache->LruHead = pEntry->Next;
+    if (pEntry->Next != FS_BLOCK_CACHE_NONE) pCache->pEntries[pEntry->Next].Prev = pEntry->Prev;
+    else                                     pCache->LruTail = pEntry->Prev;
+
+    pEntry->Prev = pEntry->Next = FS_BLOCK_CACHE_NONE;
+}
+
+static void FsiBlockCacheLruPushHead(FsBlockCache* pCache, uint32_t index)
+{
+    FsBlockCacheEntry* pEntry = &pCache->pEntries[index];
+
+    pEntry->Prev = FS_BLOCK_CACHE_NONE;
+    pEntry->Next = pCache->LruHead;
+    if (pCache->LruHead != FS_BLOCK_CACHE_NONE) pCache->pEntries[pCache->LruHead].Prev = index;
+    else                                        pCache->LruTail = index;
+    pCache->LruHead = index;
+}
+
+static void FsiBlockCacheLruPushTail(FsBlockCache* pCache, uint32_t index)
+{
+    FsBlockCacheEntry* pEntry = &pCache->pEntries[index];
+
+    pEntry->Next = FS_BLOCK_CACHE_NONE;
+    pEntry->Prev = pCache->LruTail;
+    if (pCache->LruTail != FS_BLOCK_CACHE_NONE) pCache->pEntries[pCache->LruTail].Next = index;
+    else                                        pCache->LruHead = index;
+    pCache->LruTail = index;
+}
+
+static uint32_t FsiBlockCacheLookup(const FsBlockCache* pCache, block_t block)
+{
+    uint32_t index = pCache->pBuckets[FsiBlockCacheBucket(pCache, block)];
+    while (index != FS_BLOCK_CACHE_NONE && pCache->pEntries[index].Block != block)
+    {
+        index = pCache->pEntries[index].HashNext;
+    }
+    return index;
+}
+
+static void FsiBlockCacheHashRemove(FsBlockCache* pCache, uint32_t index)
+{
+    uint32_t* pLink = &pCache->pBuckets[FsiBlockCacheBucket(pCache, pCache->pEntries[index].Block)];
+    while (*pLink != index)
+    {
+        pLink = &pCache->pEntries[*pLink].HashNext;
+    }
+    *pLink = pCache->pEntries[index].HashNext;
+    pCache->pEntries[index].HashNext = FS_BLOCK_CACHE_NONE;
+}
+
+static bool FsiBlockCacheWriteBack(FsBlockCache* pCache, FsBlockCacheEntry* pEntry)
+{
+    if (!FsDeviceWrite(pCache->pDevice, pEntry->Block * pCache->BlockSize, pEntry->pData, pCache->BlockSize))
+    {
+        printf("FsBlockCache failed, couldn't write block %lu back to the disk.\n", pEntry->Block);
+        return false;
+    }
+
+    if (!pEntry->bLogged)
+    {
+        pCache->NumUnlogged--;
+    }
+    pEntry->bDirty  = false;
+    pEntry->bLogged = false;
+    pCache->NumDirty--;
+    pCache->WriteBacks++;
+    return true;
+}
+
+// Drops an unpinned, clean entry and moves it to the LRU tail so it is reused first.
+static void FsiBlockCacheInvalidate(FsBlockCache* pCache, uint32_t index)
+{
+    FsBlockCacheEntry* pEntry = &pCache->pEntries[index];
+
+    FsiBlockCacheHashRemove(pCache, index);
+    pEntry->bValid = false;
+
+    FsiBlockCacheLruUnlink(pCache, index);
+    FsiBlockCacheLruPushTail(pCache, index);
+}
+
+// Pins the block. When bLoad is false the caller overwrites the entire block, so a miss doesn't read it from the device.
+static FsBlockCacheEntry* FsiBlockCacheAcquire(FsBlockCache* pCache, block_t block, bool bLoad)
+{
+    uint32_t index = FsiBlockCacheLookup(pCache, block);
+    if (index != FS_BLOCK_CACHE_NONE)
+    {
+        FsBlockCacheEntry* pEntry = &pCache->pEntries[index];
+        if (pEntry->Pins++ == 0)
+        {
+            FsiBlockCacheLruUnlink(pCache, index);
+        }
+
+        pCache->Hits++;
+        return pEntry;
+    }
+    pCache->Misses++;
+
+    index = pCache->LruTail;
+    if (index == FS_BLOCK_CACHE_NONE)
+    {
+        printf("FsBlockCachePin failed, every one of the %u cache entries is pinned.\n", pCache->Capacity);
+        return NULL;
+    }
+
+    if (pCache->bNoSteal && pCache->NumUnlogged)
+    {
+        uint32_t candidate = index;
+        while (candidate != FS_BLOCK_CACHE_NONE && pCache->pEntries[candidate].bDirty && !pCache->pEntries[candidate].bLogged)
+        {
+            candidate = pCache->pEntries[candidate].Prev;
+        }
+        if (candidate != FS_BLOCK_CACHE_NONE)
+        {
+            index = candidate;
+        }
+    }
+
+    FsBlockCacheEntry* pEntry = &pCache->pEntries[index];
+    if (pEntry->bValid)
+    {
+        if (pEntry->bDirty && !pEntry->bLogged && pCache->StealHook && !pCache->StealHook(pCache))
+        {
+            printf("FsBlockCachePin failed, couldn't prepare writing back block %lu ahead of its commit.\n", pEntry->Block);
+            return NULL;
+        }
+        if (pEntry->bDirty && !FsiBlockCacheWriteBack(pCache, pEntry))
+        {
+            return NULL;
+        }
+
+        FsiBlockCacheHashRemove(pCache, index);
+        pEntry->bValid = false;
+        pCache->Evictions++;
+    }
+
+    if (bLoad && !FsDeviceRead(pCache->pDevice, block * pCache->BlockSize, pEntry->pData, pCache->BlockSize))
+    {
+        printf("FsBlockCachePin failed, couldn't read block %lu from the disk.\n", block);
+        return NULL;
+    }
+
+    FsiBlockCacheLruUnlink(pCache, index);
+    pEntry->Block  = block;
+    pEntry->Pins   = 1;
+    pEntry->bValid = true;
+
+    uint32_t bucket = FsiBlockCacheBucket(pCache, block);
+    pEntry->HashNext = pCache->pBuckets[bucket];
+    pCache->pBuckets[bucket] = index;
+
+    return pEntry;
+}
+
+bool FsBlockCacheInit(FsBlockCache* pCache, FsDevice* pDevice, uint16_t blockSize, uint32_t capacity)
+{
+    memset(pCache, 0, sizeof(FsBlockCache));
+
+    if (capacity == 0)
+    {
+        capacity = FS_BLOCK_CACHE_DEFAULT_BLOCKS;
+    }
+    if (capacity < FS_BLOCK_CACHE_MINIMUM_BLOCKS)
+    {
+        capacity = FS_BLOCK_CACHE_MINIMUM_BLOCKS;
+    }
+
+    uint32_t numBuckets = 1;
+    while (numBuckets < capacity * 2)
+    {
+        numBuckets <<= 1;
+    }
+
+    pCache->pDevice    = pDevice;
+    pCache->BlockSize  = blockSize;
+    pCache->Capacity   = capacity;
+    pCache->BucketMask = numBuckets - 1;
+    pCache->pEntries   = calloc(capacity, sizeof(FsBlockCacheEntry));
+    pCache->pMemory    = malloc((size_t) capacity * blockSize);
+    pCache->pBuckets   = malloc(numBuckets * sizeof(uint32_t));
+    if (!pCache->pEntries || !pCache->pMemory || !pCache->pBuckets)
+    {
+        printf("FsBlockCacheInit failed, couldn't allocate a cache of %u blocks.\n", capacity);
+        FsBlockCacheRelease(pCache);
+        return false;
+    }
+
+    memset(pCache->pBuckets, 0xFF, numBuckets * sizeof(uint32_t));
+
+    pCache->LruHead = pCache->LruTail = FS_BLOCK_CACHE_NONE;
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        pCache->pEntries[i].pData    = pCache->pMemory + (size_t) i * blockSize;
+        pCache->pEntries[i].HashNext = FS_BLOCK_CACHE_NONE;
+        FsiBlockCacheLruPushTail(pCache, i);
+    }
+
+    return true;
+}
+
+void FsBlockCacheRelease(FsBlockCache* pCache)
+{
+    free(pCache->pEntries);
+    free(pCache->pMemory);
+    free(pCache->pBuckets);
+    memset(pCache, 0, sizeof(FsBlockCache));
+}
+
+FsBlockCacheEntry* FsBlockCachePin(FsBlockCache* pCache, block_t block)
+{
+    return FsiBlockCacheAcquire(pCache, block, true);
+}
+
+void FsBlockCacheUnpin(FsBlockCache* pCache, FsBlockCacheEntry* pEntry)
+{
+    if (--pEntry->Pins == 0)
+    {
+        FsiBlockCacheLruPushHead(pCache, (uint32_t) (pEntry - pCache->pEntries));
+    }
+}
+
+void FsBlockCacheMarkDirty(FsBlockCache* pCache, FsBlockCacheEntry* pEntry)
+{
+    if (!pEntry->bDirty)
+    {
+        pEntry->bDirty = true;
+        pCache->NumDirty++;
+        pCache->NumUnlogged++;
+    }
+    else if (pEntry->bLogged)
+    {
+        // Modified again after its transaction, the new contents need another one.
+        pEntry->bLogged = false;
+        pCache->NumUnlogged++;
+    }
+}
+
+void FsBlockCacheMarkLogged(FsBlockCache* pCache)
+{
+    for (uint32_t i = 0; i < pCache->Capacity && pCache->NumUnlogged; i++)
+    {
+        FsBlockCacheEntry* pEntry = &pCache->pEntries[i];
+        if (pEntry->bValid && pEntry->bDirty && !pEntry->bLogged)
+        {
+            pEntry->bLogged = true;
+            pCache->NumUnlogged--;
+        }
+    }
+}
+
+bool FsBlockCacheRead(FsBlockCache* pCache, block_t block, uint16_t offset, void* pDest, uint16_t size)
+{
+    if ((uint32_t) offset + size > pCache->BlockSize)
+    {
+        return false;
+    }
+
+    FsBlockCacheEntry* pEntry = FsiBlockCacheAcquire(pCache, block, true);
+    if (!pEntry)
+    {
+        return false;
+    }
+
+    memcpy(pDest, pEntry->pData + offset, size);
+    FsBlockCacheUnpin(pCache, pEntry);
+    return true;
+}
+
+bool FsBlockCacheWrite(FsBlockCache* pCache, block_t block, uint16_t offset, const void* pSource, uint16_t size)
+{
+    if ((uint32_t) offset + size > pCache->BlockSize)
+    {
+        return false;
+    }
+
+    FsBlockCacheEntry* pEntry = FsiBlockCacheAcquire(pCache, block, offset != 0 || size != pCache->BlockSize);
+    if (!pEntry)
+    {
+        return false;
+    }
+
+    memcpy(pEntry->pData + offset, pSource, size);
+    FsBlockCacheMarkDirty(pCache, pEntry);
+    FsBlockCacheUnpin(pCache, pEntry);
+    return true;
+}
+
+const uint8_t* FsBlockCacheFindDirty(const FsBlockCache* pCache, block_t block)
+{
+    uint32_t index = FsiBlockCacheLookup(pCache, block);
+    if (index == FS_BLOCK_CACHE_NONE || !pCache->pEntries[index].bDirty)
+    {
+        return NULL;
+    }
+    return pCache->pEntries[index].pData;
+}
+
+void FsBlockCacheDiscard(FsBlockCache* pCache, block_t block)
+{
+    uint32_t index = FsiBlockCacheLookup(pCache, block);
+    if (index == FS_BLOCK_CACHE_NONE || pCache->pEntries[index].Pins)
+    {
+        return;
+    }
+
+    if (pCache->pEntries[index].bDirty)
+    {
+        if (!pCache->pEntries[index].bLogged)
+        {
+            pCache->NumUnlogged--;
+        }
+        pCache->pEntries[index].bDirty  = false;
+        pCache->pEntries[index].bLogged = false;
+        pCache->NumDirty--;
+    }
+    FsiBlockCacheInvalidate(pCache, index);
+}
+
+static int FsiBlockCacheCompareEntries(const void* pLeft, const void* pRight)
+{
+    block_t left  = (*(const FsBlockCacheEntry* const*) pLeft)->Block;
+    block_t right = (*(const FsBlockCacheEntry* const*) pRight)->Block;
+    return (left > right) - (left < right);
+}
+
+bool FsBlockCacheFlush(FsBlockCache* pCache)
+{
+    if (pCache->NumDirty == 0)
+    {
+        return true;
+    }
+
+    FsBlockCacheEntry** ppDirty = malloc(pCache->NumDirty * sizeof(FsBlockCacheEntry*));
+    if (!ppDirty)
+    {
+        puts("FsBlockCacheFlush failed, couldn't allocate memory to sort the dirty blocks.");
+        return false;
+    }
+
+    uint32_t numDirty = 0;
+    for (uint32_t i = 0; i < pCache->Capacity; i++)
+    {
+        if (pCache->pEntries[i].bValid && pCache->pEntries[i].bDirty)
+        {
+            ppDirty[numDirty++] = &pCache->pEntries[i];
+        }
+    }
+
+    // Ascending order turns the write-back into a single sweep over the disk.
+    qsort(ppDirty, numDirty, sizeof(FsBlockCacheEntry*), FsiBlockCacheCompareEntries);
+
+    bool bResult = true;
+    for (uint32_t i = 0; i < numDirty; i++)
+    {
+        if (!FsiBlockCacheWriteBack(pCache, ppDirty[i]))
+        {
+            bResult = false;
+            break;
+        }
+    }
+
+    free(ppDirty);
+    return bResult;
+}
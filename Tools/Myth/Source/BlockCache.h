@@ -0,0 +1,99 @@
+/**
+ * Header for the block cache sitting between the node code and the device.
+ */
+
+#ifndef MYTH_BLOCK_CACHE_H
+#define MYTH_BLOCK_CACHE_H
+
+#include "FileSystem.h"
+#include "Device.h"
+
+#include <stdbool.h>
+
+#define FS_BLOCK_CACHE_DEFAULT_BLOCKS UINT32_C(1024)
+#define FS_BLOCK_CACHE_MINIMUM_BLOCKS UINT32_C(8) // The indirect walk alone keeps up to three blocks pinned.
+
+#define FS_BLOCK_CACHE_NONE UINT32_MAX
+
+typedef struct FsBlockCache FsBlockCache;
+
+// Called before eviction writes back a dirty block no commit has covered yet, so the owner of the cache can put what the
+// block depends on onto the disk first. Returning false fails the eviction.
+typedef bool (*block_steal_hook_t)(FsBlockCache* pCache);
+
+/** A cached copy of one device block. */
+typedef struct
+{
+    block_t  Block;
+    uint8_t* pData;     // BlockSize bytes.
+    uint32_t Pins;      // Pinned entries are never evicted.
+    bool     bValid;
+    bool     bDirty;
+    bool     bLogged;   // The dirty contents are already in the journal, writing them home is safe at any time.
+    uint32_t Prev;      // Neighbours within the LRU list, only unpinned entries are linked into it.
+    uint32_t Next;
+    uint32_t HashNext;  // Next entry within the same hash bucket.
+} FsBlockCacheEntry;
+
+/**
+ * Fixed-size, block-granular write-back cache with least recently used eviction.
+ *
+ * Entries are looked up through a chained hash table keyed by block address. Reads fill an entry once and modifications
+ * only mark it dirty, dirty entries reach the device when they are evicted or when the cache is flushed.
+ * Blocks that are written to the device without going through the cache must be discarded from it first.
+ *
+ * With bNoSteal set, eviction skips dirty blocks that aren't committed yet, in the journal or by the ordered commit of a
+ * file system without one, so uncommitted metadata doesn't reach its home location ahead of what it depends on. Only
+ * when every unpinned entry is such a block the least recently used one is written back anyway, after StealHook ran.
+ */
+struct FsBlockCache
+{
+    FsDevice*          pDevice;
+    uint16_t           BlockSize;
+    uint32_t           Capacity;
+    FsBlockCacheEntry* pEntries;
+    uint8_t*           pMemory;    // Capacity * BlockSize bytes backing every entry.
+    uint32_t*          pBuckets;
+    uint32_t           BucketMask; // Number of buckets minus one, the bucket count is a power of two.
+    uint32_t           LruHead;    // Most recently used unpinned entry.
+    uint32_t           LruTail;    // Eviction candidate.
+    uint32_t           NumDirty;
+    uint32_t           NumUnlogged; // Dirty entries whose contents aren't in the journal yet.
+    bool               bNoSteal;    // Eviction prefers entries not counted by NumUnlogged.
+    block_steal_hook_t StealHook;   // May be NULL.
+
+    uint64_t           Hits;
+    uint64_t           Misses;
+    uint64_t           Evictions;
+    uint64_t           WriteBacks; // Dirty blocks written to the device, by eviction or flush.
+};
+
+// Sets up a cache of `capacity` blocks (FS_BLOCK_CACHE_DEFAULT_BLOCKS when 0) in front of pDevice.
+bool FsBlockCacheInit(FsBlockCache* pCache, FsDevice* pDevice, uint16_t blockSize, uint32_t capacity);
+// Frees the cache without writing anything back, flush it first to keep the changes.
+void FsBlockCacheRelease(FsBlockCache* pCache);
+
+// Pins the block into the cache, reading it from the device on a miss. Returns NULL when the block can't be read
+// or every entry is pinned. Each pin must be paired with FsBlockCacheUnpin.
+FsBlockCacheEntry* FsBlockCachePin(FsBlockCache* pCache, block_t block);
+void FsBlockCacheUnpin(FsBlockCache* pCache, FsBlockCacheEntry* pEntry);
+void FsBlockCacheMarkDirty(FsBlockCache* pCache, FsBlockCacheEntry* pEntry);
+
+// Marks the contents of every dirty block as written to the journal, once the transaction holding them is committed.
+void FsBlockCacheMarkLogged(FsBlockCache* pCache);
+
+// Copies size bytes at offset within the block out of, or into, the cache. Writes leave the block dirty.
+bool FsBlockCacheRead(FsBlockCache* pCache, block_t block, uint16_t offset, void* pDest, uint16_t size);
+bool FsBlockCacheWrite(FsBlockCache* pCache, block_t block, uint16_t offset, const void* pSource, uint16_t size);
+
+// Contents of the block when the cache holds a modified copy the device doesn't have yet, NULL otherwise. Lets code
+// reading the device directly see changes still waiting in the cache. Only valid until the cache is used again.
+const uint8_t* FsBlockCacheFindDirty(const FsBlockCache* pCache, block_t block);
+
+// Drops the block from the cache without writing it back. The block must not be pinned.
+void FsBlockCacheDiscard(FsBlockCache* pCache, block_t block);
+
+// Writes every dirty block back to the device in ascending block order.
+bool FsBlockCacheFlush(FsBlockCache* pCache);
+
+#endif // !MYTH_BLOCK_CACHE_H
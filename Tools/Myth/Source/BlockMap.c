@@ -0,0 +1,213 @@
+#include "BlockMap.h"
+
+#include "Utils/Math.h"
+
+#include <stdio.h>
+
+typedef struct
+{
+    FileSystemOnDisk* pFs;
+    block_visitor_t   Visitor;
+    void*             pContext;
+    uint64_t          NumData;      // Number of data blocks the node occupies.
+    uint64_t          NextLogical;  // Logical index of the next data block to visit.
+    uint64_t          FirstLogical; // Data blocks before this one are skipped.
+    uint64_t          PtrsPerBlock;
+    bool              bStopped;
+} block_walk_t;
+
+bool FsHasHoles(const FsMeta* pMeta)
+{
+    return pMeta->Revision >= FS_REVISION_HOLES;
+}
+
+bool FsNodeMayHaveHoles(const FsMeta* pMeta, const FsNode* pNode)
+{
+    return FsHasHoles(pMeta) && pNode->Type == FS_NODE_TYPE_FILE && pNode->ID != FS_NODE_ID_JOURNAL;
+}
+
+uint64_t FsNodeDataBlocks(const FsMeta* pMeta, uint64_t size)
+{
+    return size > FS_NODE_INLINE_DATA_SIZE ? FS_DIV(size - FS_NODE_INLINE_DATA_SIZE, pMeta->BlockSize) : 0;
+}
+
+block_t FsNodeBlockAt(FileSystemOnDisk* pFs, const FsNode* pNode, uint64_t logicalIndex)
+{
+    if (logicalIndex < FS_NODE_DIRECT_DATA_BLOCKS)
+    {
+        return pNode->DirectData[logicalIndex];
+    }
+
+    uint64_t ptrsPerBlock = pFs->Meta.BlockSize / sizeof(block_t);
+    uint64_t index = logicalIndex - FS_NODE_DIRECT_DATA_BLOCKS;
+    uint64_t span  = 1; // Data blocks underneath one pointer of the block at the current level.
+
+    const block_t roots[FS_BLOCK_LEVEL_TRIPLY] = { pNode->AddrSinglyIndirect, pNode->AddrDoublyIndirect, pNode->AddrTriplyIndirect };
+
+    uint8_t level = FS_BLOCK_LEVEL_SINGLY;
+    while (index >= span * ptrsPerBlock)
+    {
+        index -= span * ptrsPerBlock;
+        span  *= ptrsPerBlock;
+        if (++level > FS_BLOCK_LEVEL_TRIPLY)
+        {
+            return 0;
+        }
+    }
+
+    block_t block = roots[level - 1];
+    for (; level >= FS_BLOCK_LEVEL_SINGLY && block; level--, span /= ptrsPerBlock)
+    {
+        uint64_t slot = index / span;
+        index %= span;
+
+        if (!FsBlockCacheRead(&pFs->Cache, block, (uint16_t) (slot * sizeof(block_t)), &block, sizeof(block_t)))
+        {
+            printf("FsNodeBlockAt failed, couldn't read indirect block %lu.\n", block);
+            return 0;
+        }
+    }
+
+    return block;
+}
+
+static bool FsiWalkVisit(block_walk_t* pWalk, uint64_t logicalIndex, block_t block, uint8_t level)
+{
+    if (!pWalk->Visitor(pWalk->pContext, logicalIndex, block, level))
+    {
+        pWalk->bStopped = true;
+    }
+    return !pWalk->bStopped;
+}
+
+static bool FsiWalkIndirect(block_walk_t* pWalk, block_t addrIndirect, uint8_t level);
+
+// Data blocks underneath one pointer of an indirect block at level.
+static uint64_t FsiWalkSpan(const block_walk_t* pWalk, uint8_t level)
+{
+    uint64_t span = 1;
+    for (uint8_t l = FS_BLOCK_LEVEL_SINGLY; l < level; l++)
+    {
+        span *= pWalk->PtrsPerBlock;
+    }
+    return span;
+}
+
+static bool FsiWalkPointers(block_walk_t* pWalk, const block_t* pPointers, uint8_t level)
+{
+    uint64_t span = FsiWalkSpan(pWalk, level);
+    uint64_t i = 0;
+    if (pWalk->NextLogical < pWalk->FirstLogical)
+    {
+        i = FS_MIN((pWalk->FirstLogical - pWalk->NextLogical) / span, pWalk->PtrsPerBlock);
+        pWalk->NextLogical += i * span;
+    }
+
+    for (; i < pWalk->PtrsPerBlock && pWalk->NextLogical < pWalk->NumData; i++)
+    {
+        // A zero pointer is a hole, nothing underneath it is allocated.
+        if (!pPointers[i])
+        {
+            pWalk->NextLogical += span;
+            continue;
+        }
+
+        if (level == FS_BLOCK_LEVEL_SINGLY)
+        {
+            if (!FsiWalkVisit(pWalk, pWalk->NextLogical++, pPointers[i], FS_BLOCK_LEVEL_DATA))
+            {
+                return true;
+            }
+            continue;
+        }
+
+        if (!FsiWalkIndirect(pWalk, pPointers[i], level - 1))
+        {
+            return false;
+        }
+        if (pWalk->bStopped)
+        {
+            return true;
+        }
+    }
+
+    return true;
+}
+
+static bool FsiWalkIndirect(block_walk_t* pWalk, block_t addrIndirect, uint8_t level)
+{
+    if (!FsiWalkVisit(pWalk, pWalk->NextLogical, addrIndirect, level))
+    {
+        return true;
+    }
+
+    // The block stays pinned while its children are walked, so at most one block per level is held at a time.
+    FsBlockCacheEntry* pEntry = FsBlockCachePin(&pWalk->pFs->Cache, addrIndirect);
+    if (!pEntry)
+    {
+        printf("FsWalkNodeBlocks failed, couldn't read indirect block %lu.\n", addrIndirect);
+        return false;
+    }
+
+    bool bResult = FsiWalkPointers(pWalk, (const block_t*) pEntry->pData, level);
+    FsBlockCacheUnpin(&pWalk->pFs->Cache, pEntry);
+    return bResult;
+}
+
+bool FsWalkNodeBlocks(FileSystemOnDisk* pFs, const FsNode* pNode, block_visitor_t visitor, void* pContext)
+{
+    return FsWalkNodeBlocksFrom(pFs, pNode, 0, visitor, pContext);
+}
+
+bool FsWalkNodeBlocksFrom(FileSystemOnDisk* pFs, const FsNode* pNode, uint64_t firstLogical, block_visitor_t visitor, void* pContext)
+{
+    block_walk_t walk;
+    walk.pFs          = pFs;
+    walk.Visitor      = visitor;
+    walk.pContext     = pContext;
+    walk.NumData      = FsNodeDataBlocks(&pFs->Meta, pNode->Size);
+    walk.NextLogical  = FS_MIN(firstLogical, FS_NODE_DIRECT_DATA_BLOCKS);
+    walk.FirstLogical = firstLogical;
+    walk.PtrsPerBlock = pFs->Meta.BlockSize / sizeof(block_t);
+    walk.bStopped     = false;
+
+    for (; walk.NextLogical < walk.NumData && walk.NextLogical < FS_NODE_DIRECT_DATA_BLOCKS; walk.NextLogical++)
+    {
+        block_t block = pNode->DirectData[walk.NextLogical];
+        if (block && !FsiWalkVisit(&walk, walk.NextLogical, block, FS_BLOCK_LEVEL_DATA))
+        {
+            return true;
+        }
+    }
+
+    if (walk.NextLogical >= walk.NumData)
+    {
+        return true;
+    }
+
+    const block_t roots[FS_BLOCK_LEVEL_TRIPLY] = { pNode->AddrSinglyIndirect, pNode->AddrDoublyIndirect, pNode->AddrTriplyIndirect };
+
+    bool bResult = true;
+    for (uint8_t level = FS_BLOCK_LEVEL_SINGLY; level <= FS_BLOCK_LEVEL_TRIPLY; level++)
+    {
+        if (walk.bStopped || walk.NextLogical >= walk.NumData)
+        {
+            break;
+        }
+
+        // A whole tree before firstLogical isn't read at all, neither is one that is a hole.
+        uint64_t treeSpan = FsiWalkSpan(&walk, level) * walk.PtrsPerBlock;
+        if (walk.NextLogical + treeSpan <= walk.FirstLogical || !roots[level - 1])
+        {
+            walk.NextLogical += treeSpan;
+            continue;
+        }
+
+        if (!(bResult = FsiWalkIndirect(&walk, roots[level - 1], level)))
+        {
+            break;
+        }
+    }
+
+    return bResult;
+}
@@ -0,0 +1,45 @@
+/**
+ * Header for walking the blocks a node occupies.
+ */
+
+#ifndef MYTH_BLOCK_MAP_H
+#define MYTH_BLOCK_MAP_H
+
+#include "FileSystem.h"
+#include "Disk.h"
+
+#include <stdbool.h>
+
+#define FS_BLOCK_LEVEL_DATA    UINT8_C(0)
+#define FS_BLOCK_LEVEL_SINGLY  UINT8_C(1)
+#define FS_BLOCK_LEVEL_DOUBLY  UINT8_C(2)
+#define FS_BLOCK_LEVEL_TRIPLY  UINT8_C(3)
+
+// Called once for every block of a node. For data blocks `level` is FS_BLOCK_LEVEL_DATA and logicalIndex is the index of
+// the block within the node's data, for indirect blocks it is the indirection level and the index of the first data block
+// underneath it. Returning false ends the walk early.
+typedef bool (*block_visitor_t)(void* pContext, uint64_t logicalIndex, block_t block, uint8_t level);
+
+// Whether the revision of pMeta allows holes in the data of file nodes.
+bool FsHasHoles(const FsMeta* pMeta);
+
+// Whether the data of pNode may have holes on the file system pMeta describes, only file nodes other than the journal do.
+bool FsNodeMayHaveHoles(const FsMeta* pMeta, const FsNode* pNode);
+
+// Number of data blocks a node of the given size occupies, the inline section is not counted.
+uint64_t FsNodeDataBlocks(const FsMeta* pMeta, uint64_t size);
+
+// Physical block holding the logical data block logicalIndex of pNode, 0 when the block is a hole, past the end of the
+// node or on I/O failure. Costs one cached read per level of indirection.
+block_t FsNodeBlockAt(FileSystemOnDisk* pFs, const FsNode* pNode, uint64_t logicalIndex);
+
+// Visits every data and indirect block of pNode in logical order, indirect blocks before the blocks they point to.
+// Indirect blocks are read through the block cache, one whole block at a time. Zero pointers are holes, the logical
+// blocks underneath them are skipped without a visit.
+// Returns false on I/O failure, a visitor ending the walk is not a failure.
+bool FsWalkNodeBlocks(FileSystemOnDisk* pFs, const FsNode* pNode, block_visitor_t visitor, void* pContext);
+// Same as FsWalkNodeBlocks, but data blocks before firstLogical are skipped along with every indirect block that only
+// leads to them, none of those are read. Indirect blocks leading to firstLogical or later blocks are still visited.
+bool FsWalkNodeBlocksFrom(FileSystemOnDisk* pFs, const FsNode* pNode, uint64_t firstLogical, block_visitor_t visitor, void* pContext);
+
+#endif // !MYTH_BLOCK_MAP_H
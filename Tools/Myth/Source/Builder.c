@@ -0,0 +1,1083 @@
+#include "Builder.h"
+
+#include "Compression.h"
+#include "Node.h"
+
+#include "Utils/BitScan.h"
+#include "Utils/Math.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define FS_BUILDER_NOT_FOUND UINT64_MAX
+
+#define FS_BUILDER_TASKS_PER_WORKER UINT32_C(4)       // Files in flight per worker, bounds what waits for its node.
+#define FS_BUILDER_BUFFER_SIZE      (UINT64_C(1) << 20)
+#define FS_BUILDER_MIN_REGION       UINT64_C(256)     // Blocks, regions smaller than this just fragment the workers.
+#define FS_BUILDER_MAX_REGION       UINT64_C(32768)
+
+/** One file being imported, its blocks are reserved and the node waits for the worker to fill them. */
+typedef struct
+{
+    FsNodeWriter Writer;
+    int          Descriptor;
+    uint64_t     FileSize;
+    uint64_t     Offset;     // Source offset the deferred blocks start at.
+    uint64_t     Size;       // Bytes the worker copies, 0 when the file fit without any.
+    block_t*     pBlocks;
+    uint64_t     MaxBlocks;
+    uint64_t     Directory;
+    char*        pPath;      // Image path of the file, its name starts at NameOffset.
+    size_t       PathLength;
+    size_t       NameOffset;
+    uint32_t     Worker;
+    bool         bDone;
+    bool         bFailed;
+} build_task_t;
+
+typedef struct
+{
+    FsBuildPool*        pPool;
+    pthread_t           Thread;
+    pthread_cond_t      Wake;
+    uint32_t*           pQueue;      // Task indices, a ring of MaxTasks.
+    uint32_t            QueueHead;
+    uint32_t            QueueLength;
+    uint64_t            QueuedBytes;
+    allocation_region_t Region;
+    bool                bHasRegion;
+    uint8_t*            pBuffer;
+    uint8_t*            pPacked;     // One packed cluster, only allocated when the build compresses.
+} build_worker_t;
+
+struct FsBuildPool
+{
+    pthread_mutex_t Lock;
+    pthread_cond_t  TaskDone;
+    FsDevice*       pDevice;
+    uint16_t        BlockSize;
+    uint64_t        ClusterBlocks;
+    build_worker_t* pWorkers;
+    uint32_t        NumWorkers;
+    uint32_t        NumStarted;
+    build_task_t*   pTasks;      // Ring in submission order, tasks are finished in that order too.
+    uint32_t        MaxTasks;
+    uint32_t        FirstTask;
+    uint32_t        NumTasks;
+    block_t         NextRegion;  // Start of the next region nobody was assigned yet.
+    uint64_t        RegionBlocks;
+    bool            bStopping;
+};
+
+// Strips the optional "FS/" prefix and any leading or trailing slashes. Returns NULL if a component is empty, "." or "..".
+static const char* FsiBuilderNormalize(const char* pImagePath, size_t* pLength)
+{
+    if (strncmp(pImagePath, "FS/", 3) == 0)
+    {
+        pImagePath += 3;
+    }
+    while (*pImagePath == '/')
+    {
+        pImagePath++;
+    }
+
+    size_t length = strlen(pImagePath);
+    while (length && pImagePath[length - 1] == '/')
+    {
+        length--;
+    }
+
+    for (size_t start = 0; start < length; )
+    {
+        size_t end = start;
+        while (end < length && pImagePath[end] != '/')
+        {
+            end++;
+        }
+
+        size_t componentLength = end - start;
+        if (componentLength == 0 || (pImagePath[start] == '.' && (componentLength == 1 || (componentLength == 2 && pImagePath[start + 1] == '.'))))
+        {
+            printf("FsBuilder failed, image path '%s' has an empty, '.' or '..' component.\n", pImagePath);
+            return NULL;
+        }
+        start = end + 1;
+    }
+
+    *pLength = length;
+    return pImagePath;
+}
+
+static char* FsiBuilderJoin(const char* pLeft, size_t leftLength, const char* pRight)
+{
+    size_t rightLength = strlen(pRight);
+    char* pResult = malloc(leftLength + rightLength + 2);
+    if (!pResult)
+    {
+        puts("FsBuilder failed, couldn't allocate memory for a path.");
+        return NULL;
+    }
+
+    memcpy(pResult, pLeft, leftLength);
+    size_t length = leftLength;
+    if (leftLength && rightLength)
+    {
+        pResult[length++] = '/';
+    }
+    memcpy(pResult + length, pRight, rightLength + 1);
+
+    return pResult;
+}
+
+static uint64_t FsiBuilderFind(FsImageBuilder* pBuilder, const char* pPath, size_t length)
+{
+    const build_directory_t* pLast = &pBuilder->pDirectories[pBuilder->LastDirectory];
+    if (strlen(pLast->pPath) == length && memcmp(pLast->pPath, pPath, length) == 0)
+    {
+        return pBuilder->LastDirectory;
+    }
+
+    for (uint64_t i = 0; i < pBuilder->NumDirectories; i++)
+    {
+        const char* pCandidate = pBuilder->pDirectories[i].pPath;
+        if (strlen(pCandidate) == length && memcmp(pCandidate, pPath, length) == 0)
+        {
+            pBuilder->LastDirectory = i;
+            return i;
+        }
+    }
+
+    return FS_BUILDER_NOT_FOUND;
+}
+
+// Finds a free node ID close to the directory the node goes into and creates an empty node of the given type there.
+static nodeid_t FsiBuilderMakeNode(FsImageBuilder* pBuilder, uint16_t type, nodeid_t parentID)
+{
+    FsNode node;
+    memset(&node, 0, FS_NODE_SIZE);
+
+    node.ID        = FsFindNodeIDNear(pBuilder->pFs, parentID);
+    node.Type      = type;
+    node.Flags     = type == FS_NODE_TYPE_FILE && pBuilder->bCompress ? FS_NODE_FLAG_COMPRESSED : FS_NODE_FLAG_CLEAR;
+    node.CreatorID = FS_CREATOR_MYTH_TOOL;
+    node.Owner     = 0xffffffff;
+
+    if (node.ID == FS_NODE_ID_INVALID)
+    {
+        return FS_NODE_ID_INVALID;
+    }
+
+    create_node_result_t result = FsMakeNode(pBuilder->pFs, &node, NULL, 0);
+    if (result != FS_MAKE_NODE_SUCCESSFUL)
+    {
+        printf("FsBuilder failed, FsMakeNode returned code %u (%s).\n", result, FsCreateNodeResultToString(result));
+        return FS_NODE_ID_INVALID;
+    }
+
+    return node.ID;
+}
+
+// Returns the index of the directory at the normalized path, creating it and its missing parents.
+static uint64_t FsiBuilderDirectory(FsImageBuilder* pBuilder, const char* pPath, size_t length)
+{
+    uint64_t index = FsiBuilderFind(pBuilder, pPath, length);
+    if (index != FS_BUILDER_NOT_FOUND)
+    {
+        return index;
+    }
+
+    size_t parentLength = length;
+    while (parentLength && pPath[parentLength - 1] != '/')
+    {
+        parentLength--;
+    }
+    const char* pName = pPath + parentLength;
+    size_t nameLength = length - parentLength;
+
+    uint64_t parent = FsiBuilderDirectory(pBuilder, pPath, parentLength ? parentLength - 1 : 0);
+    if (parent == FS_BUILDER_NOT_FOUND)
+    {
+        return FS_BUILDER_NOT_FOUND;
+    }
+
+    if (pBuilder->NumDirectories == pBuilder->MaxDirectories)
+    {
+        uint64_t maxDirectories = pBuilder->MaxDirectories * 2;
+        build_directory_t* pDirectories = realloc(pBuilder->pDirectories, maxDirectories * sizeof(build_directory_t));
+        if (!pDirectories)
+        {
+            puts("FsBuilder failed, couldn't grow the directory list.");
+            return FS_BUILDER_NOT_FOUND;
+        }
+        pBuilder->pDirectories   = pDirectories;
+        pBuilder->MaxDirectories = maxDirectories;
+    }
+
+    build_directory_t directory;
+    memset(&directory, 0, sizeof(build_directory_t));
+    directory.pPath = strndup(pPath, length);
+    if (!directory.pPath)
+    {
+        puts("FsBuilder failed, couldn't allocate memory for a path.");
+        return FS_BUILDER_NOT_FOUND;
+    }
+
+    directory.NodeID = FsiBuilderMakeNode(pBuilder, FS_NODE_TYPE_DIRECTORY, pBuilder->pDirectories[parent].NodeID);
+    if (directory.NodeID == FS_NODE_ID_INVALID ||
+        !FsEntryListAppend(&pBuilder->pDirectories[parent].Entries, directory.NodeID, FS_NODE_TYPE_DIRECTORY, pName, nameLength))
+    {
+        printf("FsBuilder failed, couldn't create directory 'FS/%s'.\n", directory.pPath);
+        free(directory.pPath);
+        return FS_BUILDER_NOT_FOUND;
+    }
+
+    index = pBuilder->NumDirectories++;
+    pBuilder->pDirectories[index] = directory;
+    pBuilder->LastDirectory = index;
+    return index;
+}
+
+static bool FsiBuilderRead(int descriptor, uint64_t offset, uint8_t* pDest, uint64_t size)
+{
+    while (size)
+    {
+        ssize_t numRead = pread(descriptor, pDest, size, (off_t) offset);
+        if (numRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (numRead <= 0)
+        {
+            return false;
+        }
+
+        pDest  += numRead;
+        offset += numRead;
+        size   -= numRead;
+    }
+
+    return true;
+}
+
+// Fills the deferred blocks of a task, one write per buffer worth of a run of adjacent blocks. Runs on a worker. When the
+// node may have holes, blocks read as all zeroes aren't written and their entries in the task's block list are set to 0,
+// they are released once the task is reaped.
+static bool FsiBuilderCopy(FsBuildPool* pPool, build_worker_t* pWorker, build_task_t* pTask)
+{
+    uint64_t blockSize = pPool->BlockSize;
+    uint64_t numBlocks = FS_DIV(pTask->Size, blockSize);
+    uint64_t maxChunk  = FS_BUILDER_BUFFER_SIZE / blockSize;
+    uint64_t copied    = 0;
+
+    for (uint64_t i = 0; i < numBlocks; )
+    {
+        uint64_t runLength = 1;
+        while (i + runLength < numBlocks && runLength < maxChunk && pTask->pBlocks[i + runLength] == pTask->pBlocks[i] + runLength)
+        {
+            runLength++;
+        }
+
+        uint64_t szRun  = runLength * blockSize;
+        uint64_t szRead = FS_MIN(szRun, pTask->Size - copied);
+        if (!FsiBuilderRead(pTask->Descriptor, pTask->Offset + copied, pWorker->pBuffer, szRead))
+        {
+            printf("FsBuilder failed, couldn't read the source of node %u.\n", pTask->Writer.Node.ID);
+            return false;
+        }
+        memset(pWorker->pBuffer + szRead, 0, szRun - szRead);
+
+        for (uint64_t j = 0; j < runLength; )
+        {
+            bool bHole = pTask->Writer.bHoles && BitScanIsZero(pWorker->pBuffer + j * blockSize, blockSize);
+            uint64_t length = pTask->Writer.bHoles ? 1 : runLength - j;
+            while (j + length < runLength && BitScanIsZero(pWorker->pBuffer + (j + length) * blockSize, blockSize) == bHole)
+            {
+                length++;
+            }
+
+            if (bHole)
+            {
+                memset(pTask->pBlocks + i + j, 0, length * sizeof(block_t));
+            }
+            else if (!FsDeviceWrite(pPool->pDevice, pTask->pBlocks[i + j] * blockSize, pWorker->pBuffer + j * blockSize, length * blockSize))
+            {
+                printf("FsBuilder failed, couldn't write %lu blocks of node %u to block %lu.\n", length, pTask->Writer.Node.ID, pTask->pBlocks[i + j]);
+                return false;
+            }
+            j += length;
+        }
+
+        copied += szRead;
+        i      += runLength;
+    }
+
+    return true;
+}
+
+// Writes count blocks of pData to pBlocks, one write per run of adjacent blocks. Runs on a worker.
+static bool FsiBuilderWriteRuns(FsBuildPool* pPool, const build_task_t* pTask, const block_t* pBlocks, uint64_t count, const uint8_t* pData)
+{
+    uint64_t blockSize = pPool->BlockSize;
+
+    for (uint64_t i = 0; i < count; )
+    {
+        uint64_t runLength = 1;
+        while (i + runLength < count && pBlocks[i + runLength] == pBlocks[i] + runLength)
+        {
+            runLength++;
+        }
+
+        if (!FsDeviceWrite(pPool->pDevice, pBlocks[i] * blockSize, pData + i * blockSize, runLength * blockSize))
+        {
+            printf("FsBuilder failed, couldn't write %lu blocks of node %u to block %lu.\n", runLength, pTask->Writer.Node.ID, pBlocks[i]);
+            return false;
+        }
+        i += runLength;
+    }
+
+    return true;
+}
+
+// Fills the deferred blocks of a compressed task, a buffer worth of clusters is read at once and packed cluster by
+// cluster. Each cluster is written to the first of its blocks and the entries of the blocks it doesn't need are set to
+// 0, they are released once the task is reaped. Runs on a worker.
+static bool FsiBuilderPack(FsBuildPool* pPool, build_worker_t* pWorker, build_task_t* pTask)
+{
+    uint64_t blockSize   = pPool->BlockSize;
+    uint64_t clusterSize = pPool->ClusterBlocks * blockSize;
+    uint64_t maxChunk    = FS_MAX(FS_BUILDER_BUFFER_SIZE / clusterSize, 1) * clusterSize;
+
+    for (uint64_t done = 0; done < pTask->Size; )
+    {
+        uint64_t szRead = FS_MIN(maxChunk, pTask->Size - done);
+        if (!FsiBuilderRead(pTask->Descriptor, pTask->Offset + done, pWorker->pBuffer, szRead))
+        {
+            printf("FsBuilder failed, couldn't read the source of node %u.\n", pTask->Writer.Node.ID);
+            return false;
+        }
+        memset(pWorker->pBuffer + szRead, 0, FS_DIV(szRead, blockSize) * blockSize - szRead);
+
+        for (uint64_t packed = 0; packed < szRead; packed += clusterSize)
+        {
+            uint64_t length    = FS_MIN(clusterSize, szRead - packed);
+            uint64_t numBlocks = FS_DIV(length, blockSize);
+            uint64_t numStored = FsPackCluster(pPool->BlockSize, pWorker->pBuffer + packed, length, pWorker->pPacked);
+            block_t* pBlocks   = pTask->pBlocks + (done + packed) / blockSize;
+
+            if (!FsiBuilderWriteRuns(pPool, pTask, pBlocks, numStored, numStored == numBlocks ? pWorker->pBuffer + packed : pWorker->pPacked))
+            {
+                return false;
+            }
+            memset(pBlocks + numStored, 0, (numBlocks - numStored) * sizeof(block_t));
+        }
+
+        done += szRead;
+    }
+
+    return true;
+}
+
+static void* FsiBuilderWorker(void* pArgument)
+{
+    build_worker_t* pWorker = (build_worker_t*) pArgument;
+    FsBuildPool* pPool = pWorker->pPool;
+
+    pthread_mutex_lock(&pPool->Lock);
+    for (;;)
+    {
+        while (!pWorker->QueueLength && !pPool->bStopping)
+        {
+            pthread_cond_wait(&pWorker->Wake, &pPool->Lock);
+        }
+        if (!pWorker->QueueLength)
+        {
+            break;
+        }
+
+        build_task_t* pTask = &pPool->pTasks[pWorker->pQueue[pWorker->QueueHead]];
+        pWorker->QueueHead = (pWorker->QueueHead + 1) % pPool->MaxTasks;
+        pWorker->QueueLength--;
+        pthread_mutex_unlock(&pPool->Lock);
+
+        bool bCopied = pTask->Writer.bCompress ? FsiBuilderPack(pPool, pWorker, pTask) : FsiBuilderCopy(pPool, pWorker, pTask);
+
+        pthread_mutex_lock(&pPool->Lock);
+        pTask->bFailed = !bCopied;
+        pTask->bDone   = true;
+        pWorker->QueuedBytes -= pTask->Size;
+        pthread_cond_signal(&pPool->TaskDone);
+    }
+    pthread_mutex_unlock(&pPool->Lock);
+
+    return NULL;
+}
+
+static void FsiBuilderStopPool(FsBuildPool* pPool)
+{
+    pthread_mutex_lock(&pPool->Lock);
+    pPool->bStopping = true;
+    for (uint32_t i = 0; i < pPool->NumStarted; i++)
+    {
+        pthread_cond_signal(&pPool->pWorkers[i].Wake);
+    }
+    pthread_mutex_unlock(&pPool->Lock);
+
+    for (uint32_t i = 0; i < pPool->NumWorkers; i++)
+    {
+        build_worker_t* pWorker = &pPool->pWorkers[i];
+        if (i < pPool->NumStarted)
+        {
+            pthread_join(pWorker->Thread, NULL);
+        }
+        pthread_cond_destroy(&pWorker->Wake);
+        free(pWorker->pQueue);
+        free(pWorker->pBuffer);
+        free(pWorker->pPacked);
+    }
+    for (uint32_t i = 0; i < pPool->MaxTasks; i++)
+    {
+        free(pPool->pTasks[i].pBlocks);
+    }
+
+    pthread_cond_destroy(&pPool->TaskDone);
+    pthread_mutex_destroy(&pPool->Lock);
+    free(pPool->pWorkers);
+    free(pPool->pTasks);
+    free(pPool);
+}
+
+static FsBuildPool* FsiBuilderStartPool(FileSystemOnDisk* pFs, uint32_t numWorkers, bool bCompress)
+{
+    FsBuildPool* pPool = calloc(1, sizeof(FsBuildPool));
+    if (!pPool)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init(&pPool->Lock, NULL);
+    pthread_cond_init(&pPool->TaskDone, NULL);
+    pPool->pDevice       = pFs->pDevice;
+    pPool->BlockSize     = pFs->Meta.BlockSize;
+    pPool->ClusterBlocks = FsClusterBlocks(&pFs->Meta);
+    pPool->NumWorkers    = numWorkers;
+    pPool->MaxTasks      = numWorkers * FS_BUILDER_TASKS_PER_WORKER;
+    pPool->pWorkers      = calloc(numWorkers, sizeof(build_worker_t));
+    pPool->pTasks        = calloc(pPool->MaxTasks, sizeof(build_task_t));
+
+    // A few regions per worker so the last of them still has some to move on to once theirs fill up.
+    const FsMeta* pMeta = &pFs->Meta;
+    pPool->NextRegion   = FS_MAX(pMeta->LastAllocatedDataBlock + 1, pMeta->AddrData);
+    pPool->RegionBlocks = (pMeta->Size - pMeta->AddrData - pMeta->NumAllocatedBlocks) / (numWorkers * 4);
+    pPool->RegionBlocks = FS_MIN(FS_MAX(pPool->RegionBlocks, FS_BUILDER_MIN_REGION), FS_BUILDER_MAX_REGION);
+
+    if (!pPool->pWorkers || !pPool->pTasks)
+    {
+        pPool->NumWorkers = 0;
+        pPool->MaxTasks   = 0;
+        FsiBuilderStopPool(pPool);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < numWorkers; i++)
+    {
+        build_worker_t* pWorker = &pPool->pWorkers[i];
+        pWorker->pPool   = pPool;
+        pWorker->pQueue  = malloc(pPool->MaxTasks * sizeof(uint32_t));
+        pWorker->pBuffer = malloc(FS_MAX(FS_BUILDER_BUFFER_SIZE, pPool->BlockSize));
+        pWorker->pPacked = bCompress ? malloc(pPool->ClusterBlocks * pPool->BlockSize) : NULL;
+        pthread_cond_init(&pWorker->Wake, NULL);
+
+        if (!pWorker->pQueue || !pWorker->pBuffer || (bCompress && !pWorker->pPacked) ||
+            pthread_create(&pWorker->Thread, NULL, FsiBuilderWorker, pWorker) != 0)
+        {
+            FsiBuilderStopPool(pPool);
+            return NULL;
+        }
+        pPool->NumStarted++;
+    }
+
+    return pPool;
+}
+
+// Moves the worker on to the next region no one was assigned yet, or leaves it without one once the data area ran out.
+static void FsiBuilderNextRegion(FileSystemOnDisk* pFs, FsBuildPool* pPool, build_worker_t* pWorker, uint64_t numBlocks)
+{
+    const FsMeta* pMeta = &pFs->Meta;
+    if (pPool->NextRegion >= pMeta->Size)
+    {
+        pWorker->bHasRegion = false;
+        return;
+    }
+
+    // Large files get a region of their own, with room for their indirect blocks.
+    uint64_t length = FS_MAX(pPool->RegionBlocks, numBlocks + numBlocks / 64 + 4);
+
+    pWorker->Region.From   = pPool->NextRegion;
+    pWorker->Region.To     = FS_MIN(pPool->NextRegion + length, pMeta->Size);
+    pWorker->Region.Cursor = pWorker->Region.From;
+    pWorker->bHasRegion    = true;
+    pPool->NextRegion      = pWorker->Region.To;
+}
+
+// Writes the nodes of finished tasks, in the order they were submitted, until at most maxPending tasks remain. Waits
+// for the workers when the oldest task isn't done yet. Returns false if any of them failed.
+static bool FsiBuilderReap(FsImageBuilder* pBuilder, uint32_t maxPending)
+{
+    FsBuildPool* pPool = pBuilder->pPool;
+    bool bResult = true;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pPool->Lock);
+        while (pPool->NumTasks > maxPending && !pPool->pTasks[pPool->FirstTask].bDone)
+        {
+            pthread_cond_wait(&pPool->TaskDone, &pPool->Lock);
+        }
+        build_task_t* pTask = pPool->NumTasks && pPool->pTasks[pPool->FirstTask].bDone ? &pPool->pTasks[pPool->FirstTask] : NULL;
+        if (pTask)
+        {
+            pPool->FirstTask = (pPool->FirstTask + 1) % pPool->MaxTasks;
+            pPool->NumTasks--;
+        }
+        pthread_mutex_unlock(&pPool->Lock);
+
+        if (!pTask)
+        {
+            return bResult;
+        }
+
+        // Only the calling thread touches the slot from here on, it isn't handed out again before this returns.
+        if (!pTask->bFailed && pTask->Size)
+        {
+            FsNodeWriterReleaseDeferred(&pTask->Writer, pTask->pBlocks);
+        }
+        write_node_data_result_t writeResult = FsCloseNodeWriter(&pTask->Writer);
+        close(pTask->Descriptor);
+
+        if (writeResult != FS_WRITE_DATA_SUCCESSFUL)
+        {
+            printf("FsBuilderAddFile failed, couldn't import 'FS/%s', code %u (%s).\n", pTask->pPath, writeResult, FsWriteNodeDataResultToString(writeResult));
+            bResult = false;
+        }
+        else if (pTask->bFailed)
+        {
+            printf("FsBuilderAddFile failed, couldn't copy the data of 'FS/%s'.\n", pTask->pPath);
+            bResult = false;
+        }
+        else if (!FsEntryListAppend(&pBuilder->pDirectories[pTask->Directory].Entries, pTask->Writer.Node.ID, FS_NODE_TYPE_FILE,
+                                    pTask->pPath + pTask->NameOffset, pTask->PathLength - pTask->NameOffset))
+        {
+            printf("FsBuilderAddFile failed, couldn't add 'FS/%s' to its directory.\n", pTask->pPath);
+            bResult = false;
+        }
+        else
+        {
+            pBuilder->NumFiles++;
+            pBuilder->NumBytes += pTask->FileSize;
+            pBuilder->NumStoredBytes += FS_MIN(pTask->FileSize, FS_NODE_INLINE_DATA_SIZE) + pTask->Writer.StoredBlocks * pPool->BlockSize;
+        }
+
+        free(pTask->pPath);
+        pTask->pPath = NULL;
+    }
+}
+
+// Reserves the blocks of the file in a worker's region and queues the copy. The head of the file up to the first block
+// is read right away, that part lives in the node.
+static bool FsiBuilderSubmit(FsImageBuilder* pBuilder, nodeid_t nodeID, int descriptor, uint64_t fileSize,
+                             uint64_t directory, const char* pPath, size_t length, size_t nameOffset)
+{
+    FileSystemOnDisk* pFs = pBuilder->pFs;
+    FsBuildPool* pPool = pBuilder->pPool;
+
+    bool bResult = FsiBuilderReap(pBuilder, pPool->MaxTasks - 1);
+
+    build_task_t* pTask = &pPool->pTasks[(pPool->FirstTask + pPool->NumTasks) % pPool->MaxTasks];
+    pTask->Descriptor = descriptor;
+    pTask->FileSize   = fileSize;
+    pTask->Offset     = FS_MIN(fileSize, FS_NODE_INLINE_DATA_SIZE);
+    pTask->Size       = fileSize - pTask->Offset;
+    pTask->Directory  = directory;
+    pTask->PathLength = length;
+    pTask->NameOffset = nameOffset;
+    pTask->pPath      = strndup(pPath, length);
+    pTask->bDone      = false;
+    pTask->bFailed    = false;
+
+    write_node_data_result_t writeResult = FsOpenNodeWriter(pFs, nodeID, &pTask->Writer);
+    if (!pTask->pPath || writeResult != FS_WRITE_DATA_SUCCESSFUL)
+    {
+        printf("FsBuilderAddFile failed, couldn't import 'FS/%.*s', code %u (%s).\n", (int) length, pPath, writeResult, FsWriteNodeDataResultToString(writeResult));
+        if (writeResult == FS_WRITE_DATA_SUCCESSFUL)
+        {
+            FsCloseNodeWriter(&pTask->Writer);
+        }
+        free(pTask->pPath);
+        pTask->pPath = NULL;
+        close(descriptor);
+        return false;
+    }
+
+    uint64_t numBlocks = FS_DIV(pTask->Size, pPool->BlockSize);
+    if (numBlocks > pTask->MaxBlocks)
+    {
+        block_t* pBlocks = realloc(pTask->pBlocks, numBlocks * sizeof(block_t));
+        if (!pBlocks)
+        {
+            puts("FsBuilderAddFile failed, couldn't allocate the block list of a file.");
+            numBlocks = 0;
+            pTask->bFailed = true;
+        }
+        else
+        {
+            pTask->pBlocks   = pBlocks;
+            pTask->MaxBlocks = numBlocks;
+        }
+    }
+
+    // The least busy worker gets the file, so one huge file doesn't hold up the small ones behind it.
+    pthread_mutex_lock(&pPool->Lock);
+    uint32_t worker = 0;
+    for (uint32_t i = 1; i < pPool->NumWorkers; i++)
+    {
+        if (pPool->pWorkers[i].QueuedBytes < pPool->pWorkers[worker].QueuedBytes)
+        {
+            worker = i;
+        }
+    }
+    pthread_mutex_unlock(&pPool->Lock);
+
+    build_worker_t* pWorker = &pPool->pWorkers[worker];
+    if (numBlocks && (!pWorker->bHasRegion || FsBitmapCountFree(&pFs->Bitmap, &pFs->Meta, pWorker->Region.Cursor, pWorker->Region.To) < numBlocks))
+    {
+        FsiBuilderNextRegion(pFs, pPool, pWorker, numBlocks);
+    }
+    pTask->Worker = worker;
+    pTask->Writer.pRegion = pWorker->bHasRegion ? &pWorker->Region : NULL;
+
+    FsNodeWriterAppendFile(&pTask->Writer, descriptor, 0, pTask->Offset);
+    if (!pTask->bFailed && FsNodeWriterAppendDeferred(&pTask->Writer, pTask->Size, pTask->pBlocks) != FS_WRITE_DATA_SUCCESSFUL)
+    {
+        pTask->bFailed = true;
+    }
+
+    // A file that failed right away stops the import here, failures of the workers surface once their task is reaped.
+    bool bSubmitted = !pTask->bFailed;
+
+    pthread_mutex_lock(&pPool->Lock);
+    pPool->NumTasks++;
+    if (pTask->bFailed || !numBlocks)
+    {
+        pTask->bDone = true;
+    }
+    else
+    {
+        pWorker->pQueue[(pWorker->QueueHead + pWorker->QueueLength) % pPool->MaxTasks] = (uint32_t) (pTask - pPool->pTasks);
+        pWorker->QueueLength++;
+        pWorker->QueuedBytes += pTask->Size;
+        pthread_cond_signal(&pWorker->Wake);
+    }
+    pthread_mutex_unlock(&pPool->Lock);
+
+    return FsiBuilderReap(pBuilder, pPool->MaxTasks) && bSubmitted && bResult;
+}
+
+bool FsBuilderInit(FsImageBuilder* pBuilder, FileSystemOnDisk* pFs, uint32_t numThreads, bool bCompress)
+{
+    memset(pBuilder, 0, sizeof(FsImageBuilder));
+    pBuilder->pFs       = pFs;
+    pBuilder->bCompress = bCompress;
+
+    if (!FsNodeExists(pFs, FS_NODE_ID_ROOT))
+    {
+        puts("FsBuilderInit failed, the file system has no root node.");
+        return false;
+    }
+    if (bCompress && !FsHasCompression(&pFs->Meta))
+    {
+        printf("FsBuilderInit failed, revision %u file systems can't hold compressed nodes.\n", pFs->Meta.Revision);
+        return false;
+    }
+
+    pBuilder->MaxDirectories = 64;
+    pBuilder->pDirectories = calloc(pBuilder->MaxDirectories, sizeof(build_directory_t));
+    if (!pBuilder->pDirectories || !(pBuilder->pDirectories[0].pPath = strdup("")))
+    {
+        puts("FsBuilderInit failed, couldn't allocate the directory list.");
+        free(pBuilder->pDirectories);
+        pBuilder->pDirectories = NULL;
+        return false;
+    }
+    pBuilder->pDirectories[0].NodeID = FS_NODE_ID_ROOT;
+    pBuilder->NumDirectories = 1;
+
+    if (!numThreads)
+    {
+        long numProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = numProcessors > 0 ? (uint32_t) numProcessors : 1;
+    }
+    pBuilder->NumThreads = numThreads;
+
+    if (numThreads > 1 && !(pBuilder->pPool = FsiBuilderStartPool(pFs, numThreads, bCompress)))
+    {
+        printf("FsBuilderInit failed, couldn't start %u worker threads.\n", numThreads);
+        free(pBuilder->pDirectories[0].pPath);
+        free(pBuilder->pDirectories);
+        pBuilder->pDirectories = NULL;
+        return false;
+    }
+
+    FsBeginBatch(pFs);
+    return true;
+}
+
+bool FsBuilderAddDirectory(FsImageBuilder* pBuilder, const char* pImagePath)
+{
+    size_t length;
+    const char* pPath = FsiBuilderNormalize(pImagePath, &length);
+    return pPath && FsiBuilderDirectory(pBuilder, pPath, length) != FS_BUILDER_NOT_FOUND;
+}
+
+// Returns the index of the directory the normalized path goes into, creating it and its missing parents. The name
+// within that directory starts at *pParentLength.
+static uint64_t FsiBuilderParent(FsImageBuilder* pBuilder, const char* pPath, size_t length, size_t* pParentLength)
+{
+    size_t parentLength = length;
+    while (parentLength && pPath[parentLength - 1] != '/')
+    {
+        parentLength--;
+    }
+
+    *pParentLength = parentLength;
+    return FsiBuilderDirectory(pBuilder, pPath, parentLength ? parentLength - 1 : 0);
+}
+
+bool FsBuilderAddFile(FsImageBuilder* pBuilder, const char* pImagePath, const char* pHostPath)
+{
+    size_t length;
+    const char* pPath = FsiBuilderNormalize(pImagePath, &length);
+    if (!pPath || !length)
+    {
+        printf("FsBuilderAddFile failed, '%s' isn't a valid path for a file.\n", pImagePath);
+        return false;
+    }
+
+    size_t parentLength;
+    uint64_t directory = FsiBuilderParent(pBuilder, pPath, length, &parentLength);
+    if (directory == FS_BUILDER_NOT_FOUND)
+    {
+        return false;
+    }
+
+    int descriptor = open(pHostPath, O_RDONLY);
+    if (descriptor < 0)
+    {
+        printf("FsBuilderAddFile failed, couldn't open '%s' (%s).\n", pHostPath, strerror(errno));
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(descriptor, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        printf("FsBuilderAddFile failed, '%s' isn't a regular file.\n", pHostPath);
+        close(descriptor);
+        return false;
+    }
+
+    nodeid_t nodeID = FsiBuilderMakeNode(pBuilder, FS_NODE_TYPE_FILE, pBuilder->pDirectories[directory].NodeID);
+    if (nodeID == FS_NODE_ID_INVALID)
+    {
+        close(descriptor);
+        return false;
+    }
+
+    if (pBuilder->pPool)
+    {
+        return FsiBuilderSubmit(pBuilder, nodeID, descriptor, (uint64_t) info.st_size, directory, pPath, length, parentLength);
+    }
+
+    FsNodeWriter writer;
+    write_node_data_result_t writeResult = FsOpenNodeWriter(pBuilder->pFs, nodeID, &writer);
+    if (writeResult == FS_WRITE_DATA_SUCCESSFUL)
+    {
+        FsNodeWriterAppendFile(&writer, descriptor, 0, (uint64_t) info.st_size);
+        writeResult = FsCloseNodeWriter(&writer);
+    }
+    uint64_t storedBytes = FS_MIN((uint64_t) info.st_size, FS_NODE_INLINE_DATA_SIZE) + writer.StoredBlocks * pBuilder->pFs->Meta.BlockSize;
+    close(descriptor);
+
+    if (writeResult != FS_WRITE_DATA_SUCCESSFUL)
+    {
+        printf("FsBuilderAddFile failed, couldn't import '%s', code %u (%s).\n", pHostPath, writeResult, FsWriteNodeDataResultToString(writeResult));
+        return false;
+    }
+
+    if (!FsEntryListAppend(&pBuilder->pDirectories[directory].Entries, nodeID, FS_NODE_TYPE_FILE, pPath + parentLength, length - parentLength))
+    {
+        printf("FsBuilderAddFile failed, couldn't add 'FS/%.*s' to its directory.\n", (int) length, pPath);
+        return false;
+    }
+
+    pBuilder->NumFiles++;
+    pBuilder->NumBytes += (uint64_t) info.st_size;
+    pBuilder->NumStoredBytes += storedBytes;
+    return true;
+}
+
+bool FsBuilderAddSoftLink(FsImageBuilder* pBuilder, const char* pImagePath, const char* pTarget)
+{
+    size_t length;
+    const char* pPath = FsiBuilderNormalize(pImagePath, &length);
+    if (!pPath || !length)
+    {
+        printf("FsBuilderAddSoftLink failed, '%s' isn't a valid path for a soft link.\n", pImagePath);
+        return false;
+    }
+
+    size_t parentLength;
+    uint64_t directory = FsiBuilderParent(pBuilder, pPath, length, &parentLength);
+    if (directory == FS_BUILDER_NOT_FOUND)
+    {
+        return false;
+    }
+
+    nodeid_t nodeID = FsiBuilderMakeNode(pBuilder, FS_NODE_TYPE_SOFT_LINK, pBuilder->pDirectories[directory].NodeID);
+    if (nodeID == FS_NODE_ID_INVALID)
+    {
+        return false;
+    }
+
+    // The data of a soft link is the path it points to, without a terminator.
+    uint64_t targetLength = strlen(pTarget);
+    FsNodeWriter writer;
+    write_node_data_result_t writeResult = FsOpenNodeWriter(pBuilder->pFs, nodeID, &writer);
+    if (writeResult == FS_WRITE_DATA_SUCCESSFUL)
+    {
+        FsNodeWriterAppend(&writer, pTarget, targetLength);
+        writeResult = FsCloseNodeWriter(&writer);
+    }
+    if (writeResult != FS_WRITE_DATA_SUCCESSFUL)
+    {
+        printf("FsBuilderAddSoftLink failed, couldn't write the target of 'FS/%.*s', code %u (%s).\n", (int) length, pPath, writeResult, FsWriteNodeDataResultToString(writeResult));
+        return false;
+    }
+
+    if (!FsEntryListAppend(&pBuilder->pDirectories[directory].Entries, nodeID, FS_NODE_TYPE_SOFT_LINK, pPath + parentLength, length - parentLength))
+    {
+        printf("FsBuilderAddSoftLink failed, couldn't add 'FS/%.*s' to its directory.\n", (int) length, pPath);
+        return false;
+    }
+
+    pBuilder->NumFiles++;
+    pBuilder->NumBytes += targetLength;
+    pBuilder->NumStoredBytes += FS_MIN(targetLength, FS_NODE_INLINE_DATA_SIZE) + writer.StoredBlocks * pBuilder->pFs->Meta.BlockSize;
+    return true;
+}
+
+static int FsiBuilderFilterDots(const struct dirent* pEntry)
+{
+    return strcmp(pEntry->d_name, ".") != 0 && strcmp(pEntry->d_name, "..") != 0;
+}
+
+// Imports the soft link at pHostPath as it is, the target isn't followed.
+static bool FsiBuilderAddHostLink(FsImageBuilder* pBuilder, const char* pImagePath, const char* pHostPath)
+{
+    char target[PATH_MAX];
+    ssize_t targetLength = readlink(pHostPath, target, sizeof(target) - 1);
+    if (targetLength < 0)
+    {
+        printf("FsBuilderAddHostTree failed, couldn't read the soft link '%s' (%s).\n", pHostPath, strerror(errno));
+        return false;
+    }
+    target[targetLength] = '\0';
+
+    return FsBuilderAddSoftLink(pBuilder, pImagePath, target);
+}
+
+bool FsBuilderAddHostTree(FsImageBuilder* pBuilder, const char* pHostDirectory, const char* pImageDirectory)
+{
+    size_t imageLength;
+    const char* pImage = FsiBuilderNormalize(pImageDirectory, &imageLength);
+    if (!pImage || FsiBuilderDirectory(pBuilder, pImage, imageLength) == FS_BUILDER_NOT_FOUND)
+    {
+        return false;
+    }
+
+    // Sorted so the same tree always turns into the same image.
+    struct dirent** ppEntries;
+    int numEntries = scandir(pHostDirectory, &ppEntries, FsiBuilderFilterDots, alphasort);
+    if (numEntries < 0)
+    {
+        printf("FsBuilderAddHostTree failed, couldn't list '%s' (%s).\n", pHostDirectory, strerror(errno));
+        return false;
+    }
+
+    bool bResult = true;
+    for (int i = 0; i < numEntries; i++)
+    {
+        if (bResult)
+        {
+            char* pHostPath  = FsiBuilderJoin(pHostDirectory, strlen(pHostDirectory), ppEntries[i]->d_name);
+            char* pImagePath = FsiBuilderJoin(pImage, imageLength, ppEntries[i]->d_name);
+
+            struct stat info;
+            if (!pHostPath || !pImagePath)
+            {
+                bResult = false;
+            }
+            else if (lstat(pHostPath, &info) != 0)
+            {
+                printf("FsBuilderAddHostTree failed, couldn't stat '%s' (%s).\n", pHostPath, strerror(errno));
+                bResult = false;
+            }
+            else if (S_ISDIR(info.st_mode))
+            {
+                bResult = FsBuilderAddHostTree(pBuilder, pHostPath, pImagePath);
+            }
+            else if (S_ISREG(info.st_mode))
+            {
+                bResult = FsBuilderAddFile(pBuilder, pImagePath, pHostPath);
+            }
+            else if (S_ISLNK(info.st_mode))
+            {
+                bResult = FsiBuilderAddHostLink(pBuilder, pImagePath, pHostPath);
+            }
+            else
+            {
+                printf("FsBuilderAddHostTree skipping '%s', only regular files, directories and soft links are imported.\n", pHostPath);
+            }
+
+            free(pHostPath);
+            free(pImagePath);
+        }
+        free(ppEntries[i]);
+    }
+    free(ppEntries);
+
+    return bResult;
+}
+
+bool FsBuilderAddManifest(FsImageBuilder* pBuilder, const char* pManifestPath)
+{
+    FILE* pManifest = fopen(pManifestPath, "r");
+    if (!pManifest)
+    {
+        printf("FsBuilderAddManifest failed, couldn't open manifest '%s'.\n", pManifestPath);
+        return false;
+    }
+
+    // Relative host paths are relative to the manifest itself, not to wherever the tool runs from.
+    const char* pSlash = strrchr(pManifestPath, '/');
+    size_t baseLength = pSlash ? (size_t) (pSlash - pManifestPath) : 0;
+
+    bool bResult = true;
+    char* pLine = NULL;
+    size_t lineCapacity = 0;
+    uint64_t lineNumber = 0;
+    ssize_t lineLength;
+    while (bResult && (lineLength = getline(&pLine, &lineCapacity, pManifest)) >= 0)
+    {
+        lineNumber++;
+        while (lineLength && (pLine[lineLength - 1] == '\n' || pLine[lineLength - 1] == '\r' || pLine[lineLength - 1] == ' ' || pLine[lineLength - 1] == '\t'))
+        {
+            pLine[--lineLength] = '\0';
+        }
+
+        char* pImagePath = pLine + strspn(pLine, " \t");
+        if (*pImagePath == '\0' || *pImagePath == '#')
+        {
+            continue;
+        }
+
+        char* pHostPath = pImagePath + strcspn(pImagePath, " \t");
+        if (*pHostPath)
+        {
+            *pHostPath++ = '\0';
+            pHostPath += strspn(pHostPath, " \t");
+        }
+
+        if (!*pHostPath)
+        {
+            bResult = FsBuilderAddDirectory(pBuilder, pImagePath);
+        }
+        else
+        {
+            char* pResolved = *pHostPath == '/' ? strdup(pHostPath) : FsiBuilderJoin(pManifestPath, baseLength, pHostPath);
+
+            struct stat info;
+            if (!pResolved)
+            {
+                bResult = false;
+            }
+            else if (stat(pResolved, &info) != 0)
+            {
+                printf("FsBuilderAddManifest failed, couldn't stat '%s' (%s).\n", pResolved, strerror(errno));
+                bResult = false;
+            }
+            else
+            {
+                bResult = S_ISDIR(info.st_mode) ? FsBuilderAddHostTree(pBuilder, pResolved, pImagePath)
+                                                : FsBuilderAddFile(pBuilder, pImagePath, pResolved);
+            }
+            free(pResolved);
+        }
+
+        if (!bResult)
+        {
+            printf("FsBuilderAddManifest failed on line %lu of '%s'.\n", lineNumber, pManifestPath);
+        }
+    }
+
+    free(pLine);
+    fclose(pManifest);
+    return bResult;
+}
+
+bool FsBuilderFinish(FsImageBuilder* pBuilder)
+{
+    bool bResult = true;
+    if (pBuilder->pPool)
+    {
+        bResult = FsiBuilderReap(pBuilder, 0);
+        FsiBuilderStopPool(pBuilder->pPool);
+        pBuilder->pPool = NULL;
+    }
+
+    for (uint64_t i = 0; i < pBuilder->NumDirectories; i++)
+    {
+        build_directory_t* pDirectory = &pBuilder->pDirectories[i];
+        if (bResult && pDirectory->Entries.Size)
+        {
+            register_node_result_t result = FsWriteDirectory(pBuilder->pFs, pDirectory->NodeID, &pDirectory->Entries);
+            if (result != FS_REGISTER_NODE_SUCCESSFUL)
+            {
+                printf("FsBuilderFinish failed, couldn't write directory 'FS/%s', code %u (%s).\n", pDirectory->pPath, result, FsRegisterNodeResultToString(result));
+                bResult = false;
+            }
+        }
+
+        FsEntryListRelease(&pDirectory->Entries);
+        free(pDirectory->pPath);
+    }
+
+    free(pBuilder->pDirectories);
+    pBuilder->pDirectories   = NULL;
+    pBuilder->NumDirectories = 0;
+
+    if (!FsEndBatch(pBuilder->pFs))
+    {
+        puts("FsBuilderFinish failed, couldn't commit the file system.");
+        bResult = false;
+    }
+
+    return bResult;
+}
@@ -0,0 +1,76 @@
+/**
+ * Header for populating a file system with many host files in one session.
+ */
+
+#ifndef MYTH_BUILDER_H
+#define MYTH_BUILDER_H
+
+#include "FileSystem.h"
+#include "Directory.h"
+#include "Disk.h"
+
+#include <stdbool.h>
+
+typedef struct
+{
+    char*       pPath;   // Image path relative to the root, without the "FS/" prefix and trailing slash. "" for the root.
+    nodeid_t    NodeID;
+    FsEntryList Entries; // Written into the directory node by FsBuilderFinish.
+} build_directory_t;
+
+// Worker threads of a parallel build, private to Builder.c.
+typedef struct FsBuildPool FsBuildPool;
+
+/**
+ * Imports files and directories into a loaded file system. Directory contents are collected in memory and each
+ * directory node is written exactly once by FsBuilderFinish, the whole build happens within a single batch so the
+ * bitmap and the metadata are committed once at the very end.
+ *
+ * With more than one thread the data of the files is read and written by a pool of workers. The calling thread still
+ * does every allocation and every metadata update: it reserves the blocks of a file within the region of the data area
+ * assigned to the least busy worker, hands the worker the copy and only writes the node once the copy is done, so data
+ * always reaches the disk before the node pointing at it. Each worker fills its own run of blocks, the writes of
+ * different workers never interleave within a region.
+ *
+ * A compressing build creates every file with FS_NODE_FLAG_COMPRESSED. The workers pack the clusters as they copy, a
+ * file gets the blocks of its uncompressed size reserved and those its clusters didn't need are freed once it is done.
+ */
+typedef struct
+{
+    FileSystemOnDisk*  pFs;
+    build_directory_t* pDirectories;
+    uint64_t           NumDirectories;
+    uint64_t           MaxDirectories;
+    uint64_t           LastDirectory; // Index of the directory most recently looked up, consecutive files usually share it.
+    uint64_t           NumFiles;
+    uint64_t           NumBytes;
+    uint64_t           NumStoredBytes; // What NumBytes take within the image, inline sections and data blocks.
+    uint32_t           NumThreads;
+    bool               bCompress;
+    FsBuildPool*       pPool;         // NULL when everything is done on the calling thread.
+} FsImageBuilder;
+
+// Opens a batch on pFs. The root directory must already exist and be empty. numThreads workers copy file data, 0 starts
+// one per online processor and 1 imports everything on the calling thread. bCompress compresses the data of every file,
+// it needs a file system of FS_REVISION_COMPRESSION or later.
+bool FsBuilderInit(FsImageBuilder* pBuilder, FileSystemOnDisk* pFs, uint32_t numThreads, bool bCompress);
+
+// Paths inside the image may start with "FS/", they are relative to the root either way. Missing parent directories are created.
+bool FsBuilderAddDirectory(FsImageBuilder* pBuilder, const char* pImagePath);
+bool FsBuilderAddFile(FsImageBuilder* pBuilder, const char* pImagePath, const char* pHostPath);
+// Creates a soft link node pointing at pTarget, which is stored as it is and never resolved.
+bool FsBuilderAddSoftLink(FsImageBuilder* pBuilder, const char* pImagePath, const char* pTarget);
+
+// Imports everything below pHostDirectory into pImageDirectory, entries of each directory are imported in name order.
+// Soft links are imported as soft links, neither the directories nor the files they point to are followed.
+bool FsBuilderAddHostTree(FsImageBuilder* pBuilder, const char* pHostDirectory, const char* pImageDirectory);
+
+// Imports what a manifest lists. Each line holds an image path and, separated by whitespace, the host path to import
+// there. A line without a host path creates a directory, a host path naming a directory imports the whole tree.
+// Empty lines and lines starting with '#' are skipped.
+bool FsBuilderAddManifest(FsImageBuilder* pBuilder, const char* pManifestPath);
+
+// Writes every directory, ends the batch and frees the builder. Must be called even after a failure.
+bool FsBuilderFinish(FsImageBuilder* pBuilder);
+
+#endif // !MYTH_BUILDER_H
@@ -0,0 +1,74 @@
+#include "Compression.h"
+
+#include "BlockMap.h"
+#include "Utils/BitScan.h"
+#include "Utils/Lz.h"
+#include "Utils/Math.h"
+
+#include <string.h>
+
+bool FsHasCompression(const FsMeta* pMeta)
+{
+    return pMeta->Revision >= FS_REVISION_COMPRESSION;
+}
+
+bool FsNodeIsCompressed(const FsMeta* pMeta, const FsNode* pNode)
+{
+    return FsHasCompression(pMeta) && FsNodeMayHaveHoles(pMeta, pNode) && (pNode->Flags & FS_NODE_FLAG_COMPRESSED);
+}
+
+uint64_t FsClusterBlocks(const FsMeta* pMeta)
+{
+    return FS_MAX(FS_CLUSTER_SIZE / pMeta->BlockSize, 1);
+}
+
+uint64_t FsPackCluster(uint16_t blockSize, const uint8_t* pData, uint64_t size, uint8_t* pPacked)
+{
+    uint64_t numBlocks = FS_DIV(size, blockSize);
+    if (BitScanIsZero(pData, size))
+    {
+        return 0;
+    }
+    // Compressing only pays off when it saves a whole block.
+    if (numBlocks < 2)
+    {
+        return numBlocks;
+    }
+
+    FsClusterHeader header;
+    size_t capacity = (numBlocks - 1) * blockSize - sizeof(FsClusterHeader);
+    header.PackedSize = (uint32_t) LzCompress(pData, size, pPacked + sizeof(FsClusterHeader), capacity);
+    if (!header.PackedSize)
+    {
+        return numBlocks;
+    }
+
+    uint64_t used      = sizeof(FsClusterHeader) + header.PackedSize;
+    uint64_t numPacked = FS_DIV(used, blockSize);
+    memcpy(pPacked, &header, sizeof(FsClusterHeader));
+    memset(pPacked + used, 0, numPacked * blockSize - used);
+    return numPacked;
+}
+
+bool FsUnpackCluster(uint16_t blockSize, const uint8_t* pStored, uint64_t numStored, uint8_t* pDest, uint64_t size)
+{
+    if (!numStored)
+    {
+        memset(pDest, 0, size);
+        return true;
+    }
+    if (numStored >= FS_DIV(size, blockSize))
+    {
+        memcpy(pDest, pStored, size);
+        return true;
+    }
+
+    FsClusterHeader header;
+    memcpy(&header, pStored, sizeof(FsClusterHeader));
+    if (header.PackedSize > numStored * blockSize - sizeof(FsClusterHeader))
+    {
+        return false;
+    }
+
+    return LzDecompress(pStored + sizeof(FsClusterHeader), header.PackedSize, pDest, size);
+}
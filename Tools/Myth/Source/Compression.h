@@ -0,0 +1,33 @@
+/**
+ * Header for compressed node data, see FS_NODE_FLAG_COMPRESSED and FsClusterHeader for the layout.
+ *
+ * Only the forms a cluster is stored in live here, the node writer and reader and the image builder decide when a
+ * cluster is packed or unpacked. Clusters are independent of each other, so workers may pack different clusters at once.
+ */
+
+#ifndef MYTH_COMPRESSION_H
+#define MYTH_COMPRESSION_H
+
+#include "FileSystem.h"
+
+#include <stdbool.h>
+
+// Whether the revision of pMeta allows compressed nodes.
+bool FsHasCompression(const FsMeta* pMeta);
+
+// Whether the data of pNode is stored in compressed clusters, only file nodes that may have holes can be.
+bool FsNodeIsCompressed(const FsMeta* pMeta, const FsNode* pNode);
+
+// Data blocks of a whole cluster.
+uint64_t FsClusterBlocks(const FsMeta* pMeta);
+
+// Packs size bytes of one cluster, size is below a whole cluster only for the last one. Returns how many blocks the
+// cluster takes: 0 when it is all zeroes, FS_DIV(size, blockSize) when it is stored as is, anything in between when
+// pPacked received that many blocks of header and compressed data, zero padded. pPacked holds a whole cluster.
+uint64_t FsPackCluster(uint16_t blockSize, const uint8_t* pData, uint64_t size, uint8_t* pPacked);
+
+// Restores size bytes of a cluster into pDest from the numStored blocks present at its start, read into pStored.
+// Returns false when the compressed data is corrupt.
+bool FsUnpackCluster(uint16_t blockSize, const uint8_t* pStored, uint64_t numStored, uint8_t* pDest, uint64_t size);
+
+#endif // !MYTH_COMPRESSION_H
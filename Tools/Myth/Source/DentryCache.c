@@ -0,0 +1,221 @@
+#include "DentryCache.h"
+
+#include "Directory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t FsiDentryHash(nodeid_t parentID, const char* pName, uint8_t nameLength)
+{
+    return FsHashName(pName, nameLength) ^ (uint32_t) ((parentID * UINT64_C(0x9E3779B97F4A7C15)) >> 32);
+}
+
+static void FsiDentryLruUnlink(FsDentryCache* pCache, uint32_t index)
+{
+    FsDentry* pEntry = &pCache->pEntries[index];
+
+    if (pEntry->Prev != FS_DENTRY_CACHE_NONE) pCache->pEntries[pEntry->Prev].Next = pEntry->Next;
+    else                                      pCache->LruHead = pEntry->Next;
+    if (pEntry->Next != FS_DENTRY_CACHE_NONE) pCache->pEntries[pEntry->Next].Prev = pEntry->Prev;
+    else                                      pCache->LruTail = pEntry->Prev;
+
+    pEntry->Prev = pEntry->Next = FS_DENTRY_CACHE_NONE;
+}
+
+static void FsiDentryLruPushHead(FsDentryCache* pCache, uint32_t index)
+{
+    FsDentry* pEntry = &pCache->pEntries[index];
+
+    pEntry->Prev = FS_DENTRY_CACHE_NONE;
+    pEntry->Next = pCache->LruHead;
+    if (pCache->LruHead != FS_DENTRY_CACHE_NONE) pCache->pEntries[pCache->LruHead].Prev = index;
+    else                                         pCache->LruTail = index;
+    pCache->LruHead = index;
+}
+
+static void FsiDentryLruPushTail(FsDentryCache* pCache, uint32_t index)
+{
+    FsDentry* pEntry = &pCache->pEntries[index];
+
+    pEntry->Next = FS_DENTRY_CACHE_NONE;
+    pEntry->Prev = pCache->LruTail;
+    if (pCache->LruTail != FS_DENTRY_CACHE_NONE) pCache->pEntries[pCache->LruTail].Next = index;
+    else                                         pCache->LruHead = index;
+    pCache->LruTail = index;
+}
+
+static uint32_t FsiDentryFind(const FsDentryCache* pCache, uint32_t hash, nodeid_t parentID, const char* pName, uint8_t nameLength)
+{
+    uint32_t index = pCache->pBuckets[hash & pCache->BucketMask];
+    while (index != FS_DENTRY_CACHE_NONE)
+    {
+        const FsDentry* pEntry = &pCache->pEntries[index];
+        if (pEntry->Hash == hash && pEntry->ParentID == parentID && pEntry->NameLength == nameLength &&
+            memcmp(pEntry->Name, pName, nameLength) == 0)
+        {
+            break;
+        }
+        index = pEntry->HashNext;
+    }
+    return index;
+}
+
+// Unhooks the entry from its bucket and moves it to the LRU tail so it is reused first.
+static void FsiDentryRemove(FsDentryCache* pCache, uint32_t index)
+{
+    FsDentry* pEntry = &pCache->pEntries[index];
+
+    uint32_t* pLink = &pCache->pBuckets[pEntry->Hash & pCache->BucketMask];
+    while (*pLink != index)
+    {
+        pLink = &pCache->pEntries[*pLink].HashNext;
+    }
+    *pLink = pEntry->HashNext;
+
+    pEntry->HashNext = FS_DENTRY_CACHE_NONE;
+    pEntry->ParentID = FS_NODE_ID_INVALID;
+
+    FsiDentryLruUnlink(pCache, index);
+    FsiDentryLruPushTail(pCache, index);
+}
+
+bool FsDentryCacheInit(FsDentryCache* pCache, uint32_t capacity)
+{
+    memset(pCache, 0, sizeof(FsDentryCache));
+
+    if (capacity == 0)
+    {
+        capacity = FS_DENTRY_CACHE_DEFAULT_ENTRIES;
+    }
+    if (capacity < FS_DENTRY_CACHE_MINIMUM_ENTRIES)
+    {
+        capacity = FS_DENTRY_CACHE_MINIMUM_ENTRIES;
+    }
+
+    uint32_t numBuckets = 1;
+    while (numBuckets < capacity * 2)
+    {
+        numBuckets <<= 1;
+    }
+
+    pCache->Capacity   = capacity;
+    pCache->BucketMask = numBuckets - 1;
+    pCache->pEntries   = calloc(capacity, sizeof(FsDentry));
+    pCache->pBuckets   = malloc(numBuckets * sizeof(uint32_t));
+    if (!pCache->pEntries || !pCache->pBuckets)
+    {
+        printf("FsDentryCacheInit failed, couldn't allocate a cache of %u entries.\n", capacity);
+        FsDentryCacheRelease(pCache);
+        return false;
+    }
+
+    memset(pCache->pBuckets, 0xFF, numBuckets * sizeof(uint32_t));
+
+    pCache->LruHead = pCache->LruTail = FS_DENTRY_CACHE_NONE;
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        pCache->pEntries[i].HashNext = FS_DENTRY_CACHE_NONE;
+        FsiDentryLruPushTail(pCache, i);
+    }
+
+    return true;
+}
+
+void FsDentryCacheRelease(FsDentryCache* pCache)
+{
+    free(pCache->pEntries);
+    free(pCache->pBuckets);
+    memset(pCache, 0, sizeof(FsDentryCache));
+}
+
+const FsDentry* FsDentryCacheLookup(FsDentryCache* pCache, nodeid_t parentID, const char* pName, uint8_t nameLength)
+{
+    if (!pCache->pEntries)
+    {
+        return NULL;
+    }
+
+    uint32_t index = FsiDentryFind(pCache, FsiDentryHash(parentID, pName, nameLength), parentID, pName, nameLength);
+    if (index == FS_DENTRY_CACHE_NONE)
+    {
+        pCache->Misses++;
+        return NULL;
+    }
+
+    FsiDentryLruUnlink(pCache, index);
+    FsiDentryLruPushHead(pCache, index);
+
+    const FsDentry* pEntry = &pCache->pEntries[index];
+    pCache->Hits++;
+    if (pEntry->NodeID == FS_NODE_ID_INVALID)
+    {
+        pCache->NegativeHits++;
+    }
+    return pEntry;
+}
+
+void FsDentryCacheInsert(FsDentryCache* pCache, nodeid_t parentID, const char* pName, uint8_t nameLength, nodeid_t nodeID, uint16_t nodeType)
+{
+    if (!pCache->pEntries)
+    {
+        return;
+    }
+
+    uint32_t hash  = FsiDentryHash(parentID, pName, nameLength);
+    uint32_t index = FsiDentryFind(pCache, hash, parentID, pName, nameLength);
+    if (index == FS_DENTRY_CACHE_NONE)
+    {
+        index = pCache->LruTail;
+        if (pCache->pEntries[index].ParentID != FS_NODE_ID_INVALID)
+        {
+            FsiDentryRemove(pCache, index);
+            pCache->Evictions++;
+        }
+
+        FsDentry* pEntry = &pCache->pEntries[index];
+        pEntry->ParentID   = parentID;
+        pEntry->NameLength = nameLength;
+        pEntry->Hash       = hash;
+        memcpy(pEntry->Name, pName, nameLength);
+
+        pEntry->HashNext = pCache->pBuckets[hash & pCache->BucketMask];
+        pCache->pBuckets[hash & pCache->BucketMask] = index;
+    }
+
+    pCache->pEntries[index].NodeID   = nodeID;
+    pCache->pEntries[index].NodeType = nodeType;
+
+    FsiDentryLruUnlink(pCache, index);
+    FsiDentryLruPushHead(pCache, index);
+}
+
+void FsDentryCacheInvalidate(FsDentryCache* pCache, nodeid_t parentID, const char* pName, uint8_t nameLength)
+{
+    if (!pCache->pEntries)
+    {
+        return;
+    }
+
+    uint32_t index = FsiDentryFind(pCache, FsiDentryHash(parentID, pName, nameLength), parentID, pName, nameLength);
+    if (index != FS_DENTRY_CACHE_NONE)
+    {
+        FsiDentryRemove(pCache, index);
+    }
+}
+
+void FsDentryCacheInvalidateDirectory(FsDentryCache* pCache, nodeid_t parentID)
+{
+    if (parentID == FS_NODE_ID_INVALID)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < pCache->Capacity; i++)
+    {
+        if (pCache->pEntries[i].ParentID == parentID)
+        {
+            FsiDentryRemove(pCache, i);
+        }
+    }
+}
@@ -0,0 +1,64 @@
+/**
+ * Header for the dentry cache, remembering which node a name within a directory resolves to.
+ */
+
+#ifndef MYTH_DENTRY_CACHE_H
+#define MYTH_DENTRY_CACHE_H
+
+#include "FileSystem.h"
+
+#include <stdbool.h>
+
+#define FS_DENTRY_CACHE_DEFAULT_ENTRIES UINT32_C(4096)
+#define FS_DENTRY_CACHE_MINIMUM_ENTRIES UINT32_C(16)
+
+#define FS_DENTRY_CACHE_NONE UINT32_MAX
+
+/** One name within one directory, either the node it resolves to or the fact that it doesn't exist. */
+typedef struct
+{
+    nodeid_t ParentID;   // Directory holding the name, FS_NODE_ID_INVALID while the entry is unused.
+    nodeid_t NodeID;     // FS_NODE_ID_INVALID for a negative entry, the directory is known not to hold the name.
+    uint16_t NodeType;
+    uint8_t  NameLength;
+    uint32_t Hash;
+    uint32_t Prev;       // Neighbours within the LRU list, every entry is linked into it.
+    uint32_t Next;
+    uint32_t HashNext;   // Next entry within the same hash bucket.
+    char     Name[UINT8_MAX]; // Not null terminated, NameLength is a single byte.
+} FsDentry;
+
+/**
+ * Fixed-size cache of directory lookups with least recently used eviction, keyed by directory and name through a
+ * chained hash table. It holds no references to disk blocks, it only has to be told when a directory changes.
+ */
+typedef struct
+{
+    FsDentry* pEntries;
+    uint32_t  Capacity;
+    uint32_t* pBuckets;
+    uint32_t  BucketMask; // Number of buckets minus one, the bucket count is a power of two.
+    uint32_t  LruHead;    // Most recently used entry.
+    uint32_t  LruTail;    // Eviction candidate, unused entries are kept at the tail.
+
+    uint64_t  Hits;
+    uint64_t  NegativeHits; // Hits on negative entries, included in Hits.
+    uint64_t  Misses;
+    uint64_t  Evictions;
+} FsDentryCache;
+
+// Sets up a cache of `capacity` entries, FS_DENTRY_CACHE_DEFAULT_ENTRIES when 0.
+bool FsDentryCacheInit(FsDentryCache* pCache, uint32_t capacity);
+void FsDentryCacheRelease(FsDentryCache* pCache);
+
+// The cached entry for the name within the directory, NULL on a miss. Valid until the cache is changed.
+const FsDentry* FsDentryCacheLookup(FsDentryCache* pCache, nodeid_t parentID, const char* pName, uint8_t nameLength);
+// Remembers what the name resolves to, nodeID FS_NODE_ID_INVALID records that it doesn't exist.
+void FsDentryCacheInsert(FsDentryCache* pCache, nodeid_t parentID, const char* pName, uint8_t nameLength, nodeid_t nodeID, uint16_t nodeType);
+
+// Forgets a single name, called whenever it is registered into or removed from the directory.
+void FsDentryCacheInvalidate(FsDentryCache* pCache, nodeid_t parentID, const char* pName, uint8_t nameLength);
+// Forgets every name within the directory, called when its contents are replaced as a whole.
+void FsDentryCacheInvalidateDirectory(FsDentryCache* pCache, nodeid_t parentID);
+
+#endif // !MYTH_DENTRY_CACHE_H
@@ -0,0 +1,438 @@
+#define _GNU_SOURCE // copy_file_range, fallocate
+
+#include "Device.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+static bool FsiDeviceInRange(FsDevice* pDevice, uint64_t offset, uint64_t size)
+{
+    return offset <= pDevice->Size && size <= pDevice->Size - offset;
+}
+
+/** Positional I/O backend */
+
+static bool FsiPioRead(FsDevice* pDevice, uint64_t offset, void* pDest, uint64_t size)
+{
+    uint8_t* pBytes = (uint8_t*) pDest;
+    while (size)
+    {
+        ssize_t numRead = pread(pDevice->Descriptor, pBytes, size, (off_t) offset);
+        if (numRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (numRead <= 0)
+        {
+            return false;
+        }
+
+        pBytes += numRead;
+        offset += numRead;
+        size   -= numRead;
+    }
+
+    return true;
+}
+
+static bool FsiPioWrite(FsDevice* pDevice, uint64_t offset, const void* pSource, uint64_t size)
+{
+    const uint8_t* pBytes = (const uint8_t*) pSource;
+    while (size)
+    {
+        ssize_t numWritten = pwrite(pDevice->Descriptor, pBytes, size, (off_t) offset);
+        if (numWritten < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (numWritten <= 0)
+        {
+            return false;
+        }
+
+        pBytes += numWritten;
+        offset += numWritten;
+        size   -= numWritten;
+    }
+
+    return true;
+}
+
+static bool FsiPioResize(FsDevice* pDevice, uint64_t size)
+{
+    if (ftruncate(pDevice->Descriptor, (off_t) size) != 0)
+    {
+        return false;
+    }
+
+    pDevice->Size = size;
+    return true;
+}
+
+static bool FsiPioSync(FsDevice* pDevice)
+{
+    return fsync(pDevice->Descriptor) == 0;
+}
+
+static void FsiPioReadahead(FsDevice* pDevice, uint64_t offset, uint64_t size)
+{
+    posix_fadvise(pDevice->Descriptor, (off_t) offset, (off_t) size, POSIX_FADV_WILLNEED);
+}
+
+static void FsiPioClose(FsDevice* pDevice)
+{
+    close(pDevice->Descriptor);
+}
+
+static const FsDeviceOps FsiPioDeviceOps =
+{
+    .pName     = "pread/pwrite",
+    .Read      = FsiPioRead,
+    .Write     = FsiPioWrite,
+    .Resize    = FsiPioResize,
+    .Sync      = FsiPioSync,
+    .Readahead = FsiPioReadahead,
+    .Close     = FsiPioClose
+};
+
+/** Memory mapped backend */
+
+static bool FsiMmapMap(FsDevice* pDevice)
+{
+    int protection = PROT_READ | (pDevice->bWritable ? PROT_WRITE : 0);
+    void* pMapping = mmap(NULL, pDevice->Size, protection, MAP_SHARED, pDevice->Descriptor, 0);
+    if (pMapping == MAP_FAILED)
+    {
+        pDevice->pMapping = NULL;
+        return false;
+    }
+
+    pDevice->pMapping = (uint8_t*) pMapping;
+    return true;
+}
+
+static bool FsiMmapRead(FsDevice* pDevice, uint64_t offset, void* pDest, uint64_t size)
+{
+    memcpy(pDest, pDevice->pMapping + offset, size);
+    return true;
+}
+
+static bool FsiMmapWrite(FsDevice* pDevice, uint64_t offset, const void* pSource, uint64_t size)
+{
+    memcpy(pDevice->pMapping + offset, pSource, size);
+    return true;
+}
+
+static bool FsiMmapResize(FsDevice* pDevice, uint64_t size)
+{
+    munmap(pDevice->pMapping, pDevice->Size);
+    pDevice->pMapping = NULL;
+
+    if (!FsiPioResize(pDevice, size))
+    {
+        return false;
+    }
+
+    return FsiMmapMap(pDevice);
+}
+
+static bool FsiMmapSync(FsDevice* pDevice)
+{
+    return msync(pDevice->pMapping, pDevice->Size, MS_SYNC) == 0 && fsync(pDevice->Descriptor) == 0;
+}
+
+static void FsiMmapReadahead(FsDevice* pDevice, uint64_t offset, uint64_t size)
+{
+    // madvise wants a page aligned start.
+    uint64_t pageSize = (uint64_t) sysconf(_SC_PAGESIZE);
+    uint64_t start = offset - offset % pageSize;
+    madvise(pDevice->pMapping + start, size + (offset - start), MADV_WILLNEED);
+}
+
+static void FsiMmapClose(FsDevice* pDevice)
+{
+    if (pDevice->pMapping)
+    {
+        munmap(pDevice->pMapping, pDevice->Size);
+    }
+    close(pDevice->Descriptor);
+}
+
+static const FsDeviceOps FsiMmapDeviceOps =
+{
+    .pName     = "mmap",
+    .Read      = FsiMmapRead,
+    .Write     = FsiMmapWrite,
+    .Resize    = FsiMmapResize,
+    .Sync      = FsiMmapSync,
+    .Readahead = FsiMmapReadahead,
+    .Close     = FsiMmapClose
+};
+
+FsDevice* FsOpenDevice(const char* pPath, bool bWritable, device_backend_t backend)
+{
+    FsDevice* pDevice = calloc(1, sizeof(FsDevice));
+    if (!pDevice)
+    {
+        puts("FsOpenDevice failed, couldn't allocate the device.");
+        return NULL;
+    }
+
+    pDevice->bWritable  = bWritable;
+    pDevice->Descriptor = open(pPath, bWritable ? O_RDWR : O_RDONLY);
+    if (pDevice->Descriptor < 0)
+    {
+        printf("FsOpenDevice failed, couldn't open '%s' (%s).\n", pPath, strerror(errno));
+        free(pDevice);
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(pDevice->Descriptor, &info) != 0)
+    {
+        printf("FsOpenDevice failed, couldn't stat '%s' (%s).\n", pPath, strerror(errno));
+        close(pDevice->Descriptor);
+        free(pDevice);
+        return NULL;
+    }
+
+    if (S_ISBLK(info.st_mode))
+    {
+        uint64_t size = 0;
+        ioctl(pDevice->Descriptor, BLKGETSIZE64, &size);
+        pDevice->Size = size;
+    }
+    else
+    {
+        pDevice->Size = (uint64_t) info.st_size;
+    }
+
+    if (backend == FS_DEVICE_BACKEND_AUTO)
+    {
+        backend = S_ISREG(info.st_mode) && pDevice->Size ? FS_DEVICE_BACKEND_MMAP : FS_DEVICE_BACKEND_PIO;
+    }
+
+    pDevice->pOps = &FsiPioDeviceOps;
+    if (backend == FS_DEVICE_BACKEND_MMAP)
+    {
+        if (!FsiMmapMap(pDevice))
+        {
+            printf("FsOpenDevice failed, couldn't map '%s' (%s).\n", pPath, strerror(errno));
+            close(pDevice->Descriptor);
+            free(pDevice);
+            return NULL;
+        }
+
+        pDevice->pOps = &FsiMmapDeviceOps;
+    }
+
+    return pDevice;
+}
+
+FsDevice* FsCreateDevice(const char* pPath, uint64_t size, device_backend_t backend)
+{
+    int descriptor = open(pPath, O_RDWR | O_CREAT, 0644);
+    if (descriptor < 0)
+    {
+        printf("FsCreateDevice failed, couldn't open or create '%s' (%s).\n", pPath, strerror(errno));
+        return NULL;
+    }
+
+    // Only the size of a regular file can be set, the size of a block device is checked once it is open.
+    struct stat info;
+    bool bSized = fstat(descriptor, &info) == 0 && (!S_ISREG(info.st_mode) || ftruncate(descriptor, (off_t) size) == 0);
+    if (!bSized)
+    {
+        printf("FsCreateDevice failed, couldn't set the size of '%s' to %lu bytes (%s).\n", pPath, size, strerror(errno));
+    }
+    close(descriptor);
+    if (!bSized)
+    {
+        return NULL;
+    }
+
+    FsDevice* pDevice = FsOpenDevice(pPath, true, backend);
+    if (pDevice && pDevice->Size < size)
+    {
+        printf("FsCreateDevice failed, '%s' only holds %lu bytes but %lu were asked for.\n", pPath, pDevice->Size, size);
+        FsCloseDevice(pDevice);
+        return NULL;
+    }
+    return pDevice;
+}
+
+void FsCloseDevice(FsDevice* pDevice)
+{
+    if (pDevice)
+    {
+        pDevice->pOps->Close(pDevice);
+        free(pDevice);
+    }
+}
+
+bool FsDeviceRead(FsDevice* pDevice, uint64_t offset, void* pDest, uint64_t size)
+{
+    return FsiDeviceInRange(pDevice, offset, size) && pDevice->pOps->Read(pDevice, offset, pDest, size);
+}
+
+bool FsDeviceWrite(FsDevice* pDevice, uint64_t offset, const void* pSource, uint64_t size)
+{
+    return pDevice->bWritable && FsiDeviceInRange(pDevice, offset, size) && pDevice->pOps->Write(pDevice, offset, pSource, size);
+}
+
+#define FS_DEVICE_COPY_BUFFER_SIZE (UINT64_C(1) << 20)
+
+bool FsDeviceZero(FsDevice* pDevice, uint64_t offset, uint64_t size)
+{
+    if (!pDevice->bWritable || !FsiDeviceInRange(pDevice, offset, size))
+    {
+        return false;
+    }
+    if (!size)
+    {
+        return true;
+    }
+
+    // Punched pages are dropped from the page cache too, a mapping of the range reads zeroes right away.
+    if (fallocate(pDevice->Descriptor, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t) offset, (off_t) size) == 0 ||
+        fallocate(pDevice->Descriptor, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, (off_t) offset, (off_t) size) == 0)
+    {
+        return true;
+    }
+
+    uint64_t chunkSize = size < FS_DEVICE_COPY_BUFFER_SIZE ? size : FS_DEVICE_COPY_BUFFER_SIZE;
+    uint8_t* pZeroes   = calloc(1, chunkSize);
+    if (!pZeroes)
+    {
+        puts("FsDeviceZero failed, couldn't allocate the zero buffer.");
+        return false;
+    }
+
+    bool bZeroed = true;
+    for (uint64_t done = 0; bZeroed && done < size; done += chunkSize)
+    {
+        bZeroed = pDevice->pOps->Write(pDevice, offset + done, pZeroes, size - done < chunkSize ? size - done : chunkSize);
+    }
+
+    free(pZeroes);
+    return bZeroed;
+}
+
+bool FsDeviceCopyFrom(FsDevice* pDevice, uint64_t offset, int sourceDescriptor, uint64_t sourceOffset, uint64_t size)
+{
+    if (!pDevice->bWritable || !FsiDeviceInRange(pDevice, offset, size))
+    {
+        return false;
+    }
+
+    loff_t in  = (loff_t) sourceOffset;
+    loff_t out = (loff_t) offset;
+
+    // Both ends are plain files most of the time, the kernel can then copy (or even reflink) without a userspace round trip.
+    while (size)
+    {
+        ssize_t numCopied = copy_file_range(sourceDescriptor, &in, pDevice->Descriptor, &out, size, 0);
+        if (numCopied < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (numCopied <= 0)
+        {
+            break;
+        }
+        size -= numCopied;
+    }
+
+    // Older kernels refuse copy_file_range across file systems, sendfile still avoids the copy through userspace.
+    if (size && lseek(pDevice->Descriptor, out, SEEK_SET) == out)
+    {
+        while (size)
+        {
+            ssize_t numSent = sendfile(pDevice->Descriptor, sourceDescriptor, &in, size);
+            if (numSent < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (numSent <= 0)
+            {
+                break;
+            }
+            out  += numSent;
+            size -= numSent;
+        }
+    }
+
+    if (!size)
+    {
+        return true;
+    }
+
+    uint8_t* pBuffer = malloc(FS_DEVICE_COPY_BUFFER_SIZE);
+    if (!pBuffer)
+    {
+        return false;
+    }
+
+    while (size)
+    {
+        uint64_t chunk = size < FS_DEVICE_COPY_BUFFER_SIZE ? size : FS_DEVICE_COPY_BUFFER_SIZE;
+        ssize_t numRead = pread(sourceDescriptor, pBuffer, chunk, in);
+        if (numRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (numRead <= 0 || !pDevice->pOps->Write(pDevice, (uint64_t) out, pBuffer, (uint64_t) numRead))
+        {
+            break;
+        }
+
+        in   += numRead;
+        out  += numRead;
+        size -= numRead;
+    }
+
+    free(pBuffer);
+    return size == 0;
+}
+
+bool FsDeviceResize(FsDevice* pDevice, uint64_t size)
+{
+    return pDevice->bWritable && pDevice->pOps->Resize(pDevice, size);
+}
+
+bool FsDeviceSync(FsDevice* pDevice)
+{
+    return pDevice->pOps->Sync(pDevice);
+}
+
+void FsDeviceReadahead(FsDevice* pDevice, uint64_t offset, uint64_t size)
+{
+    if (FsiDeviceInRange(pDevice, offset, size) && size)
+    {
+        pDevice->pOps->Readahead(pDevice, offset, size);
+    }
+}
+
+const void* FsDeviceView(FsDevice* pDevice, uint64_t offset, uint64_t size, void* pBuffer)
+{
+    if (!FsiDeviceInRange(pDevice, offset, size))
+    {
+        return NULL;
+    }
+    if (pDevice->pMapping)
+    {
+        return pDevice->pMapping + offset;
+    }
+
+    return pDevice->pOps->Read(pDevice, offset, pBuffer, size) ? pBuffer : NULL;
+}
@@ -0,0 +1,74 @@
+/**
+ * Header for the block device abstraction every disk access of Myth goes through.
+ */
+
+#ifndef MYTH_DEVICE_H
+#define MYTH_DEVICE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum
+{
+    FS_DEVICE_BACKEND_AUTO = 0, // Mapped for regular files, positional I/O for everything else.
+    FS_DEVICE_BACKEND_MMAP = 1, // The whole image is mapped into memory, reads and writes are plain memory accesses.
+    FS_DEVICE_BACKEND_PIO  = 2  // pread/pwrite on the descriptor, works on raw block devices.
+} device_backend_t;
+
+typedef struct FsDevice FsDevice;
+
+typedef struct
+{
+    const char* pName;
+    bool (*Read)(FsDevice* pDevice, uint64_t offset, void* pDest, uint64_t size);
+    bool (*Write)(FsDevice* pDevice, uint64_t offset, const void* pSource, uint64_t size);
+    bool (*Resize)(FsDevice* pDevice, uint64_t size);
+    bool (*Sync)(FsDevice* pDevice);
+    void (*Readahead)(FsDevice* pDevice, uint64_t offset, uint64_t size);
+    void (*Close)(FsDevice* pDevice);
+} FsDeviceOps;
+
+struct FsDevice
+{
+    const FsDeviceOps* pOps;
+    int                Descriptor;
+    uint64_t           Size;     // Size of the device in bytes.
+    uint8_t*           pMapping; // Start of the mapped device, NULL when the backend doesn't map it.
+    bool               bWritable;
+};
+
+// Opens the disk image or block device at pPath. Returns NULL on failure.
+FsDevice* FsOpenDevice(const char* pPath, bool bWritable, device_backend_t backend);
+// Opens the disk image at pPath for writing, creating it when it doesn't exist, and sets its size to size bytes.
+// Growing the file leaves a hole, nothing is written. Block devices are opened as they are, size must fit on them.
+FsDevice* FsCreateDevice(const char* pPath, uint64_t size, device_backend_t backend);
+void FsCloseDevice(FsDevice* pDevice);
+
+bool FsDeviceRead(FsDevice* pDevice, uint64_t offset, void* pDest, uint64_t size);
+bool FsDeviceWrite(FsDevice* pDevice, uint64_t offset, const void* pSource, uint64_t size);
+
+// Makes [offset, offset + size) read as zeroes. A hole is punched into regular files and block devices are asked to
+// zero the range on their own, so neither costs any writes. Zeroes are only written when both are unsupported.
+bool FsDeviceZero(FsDevice* pDevice, uint64_t offset, uint64_t size);
+
+// Copies size bytes starting at sourceOffset of the file behind sourceDescriptor to offset on the device.
+// The kernel moves the bytes on its own through copy_file_range or sendfile when it can, otherwise they are copied
+// through a bounded buffer. Either way memory use doesn't depend on size.
+bool FsDeviceCopyFrom(FsDevice* pDevice, uint64_t offset, int sourceDescriptor, uint64_t sourceOffset, uint64_t size);
+
+// Grows or shrinks the device, only possible for regular files.
+bool FsDeviceResize(FsDevice* pDevice, uint64_t size);
+
+// Flushes every write to stable storage.
+bool FsDeviceSync(FsDevice* pDevice);
+
+// Tells the kernel the range is going to be read soon so it can start fetching it in the background. Only a hint, it
+// may do nothing at all.
+void FsDeviceReadahead(FsDevice* pDevice, uint64_t offset, uint64_t size);
+
+// Gives access to [offset, offset + size) of the device. Mapped backends return a pointer straight into the mapping,
+// others read the range into pBuffer (which must hold size bytes) and return pBuffer. Returns NULL on failure.
+// The view is read-only, changes must go through FsDeviceWrite.
+const void* FsDeviceView(FsDevice* pDevice, uint64_t offset, uint64_t size, void* pBuffer);
+
+#endif // !MYTH_DEVICE_H
@@ -0,0 +1,1190 @@
+#include "Directory.h"
+
+#include "Node.h"
+#include "BlockMap.h"
+#include "Utils/Math.h"
+#include "Utils/BioTime.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory.h>
+
+// Deepest index the engine builds, the root plus one level of index blocks.
+#define FS_DIRECTORY_MAX_DEPTH 1
+
+#define DOCASE(x) case x: return #x
+
+const char* FsRegisterNodeResultToString(register_node_result_t result)
+{
+    switch (result)
+    {
+        DOCASE(FS_REGISTER_NODE_SUCCESSFUL);
+        DOCASE(FS_REGISTER_NODE_DIRECTORY_DOES_NOT_EXIST);
+        DOCASE(FS_REGISTER_NODE_DOES_NOT_EXIST);
+        DOCASE(FS_REGISTER_NODE_NOT_DIRECTORY);
+        DOCASE(FS_REGISTER_NODE_INVALID_NAME);
+        DOCASE(FS_REGISTER_NODE_NAME_EXISTS);
+        DOCASE(FS_REGISTER_NODE_NAME_NOT_FOUND);
+        DOCASE(FS_REGISTER_NODE_DIRECTORY_FULL);
+        DOCASE(FS_REGISTER_NODE_DISK_ERROR);
+    default: break;
+    }
+
+    return "((Invalid, Non-Standard Result))";
+}
+
+const char* FsLookupResultToString(lookup_result_t result)
+{
+    switch (result)
+    {
+        DOCASE(FS_LOOKUP_FOUND);
+        DOCASE(FS_LOOKUP_NOT_FOUND);
+        DOCASE(FS_LOOKUP_NOT_DIRECTORY);
+        DOCASE(FS_LOOKUP_DISK_ERROR);
+    default: break;
+    }
+
+    return "((Invalid, Non-Standard Result))";
+}
+
+const char* FsResolvePathResultToString(resolve_path_result_t result)
+{
+    switch (result)
+    {
+        DOCASE(FS_RESOLVE_PATH_FOUND);
+        DOCASE(FS_RESOLVE_PATH_NOT_FOUND);
+        DOCASE(FS_RESOLVE_PATH_NOT_DIRECTORY);
+        DOCASE(FS_RESOLVE_PATH_INVALID);
+        DOCASE(FS_RESOLVE_PATH_DISK_ERROR);
+    default: break;
+    }
+
+    return "((Invalid, Non-Standard Result))";
+}
+
+uint16_t FsEntrySizeFor(uint8_t nameLength)
+{
+    return (uint16_t) (FS_DIV(sizeof(FsEntry) + nameLength, 4) * 4);
+}
+
+const char* FsEntryName(const FsEntry* pEntry)
+{
+    return (const char*) pEntry + sizeof(FsEntry);
+}
+
+bool FsEntryListAppend(FsEntryList* pList, nodeid_t nodeID, uint16_t nodeType, const char* pName, size_t nameLength)
+{
+    if (nameLength == 0 || nameLength > FS_ENTRY_NAME_MAX)
+    {
+        printf("FsEntryListAppend failed, entry names must be 1 to " FS_STRINGIZE(FS_ENTRY_NAME_MAX) " bytes long but the name is %zu bytes.\n", nameLength);
+        return false;
+    }
+
+    uint16_t entrySize = FsEntrySizeFor((uint8_t) nameLength);
+    if (pList->Size + entrySize > pList->Capacity)
+    {
+        uint64_t capacity = FS_MAX(pList->Capacity * 2, FS_MAX(pList->Size + entrySize, UINT64_C(256)));
+        uint8_t* pData = realloc(pList->pData, capacity);
+        if (!pData)
+        {
+            puts("FsEntryListAppend failed, couldn't grow the entry list.");
+            return false;
+        }
+        pList->pData    = pData;
+        pList->Capacity = capacity;
+    }
+
+    FsEntry* pEntry = (FsEntry*) (pList->pData + pList->Size);
+    memset(pEntry, 0, entrySize);
+    pEntry->NodeID     = nodeID;
+    pEntry->NodeType   = nodeType;
+    pEntry->EntrySize  = entrySize;
+    pEntry->NameLength = (uint8_t) nameLength;
+    memcpy((char*) pEntry + sizeof(FsEntry), pName, nameLength);
+
+    pList->Size += entrySize;
+    pList->NumEntries++;
+    return true;
+}
+
+void FsEntryListRelease(FsEntryList* pList)
+{
+    free(pList->pData);
+    memset(pList, 0, sizeof(FsEntryList));
+}
+
+uint32_t FsHashName(const char* pName, size_t nameLength)
+{
+    // FNV-1a followed by a finalizer, so the high bits that decide which leaf a name lands in depend on every byte.
+    uint32_t hash = UINT32_C(2166136261);
+    for (size_t i = 0; i < nameLength; i++)
+    {
+        hash ^= (uint8_t) pName[i];
+        hash *= UINT32_C(16777619);
+    }
+
+    hash ^= hash >> 16;
+    hash *= UINT32_C(0x85EBCA6B);
+    hash ^= hash >> 13;
+    hash *= UINT32_C(0xC2B2AE35);
+    hash ^= hash >> 16;
+    return hash;
+}
+
+typedef struct
+{
+    uint32_t       Hash;
+    const FsEntry* pEntry;
+} hashed_entry_t;
+
+static bool FsiValidName(const char* pName, size_t nameLength)
+{
+    return nameLength && nameLength <= FS_ENTRY_NAME_MAX && !memchr(pName, '/', nameLength) && !memchr(pName, '\0', nameLength);
+}
+
+static bool FsiNamesEqual(const FsEntry* pEntry, const char* pName, size_t nameLength)
+{
+    return pEntry->NameLength == nameLength && memcmp(FsEntryName(pEntry), pName, nameLength) == 0;
+}
+
+// Next entry of a serialized list, NULL at the end of it or when the entry at *pOffset is malformed.
+static const FsEntry* FsiNextEntry(const uint8_t* pData, uint64_t size, uint64_t* pOffset)
+{
+    if (*pOffset + sizeof(FsEntry) > size)
+    {
+        return NULL;
+    }
+
+    const FsEntry* pEntry = (const FsEntry*) (pData + *pOffset);
+    if (pEntry->EntrySize < sizeof(FsEntry) + pEntry->NameLength || *pOffset + pEntry->EntrySize > size)
+    {
+        return NULL;
+    }
+
+    *pOffset += pEntry->EntrySize;
+    return pEntry;
+}
+
+static int FsiCompareHashedEntries(const void* pLeft, const void* pRight)
+{
+    const hashed_entry_t* pL = (const hashed_entry_t*) pLeft;
+    const hashed_entry_t* pR = (const hashed_entry_t*) pRight;
+    if (pL->Hash != pR->Hash)
+    {
+        return pL->Hash < pR->Hash ? -1 : 1;
+    }
+
+    int order = memcmp(FsEntryName(pL->pEntry), FsEntryName(pR->pEntry), FS_MIN(pL->pEntry->NameLength, pR->pEntry->NameLength));
+    return order ? order : (int) pL->pEntry->NameLength - (int) pR->pEntry->NameLength;
+}
+
+// Hashes every entry of a serialized list and sorts them by hash, equal names end up next to each other.
+static register_node_result_t FsiSortEntries(const uint8_t* pData, uint64_t size, hashed_entry_t** ppSorted, uint64_t* pCount)
+{
+    uint64_t count = 0, offset = 0;
+    while (FsiNextEntry(pData, size, &offset))
+    {
+        count++;
+    }
+    if (offset != size)
+    {
+        printf("FsWriteDirectory failed, the entry at byte %lu of the list is malformed.\n", offset);
+        return FS_REGISTER_NODE_INVALID_NAME;
+    }
+
+    hashed_entry_t* pSorted = malloc(FS_MAX(count, UINT64_C(1)) * sizeof(hashed_entry_t));
+    if (!pSorted)
+    {
+        puts("FsWriteDirectory failed, couldn't allocate memory to sort the entries.");
+        return FS_REGISTER_NODE_DISK_ERROR;
+    }
+
+    const FsEntry* pEntry;
+    offset = 0;
+    for (uint64_t i = 0; (pEntry = FsiNextEntry(pData, size, &offset)); i++)
+    {
+        pSorted[i].Hash   = FsHashName(FsEntryName(pEntry), pEntry->NameLength);
+        pSorted[i].pEntry = pEntry;
+    }
+    qsort(pSorted, count, sizeof(hashed_entry_t), FsiCompareHashedEntries);
+
+    for (uint64_t i = 1; i < count; i++)
+    {
+        if (FsiCompareHashedEntries(&pSorted[i - 1], &pSorted[i]) == 0)
+        {
+            printf("FsWriteDirectory failed, the name \"%.*s\" is used by more than one entry.\n",
+                   pSorted[i].pEntry->NameLength, FsEntryName(pSorted[i].pEntry));
+            free(pSorted);
+            return FS_REGISTER_NODE_NAME_EXISTS;
+        }
+    }
+
+    *ppSorted = pSorted;
+    *pCount   = count;
+    return FS_REGISTER_NODE_SUCCESSFUL;
+}
+
+static register_node_result_t FsiGetDirectory(FileSystemOnDisk* pFs, nodeid_t dirNodeID, FsNode* pDir, const char* pCaller)
+{
+    if (dirNodeID == FS_NODE_ID_INVALID || !FsNodeExists(pFs, dirNodeID))
+    {
+        printf("%s failed, directory node %u doesn't exist.\n", pCaller, dirNodeID);
+        return FS_REGISTER_NODE_DIRECTORY_DOES_NOT_EXIST;
+    }
+
+    *pDir = FsGetNode(pFs, dirNodeID);
+    if (pDir->ID == FS_NODE_ID_INVALID)
+    {
+        return FS_REGISTER_NODE_DISK_ERROR;
+    }
+    if (pDir->Type != FS_NODE_TYPE_DIRECTORY)
+    {
+        printf("%s failed, node %u is not a directory.\n", pCaller, dirNodeID);
+        return FS_REGISTER_NODE_NOT_DIRECTORY;
+    }
+    return FS_REGISTER_NODE_SUCCESSFUL;
+}
+
+// Reads the whole data of a directory stored as a plain list into a freshly allocated buffer.
+static bool FsiReadPlainDirectory(FileSystemOnDisk* pFs, const FsNode* pDir, uint8_t** ppData)
+{
+    uint16_t blockSize = pFs->Meta.BlockSize;
+    uint8_t* pData = malloc(FS_MAX(pDir->Size, UINT64_C(1)));
+    if (!pData)
+    {
+        printf("FsiReadPlainDirectory failed, couldn't allocate %lu bytes for directory %u.\n", pDir->Size, pDir->ID);
+        return false;
+    }
+
+    memcpy(pData, pDir->InlineData, FS_MIN(pDir->Size, (uint64_t) FS_NODE_INLINE_DATA_SIZE));
+
+    uint64_t numBlocks = FsNodeDataBlocks(&pFs->Meta, pDir->Size);
+    for (uint64_t i = 0; i < numBlocks; i++)
+    {
+        uint64_t offset = FS_NODE_INLINE_DATA_SIZE + i * blockSize;
+        block_t  block  = FsNodeBlockAt(pFs, pDir, i);
+        if (!block || !FsBlockCacheRead(&pFs->Cache, block, 0, pData + offset, (uint16_t) FS_MIN(pDir->Size - offset, (uint64_t) blockSize)))
+        {
+            printf("FsiReadPlainDirectory failed, couldn't read data block %lu of directory %u.\n", i, pDir->ID);
+            free(pData);
+            return false;
+        }
+    }
+
+    *ppData = pData;
+    return true;
+}
+
+static bool FsiGetIndex(FileSystemOnDisk* pFs, const FsNode* pDir, FsDirectoryIndex* pIndex)
+{
+    memcpy(pIndex, pDir->InlineData, sizeof(FsDirectoryIndex));
+    if (pIndex->HashVersion != FS_DIRECTORY_HASH_VERSION || pIndex->Depth > FS_DIRECTORY_MAX_DEPTH ||
+        FsNodeDataBlocks(&pFs->Meta, pDir->Size) < 2)
+    {
+        printf("FsiGetIndex failed, the index of directory %u is malformed (hash version %u, depth %u).\n",
+               pDir->ID, pIndex->HashVersion, pIndex->Depth);
+        return false;
+    }
+    return true;
+}
+
+static bool FsiReadLogical(FileSystemOnDisk* pFs, const FsNode* pDir, uint32_t logical, uint8_t* pBlock)
+{
+    block_t block = FsNodeBlockAt(pFs, pDir, logical);
+    if (!block || logical >= FsNodeDataBlocks(&pFs->Meta, pDir->Size) ||
+        !FsBlockCacheRead(&pFs->Cache, block, 0, pBlock, pFs->Meta.BlockSize))
+    {
+        printf("FsiReadLogical failed, couldn't read block %u of directory %u.\n", logical, pDir->ID);
+        return false;
+    }
+    return true;
+}
+
+static bool FsiWriteLogical(FileSystemOnDisk* pFs, const FsNode* pDir, uint32_t logical, const uint8_t* pBlock)
+{
+    block_t block = FsNodeBlockAt(pFs, pDir, logical);
+    if (!block || !FsBlockCacheWrite(&pFs->Cache, block, 0, pBlock, pFs->Meta.BlockSize))
+    {
+        printf("FsiWriteLogical failed, couldn't write block %u of directory %u.\n", logical, pDir->ID);
+        return false;
+    }
+    return true;
+}
+
+static FsIndexEntry* FsiSlots(uint8_t* pBlock)
+{
+    return (FsIndexEntry*) (pBlock + sizeof(FsIndexHeader));
+}
+
+// The slot of an index block routing `hash`, which is the last one whose Hash is not above it.
+static uint16_t FsiFindSlot(const uint8_t* pBlock, uint32_t hash)
+{
+    const FsIndexHeader* pHeader = (const FsIndexHeader*) pBlock;
+    const FsIndexEntry*  pSlots  = (const FsIndexEntry*) (pBlock + sizeof(FsIndexHeader));
+
+    uint16_t low = 1, high = pHeader->Count;
+    while (low < high)
+    {
+        uint16_t middle = (uint16_t) ((low + high) / 2);
+        if (pSlots[middle].Hash <= hash) low  = (uint16_t) (middle + 1);
+        else                             high = middle;
+    }
+    return (uint16_t) (low - 1);
+}
+
+static void FsiInsertSlot(uint8_t* pBlock, uint32_t hash, uint32_t logical)
+{
+    FsIndexHeader* pHeader = (FsIndexHeader*) pBlock;
+    FsIndexEntry*  pSlots  = FsiSlots(pBlock);
+
+    uint16_t slot = (uint16_t) (FsiFindSlot(pBlock, hash) + 1);
+    memmove(&pSlots[slot + 1], &pSlots[slot], (pHeader->Count - slot) * sizeof(FsIndexEntry));
+    pSlots[slot].Hash  = hash;
+    pSlots[slot].Block = logical;
+    pHeader->Count++;
+}
+
+typedef struct
+{
+    uint32_t Blocks[FS_DIRECTORY_MAX_DEPTH + 1]; // Logical index blocks passed through, starting with the root.
+    uint32_t Leaf;
+} index_path_t;
+
+// Follows the index of a directory down to the leaf holding `hash`.
+static bool FsiFindLeaf(FileSystemOnDisk* pFs, const FsNode* pDir, uint8_t depth, uint32_t hash, index_path_t* pPath)
+{
+    uint64_t numBlocks = FsNodeDataBlocks(&pFs->Meta, pDir->Size);
+    uint16_t limit = (uint16_t) ((pFs->Meta.BlockSize - sizeof(FsIndexHeader)) / sizeof(FsIndexEntry));
+
+    uint32_t logical = 0;
+    for (uint8_t level = 0; level <= depth; level++)
+    {
+        pPath->Blocks[level] = logical;
+
+        block_t block = FsNodeBlockAt(pFs, pDir, logical);
+        FsBlockCacheEntry* pEntry = block ? FsBlockCachePin(&pFs->Cache, block) : NULL;
+        if (!pEntry)
+        {
+            printf("FsiFindLeaf failed, couldn't read index block %u of directory %u.\n", logical, pDir->ID);
+            return false;
+        }
+
+        const FsIndexHeader* pHeader = (const FsIndexHeader*) pEntry->pData;
+        bool bValid = pHeader->Count && pHeader->Count <= limit;
+        if (bValid)
+        {
+            logical = FsiSlots(pEntry->pData)[FsiFindSlot(pEntry->pData, hash)].Block;
+            bValid  = logical && logical < numBlocks;
+        }
+        FsBlockCacheUnpin(&pFs->Cache, pEntry);
+
+        if (!bValid)
+        {
+            printf("FsiFindLeaf failed, index block %u of directory %u is malformed.\n", pPath->Blocks[level], pDir->ID);
+            return false;
+        }
+    }
+
+    pPath->Leaf = logical;
+    return true;
+}
+
+// Offset of the entry with the given name within a leaf block, 0 when the leaf doesn't hold it.
+static uint16_t FsiFindInLeaf(const uint8_t* pLeaf, uint16_t blockSize, const char* pName, size_t nameLength)
+{
+    const FsLeafHeader* pHeader = (const FsLeafHeader*) pLeaf;
+    uint64_t size = FS_MIN((uint64_t) pHeader->UsedBytes, (uint64_t) blockSize - sizeof(FsLeafHeader));
+    const uint8_t* pEntries = pLeaf + sizeof(FsLeafHeader);
+
+    uint64_t offset = 0;
+    const FsEntry* pEntry;
+    while ((pEntry = FsiNextEntry(pEntries, size, &offset)))
+    {
+        if (FsiNamesEqual(pEntry, pName, nameLength))
+        {
+            return (uint16_t) ((const uint8_t*) pEntry - pLeaf);
+        }
+    }
+    return 0;
+}
+
+static void FsiLeafAppend(uint8_t* pLeaf, const FsEntry* pEntry)
+{
+    FsLeafHeader* pHeader = (FsLeafHeader*) pLeaf;
+    memcpy(pLeaf + sizeof(FsLeafHeader) + pHeader->UsedBytes, pEntry, pEntry->EntrySize);
+    pHeader->UsedBytes += pEntry->EntrySize;
+    pHeader->NumEntries++;
+}
+
+// Lays out sorted entries as a complete hashed index: the root, the index blocks when the leaves don't fit into the
+// root and the leaves themselves, each filled as far as it goes. Names sharing a hash always stay within one leaf.
+static register_node_result_t FsiBuildIndex(const FsMeta* pMeta, const hashed_entry_t* pSorted, uint64_t count, uint8_t** ppData, uint64_t* pSize)
+{
+    uint16_t blockSize    = pMeta->BlockSize;
+    uint64_t leafCapacity = blockSize - sizeof(FsLeafHeader);
+    uint16_t limit        = (uint16_t) ((blockSize - sizeof(FsIndexHeader)) / sizeof(FsIndexEntry));
+
+    // Count the leaves first, walking runs of equal hashes.
+    uint64_t numLeaves = 0, used = leafCapacity;
+    for (uint64_t i = 0, j; i < count; i = j)
+    {
+        uint64_t runBytes = 0;
+        for (j = i; j < count && pSorted[j].Hash == pSorted[i].Hash; j++)
+        {
+            runBytes += pSorted[j].pEntry->EntrySize;
+        }
+        if (runBytes > leafCapacity)
+        {
+            printf("FsWriteDirectory failed, more names share the hash %08X than a leaf block can hold.\n", pSorted[i].Hash);
+            return FS_REGISTER_NODE_DIRECTORY_FULL;
+        }
+
+        if (used + runBytes > leafCapacity)
+        {
+            numLeaves++;
+            used = 0;
+        }
+        used += runBytes;
+    }
+
+    uint64_t numIndex = numLeaves <= limit ? 0 : FS_DIV(numLeaves, limit);
+    if (numIndex > limit)
+    {
+        printf("FsWriteDirectory failed, %lu entries need more than the %u leaf blocks an index can address.\n", count, limit * limit);
+        return FS_REGISTER_NODE_DIRECTORY_FULL;
+    }
+
+    uint64_t size = FS_NODE_INLINE_DATA_SIZE + (1 + numIndex + numLeaves) * blockSize;
+    uint8_t* pData = calloc(1, size);
+    uint32_t* pLeafHashes = malloc(FS_MAX(numLeaves, UINT64_C(1)) * sizeof(uint32_t));
+    if (!pData || !pLeafHashes)
+    {
+        puts("FsWriteDirectory failed, couldn't allocate memory for the directory index.");
+        free(pData);
+        free(pLeafHashes);
+        return FS_REGISTER_NODE_DISK_ERROR;
+    }
+
+    FsDirectoryIndex* pIndex = (FsDirectoryIndex*) pData;
+    pIndex->HashVersion = FS_DIRECTORY_HASH_VERSION;
+    pIndex->Depth       = numIndex ? 1 : 0;
+    pIndex->NumEntries  = (uint32_t) count;
+
+    // Fill the leaves, mirroring the counting pass above.
+    uint8_t* pBlocks = pData + FS_NODE_INLINE_DATA_SIZE;
+    int64_t  leaf    = -1;
+    used = leafCapacity;
+    for (uint64_t i = 0, j; i < count; i = j)
+    {
+        uint64_t runBytes = 0;
+        for (j = i; j < count && pSorted[j].Hash == pSorted[i].Hash; j++)
+        {
+            runBytes += pSorted[j].pEntry->EntrySize;
+        }
+
+        if (used + runBytes > leafCapacity)
+        {
+            leaf++;
+            pLeafHashes[leaf] = leaf ? pSorted[i].Hash : 0;
+            used = 0;
+        }
+        used += runBytes;
+
+        for (uint64_t k = i; k < j; k++)
+        {
+            FsiLeafAppend(pBlocks + (1 + numIndex + leaf) * blockSize, pSorted[k].pEntry);
+        }
+    }
+
+    // Route the hash ranges, either straight from the root or through one level of index blocks.
+    FsIndexHeader* pRoot = (FsIndexHeader*) pBlocks;
+    pRoot->Limit = limit;
+    if (!numIndex)
+    {
+        for (uint64_t i = 0; i < numLeaves; i++)
+        {
+            FsiSlots(pBlocks)[i] = (FsIndexEntry) { .Hash = pLeafHashes[i], .Block = (uint32_t) (1 + i) };
+        }
+        pRoot->Count = (uint16_t) numLeaves;
+    }
+    else
+    {
+        for (uint64_t i = 0; i < numIndex; i++)
+        {
+            uint8_t* pBlock = pBlocks + (1 + i) * blockSize;
+            FsIndexHeader* pHeader = (FsIndexHeader*) pBlock;
+            pHeader->Limit = limit;
+
+            for (uint64_t k = i * limit; k < numLeaves && k < (i + 1) * limit; k++)
+            {
+                FsiSlots(pBlock)[pHeader->Count++] = (FsIndexEntry) { .Hash = pLeafHashes[k], .Block = (uint32_t) (1 + numIndex + k) };
+            }
+            FsiSlots(pBlocks)[i] = (FsIndexEntry) { .Hash = pLeafHashes[i * limit], .Block = (uint32_t) (1 + i) };
+        }
+        pRoot->Count = (uint16_t) numIndex;
+    }
+
+    free(pLeafHashes);
+    *ppData = pData;
+    *pSize  = size;
+    return FS_REGISTER_NODE_SUCCESSFUL;
+}
+
+static register_node_result_t FsiWriteDirectory(FileSystemOnDisk* pFs, nodeid_t dirNodeID, const FsEntryList* pEntries)
+{
+    FsNode dir;
+    register_node_result_t result = FsiGetDirectory(pFs, dirNodeID, &dir, "FsWriteDirectory");
+    if (result != FS_REGISTER_NODE_SUCCESSFUL)
+    {
+        return result;
+    }
+
+    hashed_entry_t* pSorted;
+    uint64_t count;
+    if ((result = FsiSortEntries(pEntries->pData, pEntries->Size, &pSorted, &count)) != FS_REGISTER_NODE_SUCCESSFUL)
+    {
+        return result;
+    }
+
+    // Plain lists stay as they are while they fit into the inline section and one block.
+    const uint8_t* pData = pEntries->pData;
+    uint64_t size = pEntries->Size;
+    uint8_t* pIndexData = NULL;
+    bool bIndexed = size > FS_NODE_INLINE_DATA_SIZE + (uint64_t) pFs->Meta.BlockSize;
+    if (bIndexed)
+    {
+        result = FsiBuildIndex(&pFs->Meta, pSorted, count, &pIndexData, &size);
+        pData  = pIndexData;
+    }
+    free(pSorted);
+    if (result != FS_REGISTER_NODE_SUCCESSFUL)
+    {
+        return result;
+    }
+
+    dir.Flags = bIndexed ? (dir.Flags | FS_NODE_FLAG_INDEXED) : (dir.Flags & ~(FS_NODE_FLAG_INDEXED));
+    if (!FsWriteNode(pFs, &dir))
+    {
+        free(pIndexData);
+        return FS_REGISTER_NODE_DISK_ERROR;
+    }
+
+    write_node_data_result_t writeResult = FsWriteNodeData(pFs, dirNodeID, pData, size);
+    free(pIndexData);
+    if (writeResult != FS_WRITE_DATA_SUCCESSFUL)
+    {
+        printf("FsWriteDirectory failed, FsWriteNodeData returned %u (%s).\n", writeResult, FsWriteNodeDataResultToString(writeResult));
+
+        // The writer leaves the node empty, which is only a valid directory as a plain list.
+        dir = FsGetNode(pFs, dirNodeID);
+        dir.Flags &= ~(FS_NODE_FLAG_INDEXED);
+        FsWriteNode(pFs, &dir);
+        return FS_REGISTER_NODE_DISK_ERROR;
+    }
+
+    return FS_REGISTER_NODE_SUCCESSFUL;
+}
+
+register_node_result_t FsWriteDirectory(FileSystemOnDisk* pFs, nodeid_t dirNodeID, const FsEntryList* pEntries)
+{
+    // Any name within the directory may now mean something else.
+    FsDentryCacheInvalidateDirectory(&pFs->Dentries, dirNodeID);
+    return FsiWriteDirectory(pFs, dirNodeID, pEntries);
+}
+
+// Splits the full leaf on pPath into two, adding pNew to whichever half it belongs to, and routes the upper half through
+// the index. The index grows a level when the root runs out of slots. pDir is updated in memory only.
+static register_node_result_t FsiSplitLeaf(FileSystemOnDisk* pFs, FsNode* pDir, FsDirectoryIndex* pIndex, const index_path_t* pPath,
+                                           uint8_t* pLeaf, const FsEntry* pNew)
+{
+    uint16_t blockSize    = pFs->Meta.BlockSize;
+    uint64_t leafCapacity = blockSize - sizeof(FsLeafHeader);
+
+    // Gather the entries of the leaf and the new one in hash order.
+    FsEntryList list = { 0 };
+    uint64_t offset = 0;
+    const FsEntry* pEntry;
+    const FsLeafHeader* pHeader = (const FsLeafHeader*) pLeaf;
+    while ((pEntry = FsiNextEntry(pLeaf + sizeof(FsLeafHeader), FS_MIN((uint64_t) pHeader->UsedBytes, leafCapacity), &offset)))
+    {
+        if (!FsEntryListAppend(&list, pEntry->NodeID, pEntry->NodeType, FsEntryName(pEntry), pEntry->NameLength))
+        {
+            FsEntryListRelease(&list);
+            return FS_REGISTER_NODE_DISK_ERROR;
+        }
+    }
+    if (!FsEntryListAppend(&list, pNew->NodeID, pNew->NodeType, FsEntryName(pNew), pNew->NameLength))
+    {
+        FsEntryListRelease(&list);
+        return FS_REGISTER_NODE_DISK_ERROR;
+    }
+
+    hashed_entry_t* pSorted;
+    uint64_t count;
+    register_node_result_t result = FsiSortEntries(list.pData, list.Size, &pSorted, &count);
+    if (result != FS_REGISTER_NODE_SUCCESSFUL)
+    {
+        FsEntryListRelease(&list);
+        return result;
+    }
+
+    // Split about halfway by size, moved to the nearest boundary between two different hashes where both halves fit.
+    uint64_t middle = 0, lowerBytes = 0;
+    while (middle < count && lowerBytes + pSorted[middle].pEntry->EntrySize <= list.Size / 2)
+    {
+        lowerBytes += pSorted[middle++].pEntry->EntrySize;
+    }
+
+    uint64_t split = 0;
+    for (uint64_t distance = 0; !split && distance < count; distance++)
+    {
+        for (int direction = 0; direction < 2 && !split; direction++)
+        {
+            uint64_t candidate = direction ? middle - distance : middle + distance;
+            if (candidate == 0 || candidate >= count || pSorted[candidate].Hash == pSorted[candidate - 1].Hash)
+            {
+                continue;
+            }
+
+            uint64_t bytes = 0;
+            for (uint64_t i = 0; i < candidate; i++)
+            {
+                bytes += pSorted[i].pEntry->EntrySize;
+            }
+            if (bytes <= leafCapacity && list.Size - bytes <= leafCapacity)
+            {
+                split = candidate;
+            }
+        }
+    }
+
+    // Make sure the index can take another slot before claiming anything.
+    uint8_t* pRoot  = malloc(blockSize);
+    uint8_t* pInner = malloc(blockSize);
+    uint8_t* pExtra = calloc(1, blockSize);
+    uint8_t* pUpper = calloc(1, blockSize);
+    if (!pRoot || !pInner || !pExtra || !pUpper)
+    {
+        puts("FsRegisterNode failed, couldn't allocate memory to split a leaf block.");
+        result = FS_REGISTER_NODE_DISK_ERROR;
+    }
+    else if (!split)
+    {
+        printf("FsRegisterNode failed, leaf block %u of directory %u can't be split any further.\n", pPath->Leaf, pDir->ID);
+        result = FS_REGISTER_NODE_DIRECTORY_FULL;
+    }
+    else if (!FsiReadLogical(pFs, pDir, pPath->Blocks[0], pRoot) ||
+             (pIndex->Depth && !FsiReadLogical(pFs, pDir, pPath->Blocks[1], pInner)))
+    {
+        result = FS_REGISTER_NODE_DISK_ERROR;
+    }
+    else if (pIndex->Depth && ((FsIndexHeader*) pInner)->Count >= ((FsIndexHeader*) pInner)->Limit &&
+             ((FsIndexHeader*) pRoot)->Count >= ((FsIndexHeader*) pRoot)->Limit)
+    {
+        printf("FsRegisterNode failed, the index of directory %u is full.\n", pDir->ID);
+        result = FS_REGISTER_NODE_DIRECTORY_FULL;
+    }
+
+    uint32_t splitHash = split ? pSorted[split].Hash : 0;
+    uint32_t upperLeaf = (uint32_t) FsNodeDataBlocks(&pFs->Meta, pDir->Size);
+    block_t  block;
+    if (result == FS_REGISTER_NODE_SUCCESSFUL && !FsNodeAppendBlock(pFs, pDir, &block))
+    {
+        result = FS_REGISTER_NODE_DISK_ERROR;
+    }
+
+    if (result == FS_REGISTER_NODE_SUCCESSFUL)
+    {
+        memset(pLeaf, 0, blockSize);
+        for (uint64_t i = 0; i < count; i++)
+        {
+            FsiLeafAppend(i < split ? pLeaf : pUpper, pSorted[i].pEntry);
+        }
+
+        uint8_t* pParent = pIndex->Depth ? pInner : pRoot;
+        uint32_t parent  = pIndex->Depth ? pPath->Blocks[1] : pPath->Blocks[0];
+        FsIndexHeader* pParentHeader = (FsIndexHeader*) pParent;
+
+        bool bResult = FsiWriteLogical(pFs, pDir, pPath->Leaf, pLeaf) && FsiWriteLogical(pFs, pDir, upperLeaf, pUpper);
+        if (bResult && pParentHeader->Count < pParentHeader->Limit)
+        {
+            FsiInsertSlot(pParent, splitHash, upperLeaf);
+            bResult = FsiWriteLogical(pFs, pDir, parent, pParent);
+        }
+        else if (bResult)
+        {
+            // The parent is full. Its upper half moves into a new index block, the root gets a slot for it. A full
+            // root instead moves both halves into new index blocks and becomes their parent.
+            uint32_t lower = parent;
+            if (!pIndex->Depth)
+            {
+                lower   = (uint32_t) FsNodeDataBlocks(&pFs->Meta, pDir->Size);
+                bResult = FsNodeAppendBlock(pFs, pDir, &block);
+            }
+            uint32_t upper = (uint32_t) FsNodeDataBlocks(&pFs->Meta, pDir->Size);
+            bResult = bResult && FsNodeAppendBlock(pFs, pDir, &block);
+
+            if (bResult)
+            {
+                uint16_t half = (uint16_t) (pParentHeader->Count / 2);
+                FsIndexHeader* pExtraHeader = (FsIndexHeader*) pExtra;
+                pExtraHeader->Limit = pParentHeader->Limit;
+                pExtraHeader->Count = (uint16_t) (pParentHeader->Count - half);
+                memcpy(FsiSlots(pExtra), FsiSlots(pParent) + half, pExtraHeader->Count * sizeof(FsIndexEntry));
+                pParentHeader->Count = half;
+
+                uint32_t upperHash = FsiSlots(pExtra)[0].Hash;
+                FsiInsertSlot(splitHash >= upperHash ? pExtra : pParent, splitHash, upperLeaf);
+
+                if (!pIndex->Depth)
+                {
+                    // pRoot is the parent here and becomes the lower index block, the root starts over with two slots.
+                    memcpy(pInner, pRoot, blockSize);
+                    ((FsIndexHeader*) pRoot)->Count = 2;
+                    FsiSlots(pRoot)[0] = (FsIndexEntry) { .Hash = 0,         .Block = lower };
+                    FsiSlots(pRoot)[1] = (FsIndexEntry) { .Hash = upperHash, .Block = upper };
+                    pIndex->Depth = 1;
+                    bResult = FsiWriteLogical(pFs, pDir, lower, pInner);
+                }
+                else
+                {
+                    FsiInsertSlot(pRoot, upperHash, upper);
+                    bResult = FsiWriteLogical(pFs, pDir, lower, pInner);
+                }
+
+                bResult = bResult && FsiWriteLogical(pFs, pDir, upper, pExtra) && FsiWriteLogical(pFs, pDir, pPath->Blocks[0], pRoot);
+            }
+        }
+
+        if (!bResult)
+        {
+            result = FS_REGISTER_NODE_DISK_ERROR;
+        }
+    }
+
+    free(pRoot);
+    free(pInner);
+    free(pExtra);
+    free(pUpper);
+    free(pSorted);
+    FsEntryListRelease(&list);
+    return result;
+}
+
+static register_node_result_t FsiRegisterIndexed(FileSystemOnDisk* pFs, FsNode* pDir, const FsEntry* pNew)
+{
+    FsDirectoryIndex index;
+    index_path_t path;
+    const char* pName = FsEntryName(pNew);
+    if (!FsiGetIndex(pFs, pDir, &index) || !FsiFindLeaf(pFs, pDir, index.Depth, FsHashName(pName, pNew->NameLength), &path))
+    {
+        return FS_REGISTER_NODE_DISK_ERROR;
+    }
+
+    uint8_t* pLeaf = malloc(pFs->Meta.BlockSize);
+    if (!pLeaf)
+    {
+        puts("FsRegisterNode failed, couldn't allocate memory for a leaf block.");
+        return FS_REGISTER_NODE_DISK_ERROR;
+    }
+
+    register_node_result_t result = FS_REGISTER_NODE_SUCCESSFUL;
+    const FsLeafHeader* pHeader = (const FsLeafHeader*) pLeaf;
+    if (!FsiReadLogical(pFs, pDir, path.Leaf, pLeaf))
+    {
+        result = FS_REGISTER_NODE_DISK_ERROR;
+    }
+    else if (FsiFindInLeaf(pLeaf, pFs->Meta.BlockSize, pName, pNew->NameLength))
+    {
+        printf("FsRegisterNode failed, directory %u already has an entry named \"%.*s\".\n", pDir->ID, pNew->NameLength, pName);
+        result = FS_REGISTER_NODE_NAME_EXISTS;
+    }
+    else if (sizeof(FsLeafHeader) + pHeader->UsedBytes + pNew->EntrySize <= pFs->Meta.BlockSize)
+    {
+        FsiLeafAppend(pLeaf, pNew);
+        if (!FsiWriteLogical(pFs, pDir, path.Leaf, pLeaf))
+        {
+            result = FS_REGISTER_NODE_DISK_ERROR;
+        }
+    }
+    else
+    {
+        result = FsiSplitLeaf(pFs, pDir, &index, &path, pLeaf, pNew);
+    }
+    free(pLeaf);
+
+    if (result == FS_REGISTER_NODE_SUCCESSFUL)
+    {
+        index.NumEntries++;
+        memcpy(pDir->InlineData, &index, sizeof(FsDirectoryIndex));
+    }
+    return result;
+}
+
+register_node_result_t FsRegisterNode(FileSystemOnDisk* pFs, nodeid_t dirNodeID, nodeid_t nodeID, const char* pName)
+{
+    size_t nameLength = strlen(pName);
+    if (!FsiValidName(pName, nameLength))
+    {
+        printf("FsRegisterNode failed, \"%s\" is not a valid entry name.\n", pName);
+        return FS_REGISTER_NODE_INVALID_NAME;
+    }
+
+    FsNode dir;
+    register_node_result_t result = FsiGetDirectory(pFs, dirNodeID, &dir, "FsRegisterNode");
+    if (result != FS_REGISTER_NODE_SUCCESSFUL)
+    {
+        return result;
+    }
+
+    if (nodeID == FS_NODE_ID_INVALID || !FsNodeExists(pFs, nodeID))
+    {
+        printf("FsRegisterNode failed, node %u doesn't exist.\n", nodeID);
+        return FS_REGISTER_NODE_DOES_NOT_EXIST;
+    }
+    FsNode node = FsGetNode(pFs, nodeID);
+
+    // Drops a negative entry for the name, whatever happens below.
+    FsDentryCacheInvalidate(&pFs->Dentries, dirNodeID, pName, (uint8_t) nameLength);
+
+    if (!(dir.Flags & FS_NODE_FLAG_INDEXED))
+    {
+        // Small enough to rewrite whole, FsWriteDirectory turns it into an index once it outgrows a single block.
+        FsEntryList list = { 0 };
+        if (!FsiReadPlainDirectory(pFs, &dir, &list.pData))
+        {
+            return FS_REGISTER_NODE_DISK_ERROR;
+        }
+        list.Size = list.Capacity = dir.Size;
+
+        uint64_t offset = 0;
+        const FsEntry* pEntry;
+        while ((pEntry = FsiNextEntry(list.pData, list.Size, &offset)))
+        {
+            if (FsiNamesEqual(pEntry, pName, nameLength))
+            {
+                printf("FsRegisterNode failed, directory %u already has an entry named \"%s\".\n", dirNodeID, pName);
+                FsEntryListRelease(&list);
+                return FS_REGISTER_NODE_NAME_EXISTS;
+            }
+        }
+
+        result = FsEntryListAppend(&list, nodeID, node.Type, pName, nameLength) ? FsiWriteDirectory(pFs, dirNodeID, &list)
+                                                                                 : FS_REGISTER_NODE_DISK_ERROR;
+        FsEntryListRelease(&list);
+        return result;
+    }
+
+    FsEntryList single = { 0 };
+    if (!FsEntryListAppend(&single, nodeID, node.Type, pName, nameLength))
+    {
+        return FS_REGISTER_NODE_DISK_ERROR;
+    }
+
+    result = FsiRegisterIndexed(pFs, &dir, (const FsEntry*) single.pData);
+    FsEntryListRelease(&single);
+    if (result != FS_REGISTER_NODE_SUCCESSFUL)
+    {
+        // Blocks appended before a failure stay part of the directory, they are simply unused.
+        FsWriteNode(pFs, &dir);
+        return result;
+    }
+
+    dir.TsModified = FsGetBioTime();
+    if (!FsWriteNode(pFs, &dir) || !FsCommit(pFs))
+    {
+        printf("FsRegisterNode failed, couldn't write directory %u.\n", dirNodeID);
+        return FS_REGISTER_NODE_DISK_ERROR;
+    }
+    return FS_REGISTER_NODE_SUCCESSFUL;
+}
+
+register_node_result_t FsUnregisterNode(FileSystemOnDisk* pFs, nodeid_t dirNodeID, const char* pName)
+{
+    size_t nameLength = strlen(pName);
+    if (!FsiValidName(pName, nameLength))
+    {
+        printf("FsUnregisterNode failed, \"%s\" is not a valid entry name.\n", pName);
+        return FS_REGISTER_NODE_INVALID_NAME;
+    }
+
+    FsNode dir;
+    register_node_result_t result = FsiGetDirectory(pFs, dirNodeID, &dir, "FsUnregisterNode");
+    if (result != FS_REGISTER_NODE_SUCCESSFUL)
+    {
+        return result;
+    }
+
+    FsDentryCacheInvalidate(&pFs->Dentries, dirNodeID, pName, (uint8_t) nameLength);
+
+    if (!(dir.Flags & FS_NODE_FLAG_INDEXED))
+    {
+        uint8_t* pData;
+        if (!FsiReadPlainDirectory(pFs, &dir, &pData))
+        {
+            return FS_REGISTER_NODE_DISK_ERROR;
+        }
+
+        result = FS_REGISTER_NODE_NAME_NOT_FOUND;
+        uint64_t offset = 0;
+        const FsEntry* pEntry;
+        while ((pEntry = FsiNextEntry(pData, dir.Size, &offset)))
+        {
+            if (FsiNamesEqual(pEntry, pName, nameLength))
+            {
+                uint16_t entrySize = pEntry->EntrySize;
+                memmove(pData + offset - entrySize, pData + offset, dir.Size - offset);
+
+                write_node_data_result_t writeResult = FsWriteNodeData(pFs, dirNodeID, pData, dir.Size - entrySize);
+                result = writeResult == FS_WRITE_DATA_SUCCESSFUL ? FS_REGISTER_NODE_SUCCESSFUL : FS_REGISTER_NODE_DISK_ERROR;
+                break;
+            }
+        }
+        free(pData);
+        return result;
+    }
+
+    FsDirectoryIndex index;
+    index_path_t path;
+    if (!FsiGetIndex(pFs, &dir, &index) || !FsiFindLeaf(pFs, &dir, index.Depth, FsHashName(pName, nameLength), &path))
+    {
+        return FS_REGISTER_NODE_DISK_ERROR;
+    }
+
+    uint8_t* pLeaf = malloc(pFs->Meta.BlockSize);
+    if (!pLeaf || !FsiReadLogical(pFs, &dir, path.Leaf, pLeaf))
+    {
+        free(pLeaf);
+        return FS_REGISTER_NODE_DISK_ERROR;
+    }
+
+    uint16_t offset = FsiFindInLeaf(pLeaf, pFs->Meta.BlockSize, pName, nameLength);
+    if (offset)
+    {
+        FsLeafHeader* pHeader = (FsLeafHeader*) pLeaf;
+        uint16_t entrySize = ((const FsEntry*) (pLeaf + offset))->EntrySize;
+        uint16_t end = (uint16_t) (sizeof(FsLeafHeader) + pHeader->UsedBytes);
+        memmove(pLeaf + offset, pLeaf + offset + entrySize, end - offset - entrySize);
+        memset(pLeaf + end - entrySize, 0, entrySize);
+        pHeader->UsedBytes -= entrySize;
+        pHeader->NumEntries--;
+
+        index.NumEntries--;
+        memcpy(dir.InlineData, &index, sizeof(FsDirectoryIndex));
+        dir.TsModified = FsGetBioTime();
+        result = FsiWriteLogical(pFs, &dir, path.Leaf, pLeaf) && FsWriteNode(pFs, &dir) && FsCommit(pFs)
+               ? FS_REGISTER_NODE_SUCCESSFUL : FS_REGISTER_NODE_DISK_ERROR;
+    }
+    else
+    {
+        result = FS_REGISTER_NODE_NAME_NOT_FOUND;
+    }
+
+    free(pLeaf);
+    return result;
+}
+
+lookup_result_t FsLookupNode(FileSystemOnDisk* pFs, nodeid_t dirNodeID, const char* pName, size_t nameLength, FsEntry* pEntry)
+{
+    FsNode dir = FsGetNode(pFs, dirNodeID);
+    if (dir.ID == FS_NODE_ID_INVALID || dir.Type != FS_NODE_TYPE_DIRECTORY)
+    {
+        return FS_LOOKUP_NOT_DIRECTORY;
+    }
+
+    if (!(dir.Flags & FS_NODE_FLAG_INDEXED))
+    {
+        uint8_t* pData;
+        if (!FsiReadPlainDirectory(pFs, &dir, &pData))
+        {
+            return FS_LOOKUP_DISK_ERROR;
+        }
+
+        lookup_result_t result = FS_LOOKUP_NOT_FOUND;
+        uint64_t offset = 0;
+        const FsEntry* pCurrent;
+        while ((pCurrent = FsiNextEntry(pData, dir.Size, &offset)))
+        {
+            if (FsiNamesEqual(pCurrent, pName, nameLength))
+            {
+                if (pEntry) memcpy(pEntry, pCurrent, sizeof(FsEntry));
+                result = FS_LOOKUP_FOUND;
+                break;
+            }
+        }
+        free(pData);
+        return result;
+    }
+
+    FsDirectoryIndex index;
+    index_path_t path;
+    if (!FsiGetIndex(pFs, &dir, &index) || !FsiFindLeaf(pFs, &dir, index.Depth, FsHashName(pName, nameLength), &path))
+    {
+        return FS_LOOKUP_DISK_ERROR;
+    }
+
+    block_t block = FsNodeBlockAt(pFs, &dir, path.Leaf);
+    FsBlockCacheEntry* pLeaf = block ? FsBlockCachePin(&pFs->Cache, block) : NULL;
+    if (!pLeaf)
+    {
+        printf("FsLookupNode failed, couldn't read leaf block %u of directory %u.\n", path.Leaf, dirNodeID);
+        return FS_LOOKUP_DISK_ERROR;
+    }
+
+    uint16_t offset = FsiFindInLeaf(pLeaf->pData, pFs->Meta.BlockSize, pName, nameLength);
+    if (offset && pEntry)
+    {
+        memcpy(pEntry, pLeaf->pData + offset, sizeof(FsEntry));
+    }
+    FsBlockCacheUnpin(&pFs->Cache, pLeaf);
+    return offset ? FS_LOOKUP_FOUND : FS_LOOKUP_NOT_FOUND;
+}
+
+static bool FsiVisitEntries(const uint8_t* pData, uint64_t size, entry_visitor_t visitor, void* pContext, bool* pStopped)
+{
+    uint64_t offset = 0;
+    const FsEntry* pEntry;
+    while ((pEntry = FsiNextEntry(pData, size, &offset)))
+    {
+        if (!visitor(pContext, pEntry))
+        {
+            *pStopped = true;
+            break;
+        }
+    }
+    return true;
+}
+
+static bool FsiListIndex(FileSystemOnDisk* pFs, const FsNode* pDir, uint32_t logical, uint8_t depth, entry_visitor_t visitor, void* pContext, bool* pStopped)
+{
+    uint16_t blockSize = pFs->Meta.BlockSize;
+    uint8_t* pBlock = malloc(blockSize);
+    if (!pBlock || !FsiReadLogical(pFs, pDir, logical, pBlock))
+    {
+        free(pBlock);
+        return false;
+    }
+
+    bool bResult = true;
+    if (depth == UINT8_MAX)
+    {
+        // Past the deepest index level, this is a leaf.
+        uint64_t size = FS_MIN((uint64_t) ((const FsLeafHeader*) pBlock)->UsedBytes, (uint64_t) blockSize - sizeof(FsLeafHeader));
+        bResult = FsiVisitEntries(pBlock + sizeof(FsLeafHeader), size, visitor, pContext, pStopped);
+    }
+    else
+    {
+        const FsIndexHeader* pHeader = (const FsIndexHeader*) pBlock;
+        for (uint16_t i = 0; i < pHeader->Count && i < pHeader->Limit && bResult && !*pStopped; i++)
+        {
+            bResult = FsiListIndex(pFs, pDir, FsiSlots(pBlock)[i].Block, depth ? depth - 1 : UINT8_MAX, visitor, pContext, pStopped);
+        }
+    }
+
+    free(pBlock);
+    return bResult;
+}
+
+bool FsListDirectory(FileSystemOnDisk* pFs, nodeid_t dirNodeID, entry_visitor_t visitor, void* pContext)
+{
+    FsNode dir;
+    if (FsiGetDirectory(pFs, dirNodeID, &dir, "FsListDirectory") != FS_REGISTER_NODE_SUCCESSFUL)
+    {
+        return false;
+    }
+
+    bool bStopped = false;
+    if (!(dir.Flags & FS_NODE_FLAG_INDEXED))
+    {
+        uint8_t* pData;
+        if (!FsiReadPlainDirectory(pFs, &dir, &pData))
+        {
+            return false;
+        }
+
+        bool bResult = FsiVisitEntries(pData, dir.Size, visitor, pContext, &bStopped);
+        free(pData);
+        return bResult;
+    }
+
+    FsDirectoryIndex index;
+    return FsiGetIndex(pFs, &dir, &index) && FsiListIndex(pFs, &dir, 0, index.Depth, visitor, pContext, &bStopped);
+}
+
+resolve_path_result_t FsResolvePath(FileSystemOnDisk* pFs, const char* pPath, FsEntry* pEntry)
+{
+    if (strncmp(pPath, "FS", 2) == 0 && (pPath[2] == '/' || pPath[2] == '\0'))
+    {
+        pPath += 2;
+    }
+
+    FsEntry current;
+    memset(&current, 0, sizeof(FsEntry));
+    current.NodeID    = FS_NODE_ID_ROOT;
+    current.NodeType  = FS_NODE_TYPE_DIRECTORY;
+    current.EntrySize = FsEntrySizeFor(0);
+
+    for (;;)
+    {
+        while (*pPath == '/')
+        {
+            pPath++;
+        }
+        if (!*pPath)
+        {
+            break;
+        }
+
+        const char* pName = pPath;
+        size_t nameLength = strcspn(pPath, "/");
+        pPath += nameLength;
+
+        if (nameLength > FS_ENTRY_NAME_MAX || (pName[0] == '.' && (nameLength == 1 || (nameLength == 2 && pName[1] == '.'))))
+        {
+            printf("FsResolvePath failed, \"%.*s\" can't be a path component.\n", (int) nameLength, pName);
+            return FS_RESOLVE_PATH_INVALID;
+        }
+        if (current.NodeType != FS_NODE_TYPE_DIRECTORY)
+        {
+            return FS_RESOLVE_PATH_NOT_DIRECTORY;
+        }
+
+        const FsDentry* pCached = FsDentryCacheLookup(&pFs->Dentries, current.NodeID, pName, (uint8_t) nameLength);
+        if (pCached)
+        {
+            if (pCached->NodeID == FS_NODE_ID_INVALID)
+            {
+                return FS_RESOLVE_PATH_NOT_FOUND;
+            }
+
+            current.NodeID     = pCached->NodeID;
+            current.NodeType   = pCached->NodeType;
+            current.NameLength = (uint8_t) nameLength;
+            current.EntrySize  = FsEntrySizeFor((uint8_t) nameLength);
+            continue;
+        }
+
+        FsEntry found;
+        switch (FsLookupNode(pFs, current.NodeID, pName, nameLength, &found))
+        {
+        case FS_LOOKUP_FOUND:
+            FsDentryCacheInsert(&pFs->Dentries, current.NodeID, pName, (uint8_t) nameLength, found.NodeID, found.NodeType);
+            current = found;
+            break;
+        case FS_LOOKUP_NOT_FOUND:
+            FsDentryCacheInsert(&pFs->Dentries, current.NodeID, pName, (uint8_t) nameLength, FS_NODE_ID_INVALID, 0);
+            return FS_RESOLVE_PATH_NOT_FOUND;
+        case FS_LOOKUP_NOT_DIRECTORY:
+            return FS_RESOLVE_PATH_NOT_DIRECTORY;
+        default:
+            return FS_RESOLVE_PATH_DISK_ERROR;
+        }
+    }
+
+    if (pEntry)
+    {
+        *pEntry = current;
+    }
+    return FS_RESOLVE_PATH_FOUND;
+}
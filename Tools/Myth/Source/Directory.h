@@ -0,0 +1,99 @@
+/**
+ * Header for directory contents, the FsEntry records stored as the data of directory nodes.
+ *
+ * Small directories keep their entries as one plain list, which stays within the node's InlineData while it is short.
+ * Once the list outgrows the inline section and a single data block the directory is turned into a hashed index
+ * (FS_NODE_FLAG_INDEXED): entries are spread over leaf blocks by the hash of their name and a root index block, plus one
+ * level of index blocks for very large directories, maps hash ranges to leaves. A lookup reads at most three blocks no
+ * matter how many entries the directory holds. Leaves split when they fill up and are never merged.
+ */
+
+#ifndef MYTH_DIRECTORY_H
+#define MYTH_DIRECTORY_H
+
+#include "FileSystem.h"
+#include "Disk.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define FS_ENTRY_NAME_MAX 255 // NameLength is a single byte.
+
+// Size of an entry whose name is nameLength bytes long, the name directly follows the FsEntry header.
+uint16_t FsEntrySizeFor(uint8_t nameLength);
+// Name of the entry, not null terminated, NameLength bytes long.
+const char* FsEntryName(const FsEntry* pEntry);
+
+/** Growable buffer of serialized FsEntry records, laid out exactly like the data of a directory node. */
+typedef struct
+{
+    uint8_t* pData;
+    uint64_t Size;
+    uint64_t Capacity;
+    uint64_t NumEntries;
+} FsEntryList;
+
+bool FsEntryListAppend(FsEntryList* pList, nodeid_t nodeID, uint16_t nodeType, const char* pName, size_t nameLength);
+void FsEntryListRelease(FsEntryList* pList);
+
+// Hash the index of a directory orders names by, FS_DIRECTORY_HASH_VERSION.
+uint32_t FsHashName(const char* pName, size_t nameLength);
+
+typedef enum
+{
+    FS_REGISTER_NODE_SUCCESSFUL               = 0,
+    FS_REGISTER_NODE_DIRECTORY_DOES_NOT_EXIST = 1, // The directory to enter to doesn't exist.
+    FS_REGISTER_NODE_DOES_NOT_EXIST           = 2, // The node to register doesn't exist.
+    FS_REGISTER_NODE_NOT_DIRECTORY            = 3, // Specified nodeID for the directory node is not a directory node.
+    FS_REGISTER_NODE_INVALID_NAME             = 4, // Empty name, longer than FS_ENTRY_NAME_MAX or containing a slash.
+    FS_REGISTER_NODE_NAME_EXISTS              = 5, // The directory already has an entry with this name.
+    FS_REGISTER_NODE_NAME_NOT_FOUND           = 6, // The directory has no entry with this name.
+    FS_REGISTER_NODE_DIRECTORY_FULL           = 7, // The index of the directory can't grow any further.
+    FS_REGISTER_NODE_DISK_ERROR               = 8  // I/O failure or out of space.
+} register_node_result_t;
+const char* FsRegisterNodeResultToString(register_node_result_t result);
+
+// Registers the node to be apart of a directory under the given null terminated name.
+register_node_result_t FsRegisterNode(FileSystemOnDisk* pFs, nodeid_t dirNodeID, nodeid_t nodeID, const char* pName);
+// Removes the entry with the given name from a directory, the node it points to is left alone.
+register_node_result_t FsUnregisterNode(FileSystemOnDisk* pFs, nodeid_t dirNodeID, const char* pName);
+
+// Replaces the contents of a directory with pEntries in one go, building the hashed index right away when they are too
+// many for a plain list. Fails with FS_REGISTER_NODE_NAME_EXISTS when two entries share a name.
+register_node_result_t FsWriteDirectory(FileSystemOnDisk* pFs, nodeid_t dirNodeID, const FsEntryList* pEntries);
+
+typedef enum
+{
+    FS_LOOKUP_FOUND          = 0,
+    FS_LOOKUP_NOT_FOUND      = 1,
+    FS_LOOKUP_NOT_DIRECTORY  = 2, // The node to look in doesn't exist or is not a directory.
+    FS_LOOKUP_DISK_ERROR     = 3
+} lookup_result_t;
+const char* FsLookupResultToString(lookup_result_t result);
+
+// Looks up a name within a directory. On success pEntry receives the entry header, NodeID and NodeType among others.
+lookup_result_t FsLookupNode(FileSystemOnDisk* pFs, nodeid_t dirNodeID, const char* pName, size_t nameLength, FsEntry* pEntry);
+
+typedef enum
+{
+    FS_RESOLVE_PATH_FOUND         = 0,
+    FS_RESOLVE_PATH_NOT_FOUND     = 1, // A component of the path doesn't exist.
+    FS_RESOLVE_PATH_NOT_DIRECTORY = 2, // A component other than the last one is not a directory.
+    FS_RESOLVE_PATH_INVALID       = 3, // "." or ".." components, or a component longer than FS_ENTRY_NAME_MAX.
+    FS_RESOLVE_PATH_DISK_ERROR    = 4
+} resolve_path_result_t;
+const char* FsResolvePathResultToString(resolve_path_result_t result);
+
+// Resolves a path such as "FS/a/b/c" from the root directory down, the "FS/" prefix is optional and repeated or trailing
+// slashes are ignored. Every component goes through the dentry cache of pFs first, names already seen, existing or not,
+// don't touch any directory block. On success pEntry receives the entry of the last component, for the root itself a
+// directory entry of node FS_NODE_ID_ROOT with an empty name.
+resolve_path_result_t FsResolvePath(FileSystemOnDisk* pFs, const char* pPath, FsEntry* pEntry);
+
+// Called for every entry of a directory, the entry is only valid during the call. Returning false ends the listing early.
+typedef bool (*entry_visitor_t)(void* pContext, const FsEntry* pEntry);
+
+// Visits every entry of a directory, in hash order for indexed ones. Returns false when the directory can't be read.
+bool FsListDirectory(FileSystemOnDisk* pFs, nodeid_t dirNodeID, entry_visitor_t visitor, void* pContext);
+
+#endif // !MYTH_DIRECTORY_H
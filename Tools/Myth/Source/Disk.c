@@ -1,11 +1,12 @@
 #include "Disk.h"
 
+#include "Group.h"
 #include "Utils/Checksum.h"
+#include "Utils/Math.h"
 
-#include <sys/types.h>
 #include <assert.h>
-#include <unistd.h>
 #include <memory.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -24,6 +25,9 @@ const char* FsMakeFsStatusToString(makefs_status_t status)
         DOCASE(FS_MAKE_FILE_SYSTEM_INVALID_TAIL);
         DOCASE(FS_MAKE_FILE_SYSTEM_INVALID_CHECKSUM);
         DOCASE(FS_MAKE_FILE_SYSTEM_INVALID_CONFIGURATION_HEADER);
+        DOCASE(FS_MAKE_FILE_SYSTEM_JOURNAL_ERROR);
+        DOCASE(FS_MAKE_FILE_SYSTEM_UNSUPPORTED_REVISION);
+        DOCASE(FS_MAKE_FILE_SYSTEM_JOURNAL_PENDING);
     #undef DOCASE
     default: break;
     }
@@ -31,44 +35,49 @@ const char* FsMakeFsStatusToString(makefs_status_t status)
     return "((null))";
 }
 
-bool FsWriteMeta(FILE* pDisk, FsMeta* pMeta)
+// Bytes of FsMeta ahead of Tail the revision of pMeta stores, the fields added by later revisions are left out.
+static uint32_t FsiMetaFieldsSize(const FsMeta* pMeta)
 {
-    pMeta->Checksum = ChecksumCRC32(pMeta, sizeof(FsMeta) - sizeof(uint32_t));
-    
-    uint64_t addrMetadata = pMeta->Origin * pMeta->BlockSize;
-    if (fseek(pDisk, addrMetadata, SEEK_SET) != 0)
+    if (pMeta->Revision < FS_REVISION_ALLOCATION_GROUPS)
     {
-        printf("FsMakeFileSystem failed, seek to metadata address (block %lu, raw address 0x%x) failed.", pMeta->Origin, (uint32_t) addrMetadata);
-        return false;
+        return offsetof(FsMeta, BlocksPerGroup);
     }
-
-    if (fwrite(pMeta, 1, sizeof(FsMeta), pDisk) != sizeof(FsMeta))
+    if (pMeta->Revision < FS_REVISION_LAZY_INIT)
     {
-        puts("FsMakeFileSystem failed, couldn't write metadata to the disk.");
-        return false;
+        return offsetof(FsMeta, BitmapWatermark);
     }
-    return true;
+    return offsetof(FsMeta, Tail);
 }
 
-makefs_status_t FsMakeFileSystem(FILE* pDisk, FsMeta* pMeta, uint64_t bytesPerNodeRatio)
+uint32_t FsEncodeMeta(FsMeta* pMeta, void* pDest)
 {
-    assert(pDisk && pMeta);
-    // We need a *somewhat* reasonable ratio.
-    if (bytesPerNodeRatio < FS_MINIMUM_BLOCK_SIZE)
-    {
-        printf("FsMakeFileSystem failed, bytes per node ratio cannot be smaller than %u, but got %lu.\n", FS_MINIMUM_BLOCK_SIZE, bytesPerNodeRatio);
-        return FS_MAKE_FILE_SYSTEM_INVALID_PARAMETER;
-    }
+    // The fields of the revision are followed by Tail and Checksum.
+    uint8_t* pBytes = (uint8_t*) pDest;
+    uint32_t fieldsSize = FsiMetaFieldsSize(pMeta);
+    memcpy(pBytes, pMeta, fieldsSize);
+    memcpy(pBytes + fieldsSize, &pMeta->Tail, sizeof(uint32_t));
+    pMeta->Checksum = ChecksumCRC32(pBytes, fieldsSize + sizeof(uint32_t));
+    memcpy(pBytes + fieldsSize + sizeof(uint32_t), &pMeta->Checksum, sizeof(uint32_t));
+    return fieldsSize + 2 * sizeof(uint32_t);
+}
 
-    if (pMeta->BlockSize % FS_MINIMUM_BLOCK_SIZE)
+bool FsWriteMeta(FsDevice* pDevice, FsMeta* pMeta)
+{
+    uint8_t encoded[sizeof(FsMeta)];
+    uint32_t szEncoded = FsEncodeMeta(pMeta, encoded);
+    
+    uint64_t addrMetadata = pMeta->Origin * pMeta->BlockSize;
+    if (!FsDeviceWrite(pDevice, addrMetadata, encoded, szEncoded))
     {
-        printf("FsMakeFileSystem failed, block size must be a multiple of %u.\n", FS_MINIMUM_BLOCK_SIZE);
-        return FS_MAKE_FILE_SYSTEM_INSANE_BLOCK_SIZE;
+        printf("FsWriteMeta failed, couldn't write metadata to the disk (block %lu, raw address 0x%lx).\n", pMeta->Origin, addrMetadata);
+        return false;
     }
+    return true;
+}
 
-    uint64_t diskSize = pMeta->Size * pMeta->BlockSize;
-    ftruncate(fileno(pDisk), diskSize);
-    
+// Revision 0 layout, one bitmap, one node table and the data after it.
+static makefs_status_t FsiMakeSingleTable(FsDevice* pDevice, FsMeta* pMeta, uint64_t bytesPerNodeRatio)
+{
     pMeta->AddrBitmap = pMeta->Origin + 1;
     uint32_t trackedBlocksPerBitmapBlock = pMeta->BlockSize * 8; // Each byte can track 8 blocks.
     
@@ -78,28 +87,11 @@ makefs_status_t FsMakeFileSystem(FILE* pDisk, FsMeta* pMeta, uint64_t bytesPerNo
     // in order to cut off the bitmao itself from this size.
     bitmapSize -= bitmapSize / trackedBlocksPerBitmapBlock;
 
-    // zero the bitmap
+    // zero the bitmap, a hole as far as the device allows.
+    if (!FsDeviceZero(pDevice, pMeta->AddrBitmap * pMeta->BlockSize, bitmapSize * pMeta->BlockSize))
     {
-        uint64_t rawBitmapSize = bitmapSize * pMeta->BlockSize;
-        uint8_t* bitmap = malloc(rawBitmapSize);
-        memset(bitmap, 0, rawBitmapSize);
-
-        uint64_t bitmapAddress = pMeta->AddrBitmap * pMeta->BlockSize;
-        if (fseek(pDisk, bitmapAddress, SEEK_SET) != 0)
-        {
-            printf("FsMakeFileSystem failed, seek to bitmap address (block %lu, raw address 0x%x) failed.", pMeta->AddrBitmap, (uint32_t) bitmapAddress);
-            free(bitmap);
-            return FS_MAKE_FILE_SYSTEM_DISK_ERROR;
-        }
-        
-        if (fwrite(bitmap, 1, rawBitmapSize, pDisk) != rawBitmapSize)
-        {
-            puts("FsMakeFileSystem failed, failed to write clear bytes to the bitmap.");
-            free(bitmap);
-            return FS_MAKE_FILE_SYSTEM_DISK_ERROR;
-        }
-
-        free(bitmap);
+        puts("FsMakeFileSystem failed, failed to clear the bitmap.");
+        return FS_MAKE_FILE_SYSTEM_DISK_ERROR;
     }
 
     pMeta->AddrNodeTable = pMeta->AddrBitmap + bitmapSize;
@@ -120,6 +112,148 @@ makefs_status_t FsMakeFileSystem(FILE* pDisk, FsMeta* pMeta, uint64_t bytesPerNo
         return FS_MAKE_FILE_SYSTEM_INSUFFICIENT_DISK_SIZE;
     }
 
+    // zero the node table, whatever was on the disk before must not show up as existing nodes.
+    if (!FsDeviceZero(pDevice, pMeta->AddrNodeTable * pMeta->BlockSize, (uint64_t) nodeTableBlocks * pMeta->BlockSize))
+    {
+        puts("FsMakeFileSystem failed, failed to clear the node table.");
+        return FS_MAKE_FILE_SYSTEM_DISK_ERROR;
+    }
+
+    pMeta->NumAllocatedBlocks = pMeta->AddrNodeTable; // Up to AddrData we count everything as allocated (data before metadata block is considered allocated/reserved so we count that too).
+    return FS_MAKE_FILE_SYSTEM_SUCCESSFUL;
+}
+
+// Lays out the group table and the groups behind it, see FsGroupDescriptor. Space past the last group too short for its
+// bitmap, node table and a data block is left unused.
+static makefs_status_t FsiMakeGroups(FsDevice* pDevice, FsMeta* pMeta, uint64_t bytesPerNodeRatio)
+{
+    uint32_t nodesPerBlock = pMeta->BlockSize / FS_NODE_SIZE;
+    pMeta->BlocksPerGroup  = pMeta->BlockSize * 8; // One bitmap block per group.
+
+    uint64_t nodesPerGroup = (uint64_t) pMeta->BlocksPerGroup * pMeta->BlockSize / bytesPerNodeRatio;
+    pMeta->NodesPerGroup   = (uint32_t) FS_MAX(FS_DIV(nodesPerGroup, nodesPerBlock), 1) * nodesPerBlock;
+    uint32_t nodeTableBlocks = FsGroupNodeTableBlocks(pMeta);
+
+    // The group table is sized for every group that could start after the metadata, dropping a short last group only
+    // leaves it a little roomier than needed.
+    pMeta->AddrGroupTable = pMeta->Origin + 1;
+    pMeta->NumGroups      = (uint32_t) FS_DIV(pMeta->Size - pMeta->AddrGroupTable, pMeta->BlocksPerGroup);
+    pMeta->AddrBitmap     = pMeta->AddrGroupTable + FsGroupTableBlocks(pMeta);
+    if (pMeta->Size <= pMeta->AddrBitmap)
+    {
+        puts("FsMakeFileSystem failed, disk is too small to contain the file system with the current configuration.");
+        return FS_MAKE_FILE_SYSTEM_INSUFFICIENT_DISK_SIZE;
+    }
+
+    uint64_t remainder = (pMeta->Size - pMeta->AddrBitmap) % pMeta->BlocksPerGroup;
+    pMeta->NumGroups = (uint32_t) ((pMeta->Size - pMeta->AddrBitmap) / pMeta->BlocksPerGroup);
+    if (remainder > 1 + nodeTableBlocks)
+    {
+        pMeta->NumGroups++;
+    }
+    else
+    {
+        pMeta->Size -= remainder;
+    }
+
+    if (pMeta->NumGroups == 0)
+    {
+        puts("FsMakeFileSystem failed, disk is too small to contain the file system with the current configuration.");
+        return FS_MAKE_FILE_SYSTEM_INSUFFICIENT_DISK_SIZE;
+    }
+
+    pMeta->AddrNodeTable = FsGroupStart(pMeta, 0) + 1;
+    pMeta->AddrData      = FsGroupData(pMeta, 0);
+    pMeta->NodeCapacity  = pMeta->NumGroups * pMeta->NodesPerGroup - 1; // Node 0 is always unavailable.
+
+    pMeta->LastAllocatedDataBlock = pMeta->AddrData;
+    pMeta->LastAllocatedNodeID = FS_NODE_ID_INVALID;
+    pMeta->BitmapWatermark = 0;
+    pMeta->NodeWatermark   = FS_NODE_ID_INVALID;
+
+    // Everything before the first group counts as allocated, like the bitmap and node table of every group.
+    pMeta->NumAllocatedBlocks = pMeta->AddrBitmap + (uint64_t) pMeta->NumGroups * (1 + nodeTableBlocks);
+
+    uint64_t tableSize = FsGroupTableBlocks(pMeta) * pMeta->BlockSize;
+    FsGroupDescriptor* pTable = calloc(1, tableSize);
+    uint8_t* pHead = calloc(1, pMeta->BlockSize); // Bitmap block of a group.
+    if (!pTable || !pHead)
+    {
+        puts("FsMakeFileSystem failed, couldn't allocate memory for the group table.");
+        free(pTable);
+        free(pHead);
+        return FS_MAKE_FILE_SYSTEM_MISC_FAILURE;
+    }
+
+    makefs_status_t status = FS_MAKE_FILE_SYSTEM_SUCCESSFUL;
+    for (uint32_t group = 0; group < pMeta->NumGroups; group++)
+    {
+        uint64_t length = FsGroupEnd(pMeta, group) - FsGroupStart(pMeta, group);
+
+        nodeid_t firstNode = group * pMeta->NodesPerGroup;
+        uint32_t numReserved = firstNode <= FS_NODE_ID_ROOT ? FS_MIN(FS_NODE_ID_ROOT + 1 - firstNode, pMeta->NodesPerGroup) : 0;
+        pTable[group].FreeBlocks = (uint32_t) (length - 1 - nodeTableBlocks);
+        pTable[group].FreeNodes  = pMeta->NodesPerGroup - numReserved;
+
+        // Lazily initialized groups are left as they are, they are behind both watermarks.
+        if (FsHasLazyInit(pMeta))
+        {
+            continue;
+        }
+
+        // Only the bitmap block is written, the node table is cleared without writing anything where possible.
+        uint64_t headAddress = FsGroupStart(pMeta, group) * pMeta->BlockSize;
+        FsGroupInitBitmap(pMeta, group, pHead);
+        if (!FsDeviceWrite(pDevice, headAddress, pHead, pMeta->BlockSize) ||
+            !FsDeviceZero(pDevice, headAddress + pMeta->BlockSize, (uint64_t) nodeTableBlocks * pMeta->BlockSize))
+        {
+            printf("FsMakeFileSystem failed, couldn't write the bitmap and node table of group %u.\n", group);
+            status = FS_MAKE_FILE_SYSTEM_DISK_ERROR;
+            break;
+        }
+    }
+
+    if (status == FS_MAKE_FILE_SYSTEM_SUCCESSFUL && !FsDeviceWrite(pDevice, pMeta->AddrGroupTable * pMeta->BlockSize, pTable, tableSize))
+    {
+        puts("FsMakeFileSystem failed, couldn't write the group table.");
+        status = FS_MAKE_FILE_SYSTEM_DISK_ERROR;
+    }
+
+    free(pTable);
+    free(pHead);
+    return status;
+}
+
+makefs_status_t FsMakeFileSystem(FsDevice* pDevice, FsMeta* pMeta, uint64_t bytesPerNodeRatio)
+{
+    assert(pDevice && pMeta);
+    // We need a *somewhat* reasonable ratio.
+    if (bytesPerNodeRatio < FS_MINIMUM_BLOCK_SIZE)
+    {
+        printf("FsMakeFileSystem failed, bytes per node ratio cannot be smaller than %u, but got %lu.\n", FS_MINIMUM_BLOCK_SIZE, bytesPerNodeRatio);
+        return FS_MAKE_FILE_SYSTEM_INVALID_PARAMETER;
+    }
+
+    if (pMeta->BlockSize % FS_MINIMUM_BLOCK_SIZE)
+    {
+        printf("FsMakeFileSystem failed, block size must be a multiple of %u.\n", FS_MINIMUM_BLOCK_SIZE);
+        return FS_MAKE_FILE_SYSTEM_INSANE_BLOCK_SIZE;
+    }
+
+    uint64_t diskSize = pMeta->Size * pMeta->BlockSize;
+    if (diskSize != pDevice->Size && !FsDeviceResize(pDevice, diskSize))
+    {
+        printf("FsMakeFileSystem failed, couldn't resize the disk to %lu bytes.\n", diskSize);
+        return FS_MAKE_FILE_SYSTEM_DISK_ERROR;
+    }
+    
+    makefs_status_t layoutStatus = FsHasGroups(pMeta) ? FsiMakeGroups(pDevice, pMeta, bytesPerNodeRatio)
+                                                      : FsiMakeSingleTable(pDevice, pMeta, bytesPerNodeRatio);
+    if (layoutStatus != FS_MAKE_FILE_SYSTEM_SUCCESSFUL)
+    {
+        return layoutStatus;
+    }
+
     pMeta->ErrorState  = FS_ERROR_STATE_NORMAL;
     pMeta->ErrorAction = FS_ERROR_ACTION_NONE;
 
@@ -132,7 +266,6 @@ makefs_status_t FsMakeFileSystem(FILE* pDisk, FsMeta* pMeta, uint64_t bytesPerNo
         pMeta->UniqueID[i] = uidCharset[rand() % sizeof(FS_UNIQUE_ID_CHARSET)];
     }
     
-    pMeta->NumAllocatedBlocks = pMeta->AddrNodeTable; // Up to AddrData we count everything as allocated (data before metadata block is considered allocated/reserved so we count that too).
     pMeta->NumAllocatedNodes = 0;
     pMeta->AddrExtension = 0;
     pMeta->CreatorID = FS_CREATOR_MYTH_TOOL;
@@ -140,28 +273,25 @@ makefs_status_t FsMakeFileSystem(FILE* pDisk, FsMeta* pMeta, uint64_t bytesPerNo
     memcpy(pMeta->Header, FS_HEADER_STRING, FS_HEADER_SIZE);
     pMeta->Tail = FS_TAIL;
 
-    if (!FsWriteMeta(pDisk, pMeta))
+    // The metadata and the rest of its block go out as one write.
     {
-        puts("FsMakeFileSystem failed, couldn't write metadata to the disk.");
-        return FS_MAKE_FILE_SYSTEM_DISK_ERROR;
-    }
-    
-    {
-        uint16_t rem = pMeta->BlockSize - sizeof(FsMeta);
-        if (rem)
+        uint8_t* pMetaBlock = calloc(1, pMeta->BlockSize);
+        if (!pMetaBlock)
         {
-            uint8_t* pad = malloc(rem);
-            memset(pad, 0, rem);
-            
-            if (fwrite(pad, 1, rem, pDisk) != rem)
-            {
-                puts("FsMakeFileSystem failed, couldn't write metadata block padding to the disk.");
-                free(pad);
-                return FS_MAKE_FILE_SYSTEM_DISK_ERROR;
-            }
-            
-            free(pad);
+            puts("FsMakeFileSystem failed, couldn't allocate memory for the metadata block.");
+            return FS_MAKE_FILE_SYSTEM_MISC_FAILURE;
+        }
+
+        FsEncodeMeta(pMeta, pMetaBlock);
+
+        if (!FsDeviceWrite(pDevice, pMeta->Origin * pMeta->BlockSize, pMetaBlock, pMeta->BlockSize))
+        {
+            puts("FsMakeFileSystem failed, couldn't write metadata to the disk.");
+            free(pMetaBlock);
+            return FS_MAKE_FILE_SYSTEM_DISK_ERROR;
         }
+
+        free(pMetaBlock);
     }
 
     FsConfigChunk configChunk;
@@ -169,13 +299,7 @@ makefs_status_t FsMakeFileSystem(FILE* pDisk, FsMeta* pMeta, uint64_t bytesPerNo
     configChunk.BytesPerBlock = pMeta->BlockSize;
     configChunk.FileSystemOffset = pMeta->Origin;
 
-    if (fseek(pDisk, 0 + 2, SEEK_SET) != 0)
-    {
-        puts("FsMakeFileSystem failed, couldn't seek to Configuration Chunk on disk.");
-        return FS_MAKE_FILE_SYSTEM_DISK_ERROR;
-    }
-
-    if (fwrite(&configChunk, 1, sizeof(FsConfigChunk), pDisk) != sizeof(FsConfigChunk))
+    if (!FsDeviceWrite(pDevice, 0 + 2, &configChunk, sizeof(FsConfigChunk)))
     {
         puts("FsMakeFileSystem failed, couldn't write Configuration Chunk to disk.");
         return FS_MAKE_FILE_SYSTEM_DISK_ERROR;
@@ -184,17 +308,63 @@ makefs_status_t FsMakeFileSystem(FILE* pDisk, FsMeta* pMeta, uint64_t bytesPerNo
     return FS_MAKE_FILE_SYSTEM_SUCCESSFUL;
 }
 
-makefs_status_t FsReadFileSystem(FILE* pDisk, FsMeta* pDest)
+// Reads the metadata the configuration chunk points at and validates it.
+static makefs_status_t FsiReadMeta(FsDevice* pDevice, const FsConfigChunk* pConfigChunk, FsMeta* pDest)
 {
-    // From the disk start, jump over the JMP SHORT reserved space.
-    if (fseek(pDisk, 0 + 2, SEEK_SET) != 0)
+    uint64_t fsOffset = pConfigChunk->FileSystemOffset * pConfigChunk->BytesPerBlock;
+    uint8_t encoded[sizeof(FsMeta)];
+    if (!FsDeviceRead(pDevice, fsOffset, encoded, sizeof(FsMeta)))
     {
-        puts("FsReadFileSystem failed, couldn't seek to the magic header offset.");
+        printf("FsReadFileSystem failed, couldn't read file system metadata at offset (block %lu, raw address %lu) from disk.\n", pConfigChunk->FileSystemOffset, fsOffset);
         return FS_MAKE_FILE_SYSTEM_DISK_ERROR;
     }
+    memcpy(pDest, encoded, sizeof(FsMeta));
+
+    if (memcmp(pDest->Header, FS_HEADER_STRING, FS_HEADER_SIZE) != 0)
+    {
+        printf("FsReadFileSystem failed, metadata block lacks a proper Myth File System header. "
+               "Expected header '" FS_HEADER_STRING "', but read '%." FS_STRINGIZE(FS_HEADER_SIZE) "s'.\n",
+               pDest->Header);
+        return FS_MAKE_FILE_SYSTEM_INVALID_HEADER;
+    }
+
+    if (pDest->Revision > FS_LATEST_REVISION)
+    {
+        printf("FsReadFileSystem failed, the file system is of revision %u but Myth only knows revisions up to " FS_STRINGIZE(FS_LATEST_REVISION) ".\n",
+               pDest->Revision);
+        return FS_MAKE_FILE_SYSTEM_UNSUPPORTED_REVISION;
+    }
 
+    // Earlier revisions end earlier, the fields added since read as 0.
+    uint32_t fieldsSize = FsiMetaFieldsSize(pDest);
+    uint32_t szEncoded  = fieldsSize + 2 * sizeof(uint32_t);
+    memset((uint8_t*) pDest + fieldsSize, 0, offsetof(FsMeta, Tail) - fieldsSize);
+    memcpy(&pDest->Tail, encoded + fieldsSize, sizeof(uint32_t));
+    memcpy(&pDest->Checksum, encoded + fieldsSize + sizeof(uint32_t), sizeof(uint32_t));
+
+    if (pDest->Tail != FS_TAIL)
+    {
+        printf("FsReadFileSystem failed, metadata block contains an invalid Myth File System tail value. "
+               "Expected tail value '" FS_STRINGIZE(FS_TAIL) "', but read '%x'.\n", pDest->Tail);
+        return FS_MAKE_FILE_SYSTEM_INVALID_TAIL;
+    }
+
+    uint32_t checksum = ChecksumCRC32(encoded, szEncoded - sizeof(uint32_t));
+    if (pDest->Checksum != checksum)
+    {
+        printf("FsReadFileSystem failed, metadata checksum doesn't match with the freshly calculated checksum value for the block. "
+               "Metadata block has checksum %u, but calculated checksum was %u.\n", pDest->Checksum, checksum);
+        return FS_MAKE_FILE_SYSTEM_INVALID_CHECKSUM;
+    }
+    
+    return FS_MAKE_FILE_SYSTEM_SUCCESSFUL;
+}
+
+makefs_status_t FsReadFileSystem(FsDevice* pDevice, FsMeta* pDest)
+{
+    // From the disk start, jump over the JMP SHORT reserved space.
     FsConfigChunk configChunk;
-    if (fread(&configChunk, 1, sizeof(FsConfigChunk), pDisk) != sizeof(FsConfigChunk))
+    if (!FsDeviceRead(pDevice, 0 + 2, &configChunk, sizeof(FsConfigChunk)))
     {
         puts("FsReadFileSystem failed, failed to read Configuration Chunk from disk.");
         return FS_MAKE_FILE_SYSTEM_DISK_ERROR;
@@ -209,77 +379,339 @@ makefs_status_t FsReadFileSystem(FILE* pDisk, FsMeta* pDest)
         return FS_MAKE_FILE_SYSTEM_INVALID_CONFIGURATION_HEADER;
     }
 
-    uint64_t fsOffset = configChunk.FileSystemOffset * configChunk.BytesPerBlock;
-    if (fseek(pDisk, fsOffset, SEEK_SET) != 0)
+    makefs_status_t status = FsiReadMeta(pDevice, &configChunk, pDest);
+    if (status != FS_MAKE_FILE_SYSTEM_SUCCESSFUL || !(pDest->Flags & FS_FLAG_JOURNALED))
     {
-        printf("FsReadFileSystem failed, couldn't seek to file system at offset (block %lu, raw address %lu) on disk.\n", configChunk.FileSystemOffset, fsOffset);
-        return FS_MAKE_FILE_SYSTEM_DISK_ERROR;
+        return status;
     }
 
-    if (fread(pDest, 1, sizeof(FsMeta), pDisk) != sizeof(FsMeta))
+    int64_t replayed = FsJournalReplay(pDevice, pDest, pDevice->bWritable);
+    if (replayed < 0)
     {
-        printf("FsReadFileSystem failed, couldn't read file system metadata at offset (block %lu, raw address %lu) from disk.\n", configChunk.FileSystemOffset, fsOffset);
-        return FS_MAKE_FILE_SYSTEM_DISK_ERROR;
+        puts("FsReadFileSystem failed, couldn't replay the journal.");
+        return FS_MAKE_FILE_SYSTEM_JOURNAL_ERROR;
+    }
+    if (replayed && !pDevice->bWritable)
+    {
+        return FS_MAKE_FILE_SYSTEM_JOURNAL_PENDING;
     }
 
-    if (memcmp(pDest->Header, FS_HEADER_STRING, FS_HEADER_SIZE) != 0)
+    // The metadata block is part of most transactions, what was read before the replay may be outdated.
+    return replayed ? FsiReadMeta(pDevice, &configChunk, pDest) : FS_MAKE_FILE_SYSTEM_SUCCESSFUL;
+}
+
+// First step of a commit with FS_ORDERING_SAFE, puts the new allocations and raised watermarks onto the disk ahead of
+// the node table and pointer blocks depending on them.
+static bool FsiCommitAllocations(FileSystemOnDisk* pFs)
+{
+    bool bWrote;
+    if (!FsBitmapCacheFlushAllocations(pFs->pDevice, &pFs->Meta, &pFs->Bitmap, &bWrote))
     {
-        printf("FsReadFileSystem failed, metadata block lacks a proper Myth File System header. "
-               "Expected header '" FS_HEADER_STRING "', but read '%." FS_STRINGIZE(FS_HEADER_SIZE) "s'.\n",
-               pDest->Header);
-        return FS_MAKE_FILE_SYSTEM_INVALID_HEADER;
+        puts("FsCommit failed, couldn't write the new allocations to the bitmap.");
+        return false;
     }
 
-    if (pDest->Tail != FS_TAIL)
+    // Also orders the data blocks written since the last commit before the blocks pointing at them.
+    bool bRaised = pFs->Meta.BitmapWatermark != pFs->CommittedMeta.BitmapWatermark ||
+                   pFs->Meta.NodeWatermark != pFs->CommittedMeta.NodeWatermark;
+    if ((bWrote || bRaised || pFs->Cache.NumDirty) && !FsDeviceSync(pFs->pDevice))
     {
-        printf("FsReadFileSystem failed, metadata block contains an invalid Myth File System tail value. "
-               "Expected tail value '" FS_STRINGIZE(FS_TAIL) "', but read '%x'.\n", pDest->Tail);
-        return FS_MAKE_FILE_SYSTEM_INVALID_TAIL;
+        puts("FsCommit failed, couldn't flush the disk.");
+        return false;
     }
 
-    uint32_t checksum = ChecksumCRC32(pDest, sizeof(FsMeta) - sizeof(uint32_t));
-    if (pDest->Checksum != checksum)
+    // Raised watermarks go out with the committed metadata ahead of the nodes, otherwise the nodes and blocks
+    // past the old ones would be ignored after a crash while directories already refer to them.
+    if (bRaised)
     {
-        printf("FsReadFileSystem failed, metadata checksum doesn't match with the freshly calculated checksum value for the block. "
-               "Metadata block has checksum %u, but calculated checksum was %u.\n", pDest->Checksum, checksum);
-        return FS_MAKE_FILE_SYSTEM_INVALID_CHECKSUM;
+        FsMeta raised = pFs->CommittedMeta;
+        raised.BitmapWatermark = pFs->Meta.BitmapWatermark;
+        raised.NodeWatermark   = pFs->Meta.NodeWatermark;
+        if (!FsWriteMeta(pFs->pDevice, &raised) || !FsDeviceSync(pFs->pDevice))
+        {
+            puts("FsCommit failed, couldn't write the raised watermarks.");
+            return false;
+        }
+        pFs->CommittedMeta = raised;
     }
-    
-    return FS_MAKE_FILE_SYSTEM_SUCCESSFUL;
+
+    return true;
+}
+
+// Steal hook of the block cache. Without a journal an evicted block is written home before the commit, so with
+// FS_ORDERING_SAFE the first step of the commit is done ahead of it.
+static bool FsiBlockCacheSteal(FsBlockCache* pCache)
+{
+    // The cache is only ever set up as part of a file system.
+    FileSystemOnDisk* pFs = (FileSystemOnDisk*) ((uint8_t*) pCache - offsetof(FileSystemOnDisk, Cache));
+    if (pFs->Journal.Start || pFs->Ordering != FS_ORDERING_SAFE)
+    {
+        return true;
+    }
+
+    FsGroupUpdateWatermark(pFs);
+    return FsiCommitAllocations(pFs);
+}
+
+// Commits within a batch happen once the dirty blocks would otherwise crowd the clean ones out of the cache and every
+// eviction had to go through FsiBlockCacheSteal. A journal commits whenever it would be outgrown as well.
+static bool FsiBatchWantsCommit(FileSystemOnDisk* pFs)
+{
+    if (pFs->Journal.Start)
+    {
+        return FsJournalWantsCommit(&pFs->Journal, &pFs->Cache);
+    }
+    return pFs->Ordering == FS_ORDERING_SAFE && pFs->Cache.NumDirty >= pFs->Cache.Capacity / 2;
 }
 
-FileSystemOnDisk FsLoadFileSystemOnDisk(const char* pDiskPath)
+FileSystemOnDisk FsLoadFileSystemOnDisk(const char* pDiskPath, uint32_t cacheBlocks, bool bWritable)
 {
     FileSystemOnDisk result;
     memset(&result, 0, sizeof(FileSystemOnDisk));
     
-    if (!(result.pDisk = fopen(pDiskPath, "rb")))
+    if (!(result.pDevice = FsOpenDevice(pDiskPath, bWritable, FS_DEVICE_BACKEND_AUTO)))
     {
         printf("FsLoadFileSystemOnDisk fail, couldn't open disk from path '%s'.\n", pDiskPath);
         return result;
     }
 
-    makefs_status_t loadStatus = FsReadFileSystem(result.pDisk, &result.Meta);
+    makefs_status_t loadStatus = FsReadFileSystem(result.pDevice, &result.Meta);
+    if (loadStatus == FS_MAKE_FILE_SYSTEM_JOURNAL_PENDING)
+    {
+        // Replayed through a second, writable device, the read-only one is opened again afterwards so it sees the result.
+        FsCloseDevice(result.pDevice);
+        result.pDevice = NULL;
+
+        FsDevice* pReplayDevice = FsOpenDevice(pDiskPath, true, FS_DEVICE_BACKEND_AUTO);
+        if (!pReplayDevice)
+        {
+            printf("FsLoadFileSystemOnDisk failed, the journal of '%s' has transactions to replay but the disk can't be written.\n", pDiskPath);
+            memset(&result.Meta, 0, sizeof(FsMeta));
+            return result;
+        }
+        loadStatus = FsReadFileSystem(pReplayDevice, &result.Meta);
+        FsCloseDevice(pReplayDevice);
+
+        if (loadStatus == FS_MAKE_FILE_SYSTEM_SUCCESSFUL)
+        {
+            if (!(result.pDevice = FsOpenDevice(pDiskPath, false, FS_DEVICE_BACKEND_AUTO)))
+            {
+                printf("FsLoadFileSystemOnDisk fail, couldn't open disk from path '%s'.\n", pDiskPath);
+                memset(&result.Meta, 0, sizeof(FsMeta));
+                return result;
+            }
+            loadStatus = FsReadFileSystem(result.pDevice, &result.Meta);
+        }
+    }
     if (loadStatus != FS_MAKE_FILE_SYSTEM_SUCCESSFUL)
     {
         printf("FsLoadFileSystemOnDisk failed, FsReadFileSystem returned code %u (%s).\n", loadStatus, FsMakeFsStatusToString(loadStatus));
         
-        fclose(result.pDisk);
-        result.pDisk = NULL;
+        FsCloseDevice(result.pDevice);
+        result.pDevice = NULL;
         memset(&result.Meta, 0, sizeof(FsMeta));
         
         return result;
     }
 
+    if (!FsBitmapCacheLoad(result.pDevice, &result.Meta, &result.Bitmap))
+    {
+        puts("FsLoadFileSystemOnDisk failed, couldn't load the bitmap.");
+
+        FsCloseDevice(result.pDevice);
+        result.pDevice = NULL;
+        memset(&result.Meta, 0, sizeof(FsMeta));
+
+        return result;
+    }
+
+    if (!FsBlockCacheInit(&result.Cache, result.pDevice, result.Meta.BlockSize, cacheBlocks))
+    {
+        puts("FsLoadFileSystemOnDisk failed, couldn't set up the block cache.");
+
+        FsBitmapCacheRelease(&result.Bitmap);
+        FsCloseDevice(result.pDevice);
+        result.pDevice = NULL;
+        memset(&result.Meta, 0, sizeof(FsMeta));
+
+        return result;
+    }
+
+    if (!FsDentryCacheInit(&result.Dentries, 0))
+    {
+        puts("FsLoadFileSystemOnDisk failed, couldn't set up the dentry cache.");
+
+        FsBlockCacheRelease(&result.Cache);
+        FsBitmapCacheRelease(&result.Bitmap);
+        FsCloseDevice(result.pDevice);
+        result.pDevice = NULL;
+        memset(&result.Meta, 0, sizeof(FsMeta));
+
+        return result;
+    }
+
+    if (!FsNodeIndexInit(&result.Nodes, &result.Meta))
+    {
+        puts("FsLoadFileSystemOnDisk failed, couldn't set up the node index.");
+
+        FsDentryCacheRelease(&result.Dentries);
+        FsBlockCacheRelease(&result.Cache);
+        FsBitmapCacheRelease(&result.Bitmap);
+        FsCloseDevice(result.pDevice);
+        result.pDevice = NULL;
+        memset(&result.Meta, 0, sizeof(FsMeta));
+
+        return result;
+    }
+
+    if ((result.Meta.Flags & FS_FLAG_JOURNALED) && !FsJournalOpen(&result.Journal, result.pDevice, &result.Meta))
+    {
+        puts("FsLoadFileSystemOnDisk failed, couldn't open the journal.");
+
+        FsNodeIndexRelease(&result.Nodes);
+        FsDentryCacheRelease(&result.Dentries);
+        FsBlockCacheRelease(&result.Cache);
+        FsBitmapCacheRelease(&result.Bitmap);
+        FsCloseDevice(result.pDevice);
+        result.pDevice = NULL;
+        memset(&result.Meta, 0, sizeof(FsMeta));
+
+        return result;
+    }
+    result.Cache.bNoSteal  = true;
+    result.Cache.StealHook = FsiBlockCacheSteal;
+    result.CommittedMeta  = result.Meta;
+    result.Ordering       = FS_ORDERING_SAFE;
+
     result.bLoaded = true;
     return result;
 }
 
-void FsCloseDisk(FileSystemOnDisk fsOnDisk)
+bool FsCommit(FileSystemOnDisk* pFs)
+{
+    bool bJournaled = pFs->Journal.Start != 0;
+    if (pFs->BatchDepth && !FsiBatchWantsCommit(pFs))
+    {
+        return true;
+    }
+
+    if (!FsGroupUpdateFreeBlocks(pFs))
+    {
+        puts("FsCommit failed, couldn't update the group descriptors.");
+        return false;
+    }
+    FsGroupUpdateWatermark(pFs);
+
+    // Most commits leave the metadata as it was, it's neither checksummed nor written then.
+    bool bMetaDirty = memcmp(&pFs->Meta, &pFs->CommittedMeta, offsetof(FsMeta, Checksum)) != 0;
+
+    if (bJournaled)
+    {
+        if (!FsJournalCommit(&pFs->Journal, pFs->pDevice, &pFs->Meta, &pFs->Cache, &pFs->Bitmap, bMetaDirty))
+        {
+            puts("FsCommit failed, couldn't commit to the journal.");
+            return false;
+        }
+
+        pFs->CommittedMeta = pFs->Meta;
+        return true;
+    }
+
+    bool bSafe = pFs->Ordering == FS_ORDERING_SAFE;
+    if (bSafe && !FsiCommitAllocations(pFs))
+    {
+        return false;
+    }
+
+    // Node table and pointer blocks go first so the metadata never describes something that isn't on the disk yet.
+    bool bNodesWritten = pFs->Cache.NumDirty != 0;
+    if (!FsBlockCacheFlush(&pFs->Cache))
+    {
+        puts("FsCommit failed, couldn't write back the cached blocks.");
+        return false;
+    }
+
+    if (bSafe && bNodesWritten && (pFs->Bitmap.NumDirty || bMetaDirty) && !FsDeviceSync(pFs->pDevice))
+    {
+        puts("FsCommit failed, couldn't flush the disk.");
+        return false;
+    }
+
+    if (!FsBitmapCacheFlush(pFs->pDevice, &pFs->Meta, &pFs->Bitmap))
+    {
+        puts("FsCommit failed, couldn't write back the bitmap.");
+        return false;
+    }
+
+    if (bMetaDirty)
+    {
+        if (!FsWriteMeta(pFs->pDevice, &pFs->Meta))
+        {
+            puts("FsCommit failed, couldn't write the metadata.");
+            return false;
+        }
+        pFs->CommittedMeta = pFs->Meta;
+    }
+
+    return true;
+}
+
+void FsBeginBatch(FileSystemOnDisk* pFs)
+{
+    pFs->BatchDepth++;
+}
+
+bool FsEndBatch(FileSystemOnDisk* pFs)
+{
+    if (pFs->BatchDepth == 0)
+    {
+        puts("FsEndBatch failed, there is no open batch.");
+        return false;
+    }
+
+    return --pFs->BatchDepth ? true : FsCommit(pFs);
+}
+
+bool FsSync(FileSystemOnDisk* pFs)
 {
-    if (fsOnDisk.bLoaded && fsOnDisk.pDisk)
+    if (!FsCommit(pFs))
     {
-        fclose(fsOnDisk.pDisk);
-        fsOnDisk.pDisk = NULL;
+        return false;
+    }
+
+    if (!FsDeviceSync(pFs->pDevice))
+    {
+        puts("FsSync failed, couldn't flush the disk.");
+        return false;
+    }
+
+    return true;
+}
+
+void FsCloseDisk(FileSystemOnDisk* pFs)
+{
+    if (pFs->bLoaded && pFs->pDevice)
+    {
+        // A batch left open is closed here so its changes aren't lost.
+        pFs->BatchDepth = 0;
+
+        if (pFs->pDevice->bWritable && (pFs->Cache.NumDirty || pFs->Bitmap.NumDirty || pFs->Journal.Head > 1))
+        {
+            // Leaving nothing to replay keeps the image usable by readers that don't know about the journal.
+            if (FsSync(pFs) && pFs->Journal.Start)
+            {
+                FsJournalCheckpoint(&pFs->Journal, pFs->pDevice, &pFs->Meta, &pFs->Cache, &pFs->Bitmap);
+            }
+        }
+
+        FsJournalRelease(&pFs->Journal);
+
+        FsNodeIndexRelease(&pFs->Nodes);
+        FsDentryCacheRelease(&pFs->Dentries);
+        FsBlockCacheRelease(&pFs->Cache);
+        FsBitmapCacheRelease(&pFs->Bitmap);
+        FsCloseDevice(pFs->pDevice);
+        pFs->pDevice = NULL;
+        pFs->bLoaded = false;
     }
 }
@@ -2,8 +2,13 @@
 #define MYTH_DISK_H
 
 #include "FileSystem.h"
+#include "Bitmap.h"
+#include "Device.h"
+#include "BlockCache.h"
+#include "DentryCache.h"
+#include "NodeIndex.h"
+#include "Journal.h"
 
-#include <stdio.h>
 #include <stdbool.h>
 
 typedef enum
@@ -17,24 +22,78 @@ typedef enum
     FS_MAKE_FILE_SYSTEM_INVALID_HEADER,
     FS_MAKE_FILE_SYSTEM_INVALID_TAIL,
     FS_MAKE_FILE_SYSTEM_INVALID_CHECKSUM,
-    FS_MAKE_FILE_SYSTEM_INVALID_CONFIGURATION_HEADER
+    FS_MAKE_FILE_SYSTEM_INVALID_CONFIGURATION_HEADER,
+    FS_MAKE_FILE_SYSTEM_JOURNAL_ERROR,
+    FS_MAKE_FILE_SYSTEM_UNSUPPORTED_REVISION,
+    FS_MAKE_FILE_SYSTEM_JOURNAL_PENDING // The journal has transactions to replay but the device was opened read-only.
 } makefs_status_t;
 const char* FsMakeFsStatusToString(makefs_status_t status);
 
+// Lays pMeta out the way its Revision stores it on the disk, at most sizeof(FsMeta) bytes, and updates its Checksum.
+// Returns the number of bytes written to pDest.
+uint32_t FsEncodeMeta(FsMeta* pMeta, void* pDest);
+
 // Rewrites the pMeta. Useful when a field is changed and changes have to be replicated to disk.
-bool FsWriteMeta(FILE* pDisk, FsMeta* pMeta);
+bool FsWriteMeta(FsDevice* pDevice, FsMeta* pMeta);
 
-makefs_status_t FsMakeFileSystem(FILE* pDisk, FsMeta* pMeta, uint64_t bytesPerNodeRatio);
-makefs_status_t FsReadFileSystem(FILE* pDisk, FsMeta* pDest);
+makefs_status_t FsMakeFileSystem(FsDevice* pDevice, FsMeta* pMeta, uint64_t bytesPerNodeRatio);
+// Reads and validates the metadata. A journaled file system has its journal replayed first, on a device opened
+// read-only that fails with FS_MAKE_FILE_SYSTEM_JOURNAL_PENDING unless there is nothing to replay.
+makefs_status_t FsReadFileSystem(FsDevice* pDevice, FsMeta* pDest);
+
+typedef enum
+{
+    FS_ORDERING_SAFE    = 0, // Commits wait for the device between their steps, a crash can only leak blocks. See FsCommit.
+    FS_ORDERING_RELAXED = 1  // Commits hand everything to the device at once, a crash may leave any part of them on the disk.
+} commit_ordering_t;
 
 typedef struct
 {
-    FILE*   pDisk;
-    FsMeta  Meta;
-    bool    bLoaded;
+    FsDevice*           pDevice;
+    FsMeta              Meta;             // Updated in memory only, a commit writes it once if it changed.
+    FsMeta              CommittedMeta;    // Meta as of the last commit, what's on the disk or in the journal.
+    FsBitmapCache       Bitmap;
+    FsBlockCache        Cache;            // Node table and pointer blocks, data blocks bypass it.
+    FsDentryCache       Dentries;         // Names resolved by FsResolvePath, kept up to date by the directory functions.
+    FsNodeIndex         Nodes;            // Which node IDs are in use, kept up to date by FsMakeNode.
+    FsJournal           Journal;          // Start is 0 unless the file system is journaled.
+    allocation_policy_t AllocationPolicy; // How runs of data blocks are picked, FS_ALLOCATION_FIRST_FIT unless changed by the caller.
+    commit_ordering_t   Ordering;         // FS_ORDERING_SAFE unless changed by the caller, unused when journaled.
+    uint32_t            BatchDepth;       // Nonzero while a batch is open, FsCommit does nothing until the outermost batch ends.
+    bool                bLoaded;
 } FileSystemOnDisk;
 
-FileSystemOnDisk FsLoadFileSystemOnDisk(const char* pDiskPath);
-void FsCloseDisk(FileSystemOnDisk fsOnDisk);
+// Loads the file system with a block cache of cacheBlocks blocks, 0 picks FS_BLOCK_CACHE_DEFAULT_BLOCKS. Without
+// bWritable the disk is opened read-only, every commit fails and closing it writes nothing. A journal left with
+// transactions to replay is still replayed if the disk can be written, the load fails if it can't.
+FileSystemOnDisk FsLoadFileSystemOnDisk(const char* pDiskPath, uint32_t cacheBlocks, bool bWritable);
+
+// Writes back every dirty cached block, every dirty bitmap block and then the metadata, the metadata only if it changed.
+// Leaves the file system consistent on disk. A journaled file system logs them as one transaction instead and writes
+// them home later, see Journal.h.
+//
+// With FS_ORDERING_SAFE the writes happen in three steps separated by device flushes. First the bitmap blocks with the
+// new allocations added but freed blocks still marked, then the node table and pointer blocks, last the freed bits and
+// the metadata. Data blocks are written before the commit starts, so at any point of a crash every block a node points
+// to is on the disk and marked allocated. A block the cache has to evict before its commit gets the first step done
+// ahead of it. The worst outcome is blocks that stay allocated without being used and free counters that lag behind,
+// both of which Verify reports.
+bool FsCommit(FileSystemOnDisk* pFs);
+
+// Batches group many operations under a single commit. While one is open the commits done by the node functions are
+// skipped, the outermost FsEndBatch commits everything at once. Batches nest. A long batch still commits every now and
+// then, whenever half the cache is dirty with FS_ORDERING_SAFE or FsJournalWantsCommit says the journal would be
+// outgrown otherwise.
+void FsBeginBatch(FileSystemOnDisk* pFs);
+bool FsEndBatch(FileSystemOnDisk* pFs);
+
+// Commits and then flushes the device to stable storage.
+bool FsSync(FileSystemOnDisk* pFs);
+
+// Syncs any pending changes, checkpoints the journal and closes the disk.
+void FsCloseDisk(FileSystemOnDisk* pFs);
+
+// Creates the journal node with numBlocks contiguous blocks and turns journaling on. Meant for freshly made file systems.
+bool FsCreateJournal(FileSystemOnDisk* pFs, uint32_t numBlocks);
 
 #endif // MYTH_DISK_H
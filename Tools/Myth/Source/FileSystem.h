@@ -37,8 +37,12 @@
 #define FS_INITIAL_MAJOR    UINT16_C(1)
 #define FS_LATEST_MAJOR     FS_INITIAL_MAJOR
 
-#define FS_INITIAL_REVISION UINT16_C(0)
-#define FS_LATEST_REVISION  FS_INITIAL_REVISION
+#define FS_INITIAL_REVISION            UINT16_C(0)
+#define FS_REVISION_ALLOCATION_GROUPS  UINT16_C(1) // The volume is split into groups, see FsGroupDescriptor.
+#define FS_REVISION_LAZY_INIT          UINT16_C(2) // Group bitmaps and node tables are written once used, see BitmapWatermark.
+#define FS_REVISION_HOLES              UINT16_C(3) // Zero pointers within the data of file nodes are holes reading as zeroes.
+#define FS_REVISION_COMPRESSION        UINT16_C(4) // File nodes may store their data compressed, see FS_NODE_FLAG_COMPRESSED.
+#define FS_LATEST_REVISION             FS_REVISION_COMPRESSION
 
 typedef uint32_t nodeid_t;
 typedef uint64_t block_t;
@@ -80,19 +84,51 @@ typedef struct __attribute__((packed))
     block_t   AddrExtension; // Currently no fs size extension support, reserved for future.
     nodeid_t  LastAllocatedNodeID;
     block_t   LastAllocatedDataBlock;
+    // FS_REVISION_ALLOCATION_GROUPS onwards, revision 0 metadata ends before these and they read as 0.
+    uint32_t  BlocksPerGroup;
+    uint32_t  NodesPerGroup;
+    uint32_t  NumGroups;
+    block_t   AddrGroupTable;
+    // FS_REVISION_LAZY_INIT onwards, earlier revisions end before these and have every bitmap and node table written.
+    uint32_t  BitmapWatermark; // Groups whose bitmap block is on the disk, the bitmap of every later group is implied.
+    nodeid_t  NodeWatermark;   // Node IDs whose node table slot is on the disk, every later slot is unused.
     uint32_t  Tail;
     uint32_t  Checksum; // Checksum of all member variables before itself, uses CRC32.
 } FsMeta;
 
+// Revision 0 lays out one bitmap (AddrBitmap) tracking every block from AddrNodeTable on, one node table (AddrNodeTable)
+// and the data (AddrData) after each other. From FS_REVISION_ALLOCATION_GROUPS on the blocks after the group table are
+// split into NumGroups groups of BlocksPerGroup blocks, BlockSize * 8 so one bitmap block tracks exactly one group, the
+// last group may be shorter. Every group starts with its bitmap block, followed by the node table blocks holding its
+// NodesPerGroup nodes and its data blocks. Node ID n lives in group n / NodesPerGroup. The group bitmaps track the
+// blocks of their own group, its bitmap and node table blocks included, which are always set. AddrBitmap, AddrNodeTable
+// and AddrData describe the first group then.
+//
+// From FS_REVISION_LAZY_INIT on nothing of a group is written when the file system is made. Whatever the disk holds at
+// or past a watermark is never read: the bitmap of group BitmapWatermark and later ones is taken to have only the
+// group's own bitmap and node table blocks set, node IDs from NodeWatermark on are unused. The watermarks only grow,
+// each time by zeroing or writing out what they pass over, so the cost of both follows what is in use.
+typedef struct __attribute__((packed))
+{
+    uint32_t FreeBlocks; // Clear bits of the group bitmap.
+    uint32_t FreeNodes;  // Unused nodes of the group. Node IDs up to FS_NODE_ID_ROOT are reserved and never count as free.
+    uint32_t Flags;      // None defined yet.
+    uint32_t Reserved;
+} FsGroupDescriptor;
+
+#define FS_FLAG_JOURNALED UINT32_C(1) // Metadata changes go through the journal kept in node FS_NODE_ID_JOURNAL.
+
 #define FS_NODE_TYPE_FILE      UINT16_C(1)
 #define FS_NODE_TYPE_DIRECTORY UINT16_C(2)
 #define FS_NODE_TYPE_SOFT_LINK UINT16_C(3)
 #define FS_NODE_TYPE_HARD_LINK UINT16_C(4) // Not yet implemented.
 
-#define FS_NODE_FLAG_CLEAR     UINT32_C(0)
-#define FS_NODE_FLAG_SYSTEM    UINT32_C(1)
-#define FS_NODE_FLAG_READ_ONLY UINT32_C(1 << 1)
-#define FS_NODE_FLAG_HIDDEN    UINT32_C(1 << 2)
+#define FS_NODE_FLAG_CLEAR      UINT32_C(0)
+#define FS_NODE_FLAG_SYSTEM     UINT32_C(1)
+#define FS_NODE_FLAG_READ_ONLY  UINT32_C(1 << 1)
+#define FS_NODE_FLAG_HIDDEN     UINT32_C(1 << 2)
+#define FS_NODE_FLAG_INDEXED    UINT32_C(1 << 3) // Directory data is a hashed index (FsDirectoryIndex) instead of a plain list of entries.
+#define FS_NODE_FLAG_COMPRESSED UINT32_C(1 << 4) // File data past the inline section is stored in compressed clusters, see FsClusterHeader.
 
 #define FS_NODE_INLINE_DATA_SIZE   64
 #define FS_NODE_DIRECT_DATA_BLOCKS 12
@@ -115,6 +151,8 @@ typedef struct __attribute__((packed))
                      // any negative value = group id when turned positive.
     uint32_t  HardLinkCount; // Hard links aren't implemented as of now. For future usage.
     uint8_t   InlineData[FS_NODE_INLINE_DATA_SIZE];
+    // From FS_REVISION_HOLES on a zero data block pointer or indirect block pointer of a file node is a hole, the blocks
+    // it would cover read as zeroes and take no space. The journal node and directories never have holes.
     block_t   DirectData[FS_NODE_DIRECT_DATA_BLOCKS];
     block_t   AddrSinglyIndirect;
     block_t   AddrDoublyIndirect;
@@ -133,6 +171,80 @@ typedef struct __attribute__((packed))
     // FROM offsetof(FsEntry, NameLength) TO offsetof(FsEntry, NameLength) + NameLength = ENTRY_NAME.
 } FsEntry;
 
+#define FS_DIRECTORY_HASH_VERSION UINT8_C(1)
+
+// Directories whose entries don't fit into the inline section and one data block are kept as a hashed index. Their data
+// starts with this structure in the inline section, logical data block 0 is the root index block and every other block
+// is either an index block or a leaf block. Size is always FS_NODE_INLINE_DATA_SIZE plus a whole number of blocks.
+typedef struct __attribute__((packed))
+{
+    uint8_t  HashVersion; // Hash function the index was built with, FS_DIRECTORY_HASH_VERSION.
+    uint8_t  Depth;       // Levels of index blocks below the root, 0 means the root points at leaf blocks directly.
+    uint16_t Reserved;
+    uint32_t NumEntries;  // Entries within every leaf block combined.
+} FsDirectoryIndex;
+
+// Starts every index block, the root included, and is followed by Limit FsIndexEntry slots.
+typedef struct __attribute__((packed))
+{
+    uint16_t Count; // Slots in use, sorted by Hash. The first slot's Hash is the lowest hash the block covers.
+    uint16_t Limit; // Slots that fit into the block.
+    uint32_t Reserved;
+} FsIndexHeader;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t Hash;  // Lowest name hash routed through this slot, up to the next slot's Hash.
+    uint32_t Block; // Logical data block of the index or leaf block the slot points to.
+} FsIndexEntry;
+
+// Starts every leaf block and is followed by UsedBytes worth of FsEntry records.
+typedef struct __attribute__((packed))
+{
+    uint16_t UsedBytes;
+    uint16_t NumEntries;
+} FsLeafHeader;
+
+#define FS_CLUSTER_SIZE (UINT32_C(64) << 10) // Bytes of data compressed as a unit, whole blocks of it and at least one.
+
+// The data of a compressed node past the inline section is split into clusters of FS_CLUSTER_SIZE rounded down to whole
+// blocks, the last one may be shorter. Cluster n keeps the logical data blocks its data would occupy uncompressed, and
+// how many of them are present, counting from its first one, tells how it is stored:
+//  - None, every byte of the cluster is zero.
+//  - All of them, the data didn't compress by a whole block and is stored as is.
+//  - Fewer, they start with this header followed by the compressed data (Utils/Lz.h), the rest are holes.
+// A read of any byte of the cluster reads and decompresses the cluster and nothing else.
+typedef struct __attribute__((packed))
+{
+    uint32_t PackedSize; // Bytes of compressed data following the header.
+} FsClusterHeader;
+
+#define FS_JOURNAL_MAGIC_HEADER     UINT32_C(0x4C4E524A) // "JRNL"
+#define FS_JOURNAL_MAGIC_DESCRIPTOR UINT32_C(0x4353444A) // "JDSC"
+#define FS_JOURNAL_MAGIC_COMMIT     UINT32_C(0x4D4D434A) // "JCMM"
+
+// The journal is the data of node FS_NODE_ID_JOURNAL, every one of its data blocks is physically contiguous. Its first
+// block starts with this header, transactions are laid out one after another from the second block onwards.
+typedef struct __attribute__((packed))
+{
+    uint32_t Magic;     // FS_JOURNAL_MAGIC_HEADER.
+    uint32_t NumBlocks; // Journal blocks, this one included.
+    uint64_t Sequence;  // Sequence number of the transaction replay expects at the second block.
+    uint32_t Checksum;  // CRC32 of the members before itself.
+} FsJournalHeader;
+
+// A transaction is one or more descriptor blocks, the block images they describe and a commit block. Each descriptor
+// block starts with this record and is followed by the home addresses (block_t) of the images, in image order. The commit
+// block holds a single record whose Checksum covers every descriptor block and image of the transaction. A transaction
+// without a valid commit block, or with an unexpected sequence number, ends the journal.
+typedef struct __attribute__((packed))
+{
+    uint32_t Magic;     // FS_JOURNAL_MAGIC_DESCRIPTOR or FS_JOURNAL_MAGIC_COMMIT.
+    uint64_t Sequence;
+    uint32_t NumImages; // Block images in the whole transaction.
+    uint32_t Checksum;  // Commit records only.
+} FsJournalRecord;
+
 const char* FsCreatorIDToString(uint8_t ID);
 const char* FsErrorStateToString(uint8_t state);
 const char* FsErrorActionToString(uint8_t action);
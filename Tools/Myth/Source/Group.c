@@ -0,0 +1,177 @@
+#include "Group.h"
+
+#include "Utils/Math.h"
+
+#include <stdio.h>
+#include <string.h>
+
+bool FsHasGroups(const FsMeta* pMeta)
+{
+    return pMeta->Revision >= FS_REVISION_ALLOCATION_GROUPS;
+}
+
+bool FsHasLazyInit(const FsMeta* pMeta)
+{
+    return pMeta->Revision >= FS_REVISION_LAZY_INIT;
+}
+
+uint32_t FsGroupNodeTableBlocks(const FsMeta* pMeta)
+{
+    return pMeta->NodesPerGroup / (pMeta->BlockSize / FS_NODE_SIZE);
+}
+
+uint64_t FsGroupTableBlocks(const FsMeta* pMeta)
+{
+    return FS_DIV((uint64_t) pMeta->NumGroups * sizeof(FsGroupDescriptor), pMeta->BlockSize);
+}
+
+block_t FsGroupStart(const FsMeta* pMeta, uint32_t group)
+{
+    // The first group begins at the first block the bitmap tracks, AddrBitmap points at the bitmap block of group 0.
+    return pMeta->AddrBitmap + (block_t) group * pMeta->BlocksPerGroup;
+}
+
+block_t FsGroupData(const FsMeta* pMeta, uint32_t group)
+{
+    return FsGroupStart(pMeta, group) + 1 + FsGroupNodeTableBlocks(pMeta);
+}
+
+block_t FsGroupEnd(const FsMeta* pMeta, uint32_t group)
+{
+    return FS_MIN(FsGroupStart(pMeta, group) + pMeta->BlocksPerGroup, pMeta->Size);
+}
+
+uint32_t FsGroupOfBlock(const FsMeta* pMeta, block_t block)
+{
+    return block < pMeta->AddrBitmap ? 0 : (uint32_t) ((block - pMeta->AddrBitmap) / pMeta->BlocksPerGroup);
+}
+
+uint32_t FsGroupOfNode(const FsMeta* pMeta, nodeid_t nodeID)
+{
+    return nodeID / pMeta->NodesPerGroup;
+}
+
+void FsGroupInitBitmap(const FsMeta* pMeta, uint32_t group, uint8_t* pBlock)
+{
+    uint64_t length = FsGroupEnd(pMeta, group) - FsGroupStart(pMeta, group);
+
+    memset(pBlock, 0, pMeta->BlockSize);
+    for (uint64_t bit = 0; bit <= FsGroupNodeTableBlocks(pMeta); bit++)
+    {
+        pBlock[bit / 8] |= 1 << (bit % 8);
+    }
+    for (uint64_t bit = length; bit < pMeta->BlocksPerGroup; bit++)
+    {
+        pBlock[bit / 8] |= 1 << (bit % 8);
+    }
+}
+
+static block_t FsiGroupDescriptorBlock(const FsMeta* pMeta, uint32_t group, uint64_t* pOffset)
+{
+    uint64_t offset = (uint64_t) group * sizeof(FsGroupDescriptor);
+    *pOffset = offset % pMeta->BlockSize;
+    return pMeta->AddrGroupTable + offset / pMeta->BlockSize;
+}
+
+bool FsReadGroup(FileSystemOnDisk* pFs, uint32_t group, FsGroupDescriptor* pDescriptor)
+{
+    uint64_t offset;
+    block_t block = FsiGroupDescriptorBlock(&pFs->Meta, group, &offset);
+    if (group >= pFs->Meta.NumGroups || !FsBlockCacheRead(&pFs->Cache, block, offset, pDescriptor, sizeof(FsGroupDescriptor)))
+    {
+        printf("FsReadGroup failed, couldn't read the descriptor of group %u.\n", group);
+        return false;
+    }
+    return true;
+}
+
+bool FsWriteGroup(FileSystemOnDisk* pFs, uint32_t group, const FsGroupDescriptor* pDescriptor)
+{
+    uint64_t offset;
+    block_t block = FsiGroupDescriptorBlock(&pFs->Meta, group, &offset);
+    if (group >= pFs->Meta.NumGroups || !FsBlockCacheWrite(&pFs->Cache, block, offset, pDescriptor, sizeof(FsGroupDescriptor)))
+    {
+        printf("FsWriteGroup failed, couldn't write the descriptor of group %u.\n", group);
+        return false;
+    }
+    return true;
+}
+
+bool FsGroupCountNodes(FileSystemOnDisk* pFs, nodeid_t nodeID, int32_t delta)
+{
+    if (!FsHasGroups(&pFs->Meta) || nodeID <= FS_NODE_ID_ROOT)
+    {
+        return true;
+    }
+
+    uint32_t group = FsGroupOfNode(&pFs->Meta, nodeID);
+    FsGroupDescriptor descriptor;
+    if (!FsReadGroup(pFs, group, &descriptor))
+    {
+        return false;
+    }
+
+    descriptor.FreeNodes -= delta;
+    return FsWriteGroup(pFs, group, &descriptor);
+}
+
+bool FsGroupUpdateFreeBlocks(FileSystemOnDisk* pFs)
+{
+    if (!FsHasGroups(&pFs->Meta))
+    {
+        return true;
+    }
+
+    // Bitmap block i is the bitmap of group i, its summary already counts the clear bits.
+    const FsBitmapCache* pBitmap = &pFs->Bitmap;
+    for (uint32_t group = 0; group < pBitmap->NumBlocks && pBitmap->NumDirty; group++)
+    {
+        if (pBitmap->pDirty[group] != FS_BITMAP_DIRTY)
+        {
+            continue;
+        }
+
+        FsGroupDescriptor descriptor;
+        if (!FsReadGroup(pFs, group, &descriptor))
+        {
+            return false;
+        }
+
+        if (descriptor.FreeBlocks != pBitmap->pFreeCount[group])
+        {
+            descriptor.FreeBlocks = pBitmap->pFreeCount[group];
+            if (!FsWriteGroup(pFs, group, &descriptor))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void FsGroupUpdateWatermark(FileSystemOnDisk* pFs)
+{
+    FsBitmapCache* pBitmap = &pFs->Bitmap;
+    if (!FsHasLazyInit(&pFs->Meta) || !pBitmap->NumDirty)
+    {
+        return;
+    }
+
+    uint32_t last = pFs->Meta.NumGroups;
+    while (last > pFs->Meta.BitmapWatermark && pBitmap->pDirty[last - 1] == FS_BITMAP_CLEAN)
+    {
+        last--;
+    }
+
+    // Groups below the watermark are read from the disk from now on, so the ones skipped so far are written as well.
+    for (uint32_t group = pFs->Meta.BitmapWatermark; group < last; group++)
+    {
+        if (pBitmap->pDirty[group] == FS_BITMAP_CLEAN)
+        {
+            pBitmap->pDirty[group] = FS_BITMAP_DIRTY;
+            pBitmap->NumDirty++;
+        }
+    }
+    pFs->Meta.BitmapWatermark = FS_MAX(pFs->Meta.BitmapWatermark, last);
+}
@@ -0,0 +1,50 @@
+/**
+ * Header for allocation groups, the layout of file systems from FS_REVISION_ALLOCATION_GROUPS on (see FsGroupDescriptor).
+ *
+ * Each group keeps the bitmap, the nodes and the free counters of its own blocks, so a node, its data and the nodes of
+ * its directory can be kept close to each other and allocators can work on different groups independently. The group
+ * descriptors are kept in the group table and go through the block cache like the node table.
+ */
+
+#ifndef MYTH_GROUP_H
+#define MYTH_GROUP_H
+
+#include "FileSystem.h"
+#include "Disk.h"
+
+#include <stdbool.h>
+
+// True when the file system is split into groups, false for the single bitmap and node table of revision 0.
+bool FsHasGroups(const FsMeta* pMeta);
+
+// True when group bitmaps and node tables are only written once used, see BitmapWatermark and NodeWatermark.
+bool FsHasLazyInit(const FsMeta* pMeta);
+
+// Geometry of the groups, every group starts with its bitmap block followed by its node table blocks.
+uint32_t FsGroupNodeTableBlocks(const FsMeta* pMeta);
+uint64_t FsGroupTableBlocks(const FsMeta* pMeta);
+block_t  FsGroupStart(const FsMeta* pMeta, uint32_t group);
+block_t  FsGroupData(const FsMeta* pMeta, uint32_t group);
+block_t  FsGroupEnd(const FsMeta* pMeta, uint32_t group); // Block past the group, the last group may be shorter.
+uint32_t FsGroupOfBlock(const FsMeta* pMeta, block_t block);
+uint32_t FsGroupOfNode(const FsMeta* pMeta, nodeid_t nodeID);
+
+// Fills pBlock with the bitmap of a group that was never written, only its own bitmap and node table blocks and the
+// bits past the end of the volume are set.
+void FsGroupInitBitmap(const FsMeta* pMeta, uint32_t group, uint8_t* pBlock);
+
+bool FsReadGroup(FileSystemOnDisk* pFs, uint32_t group, FsGroupDescriptor* pDescriptor);
+bool FsWriteGroup(FileSystemOnDisk* pFs, uint32_t group, const FsGroupDescriptor* pDescriptor);
+
+// Adds delta to the free nodes of the group nodeID belongs to. Reserved node IDs are ignored.
+bool FsGroupCountNodes(FileSystemOnDisk* pFs, nodeid_t nodeID, int32_t delta);
+
+// Brings the free block counters of the groups whose bitmap changed since the last commit up to date, FsCommit does
+// this before anything is written.
+bool FsGroupUpdateFreeBlocks(FileSystemOnDisk* pFs);
+
+// Raises BitmapWatermark past the last group whose bitmap changed since the last commit, the groups it passes over are
+// marked dirty so their bitmap gets written along. FsCommit does this before anything is written.
+void FsGroupUpdateWatermark(FileSystemOnDisk* pFs);
+
+#endif // !MYTH_GROUP_H
@@ -0,0 +1,502 @@
+#include "Journal.h"
+
+#include "Disk.h"
+#include "Node.h"
+#include "BlockMap.h"
+
+#include "Utils/Checksum.h"
+#include "Utils/Math.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t FsiJournalTagsPerDescriptor(uint16_t blockSize)
+{
+    return (blockSize - sizeof(FsJournalRecord)) / sizeof(block_t);
+}
+
+// Home address of an image, the tags follow the record of each descriptor block and aren't aligned.
+static block_t FsiJournalGetTag(const uint8_t* pTransaction, uint16_t blockSize, uint64_t image)
+{
+    uint64_t tagsPerDescriptor = FsiJournalTagsPerDescriptor(blockSize);
+    const uint8_t* pTag = pTransaction + (image / tagsPerDescriptor) * blockSize + sizeof(FsJournalRecord)
+                        + (image % tagsPerDescriptor) * sizeof(block_t);
+
+    block_t home;
+    memcpy(&home, pTag, sizeof(block_t));
+    return home;
+}
+
+static void FsiJournalSetTag(uint8_t* pTransaction, uint16_t blockSize, uint64_t image, block_t home)
+{
+    uint64_t tagsPerDescriptor = FsiJournalTagsPerDescriptor(blockSize);
+    uint8_t* pTag = pTransaction + (image / tagsPerDescriptor) * blockSize + sizeof(FsJournalRecord)
+                  + (image % tagsPerDescriptor) * sizeof(block_t);
+
+    memcpy(pTag, &home, sizeof(block_t));
+}
+
+// Reads the journal node straight from the node table and then the header it points at, nothing else is loaded yet
+// when the journal is replayed.
+static bool FsiJournalLocate(FsDevice* pDevice, const FsMeta* pMeta, FsJournal* pJournal)
+{
+    FsNode node;
+    nodepos_t pos = FsResolveNodePos(pMeta, FS_NODE_ID_JOURNAL);
+    if (!FsDeviceRead(pDevice, pos.RawAddress, &node, sizeof(FsNode)))
+    {
+        puts("FsJournal failed, couldn't read the journal node.");
+        return false;
+    }
+
+    if (node.ID != FS_NODE_ID_JOURNAL || node.DirectData[0] == 0)
+    {
+        puts("FsJournal failed, the file system is journaled but the journal node is missing.");
+        return false;
+    }
+
+    FsJournalHeader header;
+    if (!FsDeviceRead(pDevice, node.DirectData[0] * pMeta->BlockSize, &header, sizeof(FsJournalHeader)))
+    {
+        printf("FsJournal failed, couldn't read the journal header at block %lu.\n", node.DirectData[0]);
+        return false;
+    }
+
+    if (header.Magic != FS_JOURNAL_MAGIC_HEADER ||
+        header.Checksum != ChecksumCRC32(&header, sizeof(FsJournalHeader) - sizeof(uint32_t)))
+    {
+        printf("FsJournal failed, block %lu doesn't hold a valid journal header.\n", node.DirectData[0]);
+        return false;
+    }
+
+    if (header.NumBlocks < FS_JOURNAL_MINIMUM_BLOCKS ||
+        node.Size < FS_NODE_INLINE_DATA_SIZE + (uint64_t) header.NumBlocks * pMeta->BlockSize ||
+        node.DirectData[0] + header.NumBlocks > pMeta->Size)
+    {
+        printf("FsJournal failed, the journal header claims %u blocks, which the journal node doesn't have.\n", header.NumBlocks);
+        return false;
+    }
+
+    pJournal->Start     = node.DirectData[0];
+    pJournal->NumBlocks = header.NumBlocks;
+    pJournal->Sequence  = header.Sequence;
+    pJournal->Head      = 1;
+    return true;
+}
+
+// Checks the records of a transaction read in one piece, the descriptor blocks come first and the commit block last.
+static bool FsiJournalCheckTransaction(const uint8_t* pTransaction, uint16_t blockSize, uint64_t sequence,
+                                       uint32_t numImages, uint64_t numDescriptors)
+{
+    FsJournalRecord record;
+    for (uint64_t i = 0; i < numDescriptors; i++)
+    {
+        memcpy(&record, pTransaction + i * blockSize, sizeof(FsJournalRecord));
+        if (record.Magic != FS_JOURNAL_MAGIC_DESCRIPTOR || record.Sequence != sequence || record.NumImages != numImages)
+        {
+            return false;
+        }
+    }
+
+    uint64_t length = numDescriptors + numImages + 1;
+    memcpy(&record, pTransaction + (length - 1) * blockSize, sizeof(FsJournalRecord));
+
+    return record.Magic == FS_JOURNAL_MAGIC_COMMIT && record.Sequence == sequence && record.NumImages == numImages &&
+           record.Checksum == ChecksumCRC32(pTransaction, (length - 1) * blockSize);
+}
+
+int64_t FsJournalReplay(FsDevice* pDevice, const FsMeta* pMeta, bool bApply)
+{
+    if (!(pMeta->Flags & FS_FLAG_JOURNALED))
+    {
+        return 0;
+    }
+
+    FsJournal journal;
+    memset(&journal, 0, sizeof(FsJournal));
+    if (!FsiJournalLocate(pDevice, pMeta, &journal))
+    {
+        return -1;
+    }
+
+    uint16_t blockSize         = pMeta->BlockSize;
+    uint64_t tagsPerDescriptor = FsiJournalTagsPerDescriptor(blockSize);
+
+    uint8_t* pTransaction = malloc((size_t) journal.NumBlocks * blockSize);
+    if (!pTransaction)
+    {
+        puts("FsJournalReplay failed, couldn't allocate memory for a transaction.");
+        return -1;
+    }
+
+    int64_t replayed = 0;
+    while (journal.Head < journal.NumBlocks)
+    {
+        FsJournalRecord record;
+        if (!FsDeviceRead(pDevice, (journal.Start + journal.Head) * blockSize, &record, sizeof(FsJournalRecord)))
+        {
+            printf("FsJournalReplay failed, couldn't read journal block %u.\n", journal.Head);
+            replayed = -1;
+            break;
+        }
+
+        // Anything but the descriptor of the transaction that comes next is left over from before the last checkpoint.
+        if (record.Magic != FS_JOURNAL_MAGIC_DESCRIPTOR || record.Sequence != journal.Sequence || record.NumImages == 0)
+        {
+            break;
+        }
+
+        uint64_t numDescriptors = FS_DIV(record.NumImages, tagsPerDescriptor);
+        uint64_t length         = numDescriptors + record.NumImages + 1;
+        if (length > journal.NumBlocks - journal.Head)
+        {
+            break;
+        }
+
+        if (!FsDeviceRead(pDevice, (journal.Start + journal.Head) * blockSize, pTransaction, length * blockSize))
+        {
+            printf("FsJournalReplay failed, couldn't read transaction %lu.\n", journal.Sequence);
+            replayed = -1;
+            break;
+        }
+
+        // A transaction whose commit block didn't make it to the disk is discarded as a whole.
+        if (!FsiJournalCheckTransaction(pTransaction, blockSize, journal.Sequence, record.NumImages, numDescriptors))
+        {
+            break;
+        }
+
+        const uint8_t* pImages = pTransaction + numDescriptors * blockSize;
+        for (uint32_t i = 0; i < record.NumImages; i++)
+        {
+            block_t home = FsiJournalGetTag(pTransaction, blockSize, i);
+            if (home < pMeta->Origin || home >= pMeta->Size || (home >= journal.Start && home < journal.Start + journal.NumBlocks))
+            {
+                printf("FsJournalReplay failed, transaction %lu logs block %lu, which metadata never lives in.\n", journal.Sequence, home);
+                replayed = -1;
+                break;
+            }
+
+            if (bApply && !FsDeviceWrite(pDevice, home * blockSize, pImages + (uint64_t) i * blockSize, blockSize))
+            {
+                printf("FsJournalReplay failed, couldn't write block %lu.\n", home);
+                replayed = -1;
+                break;
+            }
+        }
+        if (replayed < 0)
+        {
+            break;
+        }
+
+        journal.Head += length;
+        journal.Sequence++;
+        replayed++;
+    }
+    free(pTransaction);
+
+    if (replayed > 0 && bApply)
+    {
+        // The transactions are home now, moving the expected sequence past them keeps them from being applied again.
+        if (!FsDeviceSync(pDevice) || !FsJournalFormat(pDevice, pMeta, journal.Start, journal.NumBlocks, journal.Sequence) ||
+            !FsDeviceSync(pDevice))
+        {
+            puts("FsJournalReplay failed, couldn't reset the journal after replaying it.");
+            return -1;
+        }
+    }
+
+    return replayed;
+}
+
+bool FsJournalFormat(FsDevice* pDevice, const FsMeta* pMeta, block_t start, uint32_t numBlocks, uint64_t sequence)
+{
+    FsJournalHeader header;
+    header.Magic     = FS_JOURNAL_MAGIC_HEADER;
+    header.NumBlocks = numBlocks;
+    header.Sequence  = sequence;
+    header.Checksum  = ChecksumCRC32(&header, sizeof(FsJournalHeader) - sizeof(uint32_t));
+
+    if (!FsDeviceWrite(pDevice, start * pMeta->BlockSize, &header, sizeof(FsJournalHeader)))
+    {
+        printf("FsJournalFormat failed, couldn't write the journal header at block %lu.\n", start);
+        return false;
+    }
+
+    return true;
+}
+
+bool FsJournalOpen(FsJournal* pJournal, FsDevice* pDevice, const FsMeta* pMeta)
+{
+    memset(pJournal, 0, sizeof(FsJournal));
+
+    FsJournal journal;
+    memset(&journal, 0, sizeof(FsJournal));
+    if (!FsiJournalLocate(pDevice, pMeta, &journal))
+    {
+        return false;
+    }
+
+    journal.pMetaBlock = malloc(pMeta->BlockSize);
+    if (!journal.pMetaBlock)
+    {
+        puts("FsJournalOpen failed, couldn't allocate memory for the metadata block.");
+        return false;
+    }
+
+    if (!FsDeviceRead(pDevice, pMeta->Origin * pMeta->BlockSize, journal.pMetaBlock, pMeta->BlockSize))
+    {
+        puts("FsJournalOpen failed, couldn't read the metadata block.");
+        free(journal.pMetaBlock);
+        return false;
+    }
+
+    *pJournal = journal;
+    return true;
+}
+
+void FsJournalRelease(FsJournal* pJournal)
+{
+    free(pJournal->pBuffer);
+    free(pJournal->pMetaBlock);
+    memset(pJournal, 0, sizeof(FsJournal));
+}
+
+bool FsJournalWantsCommit(const FsJournal* pJournal, const FsBlockCache* pCache)
+{
+    return pCache->NumUnlogged >= FS_MIN(pCache->Capacity / 2, (pJournal->NumBlocks - 1) / 4);
+}
+
+bool FsJournalCommit(FsJournal* pJournal, FsDevice* pDevice, FsMeta* pMeta, FsBlockCache* pCache, FsBitmapCache* pBitmap, bool bMetaDirty)
+{
+    uint16_t blockSize = pMeta->BlockSize;
+
+    uint64_t numBitmapImages = 0;
+    for (uint64_t i = 0; i < pBitmap->NumBlocks; i++)
+    {
+        numBitmapImages += pBitmap->pDirty[i] == FS_BITMAP_DIRTY;
+    }
+
+    uint64_t numImages = pCache->NumUnlogged + numBitmapImages + (bMetaDirty ? 1 : 0);
+    if (numImages == 0)
+    {
+        return true;
+    }
+
+    uint64_t numDescriptors = FS_DIV(numImages, FsiJournalTagsPerDescriptor(blockSize));
+    uint64_t length         = numDescriptors + numImages + 1;
+    if (length > pJournal->NumBlocks - pJournal->Head)
+    {
+        // Only a single commit larger than half the journal gets here, it goes home directly and isn't atomic.
+        pJournal->Overflows++;
+        return FsJournalCheckpoint(pJournal, pDevice, pMeta, pCache, pBitmap);
+    }
+
+    if (pJournal->BufferBlocks < length)
+    {
+        uint8_t* pBuffer = realloc(pJournal->pBuffer, length * blockSize);
+        if (!pBuffer)
+        {
+            puts("FsJournalCommit failed, couldn't allocate memory for the transaction.");
+            return false;
+        }
+        pJournal->pBuffer      = pBuffer;
+        pJournal->BufferBlocks = length;
+    }
+
+    uint8_t* pTransaction = pJournal->pBuffer;
+    uint8_t* pImages      = pTransaction + numDescriptors * blockSize;
+    memset(pTransaction, 0, numDescriptors * blockSize);
+
+    uint64_t image = 0;
+    for (uint32_t i = 0; i < pCache->Capacity; i++)
+    {
+        const FsBlockCacheEntry* pEntry = &pCache->pEntries[i];
+        if (pEntry->bValid && pEntry->bDirty && !pEntry->bLogged)
+        {
+            FsiJournalSetTag(pTransaction, blockSize, image, pEntry->Block);
+            memcpy(pImages + image++ * blockSize, pEntry->pData, blockSize);
+        }
+    }
+
+    for (uint64_t i = 0; i < pBitmap->NumBlocks; i++)
+    {
+        if (pBitmap->pDirty[i] == FS_BITMAP_DIRTY)
+        {
+            FsiJournalSetTag(pTransaction, blockSize, image, FsBitmapBlockAddress(pMeta, i));
+            memcpy(pImages + image++ * blockSize, pBitmap->pBitmap + i * blockSize, blockSize);
+        }
+    }
+
+    if (bMetaDirty)
+    {
+        FsEncodeMeta(pMeta, pJournal->pMetaBlock);
+        FsiJournalSetTag(pTransaction, blockSize, image, pMeta->Origin);
+        memcpy(pImages + image++ * blockSize, pJournal->pMetaBlock, blockSize);
+    }
+
+    FsJournalRecord record;
+    record.Magic     = FS_JOURNAL_MAGIC_DESCRIPTOR;
+    record.Sequence  = pJournal->Sequence;
+    record.NumImages = (uint32_t) numImages;
+    record.Checksum  = 0;
+    for (uint64_t i = 0; i < numDescriptors; i++)
+    {
+        memcpy(pTransaction + i * blockSize, &record, sizeof(FsJournalRecord));
+    }
+
+    uint8_t* pCommit = pTransaction + (length - 1) * blockSize;
+    memset(pCommit, 0, blockSize);
+    record.Magic    = FS_JOURNAL_MAGIC_COMMIT;
+    record.Checksum = ChecksumCRC32(pTransaction, (length - 1) * blockSize);
+    memcpy(pCommit, &record, sizeof(FsJournalRecord));
+
+    // The commit block carries the checksum of everything before it, so the whole transaction can go out in one write.
+    // Replay tells a torn transaction apart from a committed one by the checksum instead of by the order of the writes.
+    if (!FsDeviceWrite(pDevice, (pJournal->Start + pJournal->Head) * blockSize, pTransaction, length * blockSize) ||
+        !FsDeviceSync(pDevice))
+    {
+        printf("FsJournalCommit failed, couldn't write transaction %lu to the journal.\n", pJournal->Sequence);
+        return false;
+    }
+
+    FsBlockCacheMarkLogged(pCache);
+    for (uint64_t i = 0; i < pBitmap->NumBlocks; i++)
+    {
+        if (pBitmap->pDirty[i] == FS_BITMAP_DIRTY)
+        {
+            pBitmap->pDirty[i] = FS_BITMAP_DIRTY_LOGGED;
+        }
+    }
+
+    pJournal->Head += (uint32_t) length;
+    pJournal->Sequence++;
+    pJournal->Transactions++;
+    pJournal->ImagesLogged += numImages;
+
+    // Checkpointing at half leaves the other half for the next transaction, batches commit before they outgrow it.
+    if (pJournal->Head > pJournal->NumBlocks / 2)
+    {
+        return FsJournalCheckpoint(pJournal, pDevice, pMeta, pCache, pBitmap);
+    }
+
+    return true;
+}
+
+bool FsJournalCheckpoint(FsJournal* pJournal, FsDevice* pDevice, FsMeta* pMeta, FsBlockCache* pCache, FsBitmapCache* pBitmap)
+{
+    if (!FsBlockCacheFlush(pCache) || !FsBitmapCacheFlush(pDevice, pMeta, pBitmap) || !FsWriteMeta(pDevice, pMeta))
+    {
+        puts("FsJournalCheckpoint failed, couldn't write the logged blocks home.");
+        return false;
+    }
+    FsEncodeMeta(pMeta, pJournal->pMetaBlock);
+
+    if (pJournal->Head > 1)
+    {
+        // The header may only move past the transactions once everything they hold is on stable storage.
+        if (!FsDeviceSync(pDevice) ||
+            !FsJournalFormat(pDevice, pMeta, pJournal->Start, pJournal->NumBlocks, pJournal->Sequence) ||
+            !FsDeviceSync(pDevice))
+        {
+            puts("FsJournalCheckpoint failed, couldn't reset the journal.");
+            return false;
+        }
+        pJournal->Head = 1;
+    }
+
+    pJournal->Checkpoints++;
+    return true;
+}
+
+bool FsCreateJournal(FileSystemOnDisk* pFs, uint32_t numBlocks)
+{
+    if (pFs->Meta.Flags & FS_FLAG_JOURNALED)
+    {
+        puts("FsCreateJournal failed, the file system already has a journal.");
+        return false;
+    }
+
+    if (numBlocks < FS_JOURNAL_MINIMUM_BLOCKS)
+    {
+        printf("FsCreateJournal failed, a journal needs at least %u blocks but %u were asked for.\n", FS_JOURNAL_MINIMUM_BLOCKS, numBlocks);
+        return false;
+    }
+
+    FsNode node;
+    memset(&node, 0, FS_NODE_SIZE);
+    node.ID        = FS_NODE_ID_JOURNAL;
+    node.Type      = FS_NODE_TYPE_FILE;
+    node.Flags     = FS_NODE_FLAG_SYSTEM | FS_NODE_FLAG_HIDDEN;
+    node.CreatorID = FS_CREATOR_MYTH_TOOL;
+    node.Owner     = 0;
+
+    create_node_result_t createResult = FsMakeNode(pFs, &node, NULL, 0);
+    if (createResult != FS_MAKE_NODE_SUCCESSFUL)
+    {
+        printf("FsCreateJournal failed, couldn't create the journal node, code %u (%s).\n", createResult, FsCreateNodeResultToString(createResult));
+        return false;
+    }
+
+    block_t* pBlocks = malloc(numBlocks * sizeof(block_t));
+    if (!pBlocks)
+    {
+        puts("FsCreateJournal failed, couldn't allocate memory for the journal's block list.");
+        FsDeleteNode(pFs, FS_NODE_ID_JOURNAL);
+        return false;
+    }
+    pBlocks[0] = 0;
+
+    // The blocks are allocated without writing them and zeroed by the device instead, so nothing left on the disk from
+    // before can pass for a transaction and a fresh image stays sparse.
+    static const uint8_t inlineZeroes[FS_NODE_INLINE_DATA_SIZE];
+    FsNodeWriter writer;
+    write_node_data_result_t writeResult = FsOpenNodeWriter(pFs, FS_NODE_ID_JOURNAL, &writer);
+    if (writeResult == FS_WRITE_DATA_SUCCESSFUL)
+    {
+        FsNodeWriterAppend(&writer, inlineZeroes, FS_NODE_INLINE_DATA_SIZE);
+        FsNodeWriterAppendDeferred(&writer, (uint64_t) numBlocks * pFs->Meta.BlockSize, pBlocks);
+
+        // Transactions are written with a single write each, which needs the journal to be one run of blocks.
+        bool bContiguous = writer.Status == FS_WRITE_DATA_SUCCESSFUL;
+        for (uint32_t i = 1; i < numBlocks && bContiguous; i++)
+        {
+            bContiguous = pBlocks[i] == pBlocks[0] + i;
+        }
+        if (bContiguous && !FsDeviceZero(pFs->pDevice, pBlocks[0] * pFs->Meta.BlockSize, (uint64_t) numBlocks * pFs->Meta.BlockSize))
+        {
+            puts("FsCreateJournal failed, couldn't clear the journal blocks.");
+            writer.Status = FS_WRITE_DATA_DISK_ERROR;
+        }
+        else if (!bContiguous && writer.Status == FS_WRITE_DATA_SUCCESSFUL)
+        {
+            printf("FsCreateJournal failed, couldn't find %u contiguous free blocks for the journal.\n", numBlocks);
+            writer.Status = FS_WRITE_DATA_INSUFFICIENT_DISK_SPACE;
+        }
+        writeResult = FsCloseNodeWriter(&writer);
+    }
+
+    block_t start = pBlocks[0];
+    free(pBlocks);
+    if (writeResult != FS_WRITE_DATA_SUCCESSFUL)
+    {
+        printf("FsCreateJournal failed, couldn't allocate the journal blocks, code %u (%s).\n", writeResult, FsWriteNodeDataResultToString(writeResult));
+        FsDeleteNode(pFs, FS_NODE_ID_JOURNAL);
+        return false;
+    }
+
+    if (!FsJournalFormat(pFs->pDevice, &pFs->Meta, start, numBlocks, 1))
+    {
+        FsDeleteNode(pFs, FS_NODE_ID_JOURNAL);
+        return false;
+    }
+
+    pFs->Meta.Flags |= FS_FLAG_JOURNALED;
+    if (!FsSync(pFs) || !FsJournalOpen(&pFs->Journal, pFs->pDevice, &pFs->Meta))
+    {
+        puts("FsCreateJournal failed, couldn't switch the file system over to the journal.");
+        return false;
+    }
+
+    return true;
+}
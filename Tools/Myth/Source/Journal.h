@@ -0,0 +1,67 @@
+/**
+ * Header for the metadata journal, the write-ahead log kept in the data of node FS_NODE_ID_JOURNAL.
+ *
+ * On a journaled file system (FS_FLAG_JOURNALED) a commit doesn't write the node table, pointer, bitmap and metadata
+ * blocks it changed to their home locations. It appends them to the journal as one transaction instead, a single
+ * sequential write followed by a device flush. The blocks stay dirty in memory and are written home by a checkpoint,
+ * which only happens once the journal is half full or the disk is closed. Batches turn thousands of operations into a
+ * handful of transactions that way. Data blocks never go through the journal, they are written before the transaction
+ * that links them is committed.
+ *
+ * Loading the file system replays every committed transaction that wasn't checkpointed yet, a transaction is applied
+ * entirely or not at all.
+ */
+
+#ifndef MYTH_JOURNAL_H
+#define MYTH_JOURNAL_H
+
+#include "FileSystem.h"
+#include "Bitmap.h"
+#include "Device.h"
+#include "BlockCache.h"
+
+#include <stdbool.h>
+
+#define FS_JOURNAL_DEFAULT_BLOCKS UINT32_C(1024)
+#define FS_JOURNAL_MINIMUM_BLOCKS UINT32_C(16) // Header plus room for a few small transactions.
+
+typedef struct
+{
+    block_t  Start;        // Block holding the FsJournalHeader, 0 when the file system has no journal.
+    uint32_t NumBlocks;    // Journal blocks, the header included.
+    uint32_t Head;         // Journal block, relative to Start, the next transaction is written at.
+    uint64_t Sequence;     // Sequence number of the next transaction.
+    uint8_t* pBuffer;      // One whole transaction is assembled here before it is written.
+    uint64_t BufferBlocks;
+    uint8_t* pMetaBlock;   // Block Origin as it is on disk, the metadata is laid over it to log it as a whole block.
+
+    uint64_t Transactions;
+    uint64_t ImagesLogged;
+    uint64_t Checkpoints;
+    uint64_t Overflows;    // Commits too large for the journal, written home directly like without a journal.
+} FsJournal;
+
+// Applies the committed transactions of the journal pMeta points at, if it has one. Returns the number of transactions
+// replayed or -1 when the journal can't be read. pMeta must be read again afterwards, replay may have changed it.
+// Without bApply nothing is written, the transactions that would be replayed are only counted.
+int64_t FsJournalReplay(FsDevice* pDevice, const FsMeta* pMeta, bool bApply);
+
+// Writes a fresh header to the journal occupying numBlocks blocks from start on.
+bool FsJournalFormat(FsDevice* pDevice, const FsMeta* pMeta, block_t start, uint32_t numBlocks, uint64_t sequence);
+
+// Locates the journal of pMeta and prepares pJournal to append to it. The journal must have been replayed already.
+bool FsJournalOpen(FsJournal* pJournal, FsDevice* pDevice, const FsMeta* pMeta);
+void FsJournalRelease(FsJournal* pJournal);
+
+// True once enough changes piled up that a commit should happen even within a batch, keeping each transaction small
+// enough to fit into the journal and the cache from running out of blocks it may evict.
+bool FsJournalWantsCommit(const FsJournal* pJournal, const FsBlockCache* pCache);
+
+// Logs every modification made since the last commit as one transaction and checkpoints when the journal is half full.
+// The metadata block is only logged when bMetaDirty is set.
+bool FsJournalCommit(FsJournal* pJournal, FsDevice* pDevice, FsMeta* pMeta, FsBlockCache* pCache, FsBitmapCache* pBitmap, bool bMetaDirty);
+
+// Writes every dirty block and the metadata home and empties the journal.
+bool FsJournalCheckpoint(FsJournal* pJournal, FsDevice* pDevice, FsMeta* pMeta, FsBlockCache* pCache, FsBitmapCache* pBitmap);
+
+#endif // !MYTH_JOURNAL_H
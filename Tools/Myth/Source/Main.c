@@ -2,21 +2,46 @@
 #include "Bitmap.h"
 #include "Disk.h"
 #include "Node.h"
+#include "Directory.h"
+#include "Builder.h"
+#include "Group.h"
+#include "Verify.h"
+
+#include "Utils/BitScan.h"
+#include "Utils/Math.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
 
 #define ACTION_MAKE_FILE_SYSTEM "MakeFS"
 #define ACTION_READ_FILE_SYSTEM "ReadFS"
 #define ACTION_READ_NODE        "ReadNode"
 #define ACTION_CREATE_ON_ROOT   "CreateOnRoot"
+#define ACTION_BUILD_IMAGE      "BuildImage"
+#define ACTION_RESOLVE_PATH     "ResolvePath"
+#define ACTION_VERIFY           "Verify"
+#define ACTION_EXTRACT          "Extract"
+#define ACTION_PATCH            "Patch"
+#define ACTION_TRUNCATE         "Truncate"
 
 int CliMakeFileSystem(int argc, char** argv);
+static bool CliiMakeFileSystem(const char* diskPath, uint64_t diskSize, int blockSize, int fsOffset, const char* volName, int bytesPerNodeRatio, int journalBlocks);
+static bool CliiParseSize(const char* pText, uint64_t* pSize);
 int CliReadFileSystem(int argc, char** argv);
 int CliReadNode(int argc, char** argv);
 int CliCreateOnRoot(int argc, char** argv);
+int CliBuildImage(int argc, char** argv);
+int CliResolvePath(int argc, char** argv);
+int CliVerify(int argc, char** argv);
+int CliExtract(int argc, char** argv);
+int CliPatch(int argc, char** argv);
+int CliTruncate(int argc, char** argv);
 
 int main(int argc, char** argv)
 {
@@ -44,6 +69,12 @@ int main(int argc, char** argv)
     CHECKCASE(ACTION_READ_FILE_SYSTEM, CliReadFileSystem);
     CHECKCASE(ACTION_READ_NODE       , CliReadNode);
     CHECKCASE(ACTION_CREATE_ON_ROOT  , CliCreateOnRoot);
+    CHECKCASE(ACTION_BUILD_IMAGE     , CliBuildImage);
+    CHECKCASE(ACTION_RESOLVE_PATH    , CliResolvePath);
+    CHECKCASE(ACTION_VERIFY          , CliVerify);
+    CHECKCASE(ACTION_EXTRACT         , CliExtract);
+    CHECKCASE(ACTION_PATCH           , CliPatch);
+    CHECKCASE(ACTION_TRUNCATE        , CliTruncate);
 #undef CHECKCASE
     
     printf("Unrecognized action '%s'.\n", action);
@@ -54,14 +85,17 @@ int CliMakeFileSystem(int argc, char** argv)
 {
     printf(ACTION_MAKE_FILE_SYSTEM " usage: "
             "[DiskPath: str] [BlockSize: int] [FileSystemOffset (in blocks): int] [VolumeName (max size " FS_STRINGIZE(FS_VOLUME_NAME_SIZE) "): str] "
-            "[BytesPerNodeRatio (default 16384, 16KiB)]: int\n");
+            "[BytesPerNodeRatio (default 16384, 16KiB)]: int "
+            "[JournalBlocks (default %u, 0 for none): int] "
+            "[DiskSize (K, M, G or T suffix, creates a sparse image; default 0 keeps the size of the disk): str]\n",
+           FS_JOURNAL_DEFAULT_BLOCKS);
 
     if (argc < 4)
     {
         puts("Too few arguments.");
         return 1;
     }
-    if (argc > 5)
+    if (argc > 7)
     {
         puts("Too many arguments.");
         return 1;
@@ -72,16 +106,71 @@ int CliMakeFileSystem(int argc, char** argv)
     int   fsOffset  = atoi(argv[2]);
     char* volName   =      argv[3];
 
-    if (blockSize < 0 || blockSize > 0xffff)
+    int bytesPerNodeRatio = 16384;
+    if (argc >= 5)
     {
-        printf("MakeFS fail, BlockSize must be between 0 and 0xffff but the provided value was %d.\n", blockSize);
+        bytesPerNodeRatio = atoi(argv[4]);
+    }
+
+    int journalBlocks = -1;
+    if (argc >= 6)
+    {
+        journalBlocks = atoi(argv[5]);
+    }
+
+    uint64_t diskSize = 0;
+    if (argc == 7 && !CliiParseSize(argv[6], &diskSize))
+    {
+        printf("MakeFS failed, '%s' is not a disk size.\n", argv[6]);
         return 1;
     }
 
-    int bytesPerNodeRatio = 16384;
-    if (argc == 5)
+    if (!CliiMakeFileSystem(diskPath, diskSize, blockSize, fsOffset, volName, bytesPerNodeRatio, journalBlocks))
     {
-        bytesPerNodeRatio = atoi(argv[4]);
+        return 1;
+    }
+
+    puts("MakeFS succeeded, the file system was made successfully.");
+    return 0;
+}
+
+// Parses a byte count with an optional K, M, G or T suffix (powers of 1024).
+static bool CliiParseSize(const char* pText, uint64_t* pSize)
+{
+    char* pEnd;
+    unsigned long long value = strtoull(pText, &pEnd, 10);
+    if (pEnd == pText)
+    {
+        return false;
+    }
+
+    int shift = 0;
+    switch (*pEnd)
+    {
+    case 'K': case 'k': shift = 10; pEnd++; break;
+    case 'M': case 'm': shift = 20; pEnd++; break;
+    case 'G': case 'g': shift = 30; pEnd++; break;
+    case 'T': case 't': shift = 40; pEnd++; break;
+    default: break;
+    }
+
+    if (*pEnd != '\0' || value > (UINT64_MAX >> shift))
+    {
+        return false;
+    }
+    *pSize = (uint64_t) value << shift;
+    return true;
+}
+
+// Makes the file system, its root node and its journal, shared by every action that starts from a blank disk.
+// A non-zero diskSize creates the disk image, or resizes it, as a sparse file first, otherwise the disk must exist.
+// A negative journalBlocks picks FS_JOURNAL_DEFAULT_BLOCKS, scaled down for small disks, 0 leaves the journal out.
+static bool CliiMakeFileSystem(const char* diskPath, uint64_t diskSize, int blockSize, int fsOffset, const char* volName, int bytesPerNodeRatio, int journalBlocks)
+{
+    if (blockSize < 0 || blockSize > 0xffff)
+    {
+        printf("MakeFS fail, BlockSize must be between 0 and 0xffff but the provided value was %d.\n", blockSize);
+        return false;
     }
 
     {
@@ -89,20 +178,20 @@ int CliMakeFileSystem(int argc, char** argv)
         if (volNameLen > FS_VOLUME_NAME_SIZE)
         {
             printf("MakeFS failed, the provided VolumeName has a length of %zu, but Myth accepts a maximum of " FS_STRINGIZE(FS_VOLUME_NAME_SIZE) ".", volNameLen);
-            return 1;
+            return false;
         }
     }
 
-    FILE* pDisk = fopen(diskPath, "r+b");
-    if (!pDisk)
+    // Only a few scattered blocks are written, positional writes keep everything else of a sparse image a hole.
+    FsDevice* pDevice = diskSize ? FsCreateDevice(diskPath, diskSize, FS_DEVICE_BACKEND_PIO)
+                                 : FsOpenDevice(diskPath, true, FS_DEVICE_BACKEND_PIO);
+    if (!pDevice)
     {
         printf("MakeFS fail, couldn't open disk from path '%s'.\n", diskPath);
-        return 1;
+        return false;
     }
-    
-    fseek(pDisk, 0, SEEK_END);
-    long rawDiskSize = ftell(pDisk);
-    long numBlocks = rawDiskSize / blockSize;
+
+    uint64_t numBlocks = pDevice->Size / blockSize;
 
     FsMeta meta;
     memset(&meta, 0, sizeof(FsMeta));
@@ -113,16 +202,24 @@ int CliMakeFileSystem(int argc, char** argv)
     meta.FsMajor   = FS_LATEST_MAJOR;
     meta.Revision  = FS_LATEST_REVISION;
     meta.BlockSize = (uint16_t) blockSize;
-    meta.Size      = (uint64_t) numBlocks;
+    meta.Size      = numBlocks;
     meta.Origin    = fsOffset;
     meta.Flags     = 0;
 
-    makefs_status_t makeStatus = FsMakeFileSystem(pDisk, &meta, bytesPerNodeRatio);
+    makefs_status_t makeStatus = FsMakeFileSystem(pDevice, &meta, bytesPerNodeRatio);
     if (makeStatus != FS_MAKE_FILE_SYSTEM_SUCCESSFUL)
     {
         printf("MakeFs failed, FsMakeFileSystem returned code %u (%s).\n", makeStatus, FsMakeFsStatusToString(makeStatus));
-        fclose(pDisk);
-        return 1;
+        FsCloseDevice(pDevice);
+        return false;
+    }
+    FsCloseDevice(pDevice);
+
+    FileSystemOnDisk fsOnDisk = FsLoadFileSystemOnDisk(diskPath, 0, true);
+    if (!fsOnDisk.bLoaded)
+    {
+        puts("MakeFS failed, FsLoadFileSystemOnDisk couldn't load the freshly made file system.");
+        return false;
     }
     
     // Create root node. per Myth Standard definition, it is resolved by "FS/" at the beginning of a PATH.
@@ -137,12 +234,32 @@ int CliMakeFileSystem(int argc, char** argv)
     node.Owner = 0xffffffff;
 
     // By default, empty directories have no data, and our root directory has no entries as of now so leave data NULL.
-    FsMakeNode(pDisk, &meta, &node, NULL, 0);
+    create_node_result_t createResult = FsMakeNode(&fsOnDisk, &node, NULL, 0);
+    if (createResult != FS_MAKE_NODE_SUCCESSFUL)
+    {
+        printf("MakeFS failed, couldn't create the root node, code %u (%s).\n", createResult, FsCreateNodeResultToString(createResult));
+        FsCloseDisk(&fsOnDisk);
+        return false;
+    }
 
-    puts("MakeFS succeeded, the file system was made successfully.");
-    fclose(pDisk);
+    if (journalBlocks < 0)
+    {
+        journalBlocks = (int) FS_MIN(FS_JOURNAL_DEFAULT_BLOCKS, numBlocks / 32);
+        if (journalBlocks < (int) FS_JOURNAL_MINIMUM_BLOCKS)
+        {
+            journalBlocks = 0;
+        }
+    }
 
-    return 0;
+    if (journalBlocks > 0 && !FsCreateJournal(&fsOnDisk, (uint32_t) journalBlocks))
+    {
+        printf("MakeFS failed, couldn't create a journal of %d blocks.\n", journalBlocks);
+        FsCloseDisk(&fsOnDisk);
+        return false;
+    }
+    FsCloseDisk(&fsOnDisk);
+
+    return true;
 }
 
 int CliReadFileSystem(int argc, char** argv)
@@ -161,7 +278,7 @@ int CliReadFileSystem(int argc, char** argv)
     }
 
     char* pDiskPath = argv[0];
-    FileSystemOnDisk fsOnDisk = FsLoadFileSystemOnDisk(pDiskPath);
+    FileSystemOnDisk fsOnDisk = FsLoadFileSystemOnDisk(pDiskPath, 0, false);
     if (!fsOnDisk.bLoaded)
     {
         puts(ACTION_READ_NODE " failed, FsLoadFileSystemOnDisk failed.");
@@ -203,8 +320,22 @@ int CliReadFileSystem(int argc, char** argv)
         fsOnDisk.Meta.Tail, fsOnDisk.Meta.Checksum, fsOnDisk.Meta.Checksum
     );
 
+    if (fsOnDisk.Journal.Start)
+    {
+        printf(" Journal: %u blocks from block %lu, next sequence %lu\n", fsOnDisk.Journal.NumBlocks, fsOnDisk.Journal.Start, fsOnDisk.Journal.Sequence);
+    }
+    if (FsHasGroups(&fsOnDisk.Meta))
+    {
+        printf(" Groups: %u of %u blocks and %u nodes each, group table at block %lu\n",
+               fsOnDisk.Meta.NumGroups, fsOnDisk.Meta.BlocksPerGroup, fsOnDisk.Meta.NodesPerGroup, fsOnDisk.Meta.AddrGroupTable);
+    }
+    if (FsHasLazyInit(&fsOnDisk.Meta))
+    {
+        printf(" Initialized: bitmaps of %u groups, node table up to node %u\n", fsOnDisk.Meta.BitmapWatermark, fsOnDisk.Meta.NodeWatermark);
+    }
+
     puts("ReadFS succeeded, the file system was read successfully.");
-    FsCloseDisk(fsOnDisk);
+    FsCloseDisk(&fsOnDisk);
 
     return 0;
 }
@@ -227,18 +358,18 @@ int CliReadNode(int argc, char** argv)
     char* pDiskPath = argv[0];
     nodeid_t nodeID = (nodeid_t) atoi(argv[1]);
 
-    FileSystemOnDisk fsOnDisk = FsLoadFileSystemOnDisk(pDiskPath);
+    FileSystemOnDisk fsOnDisk = FsLoadFileSystemOnDisk(pDiskPath, 0, false);
     if (!fsOnDisk.bLoaded)
     {
         puts(ACTION_READ_NODE " failed, FsLoadFileSystemOnDisk failed.");
         return 1;
     }
 
-    FsNode node = FsGetNode(fsOnDisk.pDisk, &fsOnDisk.Meta, nodeID);
+    FsNode node = FsGetNode(&fsOnDisk, nodeID);
     if (node.ID == FS_NODE_ID_INVALID)
     {
         printf(ACTION_READ_NODE " failed, node %u doesn't exist.\n", nodeID);
-        FsCloseDisk(fsOnDisk);
+        FsCloseDisk(&fsOnDisk);
         return 1;
     }
 
@@ -278,12 +409,26 @@ int CliReadNode(int argc, char** argv)
         node.AddrSinglyIndirect, node.AddrDoublyIndirect, node.AddrTriplyIndirect
     );
 
-    FsCloseDisk(fsOnDisk);
+    FsCloseDisk(&fsOnDisk);
     puts(ACTION_READ_NODE " succeeded, node was read successfully");
 
     return 0;
 }
 
+// Takes back the node CliCreateOnRoot made and, unless pName is NULL, its entry in the root, so closing the disk with
+// the batch still open commits nothing of it.
+static void CliiUndoCreateOnRoot(FileSystemOnDisk* pFs, nodeid_t nodeID, const char* pName)
+{
+    if (pName && FsUnregisterNode(pFs, FS_NODE_ID_ROOT, pName) != FS_REGISTER_NODE_SUCCESSFUL)
+    {
+        printf(ACTION_CREATE_ON_ROOT " failed, couldn't remove 'FS/%s' again.\n", pName);
+    }
+    if (!FsDeleteNode(pFs, nodeID))
+    {
+        printf(ACTION_CREATE_ON_ROOT " failed, couldn't delete node %u again.\n", nodeID);
+    }
+}
+
 int CliCreateOnRoot(int argc, char** argv)
 {
     puts(ACTION_CREATE_ON_ROOT " usage: [DiskPath: str] [SourceFilePath: str] [IsSystemFile: bool]");
@@ -303,7 +448,7 @@ int CliCreateOnRoot(int argc, char** argv)
     char* pSourceFilePath = argv[1];
     int   bIsSystemFile   = atoi(argv[2]);
 
-    FileSystemOnDisk fsOnDisk = FsLoadFileSystemOnDisk(pDiskPath);
+    FileSystemOnDisk fsOnDisk = FsLoadFileSystemOnDisk(pDiskPath, 0, true);
     if (!fsOnDisk.bLoaded)
     {
         puts(ACTION_CREATE_ON_ROOT " failed, FsLoadFileSystemOnDisk failed.");
@@ -314,7 +459,7 @@ int CliCreateOnRoot(int argc, char** argv)
     if (!pSourceFile)
     {
         printf(ACTION_CREATE_ON_ROOT " failed, couldn't open source file %s.\n", pSourceFilePath);
-        FsCloseDisk(fsOnDisk);
+        FsCloseDisk(&fsOnDisk);
         return 1;
     }
 
@@ -322,26 +467,700 @@ int CliCreateOnRoot(int argc, char** argv)
     long szSrcFile = ftell(pSourceFile);
     fseek(pSourceFile, 0, SEEK_SET);
 
-    char* pFileData = malloc(szSrcFile);
-    fread(pFileData, 1, szSrcFile, pSourceFile);
-    fclose(pSourceFile);
-    
+    // Creating, naming and filling the node is committed once at the end instead of after every step.
+    FsBeginBatch(&fsOnDisk);
+
     FsNode node;
-    node.ID    = FsFindNodeID(fsOnDisk.pDisk, &fsOnDisk.Meta);
+    memset(&node, 0, FS_NODE_SIZE);
+
+    node.ID    = FsFindNodeIDNear(&fsOnDisk, FS_NODE_ID_ROOT);
     node.Type  = FS_NODE_TYPE_FILE;
     node.Flags = bIsSystemFile ? FS_NODE_FLAG_SYSTEM : FS_NODE_FLAG_CLEAR;
 
-    create_node_result_t createResult = FsMakeNode(fsOnDisk.pDisk, &fsOnDisk.Meta, &node, pFileData, szSrcFile);
+    create_node_result_t createResult = FsMakeNode(&fsOnDisk, &node, NULL, 0);
     if (createResult != FS_MAKE_NODE_SUCCESSFUL)
     {
-        printf(ACTION_CREATE_ON_ROOT " failed, FsMakeNode failed with code %u (%s).", createResult, FsCreateNodeResultToString(createResult));
-        FsCloseDisk(fsOnDisk);
+        printf(ACTION_CREATE_ON_ROOT " failed, FsMakeNode failed with code %u (%s).\n", createResult, FsCreateNodeResultToString(createResult));
+        FsCloseDisk(&fsOnDisk);
         fclose(pSourceFile);
-        return 0;
+        return 1;
+    }
+
+    // Named after the source file, without the host directories leading up to it.
+    const char* pName = strrchr(pSourceFilePath, '/');
+    pName = pName ? pName + 1 : pSourceFilePath;
+
+    register_node_result_t registerResult = FsRegisterNode(&fsOnDisk, FS_NODE_ID_ROOT, node.ID, pName);
+    if (registerResult != FS_REGISTER_NODE_SUCCESSFUL)
+    {
+        printf(ACTION_CREATE_ON_ROOT " failed, couldn't register node %u as 'FS/%s', code %u (%s).\n", node.ID, pName, registerResult, FsRegisterNodeResultToString(registerResult));
+        CliiUndoCreateOnRoot(&fsOnDisk, node.ID, NULL);
+        FsCloseDisk(&fsOnDisk);
+        fclose(pSourceFile);
+        return 1;
+    }
+
+    // The file is streamed into the node, memory use stays the same no matter how big it is.
+    FsNodeWriter writer;
+    write_node_data_result_t writeResult = FsOpenNodeWriter(&fsOnDisk, node.ID, &writer);
+    if (writeResult == FS_WRITE_DATA_SUCCESSFUL)
+    {
+        FsNodeWriterAppendFile(&writer, fileno(pSourceFile), 0, (uint64_t) szSrcFile);
+        writeResult = FsCloseNodeWriter(&writer);
+    }
+    fclose(pSourceFile);
+
+    if (writeResult != FS_WRITE_DATA_SUCCESSFUL)
+    {
+        printf(ACTION_CREATE_ON_ROOT " failed, couldn't write the file into node %u, code %u (%s).\n", node.ID, writeResult, FsWriteNodeDataResultToString(writeResult));
+        CliiUndoCreateOnRoot(&fsOnDisk, node.ID, pName);
+        FsCloseDisk(&fsOnDisk);
+        return 1;
+    }
+
+    if (!FsEndBatch(&fsOnDisk))
+    {
+        puts(ACTION_CREATE_ON_ROOT " failed, couldn't commit the new node.");
+        FsCloseDisk(&fsOnDisk);
+        return 1;
     }
 
-    FsCloseDisk(fsOnDisk);
+    FsCloseDisk(&fsOnDisk);
     printf(ACTION_CREATE_ON_ROOT " succeeded, file was made successfully, node ID = %u.\n", node.ID);
 
     return 0;
 }
+
+int CliBuildImage(int argc, char** argv)
+{
+    printf(ACTION_BUILD_IMAGE " usage: "
+            "[DiskPath: str] [BlockSize: int] [FileSystemOffset (in blocks): int] [VolumeName (max size " FS_STRINGIZE(FS_VOLUME_NAME_SIZE) "): str] "
+            "[Source (host directory or manifest): str] [BytesPerNodeRatio (default 16384, 16KiB): int] "
+            "[CacheBlocks (default %u): int] "
+            "[JournalBlocks (default %u, 0 for none): int] "
+            "[Threads (default 1, 0 for one per processor): int] "
+            "[DiskSize (K, M, G or T suffix, creates a sparse image; default 0 keeps the size of the disk): str] "
+            "[Compress (default 0, 1 compresses the data of every file): bool]\n",
+           FS_BLOCK_CACHE_DEFAULT_BLOCKS, FS_JOURNAL_DEFAULT_BLOCKS);
+
+    if (argc < 5)
+    {
+        puts("Too few arguments.");
+        return 1;
+    }
+    if (argc > 11)
+    {
+        puts("Too many arguments.");
+        return 1;
+    }
+
+    char* pDiskPath         =      argv[0];
+    int   blockSize         = atoi(argv[1]);
+    int   fsOffset          = atoi(argv[2]);
+    char* pVolName          =      argv[3];
+    char* pSourcePath       =      argv[4];
+    int   bytesPerNodeRatio = argc >= 6 ? atoi(argv[5]) : 16384;
+    int   cacheBlocks       = argc >= 7 ? atoi(argv[6]) : 0;
+    int   journalBlocks     = argc >= 8 ? atoi(argv[7]) : -1;
+    int   numThreads        = argc >= 9 ? atoi(argv[8]) : 1;
+    int   bCompress         = argc >= 11 ? atoi(argv[10]) : 0;
+    uint64_t diskSize       = 0;
+
+    if (argc >= 10 && !CliiParseSize(argv[9], &diskSize))
+    {
+        printf(ACTION_BUILD_IMAGE " failed, '%s' is not a disk size.\n", argv[9]);
+        return 1;
+    }
+
+    struct stat sourceInfo;
+    if (stat(pSourcePath, &sourceInfo) != 0)
+    {
+        printf(ACTION_BUILD_IMAGE " failed, couldn't find source '%s'.\n", pSourcePath);
+        return 1;
+    }
+
+    struct timespec tsStart;
+    clock_gettime(CLOCK_MONOTONIC, &tsStart);
+
+    if (!CliiMakeFileSystem(pDiskPath, diskSize, blockSize, fsOffset, pVolName, bytesPerNodeRatio, journalBlocks))
+    {
+        return 1;
+    }
+
+    FileSystemOnDisk fsOnDisk = FsLoadFileSystemOnDisk(pDiskPath, cacheBlocks > 0 ? (uint32_t) cacheBlocks : 0, true);
+    if (!fsOnDisk.bLoaded)
+    {
+        puts(ACTION_BUILD_IMAGE " failed, FsLoadFileSystemOnDisk failed.");
+        return 1;
+    }
+
+    FsImageBuilder builder;
+    if (numThreads < 0 || !FsBuilderInit(&builder, &fsOnDisk, (uint32_t) numThreads, bCompress != 0))
+    {
+        FsCloseDisk(&fsOnDisk);
+        return 1;
+    }
+
+    bool bImported = S_ISDIR(sourceInfo.st_mode) ? FsBuilderAddHostTree(&builder, pSourcePath, "FS/")
+                                                 : FsBuilderAddManifest(&builder, pSourcePath);
+    uint64_t numDirectories = builder.NumDirectories;
+    uint32_t numWorkers     = builder.NumThreads;
+    bool bFinished = FsBuilderFinish(&builder);
+    // Only counted once their data is on disk, the last files of a parallel build are finished by FsBuilderFinish.
+    uint64_t numFiles       = builder.NumFiles;
+    uint64_t numBytes       = builder.NumBytes;
+    uint64_t numStoredBytes = builder.NumStoredBytes;
+
+    bool bSynced = FsSync(&fsOnDisk);
+    FsBlockCache cache   = fsOnDisk.Cache;
+    FsJournal    journal = fsOnDisk.Journal;
+    FsCloseDisk(&fsOnDisk);
+
+    struct timespec tsEnd;
+    clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+    double seconds = (tsEnd.tv_sec - tsStart.tv_sec) + (tsEnd.tv_nsec - tsStart.tv_nsec) / 1e9;
+
+    printf("Imported %lu files (%lu bytes) into %lu directories in %.3f seconds using %u threads.\n", numFiles, numBytes, numDirectories, seconds, numWorkers);
+    if (bCompress)
+    {
+        printf("Compression: %lu bytes stored in %lu bytes, ratio %.3f.\n",
+               numBytes, numStoredBytes, numStoredBytes ? (double) numBytes / numStoredBytes : 0.0);
+    }
+    printf("Block cache: %u blocks, %lu hits, %lu misses, %lu evictions, %lu write-backs.\n",
+           cache.Capacity, cache.Hits, cache.Misses, cache.Evictions, cache.WriteBacks);
+    if (journal.Start)
+    {
+        printf("Journal: %u blocks, %lu transactions, %lu blocks logged, %lu checkpoints, %lu overflows.\n",
+               journal.NumBlocks, journal.Transactions, journal.ImagesLogged, journal.Checkpoints, journal.Overflows);
+    }
+
+    if (!bImported || !bFinished || !bSynced)
+    {
+        puts(ACTION_BUILD_IMAGE " failed, the image is incomplete.");
+        return 1;
+    }
+
+    puts(ACTION_BUILD_IMAGE " succeeded, the image was built successfully.");
+    return 0;
+}
+
+int CliResolvePath(int argc, char** argv)
+{
+    puts(ACTION_RESOLVE_PATH " usage: [DiskPath: str] [Path (FS/...): str]...");
+
+    if (argc < 2)
+    {
+        puts("Too few arguments.");
+        return 1;
+    }
+
+    char* pDiskPath = argv[0];
+
+    FileSystemOnDisk fsOnDisk = FsLoadFileSystemOnDisk(pDiskPath, 0, false);
+    if (!fsOnDisk.bLoaded)
+    {
+        puts(ACTION_RESOLVE_PATH " failed, FsLoadFileSystemOnDisk failed.");
+        return 1;
+    }
+
+    int numFailed = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        FsEntry entry;
+        resolve_path_result_t result = FsResolvePath(&fsOnDisk, argv[i], &entry);
+        if (result != FS_RESOLVE_PATH_FOUND)
+        {
+            printf("%s: code %u (%s)\n", argv[i], result, FsResolvePathResultToString(result));
+            numFailed++;
+            continue;
+        }
+
+        printf("%s: node %u, type %u (%s)\n", argv[i], entry.NodeID, entry.NodeType, FsNodeTypeToString(entry.NodeType));
+    }
+
+    printf("Dentry cache: %u entries, %lu hits (%lu negative), %lu misses, %lu evictions.\n", fsOnDisk.Dentries.Capacity,
+           fsOnDisk.Dentries.Hits, fsOnDisk.Dentries.NegativeHits, fsOnDisk.Dentries.Misses, fsOnDisk.Dentries.Evictions);
+
+    FsCloseDisk(&fsOnDisk);
+    return numFailed ? 1 : 0;
+}
+
+int CliVerify(int argc, char** argv)
+{
+    puts(ACTION_VERIFY " usage: [DiskPath: str] [Threads (default 0, one per processor): int]");
+
+    if (argc < 1)
+    {
+        puts("Too few arguments.");
+        return 1;
+    }
+    if (argc > 2)
+    {
+        puts("Too many arguments.");
+        return 1;
+    }
+
+    char* pDiskPath  =      argv[0];
+    int   numThreads = argc >= 2 ? atoi(argv[1]) : 0;
+    if (numThreads < 0)
+    {
+        puts(ACTION_VERIFY " failed, the number of threads can't be negative.");
+        return 1;
+    }
+
+    struct timespec tsStart;
+    clock_gettime(CLOCK_MONOTONIC, &tsStart);
+
+    FileSystemOnDisk fsOnDisk = FsLoadFileSystemOnDisk(pDiskPath, 0, false);
+    if (!fsOnDisk.bLoaded)
+    {
+        puts(ACTION_VERIFY " failed, FsLoadFileSystemOnDisk failed.");
+        return 1;
+    }
+
+    FsVerifyReport report;
+    bool bVerified = FsVerify(&fsOnDisk, (uint32_t) numThreads, &report);
+    FsCloseDisk(&fsOnDisk);
+
+    struct timespec tsEnd;
+    clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+    double seconds = (tsEnd.tv_sec - tsStart.tv_sec) + (tsEnd.tv_nsec - tsStart.tv_nsec) / 1e9;
+
+    if (!bVerified)
+    {
+        puts(ACTION_VERIFY " failed, the file system couldn't be checked.");
+        return 1;
+    }
+
+    printf("Checked %lu nodes and %lu allocated blocks in %.3f seconds using %u threads.\n",
+           report.NodesInUse, report.BlocksInUse, seconds, report.NumThreads);
+
+    uint64_t numProblems = FsVerifyProblems(&report);
+    if (numProblems)
+    {
+        printf("Problems: %lu bad nodes, %lu bad pointers, %lu missing pointers, %lu cross-linked blocks, %lu blocks in use but free, "
+               "%lu leaked blocks, %lu bad node table marks, %lu bad counters, %lu read errors.\n",
+               report.BadNodes, report.BadPointers, report.MissingPointers, report.CrossLinked, report.UnmarkedBlocks,
+               report.LeakedBlocks, report.BadTableHints, report.BadCounters, report.ReadErrors);
+        printf(ACTION_VERIFY " failed, found %lu problems.\n", numProblems);
+        return 1;
+    }
+
+    puts(ACTION_VERIFY " succeeded, the file system is consistent.");
+    return 0;
+}
+
+#define CLI_EXTRACT_BUFFER_SIZE (UINT64_C(1) << 20)
+
+typedef struct
+{
+    FileSystemOnDisk* pFs;
+    uint64_t          Readahead;
+    uint8_t*          pBuffer;   // CLI_EXTRACT_BUFFER_SIZE bytes.
+    uint64_t          NumFiles;
+    uint64_t          NumDirectories;
+    uint64_t          NumBytes;
+} extract_state_t;
+
+static bool CliiExtractEntry(extract_state_t* pState, nodeid_t nodeID, uint16_t nodeType, const char* pHostPath);
+
+// Entry visitor collecting the entries of a directory, pContext is an FsEntryList.
+static bool CliiCollectEntry(void* pContext, const FsEntry* pEntry)
+{
+    return FsEntryListAppend((FsEntryList*) pContext, pEntry->NodeID, pEntry->NodeType, FsEntryName(pEntry), pEntry->NameLength);
+}
+
+static bool CliiExtractFile(extract_state_t* pState, nodeid_t nodeID, const char* pHostPath)
+{
+    FsNodeReader reader;
+    read_node_data_result_t result = FsOpenNodeReader(pState->pFs, nodeID, pState->Readahead, &reader);
+    if (result != FS_READ_DATA_SUCCESSFUL)
+    {
+        printf(ACTION_EXTRACT " failed, couldn't open node %u, code %u (%s).\n", nodeID, result, FsReadNodeDataResultToString(result));
+        return false;
+    }
+
+    int descriptor = open(pHostPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (descriptor < 0)
+    {
+        printf(ACTION_EXTRACT " failed, couldn't create '%s': %s.\n", pHostPath, strerror(errno));
+        FsCloseNodeReader(&reader);
+        return false;
+    }
+
+    bool bWritten = true;
+    for (uint64_t offset = 0; bWritten && offset < reader.Node.Size;)
+    {
+        uint64_t numRead;
+        result = FsNodeReaderRead(&reader, offset, pState->pBuffer, CLI_EXTRACT_BUFFER_SIZE, &numRead);
+        if (result != FS_READ_DATA_SUCCESSFUL)
+        {
+            printf(ACTION_EXTRACT " failed, couldn't read node %u at byte %lu, code %u (%s).\n", nodeID, offset, result, FsReadNodeDataResultToString(result));
+            bWritten = false;
+            break;
+        }
+
+        // Zeroes are skipped over, the host file gets a hole there unless its file system has none.
+        if (BitScanIsZero(pState->pBuffer, numRead))
+        {
+            if (lseek(descriptor, (off_t) numRead, SEEK_CUR) < 0)
+            {
+                printf(ACTION_EXTRACT " failed, couldn't write '%s': %s.\n", pHostPath, strerror(errno));
+                bWritten = false;
+            }
+            offset += numRead;
+            continue;
+        }
+
+        for (uint64_t done = 0; done < numRead;)
+        {
+            ssize_t numWritten = write(descriptor, pState->pBuffer + done, numRead - done);
+            if (numWritten < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (numWritten <= 0)
+            {
+                printf(ACTION_EXTRACT " failed, couldn't write '%s': %s.\n", pHostPath, strerror(errno));
+                bWritten = false;
+                break;
+            }
+            done += (uint64_t) numWritten;
+        }
+        offset += numRead;
+    }
+
+    // A file ending in zeroes only gets its size here.
+    if (bWritten && ftruncate(descriptor, (off_t) reader.Node.Size) != 0)
+    {
+        printf(ACTION_EXTRACT " failed, couldn't write '%s': %s.\n", pHostPath, strerror(errno));
+        bWritten = false;
+    }
+    if (close(descriptor) != 0 && bWritten)
+    {
+        printf(ACTION_EXTRACT " failed, couldn't write '%s': %s.\n", pHostPath, strerror(errno));
+        bWritten = false;
+    }
+    if (bWritten)
+    {
+        pState->NumFiles++;
+        pState->NumBytes += reader.Node.Size;
+    }
+    FsCloseNodeReader(&reader);
+    return bWritten;
+}
+
+static bool CliiExtractSoftLink(extract_state_t* pState, nodeid_t nodeID, const char* pHostPath)
+{
+    FsNode node = FsGetNode(pState->pFs, nodeID);
+    if (node.ID == FS_NODE_ID_INVALID || node.Size >= CLI_EXTRACT_BUFFER_SIZE)
+    {
+        printf(ACTION_EXTRACT " failed, node %u is not a readable soft link.\n", nodeID);
+        return false;
+    }
+
+    // The data of a soft link is the path it points to.
+    uint64_t numRead;
+    read_node_data_result_t result = FsReadNodeData(pState->pFs, nodeID, 0, pState->pBuffer, node.Size, &numRead);
+    if (result != FS_READ_DATA_SUCCESSFUL)
+    {
+        printf(ACTION_EXTRACT " failed, couldn't read node %u, code %u (%s).\n", nodeID, result, FsReadNodeDataResultToString(result));
+        return false;
+    }
+    pState->pBuffer[numRead] = '\0';
+
+    unlink(pHostPath);
+    if (symlink((const char*) pState->pBuffer, pHostPath) != 0)
+    {
+        printf(ACTION_EXTRACT " failed, couldn't create the soft link '%s': %s.\n", pHostPath, strerror(errno));
+        return false;
+    }
+
+    pState->NumFiles++;
+    return true;
+}
+
+static bool CliiExtractDirectory(extract_state_t* pState, nodeid_t nodeID, const char* pHostPath)
+{
+    if (mkdir(pHostPath, 0755) != 0 && errno != EEXIST)
+    {
+        printf(ACTION_EXTRACT " failed, couldn't create the directory '%s': %s.\n", pHostPath, strerror(errno));
+        return false;
+    }
+
+    // Collected before descending, so no directory is being listed while its subdirectories are.
+    FsEntryList entries = { 0 };
+    if (!FsListDirectory(pState->pFs, nodeID, CliiCollectEntry, &entries))
+    {
+        printf(ACTION_EXTRACT " failed, couldn't list the entries of directory node %u.\n", nodeID);
+        FsEntryListRelease(&entries);
+        return false;
+    }
+    pState->NumDirectories++;
+
+    size_t szHostPath = strlen(pHostPath);
+    char*  pChildPath = malloc(szHostPath + 1 + FS_ENTRY_NAME_MAX + 1);
+    if (!pChildPath)
+    {
+        puts(ACTION_EXTRACT " failed, couldn't allocate memory for host paths.");
+        FsEntryListRelease(&entries);
+        return false;
+    }
+    memcpy(pChildPath, pHostPath, szHostPath);
+    pChildPath[szHostPath] = '/';
+
+    bool bExtracted = true;
+    for (uint64_t offset = 0; bExtracted && offset < entries.Size;)
+    {
+        const FsEntry* pEntry = (const FsEntry*) (entries.pData + offset);
+        memcpy(pChildPath + szHostPath + 1, FsEntryName(pEntry), pEntry->NameLength);
+        pChildPath[szHostPath + 1 + pEntry->NameLength] = '\0';
+
+        bExtracted = CliiExtractEntry(pState, pEntry->NodeID, pEntry->NodeType, pChildPath);
+        offset += pEntry->EntrySize;
+    }
+
+    free(pChildPath);
+    FsEntryListRelease(&entries);
+    return bExtracted;
+}
+
+static bool CliiExtractEntry(extract_state_t* pState, nodeid_t nodeID, uint16_t nodeType, const char* pHostPath)
+{
+    switch (nodeType)
+    {
+    case FS_NODE_TYPE_FILE:      return CliiExtractFile(pState, nodeID, pHostPath);
+    case FS_NODE_TYPE_DIRECTORY: return CliiExtractDirectory(pState, nodeID, pHostPath);
+    case FS_NODE_TYPE_SOFT_LINK: return CliiExtractSoftLink(pState, nodeID, pHostPath);
+    default: break;
+    }
+
+    printf("Skipped '%s', node %u is of type %u (%s) which can't be extracted.\n", pHostPath, nodeID, nodeType, FsNodeTypeToString(nodeType));
+    return true;
+}
+
+int CliExtract(int argc, char** argv)
+{
+    puts(ACTION_EXTRACT " usage: [DiskPath: str] [Path (FS/...): str] [HostPath: str] "
+         "[ReadaheadKiB (default 8192): int]");
+
+    if (argc < 3)
+    {
+        puts("Too few arguments.");
+        return 1;
+    }
+    if (argc > 4)
+    {
+        puts("Too many arguments.");
+        return 1;
+    }
+
+    char* pDiskPath    =      argv[0];
+    char* pPath        =      argv[1];
+    char* pHostPath    =      argv[2];
+    int   readaheadKiB = argc >= 4 ? atoi(argv[3]) : (int) (FS_READ_DEFAULT_READAHEAD >> 10);
+    if (readaheadKiB < 0)
+    {
+        puts(ACTION_EXTRACT " failed, the readahead can't be negative.");
+        return 1;
+    }
+
+    struct timespec tsStart;
+    clock_gettime(CLOCK_MONOTONIC, &tsStart);
+
+    FileSystemOnDisk fsOnDisk = FsLoadFileSystemOnDisk(pDiskPath, 0, false);
+    if (!fsOnDisk.bLoaded)
+    {
+        puts(ACTION_EXTRACT " failed, FsLoadFileSystemOnDisk failed.");
+        return 1;
+    }
+
+    FsEntry entry;
+    resolve_path_result_t resolveResult = FsResolvePath(&fsOnDisk, pPath, &entry);
+    if (resolveResult != FS_RESOLVE_PATH_FOUND)
+    {
+        printf(ACTION_EXTRACT " failed, couldn't resolve '%s', code %u (%s).\n", pPath, resolveResult, FsResolvePathResultToString(resolveResult));
+        FsCloseDisk(&fsOnDisk);
+        return 1;
+    }
+
+    extract_state_t state = { .pFs = &fsOnDisk, .Readahead = (uint64_t) readaheadKiB << 10 };
+    state.pBuffer = malloc(CLI_EXTRACT_BUFFER_SIZE);
+    if (!state.pBuffer)
+    {
+        puts(ACTION_EXTRACT " failed, couldn't allocate the copy buffer.");
+        FsCloseDisk(&fsOnDisk);
+        return 1;
+    }
+
+    bool bExtracted = CliiExtractEntry(&state, entry.NodeID, entry.NodeType, pHostPath);
+    free(state.pBuffer);
+    FsCloseDisk(&fsOnDisk);
+
+    struct timespec tsEnd;
+    clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+    double seconds = (tsEnd.tv_sec - tsStart.tv_sec) + (tsEnd.tv_nsec - tsStart.tv_nsec) / 1e9;
+
+    printf("Extracted %lu files (%lu bytes) and %lu directories in %.3f seconds.\n", state.NumFiles, state.NumBytes, state.NumDirectories, seconds);
+    if (!bExtracted)
+    {
+        puts(ACTION_EXTRACT " failed, the extraction is incomplete.");
+        return 1;
+    }
+
+    puts(ACTION_EXTRACT " succeeded, everything was extracted.");
+    return 0;
+}
+
+#define CLI_PATCH_BUFFER_SIZE (UINT64_C(1) << 20)
+
+// Loads the file system and resolves pPath to a file, prints why on failure. The disk is closed again unless this succeeds.
+static bool CliiOpenFile(const char* pAction, const char* pDiskPath, const char* pPath, FileSystemOnDisk* pFs, FsEntry* pEntry)
+{
+    *pFs = FsLoadFileSystemOnDisk(pDiskPath, 0, true);
+    if (!pFs->bLoaded)
+    {
+        printf("%s failed, FsLoadFileSystemOnDisk failed.\n", pAction);
+        return false;
+    }
+
+    resolve_path_result_t resolveResult = FsResolvePath(pFs, pPath, pEntry);
+    if (resolveResult != FS_RESOLVE_PATH_FOUND)
+    {
+        printf("%s failed, couldn't resolve '%s', code %u (%s).\n", pAction, pPath, resolveResult, FsResolvePathResultToString(resolveResult));
+        FsCloseDisk(pFs);
+        return false;
+    }
+    if (pEntry->NodeType != FS_NODE_TYPE_FILE)
+    {
+        printf("%s failed, '%s' is a %s, not a file.\n", pAction, pPath, FsNodeTypeToString(pEntry->NodeType));
+        FsCloseDisk(pFs);
+        return false;
+    }
+
+    return true;
+}
+
+int CliPatch(int argc, char** argv)
+{
+    puts(ACTION_PATCH " usage: [DiskPath: str] [Path (FS/...): str] [SourceFilePath: str] "
+         "[Offset (default -1, appends to the file): int]");
+
+    if (argc < 3)
+    {
+        puts("Too few arguments.");
+        return 1;
+    }
+    if (argc > 4)
+    {
+        puts("Too many arguments.");
+        return 1;
+    }
+
+    char* pDiskPath   = argv[0];
+    char* pPath       = argv[1];
+    char* pSourcePath = argv[2];
+
+    bool     bAppend = argc < 4 || strcmp(argv[3], "-1") == 0;
+    uint64_t offset  = 0;
+    if (!bAppend && !CliiParseSize(argv[3], &offset))
+    {
+        printf(ACTION_PATCH " failed, '%s' is not an offset.\n", argv[3]);
+        return 1;
+    }
+
+    int source = open(pSourcePath, O_RDONLY);
+    if (source < 0)
+    {
+        printf(ACTION_PATCH " failed, couldn't open source file %s: %s.\n", pSourcePath, strerror(errno));
+        return 1;
+    }
+
+    uint8_t* pBuffer = malloc(CLI_PATCH_BUFFER_SIZE);
+    if (!pBuffer)
+    {
+        puts(ACTION_PATCH " failed, couldn't allocate the copy buffer.");
+        close(source);
+        return 1;
+    }
+
+    FileSystemOnDisk fsOnDisk;
+    FsEntry entry;
+    if (!CliiOpenFile(ACTION_PATCH, pDiskPath, pPath, &fsOnDisk, &entry))
+    {
+        free(pBuffer);
+        close(source);
+        return 1;
+    }
+    if (bAppend)
+    {
+        offset = FsGetNode(&fsOnDisk, entry.NodeID).Size;
+    }
+
+    // The pieces are committed together, only the blocks the source covers are written.
+    FsBeginBatch(&fsOnDisk);
+    write_node_data_result_t writeResult = FS_WRITE_DATA_SUCCESSFUL;
+    uint64_t numWritten = 0;
+    ssize_t  numRead;
+    while (writeResult == FS_WRITE_DATA_SUCCESSFUL && (numRead = read(source, pBuffer, CLI_PATCH_BUFFER_SIZE)) > 0)
+    {
+        writeResult = FsWriteNodeAt(&fsOnDisk, entry.NodeID, offset + numWritten, pBuffer, (uint64_t) numRead);
+        numWritten += (uint64_t) numRead;
+    }
+    bool bCommitted = FsEndBatch(&fsOnDisk);
+
+    free(pBuffer);
+    close(source);
+    FsCloseDisk(&fsOnDisk);
+
+    if (writeResult != FS_WRITE_DATA_SUCCESSFUL || numRead < 0 || !bCommitted)
+    {
+        printf(ACTION_PATCH " failed, couldn't write into node %u, code %u (%s).\n", entry.NodeID, writeResult, FsWriteNodeDataResultToString(writeResult));
+        return 1;
+    }
+
+    printf(ACTION_PATCH " succeeded, wrote %lu bytes at offset %lu of node %u.\n", numWritten, offset, entry.NodeID);
+    return 0;
+}
+
+int CliTruncate(int argc, char** argv)
+{
+    puts(ACTION_TRUNCATE " usage: [DiskPath: str] [Path (FS/...): str] [Size (K, M, G or T suffix): str]");
+
+    if (argc < 3)
+    {
+        puts("Too few arguments.");
+        return 1;
+    }
+    if (argc > 3)
+    {
+        puts("Too many arguments.");
+        return 1;
+    }
+
+    uint64_t size;
+    if (!CliiParseSize(argv[2], &size))
+    {
+        printf(ACTION_TRUNCATE " failed, '%s' is not a size.\n", argv[2]);
+        return 1;
+    }
+
+    FileSystemOnDisk fsOnDisk;
+    FsEntry entry;
+    if (!CliiOpenFile(ACTION_TRUNCATE, argv[0], argv[1], &fsOnDisk, &entry))
+    {
+        return 1;
+    }
+
+    write_node_data_result_t result = FsTruncateNode(&fsOnDisk, entry.NodeID, size);
+    FsCloseDisk(&fsOnDisk);
+
+    if (result != FS_WRITE_DATA_SUCCESSFUL)
+    {
+        printf(ACTION_TRUNCATE " failed, code %u (%s).\n", result, FsWriteNodeDataResultToString(result));
+        return 1;
+    }
+
+    printf(ACTION_TRUNCATE " succeeded, node %u is %lu bytes now.\n", entry.NodeID, size);
+    return 0;
+}
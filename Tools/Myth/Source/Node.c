@@ -1,12 +1,20 @@
+#define _GNU_SOURCE // SEEK_DATA, SEEK_HOLE
+
 #include "Node.h"
 
+#include "Utils/BitScan.h"
 #include "Utils/Math.h"
+#include "BlockMap.h"
 #include "Bitmap.h"
+#include "Compression.h"
 #include "Disk.h"
+#include "Group.h"
 
 #include <stdlib.h>
 #include <memory.h>
 #include <math.h>
+#include <errno.h>
+#include <unistd.h>
 
 #define DOCASE(x) case x: return #x
 
@@ -20,6 +28,21 @@ const char* FsWriteNodeDataResultToString(write_node_data_result_t result)
         DOCASE(FS_WRITE_DATA_ALLOCATION_ERROR);
         DOCASE(FS_WRITE_DATA_INSUFFICIENT_DISK_SPACE);
         DOCASE(FS_WRITE_DATA_TOO_BIG);
+        DOCASE(FS_WRITE_DATA_COMPRESSED);
+    default: break;
+    }
+
+    return "((Invalid, Non-Standard Result))";
+}
+
+const char* FsReadNodeDataResultToString(read_node_data_result_t result)
+{
+    switch (result)
+    {
+        DOCASE(FS_READ_DATA_SUCCESSFUL);
+        DOCASE(FS_READ_DATA_NODE_DOES_NOT_EXIST);
+        DOCASE(FS_READ_DATA_DISK_ERROR);
+        DOCASE(FS_READ_DATA_ALLOCATION_ERROR);
     default: break;
     }
 
@@ -50,7 +73,15 @@ nodepos_t FsResolveNodePos(const FsMeta* pMeta, nodeid_t nodeID)
     uint16_t nodesPerBlock = pMeta->BlockSize / FS_NODE_SIZE;
 
     nodepos_t pos;
-    pos.TableBlock = pMeta->AddrNodeTable + (nodeID / nodesPerBlock);
+    if (FsHasGroups(pMeta))
+    {
+        uint32_t group = FsGroupOfNode(pMeta, nodeID);
+        pos.TableBlock = FsGroupStart(pMeta, group) + 1 + (nodeID % pMeta->NodesPerGroup) / nodesPerBlock;
+    }
+    else
+    {
+        pos.TableBlock = pMeta->AddrNodeTable + (nodeID / nodesPerBlock);
+    }
     pos.Nest = nodeID % nodesPerBlock;
     pos.RawAddress = (pos.TableBlock * pMeta->BlockSize) + (pos.Nest * FS_NODE_SIZE);
 
@@ -60,36 +91,100 @@ nodepos_t FsResolveNodePos(const FsMeta* pMeta, nodeid_t nodeID)
 nodeid_t FsResolveNodeID(const FsMeta* pMeta, nodepos_t pos)
 {
     uint16_t nodesPerBlock = pMeta->BlockSize / FS_NODE_SIZE;
+    if (FsHasGroups(pMeta))
+    {
+        uint32_t group = FsGroupOfBlock(pMeta, pos.TableBlock);
+        block_t nodeBlock = pos.TableBlock - FsGroupStart(pMeta, group) - 1;
+        return group * pMeta->NodesPerGroup + nodeBlock * nodesPerBlock + pos.Nest;
+    }
+
     block_t nodeBlock = pos.TableBlock - pMeta->AddrNodeTable;
     return nodeBlock * nodesPerBlock + pos.Nest;
 }
 
-uint16_t FsFindNodeNest(FILE* pDisk, const FsMeta* pMeta, block_t nodeBlock)
+bool FsNodeInTable(const FsMeta* pMeta, nodeid_t nodeID)
 {
-    if (nodeBlock < pMeta->AddrNodeTable || nodeBlock > (pMeta->AddrNodeTable - pMeta->AddrData))
+    if (FsHasGroups(pMeta))
     {
-        printf("FsFindNodeNest failed, given node block %lu is not within the node table range.\n", nodeBlock);
-        return 0xFFFF;
+        return FsGroupOfNode(pMeta, nodeID) < pMeta->NumGroups;
+    }
+    return FsResolveNodePos(pMeta, nodeID).TableBlock < pMeta->AddrData;
+}
+
+bool FsNodeInitialized(const FsMeta* pMeta, nodeid_t nodeID)
+{
+    return !FsHasLazyInit(pMeta) || nodeID < pMeta->NodeWatermark;
+}
+
+// Raises NodeWatermark past nodeID, clearing the node table slots it passes over. The slots up to the end of an
+// FS_NODE_TABLE_INIT_SIZE worth of node table are cleared along so the watermark doesn't move for every node.
+static bool FsiInitNodeTable(FileSystemOnDisk* pFs, nodeid_t nodeID)
+{
+    FsMeta* pMeta = &pFs->Meta;
+    if (FsNodeInitialized(pMeta, nodeID))
+    {
+        return true;
     }
 
-    if (fseek(pDisk, nodeBlock * pMeta->BlockSize, SEEK_SET) != 0)
+    uint64_t nodesPerBatch = FS_NODE_TABLE_INIT_SIZE / FS_NODE_SIZE;
+    uint64_t groupStart    = (uint64_t) FsGroupOfNode(pMeta, nodeID) * pMeta->NodesPerGroup;
+    uint64_t watermark     = groupStart + FS_MIN(FS_DIV(nodeID + 1 - groupStart, nodesPerBatch) * nodesPerBatch, pMeta->NodesPerGroup);
+
+    // Each group's slots are contiguous, every group between the old watermark and nodeID is cleared in full.
+    for (uint64_t from = pMeta->NodeWatermark; from < watermark;)
     {
-        printf("FsFindNodeNest failed, couldn't seek to node block %lu on disk.\n", nodeBlock);
-        return 0xFFFF;
+        uint64_t to = FS_MIN((from / pMeta->NodesPerGroup + 1) * pMeta->NodesPerGroup, watermark);
+
+        nodepos_t pos = FsResolveNodePos(pMeta, (nodeid_t) from);
+        uint64_t numBlocks = (to - from) / (pMeta->BlockSize / FS_NODE_SIZE);
+        for (uint64_t i = 0; i < numBlocks; i++)
+        {
+            FsBlockCacheDiscard(&pFs->Cache, pos.TableBlock + i);
+        }
+        if (!FsDeviceZero(pFs->pDevice, pos.TableBlock * pMeta->BlockSize, numBlocks * pMeta->BlockSize))
+        {
+            printf("FsiInitNodeTable failed, couldn't clear the node table for nodes %lu to %lu.\n", from, to - 1);
+            return false;
+        }
+        pMeta->NodeWatermark = (nodeid_t) to;
+        from = to;
+    }
+
+    return true;
+}
+
+// True when block belongs to a node table, the one of any group when the file system has groups.
+static bool FsiIsNodeTableBlock(const FsMeta* pMeta, block_t block)
+{
+    if (FsHasGroups(pMeta))
+    {
+        uint32_t group = FsGroupOfBlock(pMeta, block);
+        return block >= pMeta->AddrBitmap && group < pMeta->NumGroups && block > FsGroupStart(pMeta, group) && block < FsGroupData(pMeta, group);
     }
+    return block >= pMeta->AddrNodeTable && block < pMeta->AddrData;
+}
+
+uint16_t FsFindNodeNest(FileSystemOnDisk* pFs, block_t nodeBlock)
+{
+    const FsMeta* pMeta = &pFs->Meta;
 
-    FsNode* nodes = malloc(pMeta->BlockSize);
-    if (!nodes)
+    if (!FsiIsNodeTableBlock(pMeta, nodeBlock))
     {
-        printf("FsFindNodeNest failed, couldn't allocate memory to store block from node block %lu.\n", nodeBlock);
+        printf("FsFindNodeNest failed, given node block %lu is not within the node table range.\n", nodeBlock);
         return 0xFFFF;
     }
-    if (fread(nodes, 1, pMeta->BlockSize, pDisk) != pMeta->BlockSize)
+    if (!FsNodeInitialized(pMeta, FsResolveNodeID(pMeta, (nodepos_t) { .TableBlock = nodeBlock, .Nest = 0 })))
+    {
+        return 0;
+    }
+
+    FsBlockCacheEntry* pEntry = FsBlockCachePin(&pFs->Cache, nodeBlock);
+    if (!pEntry)
     {
         printf("FsFindNodeNest failed, couldn't read node block %lu on disk.\n", nodeBlock);
-        free(nodes);
         return 0xFFFF;
     }
+    const FsNode* nodes = (const FsNode*) pEntry->pData;
 
     uint16_t result = 0xFFFF;
     for (uint16_t i = nodeBlock == pMeta->AddrNodeTable ? 1 : 0; i < pMeta->BlockSize / FS_NODE_SIZE; i++)
@@ -101,66 +196,75 @@ uint16_t FsFindNodeNest(FILE* pDisk, const FsMeta* pMeta, block_t nodeBlock)
         }
     }
     
-    free(nodes);
+    FsBlockCacheUnpin(&pFs->Cache, pEntry);
     return result;
 }
 
-nodeid_t FsFindNodeID(FILE* pDisk, const FsMeta* pMeta)
+// Lowest unused node ID within [cursor, to), or within [from, cursor) when there is none past the cursor.
+static nodeid_t FsiFindNodeIDFrom(FileSystemOnDisk* pFs, nodeid_t from, nodeid_t to, nodeid_t cursor)
 {
-    uint8_t* bitmap = FsLoadBitmap(pDisk, pMeta);
-    if (!bitmap)
+    nodeid_t result = FsNodeIndexFindFree(&pFs->Nodes, pFs->pDevice, &pFs->Meta, cursor, to);
+    if (result == FS_NODE_ID_INVALID && cursor > from)
     {
-        puts("FsFindNodeID failed due to FsLoadBitmap failing.");
-        return FS_MAKE_NODE_DISK_ERROR;
+        result = FsNodeIndexFindFree(&pFs->Nodes, pFs->pDevice, &pFs->Meta, from, cursor);
     }
+    return result;
+}
 
-    // TODO: Add quick allocation using LastAllocatedNodeID.
+// Looks through the groups for an unused node, starting at the group of nearID and skipping groups whose descriptor
+// says they are full. Within the group of the last allocated node the search resumes right after it.
+static nodeid_t FsiFindNodeIDInGroups(FileSystemOnDisk* pFs, nodeid_t nearID)
+{
+    const FsMeta* pMeta = &pFs->Meta;
+    uint32_t firstGroup = FsGroupOfNode(pMeta, nearID) < pMeta->NumGroups ? FsGroupOfNode(pMeta, nearID) : 0;
 
-    nodeid_t result;
-    for (uint64_t bitmapBlock = pMeta->AddrBitmap; bitmapBlock < pMeta->AddrNodeTable; bitmapBlock++)
+    for (uint32_t i = 0; i < pMeta->NumGroups; i++)
     {
-        for (uint16_t byteOffset = 0; byteOffset < pMeta->BlockSize; byteOffset++)
-        {
-            uint8_t byte = bitmap[(bitmapBlock - pMeta->AddrBitmap) * pMeta->BlockSize + byteOffset];
+        uint32_t group = (firstGroup + i) % pMeta->NumGroups;
 
-            // all bits set?
-            if (byte == 0xFF)
-            {
-                continue;
-            }
+        FsGroupDescriptor descriptor;
+        if (!FsReadGroup(pFs, group, &descriptor))
+        {
+            return FS_NODE_ID_INVALID;
+        }
+        if (!descriptor.FreeNodes)
+        {
+            continue;
+        }
 
-            for (uint8_t i = 0; i < 8; i++)
-            {
-                // bit set, all node nests are used.
-                if (byte & (1 << i))
-                {
-                    continue;
-                }
+        nodeid_t from   = group * pMeta->NodesPerGroup;
+        nodeid_t to     = from + pMeta->NodesPerGroup;
+        nodeid_t cursor = FsGroupOfNode(pMeta, pMeta->LastAllocatedNodeID) == group ? pMeta->LastAllocatedNodeID : from;
 
-                nodepos_t pos;
-                pos.TableBlock = FsBitmapResolveToBlock(pMeta, (bitmappos_t) { .Block = bitmapBlock, .ByteOffset = byteOffset, .BitOffset = i });
-                pos.Nest = FsFindNodeNest(pDisk, pMeta, pos.TableBlock);
+        nodeid_t result = FsiFindNodeIDFrom(pFs, from, to, cursor);
+        if (result != FS_NODE_ID_INVALID)
+        {
+            return result;
+        }
+    }
 
-                if (pos.Nest == 0xFFFF)
-                {
-                    printf("FsFindNodeID failed, node block %lu has no free node nests, contrary to the bitmap. Possible corruption?\n", pos.TableBlock);
-                    result = FS_NODE_ID_INVALID;
-                    goto Finish;
-                }
+    puts("FsFindNodeID failed, every group is full.");
+    return FS_NODE_ID_INVALID;
+}
 
-                result = FsResolveNodeID(pMeta, pos);
-                if (result == FS_NODE_ID_INVALID || result == FS_NODE_ID_JOURNAL || result == FS_NODE_ID_ROOT)
-                {
-                    continue;
-                }
+nodeid_t FsFindNodeID(FileSystemOnDisk* pFs)
+{
+    return FsFindNodeIDNear(pFs, pFs->Meta.LastAllocatedNodeID);
+}
 
-                goto Finish;
-            }
-        }
+nodeid_t FsFindNodeIDNear(FileSystemOnDisk* pFs, nodeid_t nearID)
+{
+    if (FsHasGroups(&pFs->Meta))
+    {
+        return FsiFindNodeIDInGroups(pFs, nearID);
     }
 
-Finish:
-    free(bitmap);
+    // The search resumes from the last allocated node and wraps around, the nodes before it are likely in use.
+    nodeid_t result = FsiFindNodeIDFrom(pFs, 0, (nodeid_t) pFs->Nodes.NumNodes, pFs->Meta.LastAllocatedNodeID);
+    if (result == FS_NODE_ID_INVALID)
+    {
+        puts("FsFindNodeID failed, every node table block is full.");
+    }
     return result;
 }
 
@@ -171,38 +275,39 @@ FsNode FsInvalidNode(void)
     return node;
 }
 
-bool FsNodeExists(FILE* pDisk, const FsMeta* pMeta, nodeid_t nodeID)
+bool FsNodeExists(FileSystemOnDisk* pFs, nodeid_t nodeID)
 {
-    nodepos_t pos = FsResolveNodePos(pMeta, nodeID);
-
-    if (fseek(pDisk, pos.RawAddress, SEEK_SET) != 0)
+    if (!FsNodeInitialized(&pFs->Meta, nodeID))
     {
-        printf("FsNodeExists failed, couldn't seek to node %u's position {block %lu, nest %u} on disk.\n", nodeID, pos.TableBlock, pos.Nest);
-        return 0;
+        return false;
     }
 
-    FsNode node;
-    if (fread(&node, 1, FS_NODE_SIZE, pDisk) != FS_NODE_SIZE)
+    nodepos_t pos = FsResolveNodePos(&pFs->Meta, nodeID);
+
+    FsBlockCacheEntry* pEntry = FsBlockCachePin(&pFs->Cache, pos.TableBlock);
+    if (!pEntry)
     {
         printf("FsNodeExists failed, couldn't read node %u from disk on block %lu, nest %u.\n", nodeID, pos.TableBlock, pos.Nest);
         return 0;
     }
 
-    return node.ID != 0;
+    bool bExists = ((const FsNode*) pEntry->pData)[pos.Nest].ID != 0;
+    FsBlockCacheUnpin(&pFs->Cache, pEntry);
+    return bExists;
 }
 
-FsNode FsGetNode(FILE* pDisk, const FsMeta* pMeta, nodeid_t nodeID)
+FsNode FsGetNode(FileSystemOnDisk* pFs, nodeid_t nodeID)
 {
-    nodepos_t pos = FsResolveNodePos(pMeta, nodeID);
-
-    if (fseek(pDisk, pos.RawAddress, SEEK_SET) != 0)
+    if (!FsNodeInitialized(&pFs->Meta, nodeID))
     {
-        printf("FsGetNode failed, couldn't seek to node %u's position {block %lu, nest %u} on disk.\n", nodeID, pos.TableBlock, pos.Nest);
+        printf("FsGetNode failed, node %u doesn't exist.\n", nodeID);
         return FsInvalidNode();
     }
 
+    nodepos_t pos = FsResolveNodePos(&pFs->Meta, nodeID);
+
     FsNode node;
-    if (fread(&node, 1, FS_NODE_SIZE, pDisk) != FS_NODE_SIZE)
+    if (!FsBlockCacheRead(&pFs->Cache, pos.TableBlock, pos.Nest * FS_NODE_SIZE, &node, FS_NODE_SIZE))
     {
         printf("FsGetNode failed, couldn't read node %u from disk on block %lu, nest %u.\n", nodeID, pos.TableBlock, pos.Nest);
         return FsInvalidNode();
@@ -217,82 +322,27 @@ FsNode FsGetNode(FILE* pDisk, const FsMeta* pMeta, nodeid_t nodeID)
     return node;
 }
 
-void FsiBitmapSetBlocksBySinglyIndirect(FILE* pDisk, FsMeta* pMeta, block_t addrIndirect, uint8_t state)
-{
-    if (!addrIndirect || !FsBitmapCheckBlock(pDisk, pMeta, addrIndirect))
-    {
-        return;
-    }
-    FsBitmapSetBlock(pDisk, pMeta, addrIndirect, state);
-    
-    uint64_t ptrsPerBlock  = pMeta->BlockSize / sizeof(block_t);
-    uint64_t totalBlocks   = ptrsPerBlock;
-
-    for (uint64_t i = 0; i < totalBlocks; i++)
-    {
-        if (fseek(pDisk, addrIndirect + i * sizeof(block_t), SEEK_SET) != 0)
-        {
-            return;
-        }
-        block_t block;
-        if (fread(&block, 1, sizeof(block_t), pDisk) != sizeof(block_t))
-        {
-            return;
-        }
-        FsiBitmapSetBlocksBySinglyIndirect(pDisk, pMeta, block, state);
-    }
-}
-
-void FsiBitmapSetBlocksByDoublyIndirect(FILE* pDisk, FsMeta* pMeta, block_t addrIndirect, uint8_t state)
+bool FsWriteNode(FileSystemOnDisk* pFs, const FsNode* pNode)
 {
-    if (!addrIndirect || !FsBitmapCheckBlock(pDisk, pMeta, addrIndirect))
-    {
-        return;
-    }
-    FsBitmapSetBlock(pDisk, pMeta, addrIndirect, state);
-    
-    uint64_t ptrsPerBlock  = pMeta->BlockSize / sizeof(block_t);
-    uint64_t totalSinglies = ptrsPerBlock * ptrsPerBlock;
-
-    for (uint64_t i = 0; i < totalSinglies; i++)
+    nodepos_t pos = FsResolveNodePos(&pFs->Meta, pNode->ID);
+    if (!FsiInitNodeTable(pFs, pNode->ID) || !FsBlockCacheWrite(&pFs->Cache, pos.TableBlock, pos.Nest * FS_NODE_SIZE, pNode, FS_NODE_SIZE))
     {
-        if (fseek(pDisk, addrIndirect + i * sizeof(block_t), SEEK_SET) != 0)
-        {
-            return;
-        }
-        block_t block;
-        if (fread(&block, 1, sizeof(block_t), pDisk) != sizeof(block_t))
-        {
-            return;
-        }
-        FsiBitmapSetBlocksBySinglyIndirect(pDisk, pMeta, block, state);
+        printf("FsWriteNode failed, couldn't write node %u to disk on block %lu, nest %u.\n", pNode->ID, pos.TableBlock, pos.Nest);
+        return false;
     }
+    return true;
 }
 
-void FsiBitmapSetBlocksByTriplyIndirect(FILE* pDisk, FsMeta* pMeta, block_t addrIndirect, uint8_t state)
+// Block visitor releasing every block of a node, pContext is the file system on disk.
+static bool FsiFreeBlockVisitor(void* pContext, uint64_t logicalIndex, block_t block, uint8_t level)
 {
-    if (!addrIndirect || !FsBitmapCheckBlock(pDisk, pMeta, addrIndirect))
-    {
-        return;
-    }
-    FsBitmapSetBlock(pDisk, pMeta, addrIndirect, state);
-    
-    uint64_t ptrsPerBlock  = pMeta->BlockSize / sizeof(block_t);
-    uint64_t totalDoublies = ptrsPerBlock * ptrsPerBlock * ptrsPerBlock;
-
-    for (uint64_t i = 0; i < totalDoublies; i++)
+    FileSystemOnDisk* pFs = (FileSystemOnDisk*) pContext;
+    if (FsBitmapCheckBlock(&pFs->Bitmap, &pFs->Meta, block) == FS_BITMAP_BLOCK_ALLOCATED)
     {
-        if (fseek(pDisk, addrIndirect + i * sizeof(block_t), SEEK_SET) != 0)
-        {
-            return;
-        }
-        block_t block;
-        if (fread(&block, 1, sizeof(block_t), pDisk) != sizeof(block_t))
-        {
-            return;
-        }
-        FsiBitmapSetBlocksByDoublyIndirect(pDisk, pMeta, block, state);
+        FsBitmapSetBlock(&pFs->Bitmap, &pFs->Meta, block, FS_BITMAP_BLOCK_FREE);
+        pFs->Meta.NumAllocatedBlocks--;
     }
+    return true;
 }
 
 typedef struct
@@ -377,259 +427,1967 @@ data_storage_t FsiCalculateDataStorage(FsMeta* pMeta, uint64_t size)
     return storage;
 }
 
-write_node_data_result_t FsWriteNodeData(FILE* pDisk, FsMeta* pMeta, nodeid_t nodeID, const void* pData, uint64_t szData)
+// Allocates `count` data blocks into pBlocks using as few contiguous runs as the free space allows. With pRegion set the
+// blocks come from within it while it has any, the rest of the data area is only used once it is full. Without one the
+// group of the node takes that role on file systems with groups.
+static bool FsiAllocateBlocks(FileSystemOnDisk* pFs, nodeid_t nodeID, uint64_t count, block_t* pBlocks, allocation_region_t* pRegion)
 {
-    nodepos_t pos = FsResolveNodePos(pMeta, nodeID);
-    if (fseek(pDisk, pos.RawAddress, SEEK_SET) != 0)
+    FsMeta* pMeta = &pFs->Meta;
+    block_t lastAllocatedDataBlock = pMeta->LastAllocatedDataBlock;
+
+    // Without a region of its own the data goes near the node, into the data blocks of the node's group.
+    allocation_region_t group;
+    bool bGroup = !pRegion && FsHasGroups(pMeta);
+    if (bGroup)
     {
-        printf("FsWriteNodeData failed, couldn't seek to node %u's location on disk.\n", nodeID);
-        return FS_WRITE_DATA_NODE_DOES_NOT_EXIST;
+        uint32_t index = FsGroupOfNode(pMeta, nodeID);
+        group.From   = FsGroupData(pMeta, index);
+        group.To     = FsGroupEnd(pMeta, index);
+        group.Cursor = lastAllocatedDataBlock;
+        pRegion = &group;
     }
+    block_t regionCursor = pRegion ? pRegion->Cursor : 0;
 
-    FsNode node;
-    if (fread(&node, 1, FS_NODE_SIZE, pDisk) != FS_NODE_SIZE)
+    uint64_t numAllocated = 0;
+    while (numAllocated < count)
     {
-        printf("FsWriteNodeData failed, couldn't read node %u on disk.\n", nodeID);
-        return FS_WRITE_DATA_DISK_ERROR;
-    }
+        fsextent_t extent = { 0, 0 };
+        if (pRegion)
+        {
+            extent = FsBitmapFindExtent(&pFs->Bitmap, pMeta, pRegion->From, pRegion->To, pRegion->Cursor,
+                                        count - numAllocated, pFs->AllocationPolicy);
+            if (extent.Length)
+            {
+                pRegion->Cursor = extent.Start + extent.Length - 1;
+                if (bGroup)
+                {
+                    pMeta->LastAllocatedDataBlock = pRegion->Cursor;
+                }
+            }
+        }
+
+        if (!extent.Length)
+        {
+            extent = FsBitmapFindExtent(&pFs->Bitmap, pMeta, pMeta->AddrData, pMeta->Size, pMeta->LastAllocatedDataBlock,
+                                        count - numAllocated, pFs->AllocationPolicy);
+            if (!extent.Length)
+            {
+                // Out of space, give back what was claimed so far.
+                for (uint64_t i = 0; i < numAllocated; i++)
+                {
+                    FsBitmapSetBlock(&pFs->Bitmap, pMeta, pBlocks[i], FS_BITMAP_BLOCK_FREE);
+                }
+                pMeta->LastAllocatedDataBlock = lastAllocatedDataBlock;
+                if (pRegion)
+                {
+                    pRegion->Cursor = regionCursor;
+                }
+                return false;
+            }
+            pMeta->LastAllocatedDataBlock = extent.Start + extent.Length - 1;
+        }
 
-    data_storage_t oldDataStorageInfo = FsiCalculateDataStorage(pMeta, node.Size);
-    pMeta->NumAllocatedNodes -= oldDataStorageInfo.TotalBlocks;
+        FsBitmapSetExtent(&pFs->Bitmap, pMeta, extent, FS_BITMAP_BLOCK_ALLOCATED);
+        for (uint64_t i = 0; i < extent.Length; i++)
+        {
+            pBlocks[numAllocated++] = extent.Start + i;
+        }
+    }
 
-    // Ensure size on node itself
-    const uint8_t* data = (const uint8_t*) pData;
-    node.Size = szData;
+    pMeta->NumAllocatedBlocks += count;
+    return true;
+}
 
-    // load bitmap, we'll need it
-    uint8_t* bitmap = FsLoadBitmap(pDisk, pMeta);
-    if (!bitmap)
+bool FsNodeAppendBlock(FileSystemOnDisk* pFs, FsNode* pNode, block_t* pBlock)
+{
+    const FsMeta* pMeta = &pFs->Meta;
+    if (pNode->Size > FS_NODE_INLINE_DATA_SIZE && (pNode->Size - FS_NODE_INLINE_DATA_SIZE) % pMeta->BlockSize)
     {
-        puts("FsMakeNode failed due to FsLoadBitmap failing.");
-        return FS_WRITE_DATA_ALLOCATION_ERROR;
+        printf("FsNodeAppendBlock failed, the data of node %u doesn't end on a block boundary.\n", pNode->ID);
+        return false;
     }
 
-    // set every used data block as free
-    for (uint16_t i = 0; i < FS_NODE_DIRECT_DATA_BLOCKS; i++)
+    uint64_t ptrsPerBlock = pMeta->BlockSize / sizeof(block_t);
+    uint64_t logical = FsNodeDataBlocks(pMeta, pNode->Size);
+
+    // Locate the new block within the indirection tree, index is relative to the first block under the root at `level`.
+    uint8_t  level = FS_BLOCK_LEVEL_DATA;
+    uint64_t index = logical;
+    uint64_t span  = 1;
+    if (logical >= FS_NODE_DIRECT_DATA_BLOCKS)
     {
-        if (node.DirectData[i])
+        index -= FS_NODE_DIRECT_DATA_BLOCKS;
+        level  = FS_BLOCK_LEVEL_SINGLY;
+        while (index >= span * ptrsPerBlock)
         {
-            FsBitmapSetBlock(pDisk, pMeta, node.DirectData[i], FS_BITMAP_BLOCK_FREE);
+            index -= span * ptrsPerBlock;
+            span  *= ptrsPerBlock;
+            if (++level > FS_BLOCK_LEVEL_TRIPLY)
+            {
+                printf("FsNodeAppendBlock failed, node %u can't address any more blocks.\n", pNode->ID);
+                return false;
+            }
         }
     }
-    FsiBitmapSetBlocksBySinglyIndirect(pDisk, pMeta, node.AddrSinglyIndirect, FS_BITMAP_BLOCK_FREE);
-    FsiBitmapSetBlocksByDoublyIndirect(pDisk, pMeta, node.AddrDoublyIndirect, FS_BITMAP_BLOCK_FREE);
-    FsiBitmapSetBlocksByTriplyIndirect(pDisk, pMeta, node.AddrTriplyIndirect, FS_BITMAP_BLOCK_FREE);
 
-    // Make sure these are empty first as what we write to is szData-dependent and we don't want weird shit happening.
-    memset(node.InlineData, 0, FS_NODE_INLINE_DATA_SIZE);
-    memset(node.DirectData, 0, sizeof(block_t) * FS_NODE_DIRECT_DATA_BLOCKS);
-    node.AddrSinglyIndirect = 0;
-    node.AddrDoublyIndirect = 0;
-    node.AddrTriplyIndirect = 0;
-
-    // Write as much data as possible to inline section
-    for (uint16_t i = 0; i < szData && i < FS_NODE_INLINE_DATA_SIZE; i++)
+    // An indirect block is needed at every level where the new block is the first one underneath it. All of them are
+    // claimed up front, so a full disk can't leave a half linked chain behind.
+    block_t blocks[1 + FS_BLOCK_LEVEL_TRIPLY];
+    uint8_t count = 1;
+    for (uint64_t s = span * ptrsPerBlock, l = level; l >= FS_BLOCK_LEVEL_SINGLY; l--, s /= ptrsPerBlock)
     {
-        node.InlineData[i] = *data++;
+        if (index % s == 0)
+        {
+            count++;
+        }
     }
-    
-    // if data fit in the inline section, we can skip to writing the node directly.
-    if (szData <= FS_NODE_INLINE_DATA_SIZE)
+
+    if (!FsiAllocateBlocks(pFs, pNode->ID, count, blocks, NULL))
     {
-        goto WriteNode;
+        printf("FsNodeAppendBlock failed, not enough free blocks to grow node %u.\n", pNode->ID);
+        return false;
     }
 
-    // data didn't fit, remove the no. bytes we wrote to the inline section
-    szData -= FS_NODE_INLINE_DATA_SIZE;
-    
-    //
-    // TODO: Do quick calculation using LastAllocatedBlock
-    //
-
-    data_storage_t dataStorage = FsiCalculateDataStorage(pMeta, szData);
-    block_t* pBlocks = malloc(dataStorage.TotalBlocks * sizeof(block_t));
-    uint64_t tmpNumBlocksStored = 0; // represents num of elements in pBlocks.
-
-    if (!pBlocks)
+    uint8_t* pZero = calloc(1, pMeta->BlockSize);
+    if (!pZero)
     {
-        puts("FsWriteNodeData failed, couldn't allocate space to intermediately store clear data blocks.");
-        return FS_WRITE_DATA_ALLOCATION_ERROR;
+        puts("FsNodeAppendBlock failed, couldn't allocate a zeroed block.");
+        return false;
     }
 
-    // locate clear blocks from bitmap
-    bitmappos_t posCheck = FsBitmapResolveFromBlock(pMeta, pMeta->AddrData);
+    bool bResult = true;
+    for (uint8_t i = 0; i < count && bResult; i++)
+    {
+        bResult = FsBlockCacheWrite(&pFs->Cache, blocks[i], 0, pZero, pMeta->BlockSize);
+    }
+    free(pZero);
 
-    for (block_t bitmapBlock = posCheck.Block; bitmapBlock < (pMeta->AddrNodeTable - pMeta->AddrBitmap); bitmapBlock++)
+    uint8_t next = 1; // Next freshly claimed indirect block.
+    if (bResult && level == FS_BLOCK_LEVEL_DATA)
+    {
+        pNode->DirectData[logical] = blocks[0];
+    }
+    else if (bResult)
     {
-        for (uint16_t byteOffset = posCheck.ByteOffset; byteOffset < pMeta->BlockSize; byteOffset++)
+        block_t roots[FS_BLOCK_LEVEL_TRIPLY] = { pNode->AddrSinglyIndirect, pNode->AddrDoublyIndirect, pNode->AddrTriplyIndirect };
+        if (index == 0)
+        {
+            roots[level - 1] = blocks[next++];
+            pNode->AddrSinglyIndirect = roots[0];
+            pNode->AddrDoublyIndirect = roots[1];
+            pNode->AddrTriplyIndirect = roots[2];
+        }
+
+        block_t parent = roots[level - 1];
+        for (; level > FS_BLOCK_LEVEL_SINGLY && bResult; level--, span /= ptrsPerBlock)
         {
-            uint8_t byte = bitmap[(bitmapBlock - pMeta->AddrBitmap) * pMeta->BlockSize + byteOffset];
-            
-            if (byte == 0xFF)
+            uint16_t offset = (uint16_t) (index / span * sizeof(block_t));
+            index %= span;
+
+            block_t child;
+            if (index == 0)
             {
-                continue;
+                child   = blocks[next++];
+                bResult = FsBlockCacheWrite(&pFs->Cache, parent, offset, &child, sizeof(block_t));
             }
-
-            for (uint8_t i = posCheck.BitOffset; i < 8; i++)
+            else
             {
-                if (byte & (1 << i))
-                {
-                    continue;
-                }
-
-                // Block's clear! Save it.
-                pBlocks[tmpNumBlocksStored++] = FsBitmapResolveToBlock(pMeta, (bitmappos_t) {
-                    .Block = bitmapBlock, .ByteOffset = byteOffset, .BitOffset = i
-                });
-
-                if (tmpNumBlocksStored == dataStorage.TotalBlocks)
-                {
-                    // found enough sectors.
-                    goto PostBitmapCheck;
-                }
+                bResult = FsBlockCacheRead(&pFs->Cache, parent, offset, &child, sizeof(block_t));
             }
+            parent = child;
         }
 
-        // roll back to zero (needed because when initially getting posCheck byteOffset and bitOffset might be set already.)
-        posCheck.ByteOffset = 0;
-        posCheck.BitOffset  = 0;
+        bResult = bResult && FsBlockCacheWrite(&pFs->Cache, parent, (uint16_t) (index * sizeof(block_t)), &blocks[0], sizeof(block_t));
     }
-PostBitmapCheck:
-    // No longer needed.
-    free(bitmap);
-    bitmap = NULL;
-    
-    // We either got here from out of the main bitmap block check loop or because we found enough sectors and escaped.
-    // Check if we found enough sectors (with former, we didn't, with the latter, we did.)
-    if (tmpNumBlocksStored != dataStorage.TotalBlocks)
+
+    if (!bResult)
     {
-        free(pBlocks);
-        printf("FsWriteNodeData failed, the disk doesn't have enough space to store a node worth %lu bytes of data.\n", node.Size);
-        return FS_WRITE_DATA_INSUFFICIENT_DISK_SPACE;
+        printf("FsNodeAppendBlock failed, couldn't link a new block into node %u.\n", pNode->ID);
+        return false;
     }
 
-    uint64_t blocksLeft = dataStorage.TotalBlocks;
-    // Write direct blocks. iBlocks is used to keep track of pBlocks and what sectors have already been assigned a task.
-    uint64_t iBlocks;
-    for (iBlocks = 0; iBlocks < dataStorage.TotalBlocks && iBlocks < FS_NODE_DIRECT_DATA_BLOCKS; iBlocks++)
+    pNode->Size = FS_NODE_INLINE_DATA_SIZE + (logical + 1) * pMeta->BlockSize;
+    *pBlock = blocks[0];
+    return true;
+}
+
+// Writes `count` consecutive logical blocks of pData to pBlocks. Physically adjacent blocks are merged into a single write.
+// szData is the number of bytes left in pData, the last block is only partially written when it runs out.
+// The writes bypass the block cache, so any stale copy of the blocks is discarded from it first.
+static bool FsiWriteDataRuns(FileSystemOnDisk* pFs, const block_t* pBlocks, uint64_t count, const uint8_t* pData, uint64_t szData)
+{
+    const FsMeta* pMeta = &pFs->Meta;
+
+    for (uint64_t i = 0; i < count; i++)
     {
-        node.DirectData[iBlocks] = pBlocks[iBlocks];
-        
-        uint64_t address = node.DirectData[iBlocks] * pMeta->BlockSize;
-        if (fseek(pDisk, address, SEEK_SET) != 0)
+        FsBlockCacheDiscard(&pFs->Cache, pBlocks[i]);
+    }
+
+    for (uint64_t i = 0; i < count; )
+    {
+        uint64_t runLength = 1;
+        while (i + runLength < count && pBlocks[i + runLength] == pBlocks[i] + runLength)
         {
-            puts("FsWriteNodeData failed, couldn't seek to direct block on disk.");
-            return FS_WRITE_DATA_DISK_ERROR;
+            runLength++;
         }
 
-        uint16_t bytesToWrite = FS_MIN(szData, pMeta->BlockSize);
-        if (fwrite(data, 1, bytesToWrite, pDisk) != bytesToWrite)
+        uint64_t offset = i * pMeta->BlockSize;
+        if (offset >= szData)
         {
-            puts("FsWriteNodeData failed, couldn't write to direct block on disk.");
-            return FS_WRITE_DATA_DISK_ERROR;
+            break;
+        }
+        uint64_t bytesToWrite = FS_MIN(szData - offset, runLength * pMeta->BlockSize);
+
+        if (!FsDeviceWrite(pFs->pDevice, pBlocks[i] * pMeta->BlockSize, pData + offset, bytesToWrite))
+        {
+            printf("FsiWriteDataRuns failed, couldn't write %lu blocks starting at block %lu.\n", runLength, pBlocks[i]);
+            return false;
         }
-        FsBitmapSetBlock(pDisk, pMeta, node.DirectData[iBlocks], FS_BITMAP_BLOCK_ALLOCATED);
-        data += bytesToWrite;
+
+        i += runLength;
     }
 
-    // Did it fit in the direct blocks?
-    if (dataStorage.TotalBlocks <= FS_NODE_DIRECT_DATA_BLOCKS)
+    return true;
+}
+
+typedef struct
+{
+    const block_t* pBlocks;      // Data blocks of a node in logical order, 0 for holes.
+    uint64_t       NumData;      // Number of data blocks in pBlocks.
+    uint64_t       NextData;     // Index of the next data block that has to be pointed to.
+    const block_t* pIndirect;    // Indirect blocks in the order they are handed out, NULL while they are only counted.
+    uint64_t       NumIndirect;  // Indirect blocks handed out or counted so far.
+    uint64_t       PtrsPerBlock;
+    block_t*       pPointers;    // Contents of the indirect blocks, one block each, in the order of pIndirect.
+} indirect_builder_t;
+
+// Hands out the next indirect block and fills in its pointers, recursing for doubly (level 2) and triply (level 3)
+// indirection. Returns the address of the indirect block, 0 when there are only holes underneath it and none is needed.
+static block_t FsiBuildIndirect(indirect_builder_t* pBuilder, uint8_t level)
+{
+    uint64_t span = pBuilder->PtrsPerBlock;
+    for (uint8_t l = FS_BLOCK_LEVEL_SINGLY; l < level; l++)
     {
-        // go write the data to the blocks now.
-        goto WriteNode;
+        span *= pBuilder->PtrsPerBlock;
     }
-    
-    // The data didn't fit into the direct blocks. Singly indirect time.
-    //blocksLeft -= FS_NODE_DIRECT_DATA_BLOCKS;
-    
-    //pNode->AddrSinglyIndirect = pBlocks[iBlocks++]; // One block for the singly
-    //blocksLeft -= 1 + FS_MIN(blocksLeft, ptrsPerBlock);
 
-    pMeta->NumAllocatedBlocks += dataStorage.TotalBlocks;
-    free(pBlocks);
-WriteNode:
-    
-    node.TsCreated  = FsGetBioTime();
-    node.TsAccessed = FsGetBioTime();
-    node.TsModified = FsGetBioTime();
-    
-    if (fseek(pDisk, pos.RawAddress, SEEK_SET) != 0)
+    uint64_t end = FS_MIN(pBuilder->NextData + span, pBuilder->NumData);
+    if (BitScanIsZero((const uint8_t*) (pBuilder->pBlocks + pBuilder->NextData), (end - pBuilder->NextData) * sizeof(block_t)))
     {
-        printf("FsWriteNodeData failed, couldn't seek to node nest on disk.\n");
-        return FS_WRITE_DATA_DISK_ERROR;
+        pBuilder->NextData = end;
+        return 0;
     }
 
-    if (fwrite(&node, 1, FS_NODE_SIZE, pDisk) != FS_NODE_SIZE)
+    uint64_t slot = pBuilder->NumIndirect++;
+    for (uint64_t i = 0; i < pBuilder->PtrsPerBlock && pBuilder->NextData < pBuilder->NumData; i++)
     {
-        printf("FsMakeNode failed, couldn't write node %u to it's position on disk (block %lu, nest %u).\n", node.ID, pos.TableBlock, pos.Nest);
-        return FS_WRITE_DATA_DISK_ERROR;
+        block_t child = level == 1 ? pBuilder->pBlocks[pBuilder->NextData++] : FsiBuildIndirect(pBuilder, level - 1);
+        if (pBuilder->pIndirect)
+        {
+            pBuilder->pPointers[slot * pBuilder->PtrsPerBlock + i] = child;
+        }
     }
 
-    pMeta->NumAllocatedNodes++;
-    pMeta->LastAllocatedNodeID = node.ID;
+    return pBuilder->pIndirect ? pBuilder->pIndirect[slot] : 0;
+}
 
-    if (!FsWriteMeta(pDisk, pMeta))
+// Builds the trees of the singly, doubly and triply indirect block from the first data block past the direct ones.
+static void FsiBuildRoots(indirect_builder_t* pBuilder, block_t roots[FS_BLOCK_LEVEL_TRIPLY])
+{
+    pBuilder->NextData    = FS_MIN(pBuilder->NumData, FS_NODE_DIRECT_DATA_BLOCKS);
+    pBuilder->NumIndirect = 0;
+    for (uint8_t level = FS_BLOCK_LEVEL_SINGLY; level <= FS_BLOCK_LEVEL_TRIPLY; level++)
     {
-        puts("FsMakeNode failed, failed to overwrite file system metadata.");
-        return FS_WRITE_DATA_DISK_ERROR;
+        roots[level - 1] = pBuilder->NextData < pBuilder->NumData ? FsiBuildIndirect(pBuilder, level) : 0;
     }
-
-    return FS_MAKE_NODE_SUCCESSFUL;
 }
 
-create_node_result_t FsMakeNode(FILE* pDisk, FsMeta* pMeta, FsNode* pNode, const void* pData, uint64_t szData)
+static write_node_data_result_t FsiNodeWriterFail(FsNodeWriter* pWriter, write_node_data_result_t status)
 {
-    /** Holy trio of checks */
-    if (pNode->ID == FS_NODE_ID_INVALID)
+    if (pWriter->Status == FS_WRITE_DATA_SUCCESSFUL)
     {
-        puts("FsMakeNode failed, nodes cannot have the ID 0 because it represents invalidity.");
-        return FS_MAKE_NODE_INVALID_ID;
+        pWriter->Status = status;
     }
-    if (FsNodeExists(pDisk, pMeta, pNode->ID))
+    return pWriter->Status;
+}
+
+// Makes room for `count` more entries at the end of the writer's block list, the caller fills them in.
+static bool FsiNodeWriterGrow(FsNodeWriter* pWriter, uint64_t count)
+{
+    FileSystemOnDisk* pFs = pWriter->pFs;
+    uint64_t numBlocks = pWriter->NumBlocks + count;
+
+    if (!FsiCalculateDataStorage(&pFs->Meta, numBlocks * pFs->Meta.BlockSize).TotalBlocks)
     {
-        printf("FsMakeNode failed, node %u already exists.\n", pNode->ID);
-        return FS_MAKE_NODE_EXISTS;
+        printf("FsNodeWriter failed, a node worth %lu data blocks is beyond what the triply indirect block can address.\n", numBlocks);
+        FsiNodeWriterFail(pWriter, FS_WRITE_DATA_TOO_BIG);
+        return false;
     }
-    if (pNode->Type != FS_NODE_TYPE_FILE && pNode->Type != FS_NODE_TYPE_DIRECTORY && pNode->Type != FS_NODE_TYPE_SOFT_LINK)
+
+    if (numBlocks > pWriter->MaxBlocks)
     {
-        printf("FsMakeNode failed, node type %u doesn't correspond to any valid Myth File System node type.\n", pNode->Type);
-        return FS_MAKE_NODE_INVALID_TYPE;
+        uint64_t maxBlocks = FS_MAX(numBlocks, pWriter->MaxBlocks * 2);
+        block_t* pBlocks = realloc(pWriter->pBlocks, maxBlocks * sizeof(block_t));
+        if (!pBlocks)
+        {
+            puts("FsNodeWriter failed, couldn't grow the list of data blocks.");
+            FsiNodeWriterFail(pWriter, FS_WRITE_DATA_ALLOCATION_ERROR);
+            return false;
+        }
+        pWriter->pBlocks   = pBlocks;
+        pWriter->MaxBlocks = maxBlocks;
     }
 
-    // Pseudo-write node to the table so FsWriteNodeData doesn't fail.
-    nodepos_t pos = FsResolveNodePos(pMeta, pNode->ID);
-    if (fseek(pDisk, pos.RawAddress, SEEK_SET) != 0)
+    return true;
+}
+
+// Allocates `count` more data blocks at the end of the writer's block list.
+static bool FsiNodeWriterReserve(FsNodeWriter* pWriter, uint64_t count)
+{
+    if (!FsiNodeWriterGrow(pWriter, count))
     {
-        printf("FsMakeNode failed, couldn't seek to node %u's location on disk.\n", pNode->ID);
-        return FS_MAKE_NODE_DISK_ERROR;
+        return false;
     }
 
-    if (fwrite(pNode, 1, FS_NODE_SIZE, pDisk) != FS_NODE_SIZE)
+    if (!FsiAllocateBlocks(pWriter->pFs, pWriter->Node.ID, count, pWriter->pBlocks + pWriter->NumBlocks, pWriter->pRegion))
     {
-        printf("FsMakeNode failed, couldn't write to node %u's location on disk.\n", pNode->ID);
-        return FS_MAKE_NODE_DISK_ERROR;
+        printf("FsNodeWriter failed, the disk doesn't have space for %lu more blocks of node %u.\n", count, pWriter->Node.ID);
+        FsiNodeWriterFail(pWriter, FS_WRITE_DATA_INSUFFICIENT_DISK_SPACE);
+        return false;
     }
 
-    write_node_data_result_t writeResult = FsWriteNodeData(pDisk, pMeta, pNode->ID, pData, szData);
-    if (writeResult != FS_WRITE_DATA_SUCCESSFUL)
+    pWriter->NumBlocks += count;
+    return true;
+}
+
+// Adds `count` holes at the end of the writer's block list.
+static bool FsiNodeWriterSkip(FsNodeWriter* pWriter, uint64_t count)
+{
+    if (!FsiNodeWriterGrow(pWriter, count))
     {
-        printf("FsMakeNode failed, FsWriteNodeData returned non-succesful return value %u (%s).\n", writeResult, FsWriteNodeDataResultToString(writeResult));
-        switch (writeResult)
-        {
-        case FS_WRITE_DATA_NODE_DOES_NOT_EXIST:     return FS_MAKE_NODE_INTERMEDIATE_ERROR;
-        case FS_WRITE_DATA_DISK_ERROR:              return FS_MAKE_NODE_DISK_ERROR;
-        case FS_WRITE_DATA_ALLOCATION_ERROR:        return FS_MAKE_NODE_ALLOCATION_ERROR;
-        case FS_WRITE_DATA_INSUFFICIENT_DISK_SPACE: return FS_MAKE_NODE_INSUFFICIENT_DISK_SPACE;
-        case FS_WRITE_DATA_TOO_BIG:                 return FS_MAKE_NODE_DATA_TOO_BIG;
-        default: return -1;
-        }
+        return false;
     }
 
-    return FS_MAKE_NODE_SUCCESSFUL;
+    memset(pWriter->pBlocks + pWriter->NumBlocks, 0, count * sizeof(block_t));
+    pWriter->NumBlocks += count;
+    return true;
 }
 
-bool FsDeleteNode(FILE* pDisk, FsMeta* pMeta, nodeid_t nodeID)
+// Writes numBlocks whole blocks of pData to newly allocated blocks. When the node may have holes, each run of blocks of
+// nothing but zeroes becomes a hole instead.
+static bool FsiNodeWriterAppendBlocks(FsNodeWriter* pWriter, const uint8_t* pData, uint64_t numBlocks)
 {
-    puts("!!! not implemented !!!");
-    return false;
+    uint16_t blockSize = pWriter->pFs->Meta.BlockSize;
+
+    for (uint64_t i = 0; i < numBlocks; )
+    {
+        bool bHole = pWriter->bHoles && BitScanIsZero(pData + i * blockSize, blockSize);
+        uint64_t length = pWriter->bHoles ? 1 : numBlocks - i;
+        while (i + length < numBlocks && BitScanIsZero(pData + (i + length) * blockSize, blockSize) == bHole)
+        {
+            length++;
+        }
+
+        uint64_t first = pWriter->NumBlocks;
+        if (bHole)
+        {
+            if (!FsiNodeWriterSkip(pWriter, length))
+            {
+                return false;
+            }
+        }
+        else if (!FsiNodeWriterReserve(pWriter, length))
+        {
+            return false;
+        }
+        else if (!FsiWriteDataRuns(pWriter->pFs, pWriter->pBlocks + first, length, pData + i * blockSize, length * blockSize))
+        {
+            FsiNodeWriterFail(pWriter, FS_WRITE_DATA_DISK_ERROR);
+            return false;
+        }
+
+        i += length;
+    }
+
+    return true;
+}
+
+// Packs size bytes of pData cluster by cluster. The blocks a cluster takes are allocated and written, the rest of its
+// blocks become holes. Only the last cluster may be short, pData has to be zero padded up to the block boundary after it.
+static bool FsiNodeWriterAppendClusters(FsNodeWriter* pWriter, const uint8_t* pData, uint64_t size)
+{
+    FileSystemOnDisk* pFs = pWriter->pFs;
+    uint16_t blockSize   = pFs->Meta.BlockSize;
+    uint64_t clusterSize = FsClusterBlocks(&pFs->Meta) * blockSize;
+
+    for (uint64_t done = 0; done < size; done += clusterSize)
+    {
+        uint64_t length    = FS_MIN(clusterSize, size - done);
+        uint64_t numBlocks = FS_DIV(length, blockSize);
+        uint64_t numStored = FsPackCluster(blockSize, pData + done, length, pWriter->pPacked);
+        const uint8_t* pStored = numStored == numBlocks ? pData + done : pWriter->pPacked;
+
+        uint64_t first = pWriter->NumBlocks;
+        if ((numStored && !FsiNodeWriterReserve(pWriter, numStored)) || !FsiNodeWriterSkip(pWriter, numBlocks - numStored))
+        {
+            return false;
+        }
+        if (!FsiWriteDataRuns(pFs, pWriter->pBlocks + first, numStored, pStored, numStored * blockSize))
+        {
+            FsiNodeWriterFail(pWriter, FS_WRITE_DATA_DISK_ERROR);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Bytes gathered in pTail before they are written, a block or a whole cluster when compressing.
+static uint64_t FsiNodeWriterUnit(const FsNodeWriter* pWriter)
+{
+    const FsMeta* pMeta = &pWriter->pFs->Meta;
+    return pWriter->bCompress ? FsClusterBlocks(pMeta) * pMeta->BlockSize : pMeta->BlockSize;
+}
+
+// Writes the partially filled last block or cluster, zero padded to the block boundary.
+static bool FsiNodeWriterFlushTail(FsNodeWriter* pWriter)
+{
+    uint16_t blockSize = pWriter->pFs->Meta.BlockSize;
+    uint64_t padded    = FS_DIV(pWriter->TailSize, blockSize) * blockSize;
+
+    memset(pWriter->pTail + pWriter->TailSize, 0, padded - pWriter->TailSize);
+    if (pWriter->bCompress ? !FsiNodeWriterAppendClusters(pWriter, pWriter->pTail, pWriter->TailSize)
+                           : !FsiNodeWriterAppendBlocks(pWriter, pWriter->pTail, 1))
+    {
+        return false;
+    }
+
+    pWriter->TailSize = 0;
+    return true;
+}
+
+// Splits the next numBlocks blocks of the file behind descriptor at offset into *pNumHole blocks that lie entirely within
+// a hole of the file and the *pNumData blocks with data following them. File systems without SEEK_DATA only have data.
+static void FsiSourceExtent(int descriptor, uint64_t offset, uint64_t numBlocks, uint16_t blockSize, uint64_t* pNumHole, uint64_t* pNumData)
+{
+    uint64_t end = offset + numBlocks * blockSize;
+
+    off_t dataStart = lseek(descriptor, (off_t) offset, SEEK_DATA);
+    uint64_t from = dataStart >= 0 ? FS_MIN((uint64_t) dataStart, end) : (errno == ENXIO ? end : offset);
+    *pNumHole = (from - offset) / blockSize;
+    if (*pNumHole == numBlocks)
+    {
+        *pNumData = 0;
+        return;
+    }
+
+    off_t holeStart = lseek(descriptor, (off_t) from, SEEK_HOLE);
+    uint64_t to = holeStart >= 0 ? FS_MIN((uint64_t) holeStart, end) : end;
+    *pNumData = FS_DIV(to - offset, blockSize) - *pNumHole;
+}
+
+static bool FsiReadSource(int descriptor, uint64_t offset, void* pDest, uint64_t size)
+{
+    uint8_t* pBytes = (uint8_t*) pDest;
+    while (size)
+    {
+        ssize_t numRead = pread(descriptor, pBytes, size, (off_t) offset);
+        if (numRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (numRead <= 0)
+        {
+            return false;
+        }
+
+        pBytes += numRead;
+        offset += numRead;
+        size   -= numRead;
+    }
+
+    return true;
+}
+
+write_node_data_result_t FsOpenNodeWriter(FileSystemOnDisk* pFs, nodeid_t nodeID, FsNodeWriter* pWriter)
+{
+    memset(pWriter, 0, sizeof(FsNodeWriter));
+    pWriter->pFs = pFs;
+    pWriter->Pos = FsResolveNodePos(&pFs->Meta, nodeID);
+
+    if (!FsNodeInTable(&pFs->Meta, nodeID))
+    {
+        printf("FsOpenNodeWriter failed, node %u's location is outside of the node table.\n", nodeID);
+        return FS_WRITE_DATA_NODE_DOES_NOT_EXIST;
+    }
+    if (!FsNodeInitialized(&pFs->Meta, nodeID))
+    {
+        printf("FsOpenNodeWriter failed, node %u doesn't exist.\n", nodeID);
+        return FS_WRITE_DATA_NODE_DOES_NOT_EXIST;
+    }
+
+    FsNode* pNode = &pWriter->Node;
+    if (!FsBlockCacheRead(&pFs->Cache, pWriter->Pos.TableBlock, pWriter->Pos.Nest * FS_NODE_SIZE, pNode, FS_NODE_SIZE))
+    {
+        printf("FsOpenNodeWriter failed, couldn't read node %u on disk.\n", nodeID);
+        return FS_WRITE_DATA_DISK_ERROR;
+    }
+
+    pWriter->bHoles    = FsNodeMayHaveHoles(&pFs->Meta, pNode);
+    pWriter->bCompress = FsNodeIsCompressed(&pFs->Meta, pNode);
+
+    pWriter->pTail   = malloc(FsiNodeWriterUnit(pWriter));
+    pWriter->pPacked = pWriter->bCompress ? malloc(FsiNodeWriterUnit(pWriter)) : NULL;
+    if (!pWriter->pTail || (pWriter->bCompress && !pWriter->pPacked))
+    {
+        puts("FsOpenNodeWriter failed, couldn't allocate the block buffer.");
+        free(pWriter->pTail);
+        free(pWriter->pPacked);
+        pWriter->pTail   = NULL;
+        pWriter->pPacked = NULL;
+        return FS_WRITE_DATA_ALLOCATION_ERROR;
+    }
+
+    // set every used block as free
+    if (!FsWalkNodeBlocks(pFs, pNode, FsiFreeBlockVisitor, pFs))
+    {
+        printf("FsOpenNodeWriter failed, couldn't walk the blocks of node %u to free them.\n", nodeID);
+        free(pWriter->pTail);
+        free(pWriter->pPacked);
+        pWriter->pTail   = NULL;
+        pWriter->pPacked = NULL;
+        return FS_WRITE_DATA_DISK_ERROR;
+    }
+
+    // The node starts out empty, the data appended to it decides which of these get used.
+    pNode->Size = 0;
+    memset(pNode->InlineData, 0, FS_NODE_INLINE_DATA_SIZE);
+    memset(pNode->DirectData, 0, sizeof(block_t) * FS_NODE_DIRECT_DATA_BLOCKS);
+    pNode->AddrSinglyIndirect = 0;
+    pNode->AddrDoublyIndirect = 0;
+    pNode->AddrTriplyIndirect = 0;
+
+    return FS_WRITE_DATA_SUCCESSFUL;
+}
+
+write_node_data_result_t FsNodeWriterAppend(FsNodeWriter* pWriter, const void* pData, uint64_t szData)
+{
+    if (pWriter->Status != FS_WRITE_DATA_SUCCESSFUL || !szData)
+    {
+        return pWriter->Status;
+    }
+
+    FsNode* pNode = &pWriter->Node;
+    uint64_t unit = FsiNodeWriterUnit(pWriter);
+    const uint8_t* data = (const uint8_t*) pData;
+
+    // The first bytes of every node live in its inline section.
+    if (pNode->Size < FS_NODE_INLINE_DATA_SIZE)
+    {
+        uint64_t numInline = FS_MIN(szData, FS_NODE_INLINE_DATA_SIZE - pNode->Size);
+        memcpy(pNode->InlineData + pNode->Size, data, numInline);
+        pNode->Size += numInline;
+        data        += numInline;
+        szData      -= numInline;
+    }
+
+    // Top up the partially filled block (or cluster) first, whole ones can only follow once it is written.
+    if (pWriter->TailSize && szData)
+    {
+        uint64_t numTail = FS_MIN(szData, unit - pWriter->TailSize);
+        memcpy(pWriter->pTail + pWriter->TailSize, data, numTail);
+        pWriter->TailSize += numTail;
+        pNode->Size       += numTail;
+        data              += numTail;
+        szData            -= numTail;
+
+        if (pWriter->TailSize == unit && !FsiNodeWriterFlushTail(pWriter))
+        {
+            return pWriter->Status;
+        }
+    }
+
+    uint64_t numWhole = szData / unit;
+    if (numWhole)
+    {
+        if (pWriter->bCompress ? !FsiNodeWriterAppendClusters(pWriter, data, numWhole * unit)
+                               : !FsiNodeWriterAppendBlocks(pWriter, data, numWhole))
+        {
+            return pWriter->Status;
+        }
+
+        pNode->Size += numWhole * unit;
+        data        += numWhole * unit;
+        szData      -= numWhole * unit;
+    }
+
+    memcpy(pWriter->pTail + pWriter->TailSize, data, szData);
+    pWriter->TailSize += szData;
+    pNode->Size       += szData;
+
+    return FS_WRITE_DATA_SUCCESSFUL;
+}
+
+write_node_data_result_t FsNodeWriterAppendFile(FsNodeWriter* pWriter, int descriptor, uint64_t offset, uint64_t szData)
+{
+    if (pWriter->Status != FS_WRITE_DATA_SUCCESSFUL || !szData)
+    {
+        return pWriter->Status;
+    }
+
+    FileSystemOnDisk* pFs = pWriter->pFs;
+    FsNode* pNode = &pWriter->Node;
+    uint16_t blockSize = pFs->Meta.BlockSize;
+    uint64_t unit = FsiNodeWriterUnit(pWriter);
+
+    // The inline section and the partially filled block are read in, everything after them starts on a block boundary.
+    if (pNode->Size < FS_NODE_INLINE_DATA_SIZE || pWriter->TailSize)
+    {
+        uint64_t numHead = pNode->Size < FS_NODE_INLINE_DATA_SIZE ? FS_NODE_INLINE_DATA_SIZE - pNode->Size : unit - pWriter->TailSize;
+        numHead = FS_MIN(numHead, szData);
+
+        uint8_t* pHead = pNode->Size < FS_NODE_INLINE_DATA_SIZE ? pNode->InlineData + pNode->Size : pWriter->pTail + pWriter->TailSize;
+        if (!FsiReadSource(descriptor, offset, pHead, numHead))
+        {
+            puts("FsNodeWriterAppendFile failed, couldn't read the source file.");
+            return FsiNodeWriterFail(pWriter, FS_WRITE_DATA_DISK_ERROR);
+        }
+
+        if (pNode->Size >= FS_NODE_INLINE_DATA_SIZE)
+        {
+            pWriter->TailSize += numHead;
+        }
+        pNode->Size += numHead;
+        offset      += numHead;
+        szData      -= numHead;
+
+        if (pWriter->TailSize == unit && !FsiNodeWriterFlushTail(pWriter))
+        {
+            return pWriter->Status;
+        }
+    }
+
+    // Data being compressed has to pass through the writer, it is read in a cluster at a time.
+    while (pWriter->bCompress && szData >= unit)
+    {
+        if (!FsiReadSource(descriptor, offset, pWriter->pTail, unit))
+        {
+            puts("FsNodeWriterAppendFile failed, couldn't read the source file.");
+            return FsiNodeWriterFail(pWriter, FS_WRITE_DATA_DISK_ERROR);
+        }
+
+        pWriter->TailSize = unit;
+        if (!FsiNodeWriterFlushTail(pWriter))
+        {
+            return pWriter->Status;
+        }
+        pNode->Size += unit;
+        offset      += unit;
+        szData      -= unit;
+    }
+
+    uint64_t numWhole = pWriter->bCompress ? 0 : szData / blockSize;
+    while (numWhole)
+    {
+        uint64_t numHole = 0, numData = numWhole;
+        if (pWriter->bHoles)
+        {
+            FsiSourceExtent(descriptor, offset, numWhole, blockSize, &numHole, &numData);
+        }
+        if (numHole && !FsiNodeWriterSkip(pWriter, numHole))
+        {
+            return pWriter->Status;
+        }
+        pNode->Size += numHole * blockSize;
+        offset      += numHole * blockSize;
+        szData      -= numHole * blockSize;
+        numWhole    -= numHole + numData;
+
+        uint64_t first = pWriter->NumBlocks;
+        if (numData && !FsiNodeWriterReserve(pWriter, numData))
+        {
+            return pWriter->Status;
+        }
+
+        // Each run of physically adjacent blocks is handed to the kernel as one copy, the data never enters this process.
+        const block_t* pBlocks = pWriter->pBlocks + first;
+        for (uint64_t i = 0; i < numData; )
+        {
+            uint64_t runLength = 1;
+            while (i + runLength < numData && pBlocks[i + runLength] == pBlocks[i] + runLength)
+            {
+                runLength++;
+            }
+
+            for (uint64_t j = i; j < i + runLength; j++)
+            {
+                FsBlockCacheDiscard(&pFs->Cache, pBlocks[j]);
+            }
+
+            if (!FsDeviceCopyFrom(pFs->pDevice, pBlocks[i] * blockSize, descriptor, offset, runLength * blockSize))
+            {
+                printf("FsNodeWriterAppendFile failed, couldn't copy %lu blocks of the source file to block %lu.\n", runLength, pBlocks[i]);
+                return FsiNodeWriterFail(pWriter, FS_WRITE_DATA_DISK_ERROR);
+            }
+
+            pNode->Size += runLength * blockSize;
+            offset      += runLength * blockSize;
+            szData      -= runLength * blockSize;
+            i           += runLength;
+        }
+    }
+
+    if (!FsiReadSource(descriptor, offset, pWriter->pTail + pWriter->TailSize, szData))
+    {
+        puts("FsNodeWriterAppendFile failed, couldn't read the source file.");
+        return FsiNodeWriterFail(pWriter, FS_WRITE_DATA_DISK_ERROR);
+    }
+    pWriter->TailSize += szData;
+    pNode->Size       += szData;
+
+    return FS_WRITE_DATA_SUCCESSFUL;
+}
+
+write_node_data_result_t FsNodeWriterAppendDeferred(FsNodeWriter* pWriter, uint64_t szData, block_t* pBlocks)
+{
+    if (pWriter->Status != FS_WRITE_DATA_SUCCESSFUL || !szData)
+    {
+        return pWriter->Status;
+    }
+
+    FileSystemOnDisk* pFs = pWriter->pFs;
+    FsNode* pNode = &pWriter->Node;
+    uint16_t blockSize = pFs->Meta.BlockSize;
+
+    if (pNode->Size < FS_NODE_INLINE_DATA_SIZE || pWriter->TailSize)
+    {
+        puts("FsNodeWriterAppendDeferred failed, the data appended so far doesn't end on a block boundary.");
+        return FsiNodeWriterFail(pWriter, FS_WRITE_DATA_DISK_ERROR);
+    }
+
+    uint64_t first     = pWriter->NumBlocks;
+    uint64_t numBlocks = FS_DIV(szData, blockSize);
+    if (!FsiNodeWriterReserve(pWriter, numBlocks))
+    {
+        return pWriter->Status;
+    }
+
+    // The caller writes these blocks behind the cache's back.
+    pWriter->FirstDeferred = first;
+    for (uint64_t i = 0; i < numBlocks; i++)
+    {
+        FsBlockCacheDiscard(&pFs->Cache, pWriter->pBlocks[first + i]);
+    }
+    memcpy(pBlocks, pWriter->pBlocks + first, numBlocks * sizeof(block_t));
+
+    // Any later append starts on a fresh block, the last deferred one is the caller's to pad.
+    pNode->Size += szData;
+    return FS_WRITE_DATA_SUCCESSFUL;
+}
+
+void FsNodeWriterReleaseDeferred(FsNodeWriter* pWriter, const block_t* pBlocks)
+{
+    FileSystemOnDisk* pFs = pWriter->pFs;
+    if (!pWriter->bHoles)
+    {
+        return;
+    }
+
+    for (uint64_t i = pWriter->FirstDeferred; i < pWriter->NumBlocks; i++)
+    {
+        if (pWriter->pBlocks[i] && !pBlocks[i - pWriter->FirstDeferred])
+        {
+            FsBitmapSetBlock(&pFs->Bitmap, &pFs->Meta, pWriter->pBlocks[i], FS_BITMAP_BLOCK_FREE);
+            pFs->Meta.NumAllocatedBlocks--;
+            pWriter->pBlocks[i] = 0;
+        }
+    }
+}
+
+// Points the node at its data blocks, allocating and writing whatever indirect blocks that takes.
+static bool FsiNodeWriterLinkBlocks(FsNodeWriter* pWriter)
+{
+    FileSystemOnDisk* pFs = pWriter->pFs;
+    FsNode* pNode = &pWriter->Node;
+
+    uint64_t numDirectBlocks = FS_MIN(pWriter->NumBlocks, FS_NODE_DIRECT_DATA_BLOCKS);
+    if (numDirectBlocks)
+    {
+        memcpy(pNode->DirectData, pWriter->pBlocks, numDirectBlocks * sizeof(block_t));
+    }
+
+    // A first pass only counts the indirect blocks, holes leave some of them out.
+    block_t roots[FS_BLOCK_LEVEL_TRIPLY];
+    indirect_builder_t builder;
+    memset(&builder, 0, sizeof(indirect_builder_t));
+    builder.pBlocks      = pWriter->pBlocks;
+    builder.NumData      = pWriter->NumBlocks;
+    builder.PtrsPerBlock = pFs->Meta.BlockSize / sizeof(block_t);
+    FsiBuildRoots(&builder, roots);
+
+    uint64_t numIndirectBlocks = builder.NumIndirect;
+    if (!numIndirectBlocks)
+    {
+        return true;
+    }
+
+    // The indirect blocks follow the data blocks within pBlocks. They are allocated back to back and assembled in memory
+    // first, so writing them out is usually a single write.
+    uint64_t numData = pWriter->NumBlocks;
+    if (!FsiNodeWriterReserve(pWriter, numIndirectBlocks))
+    {
+        return false;
+    }
+
+    builder.pBlocks   = pWriter->pBlocks;
+    builder.pIndirect = pWriter->pBlocks + numData;
+    builder.pPointers = calloc(numIndirectBlocks, pFs->Meta.BlockSize);
+
+    if (!builder.pPointers)
+    {
+        puts("FsNodeWriter failed, couldn't allocate space to assemble the indirect blocks.");
+        FsiNodeWriterFail(pWriter, FS_WRITE_DATA_ALLOCATION_ERROR);
+        return false;
+    }
+
+    FsiBuildRoots(&builder, roots);
+    pNode->AddrSinglyIndirect = roots[0];
+    pNode->AddrDoublyIndirect = roots[1];
+    pNode->AddrTriplyIndirect = roots[2];
+
+    bool bIndirectWritten = FsiWriteDataRuns(pFs, pWriter->pBlocks + numData, numIndirectBlocks,
+                                             (const uint8_t*) builder.pPointers, numIndirectBlocks * pFs->Meta.BlockSize);
+    free(builder.pPointers);
+
+    if (!bIndirectWritten)
+    {
+        puts("FsNodeWriter failed, couldn't write the indirect blocks to disk.");
+        FsiNodeWriterFail(pWriter, FS_WRITE_DATA_DISK_ERROR);
+        return false;
+    }
+
+    return true;
+}
+
+write_node_data_result_t FsCloseNodeWriter(FsNodeWriter* pWriter)
+{
+    FileSystemOnDisk* pFs = pWriter->pFs;
+    FsNode* pNode = &pWriter->Node;
+
+    if (pWriter->Status == FS_WRITE_DATA_SUCCESSFUL && pWriter->TailSize)
+    {
+        FsiNodeWriterFlushTail(pWriter);
+    }
+
+    pWriter->StoredBlocks = 0;
+    for (uint64_t i = 0; i < pWriter->NumBlocks; i++)
+    {
+        pWriter->StoredBlocks += pWriter->pBlocks[i] != 0;
+    }
+
+    if (pWriter->Status == FS_WRITE_DATA_SUCCESSFUL)
+    {
+        FsiNodeWriterLinkBlocks(pWriter);
+    }
+
+    if (pWriter->Status != FS_WRITE_DATA_SUCCESSFUL)
+    {
+        // Give back every block handed out so far, the node is left empty.
+        for (uint64_t i = 0; i < pWriter->NumBlocks; i++)
+        {
+            if (pWriter->pBlocks[i])
+            {
+                FsBitmapSetBlock(&pFs->Bitmap, &pFs->Meta, pWriter->pBlocks[i], FS_BITMAP_BLOCK_FREE);
+                pFs->Meta.NumAllocatedBlocks--;
+            }
+        }
+
+        pWriter->StoredBlocks = 0;
+        pNode->Size = 0;
+        memset(pNode->InlineData, 0, FS_NODE_INLINE_DATA_SIZE);
+        memset(pNode->DirectData, 0, sizeof(block_t) * FS_NODE_DIRECT_DATA_BLOCKS);
+        pNode->AddrSinglyIndirect = 0;
+        pNode->AddrDoublyIndirect = 0;
+        pNode->AddrTriplyIndirect = 0;
+    }
+
+    free(pWriter->pBlocks);
+    free(pWriter->pTail);
+    free(pWriter->pPacked);
+    pWriter->pBlocks = NULL;
+    pWriter->pTail   = NULL;
+    pWriter->pPacked = NULL;
+
+    pNode->TsCreated  = FsGetBioTime();
+    pNode->TsAccessed = FsGetBioTime();
+    pNode->TsModified = FsGetBioTime();
+
+    if (!FsBlockCacheWrite(&pFs->Cache, pWriter->Pos.TableBlock, pWriter->Pos.Nest * FS_NODE_SIZE, pNode, FS_NODE_SIZE))
+    {
+        printf("FsCloseNodeWriter failed, couldn't write node %u to it's position on disk (block %lu, nest %u).\n",
+               pNode->ID, pWriter->Pos.TableBlock, pWriter->Pos.Nest);
+        return FsiNodeWriterFail(pWriter, FS_WRITE_DATA_DISK_ERROR);
+    }
+
+    if (!FsCommit(pFs))
+    {
+        puts("FsCloseNodeWriter failed, failed to commit the bitmap and file system metadata.");
+        return FsiNodeWriterFail(pWriter, FS_WRITE_DATA_DISK_ERROR);
+    }
+
+    return pWriter->Status;
+}
+
+write_node_data_result_t FsWriteNodeData(FileSystemOnDisk* pFs, nodeid_t nodeID, const void* pData, uint64_t szData)
+{
+    FsNodeWriter writer;
+    write_node_data_result_t result = FsOpenNodeWriter(pFs, nodeID, &writer);
+    if (result != FS_WRITE_DATA_SUCCESSFUL)
+    {
+        return result;
+    }
+
+    // A single append allocates every data block in one go, so the data still ends up in as few runs as possible.
+    FsNodeWriterAppend(&writer, pData, szData);
+    return FsCloseNodeWriter(&writer);
+}
+
+// Reads the node an in-place update starts from, the caller writes it back with FsWriteNode.
+static write_node_data_result_t FsiReadNodeForUpdate(FileSystemOnDisk* pFs, nodeid_t nodeID, FsNode* pNode)
+{
+    if (nodeID == FS_NODE_ID_INVALID || !FsNodeInTable(&pFs->Meta, nodeID) || !FsNodeInitialized(&pFs->Meta, nodeID))
+    {
+        printf("FsiReadNodeForUpdate failed, node %u doesn't exist.\n", nodeID);
+        return FS_WRITE_DATA_NODE_DOES_NOT_EXIST;
+    }
+
+    nodepos_t pos = FsResolveNodePos(&pFs->Meta, nodeID);
+    if (!FsBlockCacheRead(&pFs->Cache, pos.TableBlock, pos.Nest * FS_NODE_SIZE, pNode, FS_NODE_SIZE))
+    {
+        printf("FsiReadNodeForUpdate failed, couldn't read node %u on disk.\n", nodeID);
+        return FS_WRITE_DATA_DISK_ERROR;
+    }
+    if (pNode->ID == FS_NODE_ID_INVALID)
+    {
+        printf("FsiReadNodeForUpdate failed, node %u doesn't exist.\n", nodeID);
+        return FS_WRITE_DATA_NODE_DOES_NOT_EXIST;
+    }
+    // Changing a few bytes would mean unpacking and repacking their cluster, which may then need more blocks than before.
+    if (FsNodeIsCompressed(&pFs->Meta, pNode))
+    {
+        printf("FsiReadNodeForUpdate failed, node %u is compressed, its data can only be replaced as a whole.\n", nodeID);
+        return FS_WRITE_DATA_COMPRESSED;
+    }
+
+    return FS_WRITE_DATA_SUCCESSFUL;
+}
+
+typedef struct
+{
+    nodeid_t       NodeID;
+    const block_t* pBlocks; // Indirect blocks claimed up front, handed out as the tree needs them.
+    uint64_t       NumBlocks;
+    uint64_t       Next;
+    const uint8_t* pZero;   // One zeroed block.
+} indirect_pool_t;
+
+// Hands out the next indirect block of the pool, zeroed within the cache. Once the blocks claimed up front are used up,
+// each further one is allocated on its own. Returns 0 when there is none left.
+static block_t FsiTakeIndirect(FileSystemOnDisk* pFs, indirect_pool_t* pPool)
+{
+    block_t block;
+    if (pPool->Next < pPool->NumBlocks)
+    {
+        block = pPool->pBlocks[pPool->Next++];
+    }
+    else if (!FsiAllocateBlocks(pFs, pPool->NodeID, 1, &block, NULL))
+    {
+        printf("FsiTakeIndirect failed, the disk doesn't have space for another indirect block of node %u.\n", pPool->NodeID);
+        return 0;
+    }
+
+    if (!FsBlockCacheWrite(&pFs->Cache, block, 0, pPool->pZero, pFs->Meta.BlockSize))
+    {
+        printf("FsiTakeIndirect failed, couldn't clear indirect block %lu.\n", block);
+        return 0;
+    }
+    return block;
+}
+
+// Points the logical data block logicalIndex of pNode at block, missing indirect blocks on the way are taken from pPool.
+// pNode is only updated in memory.
+static bool FsiNodeLinkBlock(FileSystemOnDisk* pFs, FsNode* pNode, uint64_t logicalIndex, block_t block, indirect_pool_t* pPool)
+{
+    if (logicalIndex < FS_NODE_DIRECT_DATA_BLOCKS)
+    {
+        pNode->DirectData[logicalIndex] = block;
+        return true;
+    }
+
+    uint64_t ptrsPerBlock = pFs->Meta.BlockSize / sizeof(block_t);
+    uint64_t index = logicalIndex - FS_NODE_DIRECT_DATA_BLOCKS;
+    uint64_t span  = 1;
+
+    uint8_t level = FS_BLOCK_LEVEL_SINGLY;
+    while (index >= span * ptrsPerBlock)
+    {
+        index -= span * ptrsPerBlock;
+        span  *= ptrsPerBlock;
+        if (++level > FS_BLOCK_LEVEL_TRIPLY)
+        {
+            printf("FsiNodeLinkBlock failed, node %u can't address block %lu.\n", pNode->ID, logicalIndex);
+            return false;
+        }
+    }
+
+    block_t roots[FS_BLOCK_LEVEL_TRIPLY] = { pNode->AddrSinglyIndirect, pNode->AddrDoublyIndirect, pNode->AddrTriplyIndirect };
+    if (!roots[level - 1])
+    {
+        if (!(roots[level - 1] = FsiTakeIndirect(pFs, pPool)))
+        {
+            return false;
+        }
+        pNode->AddrSinglyIndirect = roots[0];
+        pNode->AddrDoublyIndirect = roots[1];
+        pNode->AddrTriplyIndirect = roots[2];
+    }
+
+    block_t parent = roots[level - 1];
+    for (; level > FS_BLOCK_LEVEL_SINGLY; level--, span /= ptrsPerBlock)
+    {
+        uint16_t offset = (uint16_t) (index / span * sizeof(block_t));
+        index %= span;
+
+        block_t child;
+        if (!FsBlockCacheRead(&pFs->Cache, parent, offset, &child, sizeof(block_t)))
+        {
+            printf("FsiNodeLinkBlock failed, couldn't read indirect block %lu.\n", parent);
+            return false;
+        }
+        if (!child && (!(child = FsiTakeIndirect(pFs, pPool)) || !FsBlockCacheWrite(&pFs->Cache, parent, offset, &child, sizeof(block_t))))
+        {
+            return false;
+        }
+        parent = child;
+    }
+
+    if (!FsBlockCacheWrite(&pFs->Cache, parent, (uint16_t) (index * sizeof(block_t)), &block, sizeof(block_t)))
+    {
+        printf("FsiNodeLinkBlock failed, couldn't write indirect block %lu.\n", parent);
+        return false;
+    }
+    return true;
+}
+
+// Whether the part of [offset, offset + szData) within the data blocks that falls into logical block `logical` is all
+// zeroes, pData holding the bytes of the whole range.
+static bool FsiBlockPartIsZero(uint64_t blockSize, uint64_t logical, uint64_t offset, const uint8_t* pData, uint64_t szData)
+{
+    uint64_t from = FS_MAX(offset, logical * blockSize);
+    uint64_t to   = FS_MIN(offset + szData, (logical + 1) * blockSize);
+    return BitScanIsZero(pData + (from - offset), to - from);
+}
+
+// Writes the part of [offset, offset + szData) within the data blocks that falls into the holes of pNode starting at
+// logical block `logical`, up to the first block that isn't a hole. A hole whose part is all zeroes stays one, the run
+// of holes with data is given new blocks, zeroed around the data, and linked into pNode in memory. Returns the number of
+// logical blocks dealt with, 0 on failure.
+static uint64_t FsiWriteNodeHoles(FileSystemOnDisk* pFs, FsNode* pNode, uint64_t logical, uint64_t offset, const uint8_t* pData, uint64_t szData)
+{
+    uint64_t blockSize = pFs->Meta.BlockSize;
+    uint64_t end       = offset + szData;
+    uint64_t last      = (end - 1) / blockSize;
+
+    if (FsiBlockPartIsZero(blockSize, logical, offset, pData, szData))
+    {
+        return 1;
+    }
+
+    uint64_t length = 1;
+    while (logical + length <= last && !FsNodeBlockAt(pFs, pNode, logical + length) &&
+           !FsiBlockPartIsZero(blockSize, logical + length, offset, pData, szData))
+    {
+        length++;
+    }
+
+    block_t* pBlocks = malloc(length * sizeof(block_t));
+    uint8_t* pZero   = calloc(1, blockSize);
+    if (!pBlocks || !pZero || !FsiAllocateBlocks(pFs, pNode->ID, length, pBlocks, NULL))
+    {
+        printf("FsiWriteNodeHoles failed, couldn't get %lu blocks for node %u.\n", length, pNode->ID);
+        free(pBlocks);
+        free(pZero);
+        return 0;
+    }
+
+    // Blocks handed out before may still be cached, the new contents go straight to the device.
+    bool bResult = true;
+    for (uint64_t i = 0; i < length; i++)
+    {
+        FsBlockCacheDiscard(&pFs->Cache, pBlocks[i]);
+    }
+    for (uint64_t i = 0; i < length && bResult; )
+    {
+        uint64_t runLength = 1;
+        while (i + runLength < length && pBlocks[i + runLength] == pBlocks[i] + runLength)
+        {
+            runLength++;
+        }
+
+        uint64_t runFrom  = (logical + i) * blockSize;
+        uint64_t runTo    = runFrom + runLength * blockSize;
+        uint64_t dataFrom = FS_MAX(offset, runFrom);
+        uint64_t dataTo   = FS_MIN(end, runTo);
+        uint64_t address  = pBlocks[i] * blockSize;
+
+        bResult = FsDeviceZero(pFs->pDevice, address, dataFrom - runFrom) &&
+                  FsDeviceWrite(pFs->pDevice, address + (dataFrom - runFrom), pData + (dataFrom - offset), dataTo - dataFrom) &&
+                  FsDeviceZero(pFs->pDevice, address + (dataTo - runFrom), runTo - dataTo);
+        i += runLength;
+    }
+    if (!bResult)
+    {
+        printf("FsiWriteNodeHoles failed, couldn't write %lu new blocks of node %u.\n", length, pNode->ID);
+    }
+
+    indirect_pool_t pool = { .NodeID = pNode->ID, .pBlocks = NULL, .NumBlocks = 0, .Next = 0, .pZero = pZero };
+    for (uint64_t i = 0; i < length && bResult; i++)
+    {
+        bResult = FsiNodeLinkBlock(pFs, pNode, logical + i, pBlocks[i], &pool);
+    }
+
+    free(pBlocks);
+    free(pZero);
+    return bResult ? length : 0;
+}
+
+// Writes szData bytes of pData at offset within the data blocks of pNode, offset 0 being the first byte past the inline
+// section. The blocks must exist unless pNode may have holes, see FsiWriteNodeHoles. Blocks the cache holds modified are
+// written there, the others bypass the cache with one device write per physically contiguous run.
+static bool FsiWriteNodeBlocks(FileSystemOnDisk* pFs, FsNode* pNode, uint64_t offset, const uint8_t* pData, uint64_t szData)
+{
+    uint64_t blockSize = pFs->Meta.BlockSize;
+    uint64_t end       = offset + szData;
+    uint64_t last      = (end - 1) / blockSize;
+
+    for (uint64_t logical = offset / blockSize; logical <= last;)
+    {
+        block_t start = FsNodeBlockAt(pFs, pNode, logical);
+        if (!start && FsNodeMayHaveHoles(&pFs->Meta, pNode))
+        {
+            uint64_t length = FsiWriteNodeHoles(pFs, pNode, logical, offset, pData, szData);
+            if (!length)
+            {
+                return false;
+            }
+            logical += length;
+            continue;
+        }
+        if (!start)
+        {
+            printf("FsiWriteNodeBlocks failed, node %u has no block %lu.\n", pNode->ID, logical);
+            return false;
+        }
+
+        uint64_t from = FS_MAX(offset, logical * blockSize);
+        if (FsBlockCacheFindDirty(&pFs->Cache, start))
+        {
+            uint64_t to = FS_MIN(end, (logical + 1) * blockSize);
+            if (!FsBlockCacheWrite(&pFs->Cache, start, (uint16_t) (from - logical * blockSize), pData + (from - offset), (uint16_t) (to - from)))
+            {
+                printf("FsiWriteNodeBlocks failed, couldn't write block %lu.\n", start);
+                return false;
+            }
+            logical++;
+            continue;
+        }
+
+        uint64_t length = 1;
+        FsBlockCacheDiscard(&pFs->Cache, start);
+        while (logical + length <= last)
+        {
+            block_t next = FsNodeBlockAt(pFs, pNode, logical + length);
+            if (next != start + length || FsBlockCacheFindDirty(&pFs->Cache, next))
+            {
+                break;
+            }
+            FsBlockCacheDiscard(&pFs->Cache, next);
+            length++;
+        }
+
+        uint64_t to = FS_MIN(end, (logical + length) * blockSize);
+        if (!FsDeviceWrite(pFs->pDevice, start * blockSize + (from - logical * blockSize), pData + (from - offset), to - from))
+        {
+            printf("FsiWriteNodeBlocks failed, couldn't write %lu blocks starting at block %lu.\n", length, start);
+            return false;
+        }
+        logical += length;
+    }
+
+    return true;
+}
+
+// Gives pNode the data and indirect blocks a size of newSize calls for, pNode->Size is left to the caller. New data
+// blocks are zeroed unless [keepFrom, keepTo) of the block data is about to cover them completely. A node that may have
+// holes gets none, the new blocks are holes until something is written into them.
+static write_node_data_result_t FsiGrowNode(FileSystemOnDisk* pFs, FsNode* pNode, uint64_t newSize, uint64_t keepFrom, uint64_t keepTo)
+{
+    FsMeta*  pMeta     = &pFs->Meta;
+    uint64_t blockSize = pMeta->BlockSize;
+    uint64_t oldData   = FsNodeDataBlocks(pMeta, pNode->Size);
+    uint64_t newData   = FsNodeDataBlocks(pMeta, newSize);
+    if (newData <= oldData)
+    {
+        return FS_WRITE_DATA_SUCCESSFUL;
+    }
+    if (!FsiCalculateDataStorage(pMeta, newData * blockSize).TotalBlocks)
+    {
+        printf("FsiGrowNode failed, a node worth %lu data blocks is beyond what the triply indirect block can address.\n", newData);
+        return FS_WRITE_DATA_TOO_BIG;
+    }
+    if (FsNodeMayHaveHoles(pMeta, pNode))
+    {
+        return FS_WRITE_DATA_SUCCESSFUL;
+    }
+
+    data_storage_t oldStorage = FsiCalculateDataStorage(pMeta, oldData * blockSize);
+    data_storage_t newStorage = FsiCalculateDataStorage(pMeta, newData * blockSize);
+
+    // The data blocks come first so they end up in as few runs as possible, the indirect blocks follow them.
+    uint64_t numData   = newData - oldData;
+    uint64_t numBlocks = newStorage.TotalBlocks - oldStorage.TotalBlocks;
+    block_t* pBlocks   = malloc(numBlocks * sizeof(block_t));
+    uint8_t* pZero     = calloc(1, blockSize);
+    if (!pBlocks || !pZero)
+    {
+        puts("FsiGrowNode failed, couldn't allocate the list of new blocks.");
+        free(pBlocks);
+        free(pZero);
+        return FS_WRITE_DATA_ALLOCATION_ERROR;
+    }
+    if (!FsiAllocateBlocks(pFs, pNode->ID, numBlocks, pBlocks, NULL))
+    {
+        printf("FsiGrowNode failed, the disk doesn't have space for %lu more blocks of node %u.\n", numBlocks, pNode->ID);
+        free(pBlocks);
+        free(pZero);
+        return FS_WRITE_DATA_INSUFFICIENT_DISK_SPACE;
+    }
+
+    // Blocks handed out before may still be cached, the new contents go straight to the device.
+    write_node_data_result_t result = FS_WRITE_DATA_SUCCESSFUL;
+    for (uint64_t i = 0; i < numData;)
+    {
+        uint64_t logical = oldData + i;
+        if (keepFrom <= logical * blockSize && (logical + 1) * blockSize <= keepTo)
+        {
+            i++;
+            continue;
+        }
+
+        uint64_t length = 1;
+        while (i + length < numData && pBlocks[i + length] == pBlocks[i] + length &&
+               !(keepFrom <= (logical + length) * blockSize && (logical + length + 1) * blockSize <= keepTo))
+        {
+            length++;
+        }
+
+        for (uint64_t j = 0; j < length; j++)
+        {
+            FsBlockCacheDiscard(&pFs->Cache, pBlocks[i + j]);
+        }
+        if (!FsDeviceZero(pFs->pDevice, pBlocks[i] * blockSize, length * blockSize))
+        {
+            printf("FsiGrowNode failed, couldn't clear %lu blocks starting at block %lu.\n", length, pBlocks[i]);
+            result = FS_WRITE_DATA_DISK_ERROR;
+            break;
+        }
+        i += length;
+    }
+
+    indirect_pool_t pool = { .NodeID = pNode->ID, .pBlocks = pBlocks + numData, .NumBlocks = numBlocks - numData, .Next = 0, .pZero = pZero };
+    for (uint64_t i = 0; i < numData && result == FS_WRITE_DATA_SUCCESSFUL; i++)
+    {
+        if (!FsiNodeLinkBlock(pFs, pNode, oldData + i, pBlocks[i], &pool))
+        {
+            result = FS_WRITE_DATA_DISK_ERROR;
+        }
+    }
+
+    // Once anything may be linked the blocks stay allocated, the node isn't written so they are only leaked.
+    free(pBlocks);
+    free(pZero);
+    return result;
+}
+
+typedef struct
+{
+    FileSystemOnDisk* pFs;
+    uint64_t          FirstFreed; // Data blocks from here on and the indirect blocks only they hang off are freed.
+} block_release_t;
+
+// Block visitor releasing the blocks of a node from a logical index on, pContext is a block_release_t.
+static bool FsiReleaseTailVisitor(void* pContext, uint64_t logicalIndex, block_t block, uint8_t level)
+{
+    block_release_t* pRelease = (block_release_t*) pContext;
+    if (logicalIndex >= pRelease->FirstFreed)
+    {
+        FsiFreeBlockVisitor(pRelease->pFs, logicalIndex, block, level);
+    }
+    return true;
+}
+
+// Zeroes every pointer of pNode to data blocks from logicalIndex on and to the indirect blocks only they hang off,
+// after they were freed. Surviving indirect blocks are updated through the cache, pNode only in memory.
+static bool FsiClearPointersFrom(FileSystemOnDisk* pFs, FsNode* pNode, uint64_t logicalIndex)
+{
+    if (logicalIndex < FS_NODE_DIRECT_DATA_BLOCKS)
+    {
+        memset(&pNode->DirectData[logicalIndex], 0, (FS_NODE_DIRECT_DATA_BLOCKS - logicalIndex) * sizeof(block_t));
+        pNode->AddrSinglyIndirect = 0;
+        pNode->AddrDoublyIndirect = 0;
+        pNode->AddrTriplyIndirect = 0;
+        return true;
+    }
+
+    uint64_t ptrsPerBlock = pFs->Meta.BlockSize / sizeof(block_t);
+    uint64_t index = logicalIndex - FS_NODE_DIRECT_DATA_BLOCKS;
+    uint64_t span  = 1;
+
+    uint8_t level = FS_BLOCK_LEVEL_SINGLY;
+    while (index >= span * ptrsPerBlock)
+    {
+        index -= span * ptrsPerBlock;
+        span  *= ptrsPerBlock;
+        if (++level > FS_BLOCK_LEVEL_TRIPLY)
+        {
+            return true;
+        }
+    }
+
+    // Trees past the one holding logicalIndex are gone, so is that one when logicalIndex is its first block.
+    block_t roots[FS_BLOCK_LEVEL_TRIPLY] = { pNode->AddrSinglyIndirect, pNode->AddrDoublyIndirect, pNode->AddrTriplyIndirect };
+    for (uint8_t l = index ? level + 1 : level; l <= FS_BLOCK_LEVEL_TRIPLY; l++)
+    {
+        roots[l - 1] = 0;
+    }
+    pNode->AddrSinglyIndirect = roots[0];
+    pNode->AddrDoublyIndirect = roots[1];
+    pNode->AddrTriplyIndirect = roots[2];
+    if (index == 0)
+    {
+        return true;
+    }
+
+    // Down the path to logicalIndex, the child holding it survives when some of its data does, everything after it goes.
+    // The path ends early at a hole, nothing underneath it has to be cleared.
+    block_t parent = roots[level - 1];
+    for (; parent; level--, span /= ptrsPerBlock)
+    {
+        uint64_t slot = index / span;
+        index %= span;
+
+        uint64_t firstCleared = slot + (index ? 1 : 0);
+        if (firstCleared < ptrsPerBlock)
+        {
+            FsBlockCacheEntry* pEntry = FsBlockCachePin(&pFs->Cache, parent);
+            if (!pEntry)
+            {
+                printf("FsiClearPointersFrom failed, couldn't read indirect block %lu.\n", parent);
+                return false;
+            }
+            memset(pEntry->pData + firstCleared * sizeof(block_t), 0, (ptrsPerBlock - firstCleared) * sizeof(block_t));
+            FsBlockCacheMarkDirty(&pFs->Cache, pEntry);
+            FsBlockCacheUnpin(&pFs->Cache, pEntry);
+        }
+
+        if (!index || level == FS_BLOCK_LEVEL_SINGLY)
+        {
+            return true;
+        }
+        if (!FsBlockCacheRead(&pFs->Cache, parent, (uint16_t) (slot * sizeof(block_t)), &parent, sizeof(block_t)))
+        {
+            printf("FsiClearPointersFrom failed, couldn't read indirect block %lu.\n", parent);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Releases the blocks of pNode past newSize and zeroes the rest of the last block, so growing the node again reads
+// zeroes there. pNode->Size is left to the caller.
+static write_node_data_result_t FsiShrinkNode(FileSystemOnDisk* pFs, FsNode* pNode, uint64_t newSize)
+{
+    const FsMeta* pMeta = &pFs->Meta;
+    uint64_t newData = FsNodeDataBlocks(pMeta, newSize);
+
+    block_release_t release = { .pFs = pFs, .FirstFreed = newData };
+    if (!FsWalkNodeBlocksFrom(pFs, pNode, newData, FsiReleaseTailVisitor, &release) || !FsiClearPointersFrom(pFs, pNode, newData))
+    {
+        printf("FsiShrinkNode failed, couldn't release the blocks of node %u past %lu bytes.\n", pNode->ID, newSize);
+        return FS_WRITE_DATA_DISK_ERROR;
+    }
+
+    if (newSize < FS_NODE_INLINE_DATA_SIZE)
+    {
+        memset(pNode->InlineData + newSize, 0, FS_NODE_INLINE_DATA_SIZE - newSize);
+        return FS_WRITE_DATA_SUCCESSFUL;
+    }
+
+    uint64_t used = (newSize - FS_NODE_INLINE_DATA_SIZE) % pMeta->BlockSize;
+    if (used)
+    {
+        uint8_t* pZero = calloc(1, pMeta->BlockSize);
+        bool bZeroed = pZero && FsiWriteNodeBlocks(pFs, pNode, newSize - FS_NODE_INLINE_DATA_SIZE, pZero, pMeta->BlockSize - used);
+        free(pZero);
+        if (!bZeroed)
+        {
+            printf("FsiShrinkNode failed, couldn't clear the end of the last block of node %u.\n", pNode->ID);
+            return FS_WRITE_DATA_DISK_ERROR;
+        }
+    }
+
+    return FS_WRITE_DATA_SUCCESSFUL;
+}
+
+// Writes pNode back with its new size and commits.
+static write_node_data_result_t FsiFinishUpdate(FileSystemOnDisk* pFs, FsNode* pNode, uint64_t newSize)
+{
+    pNode->Size       = newSize;
+    pNode->TsAccessed = FsGetBioTime();
+    pNode->TsModified = FsGetBioTime();
+
+    if (!FsWriteNode(pFs, pNode) || !FsCommit(pFs))
+    {
+        printf("FsiFinishUpdate failed, couldn't write and commit node %u.\n", pNode->ID);
+        return FS_WRITE_DATA_DISK_ERROR;
+    }
+    return FS_WRITE_DATA_SUCCESSFUL;
+}
+
+write_node_data_result_t FsWriteNodeAt(FileSystemOnDisk* pFs, nodeid_t nodeID, uint64_t offset, const void* pData, uint64_t szData)
+{
+    FsNode node;
+    write_node_data_result_t result = FsiReadNodeForUpdate(pFs, nodeID, &node);
+    if (result != FS_WRITE_DATA_SUCCESSFUL || !szData)
+    {
+        return result;
+    }
+
+    const uint8_t* pBytes = (const uint8_t*) pData;
+    uint64_t end = offset + szData;
+    if (end < offset)
+    {
+        printf("FsWriteNodeAt failed, %lu bytes at offset %lu are past what a node can hold.\n", szData, offset);
+        return FS_WRITE_DATA_TOO_BIG;
+    }
+
+    // Data blocks are counted from the end of the inline section.
+    uint64_t blockFrom = FS_MAX(offset, FS_NODE_INLINE_DATA_SIZE) - FS_NODE_INLINE_DATA_SIZE;
+    uint64_t blockTo   = FS_MAX(end, FS_NODE_INLINE_DATA_SIZE) - FS_NODE_INLINE_DATA_SIZE;
+    if (end > node.Size && (result = FsiGrowNode(pFs, &node, end, blockFrom, blockTo)) != FS_WRITE_DATA_SUCCESSFUL)
+    {
+        return result;
+    }
+
+    if (offset < FS_NODE_INLINE_DATA_SIZE)
+    {
+        memcpy(node.InlineData + offset, pBytes, FS_MIN(szData, FS_NODE_INLINE_DATA_SIZE - offset));
+    }
+    if (blockTo > blockFrom && !FsiWriteNodeBlocks(pFs, &node, blockFrom, pBytes + (blockFrom + FS_NODE_INLINE_DATA_SIZE - offset), blockTo - blockFrom))
+    {
+        printf("FsWriteNodeAt failed, couldn't write %lu bytes at offset %lu of node %u.\n", szData, offset, nodeID);
+        return FS_WRITE_DATA_DISK_ERROR;
+    }
+
+    return FsiFinishUpdate(pFs, &node, FS_MAX(node.Size, end));
+}
+
+write_node_data_result_t FsAppendNode(FileSystemOnDisk* pFs, nodeid_t nodeID, const void* pData, uint64_t szData)
+{
+    FsNode node;
+    write_node_data_result_t result = FsiReadNodeForUpdate(pFs, nodeID, &node);
+    return result == FS_WRITE_DATA_SUCCESSFUL ? FsWriteNodeAt(pFs, nodeID, node.Size, pData, szData) : result;
+}
+
+write_node_data_result_t FsTruncateNode(FileSystemOnDisk* pFs, nodeid_t nodeID, uint64_t size)
+{
+    FsNode node;
+    write_node_data_result_t result = FsiReadNodeForUpdate(pFs, nodeID, &node);
+    if (result != FS_WRITE_DATA_SUCCESSFUL || size == node.Size)
+    {
+        return result;
+    }
+
+    result = size > node.Size ? FsiGrowNode(pFs, &node, size, 0, 0) : FsiShrinkNode(pFs, &node, size);
+    return result == FS_WRITE_DATA_SUCCESSFUL ? FsiFinishUpdate(pFs, &node, size) : result;
+}
+
+// Block visitor collecting the data blocks of a node into the runs of a reader, pContext is the reader.
+static bool FsiNodeReaderMapVisitor(void* pContext, uint64_t logicalIndex, block_t block, uint8_t level)
+{
+    FsNodeReader* pReader = (FsNodeReader*) pContext;
+    if (level != FS_BLOCK_LEVEL_DATA)
+    {
+        return true;
+    }
+
+    if (pReader->NumRuns)
+    {
+        data_run_t* pLast = &pReader->pRuns[pReader->NumRuns - 1];
+        if (pLast->Logical + pLast->Length == logicalIndex && pLast->Start + pLast->Length == block)
+        {
+            pLast->Length++;
+            return true;
+        }
+    }
+
+    if (pReader->NumRuns == pReader->MaxRuns)
+    {
+        uint64_t    maxRuns = pReader->MaxRuns ? pReader->MaxRuns * 2 : 16;
+        data_run_t* pRuns   = realloc(pReader->pRuns, maxRuns * sizeof(data_run_t));
+        if (!pRuns)
+        {
+            pReader->bMapFailed = true;
+            return false;
+        }
+        pReader->pRuns   = pRuns;
+        pReader->MaxRuns = maxRuns;
+    }
+
+    pReader->pRuns[pReader->NumRuns++] = (data_run_t) { .Logical = logicalIndex, .Start = block, .Length = 1 };
+    return true;
+}
+
+// Index of the run holding the logical block, or of the first run after it when no run does.
+static uint64_t FsiNodeReaderFindRun(const FsNodeReader* pReader, uint64_t logicalIndex)
+{
+    uint64_t low = 0, high = pReader->NumRuns;
+    while (low < high)
+    {
+        uint64_t middle = low + (high - low) / 2;
+        const data_run_t* pRun = &pReader->pRuns[middle];
+        if (pRun->Logical + pRun->Length <= logicalIndex)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Hints the logical blocks [logicalIndex, end) to the device, run by run.
+static void FsiNodeReaderHint(FsNodeReader* pReader, uint64_t logicalIndex, uint64_t end)
+{
+    uint64_t blockSize = pReader->pFs->Meta.BlockSize;
+
+    for (uint64_t i = FsiNodeReaderFindRun(pReader, logicalIndex); i < pReader->NumRuns && pReader->pRuns[i].Logical < end; i++)
+    {
+        const data_run_t* pRun = &pReader->pRuns[i];
+        uint64_t first = FS_MAX(pRun->Logical, logicalIndex);
+        uint64_t last  = FS_MIN(pRun->Logical + pRun->Length, end);
+        FsDeviceReadahead(pReader->pFs->pDevice, (pRun->Start + first - pRun->Logical) * blockSize, (last - first) * blockSize);
+    }
+    pReader->NextHinted = end;
+}
+
+read_node_data_result_t FsOpenNodeReader(FileSystemOnDisk* pFs, nodeid_t nodeID, uint64_t readahead, FsNodeReader* pReader)
+{
+    memset(pReader, 0, sizeof(FsNodeReader));
+    pReader->pFs = pFs;
+    pReader->ReadaheadBlocks = FS_DIV(readahead, pFs->Meta.BlockSize);
+    pReader->Cluster         = UINT64_MAX;
+
+    if (nodeID == FS_NODE_ID_INVALID || !FsNodeInTable(&pFs->Meta, nodeID))
+    {
+        printf("FsOpenNodeReader failed, node %u's location is outside of the node table.\n", nodeID);
+        return FS_READ_DATA_NODE_DOES_NOT_EXIST;
+    }
+    if (!FsNodeInitialized(&pFs->Meta, nodeID))
+    {
+        return FS_READ_DATA_NODE_DOES_NOT_EXIST;
+    }
+
+    nodepos_t pos = FsResolveNodePos(&pFs->Meta, nodeID);
+    if (!FsBlockCacheRead(&pFs->Cache, pos.TableBlock, pos.Nest * FS_NODE_SIZE, &pReader->Node, FS_NODE_SIZE))
+    {
+        printf("FsOpenNodeReader failed, couldn't read node %u on disk.\n", nodeID);
+        return FS_READ_DATA_DISK_ERROR;
+    }
+    if (pReader->Node.ID == FS_NODE_ID_INVALID)
+    {
+        return FS_READ_DATA_NODE_DOES_NOT_EXIST;
+    }
+
+    if (!FsWalkNodeBlocks(pFs, &pReader->Node, FsiNodeReaderMapVisitor, pReader))
+    {
+        printf("FsOpenNodeReader failed, couldn't walk the blocks of node %u.\n", nodeID);
+        FsCloseNodeReader(pReader);
+        return FS_READ_DATA_DISK_ERROR;
+    }
+
+    // The visitor only stops the walk when the list of runs can't grow.
+    if (pReader->bMapFailed)
+    {
+        puts("FsOpenNodeReader failed, couldn't grow the list of data runs.");
+        FsCloseNodeReader(pReader);
+        return FS_READ_DATA_ALLOCATION_ERROR;
+    }
+
+    if (FsNodeIsCompressed(&pFs->Meta, &pReader->Node))
+    {
+        uint64_t clusterSize = FsClusterBlocks(&pFs->Meta) * pFs->Meta.BlockSize;
+        pReader->pCluster = malloc(clusterSize);
+        pReader->pPacked  = malloc(clusterSize);
+        if (!pReader->pCluster || !pReader->pPacked)
+        {
+            puts("FsOpenNodeReader failed, couldn't allocate the cluster buffers.");
+            FsCloseNodeReader(pReader);
+            return FS_READ_DATA_ALLOCATION_ERROR;
+        }
+    }
+
+    return FS_READ_DATA_SUCCESSFUL;
+}
+
+// Reads the bytes [dataOffset, dataEnd) of the block data, past the inline section, as they are stored.
+static read_node_data_result_t FsiNodeReaderReadBlocks(FsNodeReader* pReader, uint64_t dataOffset, uint64_t dataEnd, uint8_t* pOut)
+{
+    const FsNode* pNode     = &pReader->Node;
+    uint64_t      blockSize = pReader->pFs->Meta.BlockSize;
+
+    for (uint64_t i = FsiNodeReaderFindRun(pReader, dataOffset / blockSize); dataOffset < dataEnd; i++)
+    {
+        const data_run_t* pRun = i < pReader->NumRuns ? &pReader->pRuns[i] : NULL;
+        if (!pRun || pRun->Logical * blockSize > dataOffset)
+        {
+            if (!FsNodeMayHaveHoles(&pReader->pFs->Meta, pNode))
+            {
+                printf("FsNodeReaderRead failed, node %u has no block for byte %lu of its data.\n", pNode->ID, dataOffset + FS_NODE_INLINE_DATA_SIZE);
+                return FS_READ_DATA_DISK_ERROR;
+            }
+
+            // A hole up to the next run, or up to the end of the read when there is none.
+            uint64_t holeEnd = pRun ? FS_MIN(pRun->Logical * blockSize, dataEnd) : dataEnd;
+            memset(pOut, 0, holeEnd - dataOffset);
+            pOut      += holeEnd - dataOffset;
+            dataOffset = holeEnd;
+            i--;
+            continue;
+        }
+
+        uint64_t runOffset = dataOffset - pRun->Logical * blockSize;
+        uint64_t chunk     = FS_MIN(pRun->Length * blockSize - runOffset, dataEnd - dataOffset);
+        if (!FsDeviceRead(pReader->pFs->pDevice, pRun->Start * blockSize + runOffset, pOut, chunk))
+        {
+            printf("FsNodeReaderRead failed, couldn't read %lu bytes from block %lu on.\n", chunk, pRun->Start + runOffset / blockSize);
+            return FS_READ_DATA_DISK_ERROR;
+        }
+
+        // Blocks changed through the block cache, directory blocks for one, may not have reached the device yet.
+        if (pReader->pFs->Cache.NumDirty)
+        {
+            for (uint64_t pos = runOffset - runOffset % blockSize; pos < runOffset + chunk; pos += blockSize)
+            {
+                const uint8_t* pCached = FsBlockCacheFindDirty(&pReader->pFs->Cache, pRun->Start + pos / blockSize);
+                if (pCached)
+                {
+                    uint64_t from = FS_MAX(pos, runOffset);
+                    uint64_t to   = FS_MIN(pos + blockSize, runOffset + chunk);
+                    memcpy(pOut + (from - runOffset), pCached + (from - pos), to - from);
+                }
+            }
+        }
+
+        pOut       += chunk;
+        dataOffset += chunk;
+    }
+
+    return FS_READ_DATA_SUCCESSFUL;
+}
+
+// Number of blocks present from the logical block first on, at most count.
+static uint64_t FsiNodeReaderCountPresent(const FsNodeReader* pReader, uint64_t first, uint64_t count)
+{
+    uint64_t next = first;
+    for (uint64_t i = FsiNodeReaderFindRun(pReader, first); i < pReader->NumRuns && pReader->pRuns[i].Logical <= next; i++)
+    {
+        next = pReader->pRuns[i].Logical + pReader->pRuns[i].Length;
+    }
+    return FS_MIN(next, first + count) - first;
+}
+
+// Reads the bytes [dataOffset, dataEnd) of the block data of a compressed node, unpacking each cluster they touch.
+static read_node_data_result_t FsiNodeReaderReadClusters(FsNodeReader* pReader, uint64_t dataOffset, uint64_t dataEnd, uint8_t* pOut)
+{
+    const FsNode* pNode         = &pReader->Node;
+    uint16_t      blockSize     = pReader->pFs->Meta.BlockSize;
+    uint64_t      clusterBlocks = FsClusterBlocks(&pReader->pFs->Meta);
+    uint64_t      clusterSize   = clusterBlocks * blockSize;
+    uint64_t      dataSize      = pNode->Size - FS_NODE_INLINE_DATA_SIZE;
+
+    while (dataOffset < dataEnd)
+    {
+        uint64_t cluster   = dataOffset / clusterSize;
+        uint64_t start     = cluster * clusterSize;
+        uint64_t length    = FS_MIN(clusterSize, dataSize - start);
+        uint64_t numBlocks = FS_DIV(length, blockSize);
+        uint64_t chunk     = FS_MIN(start + length, dataEnd) - dataOffset;
+
+        if (cluster != pReader->Cluster)
+        {
+            uint64_t numStored = FsiNodeReaderCountPresent(pReader, cluster * clusterBlocks, numBlocks);
+
+            // A cluster stored as is reads like any other data.
+            if (numStored == numBlocks)
+            {
+                read_node_data_result_t result = FsiNodeReaderReadBlocks(pReader, dataOffset, dataOffset + chunk, pOut);
+                if (result != FS_READ_DATA_SUCCESSFUL)
+                {
+                    return result;
+                }
+
+                pOut       += chunk;
+                dataOffset += chunk;
+                continue;
+            }
+
+            read_node_data_result_t result = FsiNodeReaderReadBlocks(pReader, start, start + numStored * blockSize, pReader->pPacked);
+            if (result != FS_READ_DATA_SUCCESSFUL)
+            {
+                return result;
+            }
+            if (!FsUnpackCluster(blockSize, pReader->pPacked, numStored, pReader->pCluster, length))
+            {
+                printf("FsNodeReaderRead failed, cluster %lu of node %u doesn't decompress.\n", cluster, pNode->ID);
+                pReader->Cluster = UINT64_MAX;
+                return FS_READ_DATA_DISK_ERROR;
+            }
+            pReader->Cluster = cluster;
+        }
+
+        memcpy(pOut, pReader->pCluster + (dataOffset - start), chunk);
+        pOut       += chunk;
+        dataOffset += chunk;
+    }
+
+    return FS_READ_DATA_SUCCESSFUL;
+}
+
+read_node_data_result_t FsNodeReaderRead(FsNodeReader* pReader, uint64_t offset, void* pDest, uint64_t size, uint64_t* pRead)
+{
+    const FsNode* pNode     = &pReader->Node;
+    uint64_t      blockSize = pReader->pFs->Meta.BlockSize;
+    uint8_t*      pOut      = (uint8_t*) pDest;
+
+    *pRead = 0;
+    if (offset >= pNode->Size)
+    {
+        return FS_READ_DATA_SUCCESSFUL;
+    }
+    size = FS_MIN(size, pNode->Size - offset);
+    uint64_t end = offset + size;
+
+    if (offset < FS_NODE_INLINE_DATA_SIZE)
+    {
+        uint64_t inlineSize = FS_MIN(end, (uint64_t) FS_NODE_INLINE_DATA_SIZE) - offset;
+        memcpy(pOut, pNode->InlineData + offset, inlineSize);
+        pOut   += inlineSize;
+        offset += inlineSize;
+    }
+    if (offset == end)
+    {
+        *pRead = size;
+        return FS_READ_DATA_SUCCESSFUL;
+    }
+
+    // Byte positions within the block data, past the inline section.
+    uint64_t dataOffset = offset - FS_NODE_INLINE_DATA_SIZE;
+    uint64_t dataEnd    = end - FS_NODE_INLINE_DATA_SIZE;
+    uint64_t firstBlock = dataOffset / blockSize;
+    uint64_t lastBlock  = (dataEnd - 1) / blockSize;
+
+    // Compressed data is read whole clusters at a time.
+    if (pReader->pCluster)
+    {
+        uint64_t clusterBlocks = FsClusterBlocks(&pReader->pFs->Meta);
+        firstBlock -= firstBlock % clusterBlocks;
+        lastBlock  += clusterBlocks - 1 - lastBlock % clusterBlocks;
+    }
+
+    // The blocks of the read are hinted along with the readahead, so the runs of a fragmented node are fetched side by side.
+    if (pReader->NextHinted < lastBlock + 1 + pReader->ReadaheadBlocks / 2)
+    {
+        FsiNodeReaderHint(pReader, FS_MAX(pReader->NextHinted, firstBlock), lastBlock + 1 + pReader->ReadaheadBlocks);
+    }
+
+    read_node_data_result_t result = pReader->pCluster ? FsiNodeReaderReadClusters(pReader, dataOffset, dataEnd, pOut)
+                                                       : FsiNodeReaderReadBlocks(pReader, dataOffset, dataEnd, pOut);
+    if (result != FS_READ_DATA_SUCCESSFUL)
+    {
+        return result;
+    }
+
+    *pRead = size;
+    return FS_READ_DATA_SUCCESSFUL;
+}
+
+void FsCloseNodeReader(FsNodeReader* pReader)
+{
+    free(pReader->pRuns);
+    free(pReader->pCluster);
+    free(pReader->pPacked);
+    pReader->pRuns    = NULL;
+    pReader->pCluster = NULL;
+    pReader->pPacked  = NULL;
+    pReader->NumRuns = 0;
+    pReader->MaxRuns = 0;
+}
+
+read_node_data_result_t FsReadNodeData(FileSystemOnDisk* pFs, nodeid_t nodeID, uint64_t offset, void* pDest, uint64_t szData, uint64_t* pRead)
+{
+    FsNodeReader reader;
+    read_node_data_result_t result = FsOpenNodeReader(pFs, nodeID, 0, &reader);
+    if (result != FS_READ_DATA_SUCCESSFUL)
+    {
+        *pRead = 0;
+        return result;
+    }
+
+    result = FsNodeReaderRead(&reader, offset, pDest, szData, pRead);
+    FsCloseNodeReader(&reader);
+    return result;
+}
+
+create_node_result_t FsMakeNode(FileSystemOnDisk* pFs, FsNode* pNode, const void* pData, uint64_t szData)
+{
+
+    /** Holy trio of checks */
+    if (pNode->ID == FS_NODE_ID_INVALID)
+    {
+        puts("FsMakeNode failed, nodes cannot have the ID 0 because it represents invalidity.");
+        return FS_MAKE_NODE_INVALID_ID;
+    }
+    if (!FsNodeInTable(&pFs->Meta, pNode->ID))
+    {
+        printf("FsMakeNode failed, node %u has no slot within the node table.\n", pNode->ID);
+        return FS_MAKE_NODE_INVALID_ID;
+    }
+
+    // The index always counts the reserved nodes as used, only their own slot can tell whether they were made already.
+    bool bExists = false;
+    if (pNode->ID <= FS_NODE_ID_ROOT)
+    {
+        bExists = FsNodeExists(pFs, pNode->ID);
+    }
+    else if (!FsNodeIndexCheck(&pFs->Nodes, pFs->pDevice, &pFs->Meta, pNode->ID, &bExists))
+    {
+        return FS_MAKE_NODE_DISK_ERROR;
+    }
+    if (bExists)
+    {
+        printf("FsMakeNode failed, node %u already exists.\n", pNode->ID);
+        return FS_MAKE_NODE_EXISTS;
+    }
+    if (pNode->Type != FS_NODE_TYPE_FILE && pNode->Type != FS_NODE_TYPE_DIRECTORY && pNode->Type != FS_NODE_TYPE_SOFT_LINK)
+    {
+        printf("FsMakeNode failed, node type %u doesn't correspond to any valid Myth File System node type.\n", pNode->Type);
+        return FS_MAKE_NODE_INVALID_TYPE;
+    }
+
+    // Pseudo-write node to the table so FsWriteNodeData doesn't fail.
+    nodepos_t pos = FsResolveNodePos(&pFs->Meta, pNode->ID);
+    if (!FsiInitNodeTable(pFs, pNode->ID) || !FsBlockCacheWrite(&pFs->Cache, pos.TableBlock, pos.Nest * FS_NODE_SIZE, pNode, FS_NODE_SIZE))
+    {
+        printf("FsMakeNode failed, couldn't write to node %u's location on disk.\n", pNode->ID);
+        return FS_MAKE_NODE_DISK_ERROR;
+    }
+
+    // Accounted for before writing the data so the commit at the end of FsWriteNodeData already includes the new node.
+    nodeid_t lastAllocatedNodeID = pFs->Meta.LastAllocatedNodeID;
+    pFs->Meta.NumAllocatedNodes++;
+    pFs->Meta.LastAllocatedNodeID = pNode->ID;
+    if (!FsGroupCountNodes(pFs, pNode->ID, 1))
+    {
+        pFs->Meta.NumAllocatedNodes--;
+        pFs->Meta.LastAllocatedNodeID = lastAllocatedNodeID;
+        return FS_MAKE_NODE_DISK_ERROR;
+    }
+    FsNodeIndexSet(&pFs->Nodes, pFs->pDevice, &pFs->Meta, pNode->ID, true); // Loaded by the check above, can't fail.
+
+    write_node_data_result_t writeResult = FsWriteNodeData(pFs, pNode->ID, pData, szData);
+    if (writeResult != FS_WRITE_DATA_SUCCESSFUL)
+    {
+        // The failed write gave back its blocks already, only the slot written above is left to clear.
+        FsNode invalidNode = FsInvalidNode();
+        FsBlockCacheWrite(&pFs->Cache, pos.TableBlock, pos.Nest * FS_NODE_SIZE, &invalidNode, FS_NODE_SIZE);
+        pFs->Meta.NumAllocatedNodes--;
+        pFs->Meta.LastAllocatedNodeID = lastAllocatedNodeID;
+        FsGroupCountNodes(pFs, pNode->ID, -1);
+        FsNodeIndexSet(&pFs->Nodes, pFs->pDevice, &pFs->Meta, pNode->ID, false);
+
+        printf("FsMakeNode failed, FsWriteNodeData returned non-succesful return value %u (%s).\n", writeResult, FsWriteNodeDataResultToString(writeResult));
+        switch (writeResult)
+        {
+        case FS_WRITE_DATA_NODE_DOES_NOT_EXIST:     return FS_MAKE_NODE_INTERMEDIATE_ERROR;
+        case FS_WRITE_DATA_DISK_ERROR:              return FS_MAKE_NODE_DISK_ERROR;
+        case FS_WRITE_DATA_ALLOCATION_ERROR:        return FS_MAKE_NODE_ALLOCATION_ERROR;
+        case FS_WRITE_DATA_INSUFFICIENT_DISK_SPACE: return FS_MAKE_NODE_INSUFFICIENT_DISK_SPACE;
+        case FS_WRITE_DATA_TOO_BIG:                 return FS_MAKE_NODE_DATA_TOO_BIG;
+        default: return -1;
+        }
+    }
+
+    return FS_MAKE_NODE_SUCCESSFUL;
+}
+
+bool FsDeleteNode(FileSystemOnDisk* pFs, nodeid_t nodeID)
+{
+    if (nodeID == FS_NODE_ID_INVALID || !FsNodeInTable(&pFs->Meta, nodeID))
+    {
+        printf("FsDeleteNode failed, node %u has no slot within the node table.\n", nodeID);
+        return false;
+    }
+    if (!FsNodeExists(pFs, nodeID))
+    {
+        printf("FsDeleteNode failed, node %u doesn't exist.\n", nodeID);
+        return false;
+    }
+
+    nodepos_t pos = FsResolveNodePos(&pFs->Meta, nodeID);
+    FsNode node;
+    if (!FsBlockCacheRead(&pFs->Cache, pos.TableBlock, pos.Nest * FS_NODE_SIZE, &node, FS_NODE_SIZE))
+    {
+        printf("FsDeleteNode failed, couldn't read node %u on disk.\n", nodeID);
+        return false;
+    }
+    if (!FsWalkNodeBlocks(pFs, &node, FsiFreeBlockVisitor, pFs))
+    {
+        printf("FsDeleteNode failed, couldn't walk the blocks of node %u to free them.\n", nodeID);
+        return false;
+    }
+
+    // An invalid ID marks the slot as free, entries still naming the node are left for the caller to remove.
+    node = FsInvalidNode();
+    if (!FsBlockCacheWrite(&pFs->Cache, pos.TableBlock, pos.Nest * FS_NODE_SIZE, &node, FS_NODE_SIZE))
+    {
+        printf("FsDeleteNode failed, couldn't clear node %u on disk.\n", nodeID);
+        return false;
+    }
+
+    pFs->Meta.NumAllocatedNodes--;
+    if (!FsGroupCountNodes(pFs, nodeID, -1) || !FsNodeIndexSet(&pFs->Nodes, pFs->pDevice, &pFs->Meta, nodeID, false))
+    {
+        return false;
+    }
+
+    if (!FsCommit(pFs))
+    {
+        puts("FsDeleteNode failed, couldn't commit the bitmap and file system metadata.");
+        return false;
+    }
+    return true;
 }
@@ -6,6 +6,7 @@
 #define MYTH_NODE_H
 
 #include "FileSystem.h"
+#include "Disk.h"
 
 #include <stdio.h>
 #include <stdbool.h>
@@ -21,14 +22,29 @@ nodepos_t FsResolveNodePos(const FsMeta* pMeta, nodeid_t nodeID);
 nodeid_t FsResolveNodeID(const FsMeta* pMeta, nodepos_t pos);
 
 // Finds the first unused node nest (byte offset within block) within a node block. Returns 0xFFFF if all nests are full.
-uint16_t FsFindNodeNest(FILE* pDisk, const FsMeta* pMeta, block_t nodeBlock);
+uint16_t FsFindNodeNest(FileSystemOnDisk* pFs, block_t nodeBlock);
 
 // Finds an unused node ID within FS.
-nodeid_t FsFindNodeID(FILE* pDisk, const FsMeta* pMeta);
+nodeid_t FsFindNodeID(FileSystemOnDisk* pFs);
+// Same as FsFindNodeID, but on a file system with groups the search starts in the group of nearID, usually the directory
+// the node is going to be entered in.
+nodeid_t FsFindNodeIDNear(FileSystemOnDisk* pFs, nodeid_t nearID);
+#define FS_NODE_TABLE_INIT_SIZE (UINT64_C(1) << 20) // Bytes of node table initialized at once when NodeWatermark is raised.
+
+// True when nodeID has a slot within the node table.
+bool     FsNodeInTable(const FsMeta* pMeta, nodeid_t nodeID);
+// True when the slot of nodeID is below NodeWatermark and has to be read, the ones past it are unused.
+bool     FsNodeInitialized(const FsMeta* pMeta, nodeid_t nodeID);
 
 FsNode FsInvalidNode(void);
-bool   FsNodeExists(FILE* pDisk, const FsMeta* pMeta, nodeid_t nodeID);
-FsNode FsGetNode(FILE* pDisk, const FsMeta* pMeta, nodeid_t nodeID);
+bool   FsNodeExists(FileSystemOnDisk* pFs, nodeid_t nodeID);
+FsNode FsGetNode(FileSystemOnDisk* pFs, nodeid_t nodeID);
+// Writes the node record itself to the node table, its data is left alone.
+bool   FsWriteNode(FileSystemOnDisk* pFs, const FsNode* pNode);
+
+// Grows the data of pNode by one zeroed block and returns it in pBlock, allocating the indirect blocks it needs on the way.
+// The data must end on a block boundary, Size grows by BlockSize. pNode is only updated in memory, write it with FsWriteNode.
+bool   FsNodeAppendBlock(FileSystemOnDisk* pFs, FsNode* pNode, block_t* pBlock);
 
 typedef enum
 {
@@ -37,11 +53,123 @@ typedef enum
     FS_WRITE_DATA_DISK_ERROR              = 2, // I/O failure.
     FS_WRITE_DATA_ALLOCATION_ERROR        = 3, // FS unrelated, allocation error on host device.
     FS_WRITE_DATA_INSUFFICIENT_DISK_SPACE = 4, // FS does not have enough space to contain the data.
-    FS_WRITE_DATA_TOO_BIG                 = 5  // FS cannot handle a node this big with the current configuration.
+    FS_WRITE_DATA_TOO_BIG                 = 5, // FS cannot handle a node this big with the current configuration.
+    FS_WRITE_DATA_COMPRESSED              = 6  // The data of compressed nodes can only be replaced as a whole.
 } write_node_data_result_t;
 const char* FsWriteNodeDataResultToString(write_node_data_result_t result);
 
-write_node_data_result_t FsWriteNodeData(FILE* pDisk, FsMeta* pMeta, nodeid_t nodeID, const void* pData, uint64_t szData);
+// Replaces the data of the node with pData in one go, same as opening a writer, appending pData and closing it.
+write_node_data_result_t FsWriteNodeData(FileSystemOnDisk* pFs, nodeid_t nodeID, const void* pData, uint64_t szData);
+
+/**
+ * Streaming replacement of a node's data. Data blocks are allocated and written as the data is appended, the writer only
+ * holds the list of blocks handed out so far and one partially filled block. The indirect blocks and the node itself are
+ * written when the writer is closed. For nodes that may have holes, whole blocks of zeroes aren't allocated at all and
+ * indirect blocks with nothing but holes underneath are left out. For compressed nodes the writer holds a whole cluster
+ * instead of a block and packs each one once it is full.
+ */
+typedef struct
+{
+    FileSystemOnDisk*        pFs;
+    FsNode                   Node;      // Node being written, Size counts every byte appended so far.
+    nodepos_t                Pos;
+    block_t*                 pBlocks;   // Data blocks in logical order, 0 for holes, followed by the indirect blocks once closing.
+    uint64_t                 NumBlocks;
+    uint64_t                 MaxBlocks; // Capacity of pBlocks.
+    uint8_t*                 pTail;     // Bytes of the last data block, or cluster when compressing, that isn't full yet.
+    uint32_t                 TailSize;
+    write_node_data_result_t Status;    // First failure, appending does nothing once it isn't FS_WRITE_DATA_SUCCESSFUL.
+    allocation_region_t*     pRegion;   // Blocks are taken from here first when set, may be set right after opening.
+    bool                     bHoles;    // Blocks of zeroes become holes, see FsNodeMayHaveHoles.
+    uint64_t                 FirstDeferred; // Index within pBlocks of the first block FsNodeWriterAppendDeferred handed out.
+    bool                     bCompress; // Data is packed cluster by cluster, see FsNodeIsCompressed.
+    uint8_t*                 pPacked;   // One packed cluster, only allocated when compressing.
+    uint64_t                 StoredBlocks; // Data blocks the node ended up with once closed, holes aren't counted.
+} FsNodeWriter;
+
+// Frees the current data of the node and prepares pWriter to append to it. Only a successfully opened writer has to be closed.
+// Whether the data is compressed follows FS_NODE_FLAG_COMPRESSED of the node, it is set when the node is made.
+write_node_data_result_t FsOpenNodeWriter(FileSystemOnDisk* pFs, nodeid_t nodeID, FsNodeWriter* pWriter);
+write_node_data_result_t FsNodeWriterAppend(FsNodeWriter* pWriter, const void* pData, uint64_t szData);
+// Appends szData bytes starting at offset of the file behind descriptor. Whole blocks are copied by the kernel, so only
+// the holes of the file itself become holes of the node, found with SEEK_DATA and SEEK_HOLE. Data being compressed is
+// read in and packed instead.
+write_node_data_result_t FsNodeWriterAppendFile(FsNodeWriter* pWriter, int descriptor, uint64_t offset, uint64_t szData);
+// Allocates the blocks for szData more bytes without writing them, pBlocks receives the FS_DIV(szData, BlockSize) blocks
+// in logical order. Everything appended before must end on a block boundary past the inline section and nothing may be
+// appended after. The caller writes the blocks, the last one zero padded, and must be done before the writer is closed.
+// When compressing, the blocks start on a cluster boundary and the caller writes each cluster packed (FsPackCluster)
+// into the first of its blocks, the others are released as holes through FsNodeWriterReleaseDeferred.
+write_node_data_result_t FsNodeWriterAppendDeferred(FsNodeWriter* pWriter, uint64_t szData, block_t* pBlocks);
+// Turns the deferred blocks the caller found to hold nothing but zeroes into holes and frees them. pBlocks is the list
+// FsNodeWriterAppendDeferred filled, with the entries of those blocks set to 0. Only for writers with bHoles set.
+void FsNodeWriterReleaseDeferred(FsNodeWriter* pWriter, const block_t* pBlocks);
+// Writes the remaining data, the indirect blocks and the node and commits. When any step failed, the blocks
+// of the writer are released and the node is left empty. Returns the first failure.
+write_node_data_result_t FsCloseNodeWriter(FsNodeWriter* pWriter);
+
+// In-place updates of a node's data. Only the data blocks within the range and the indirect blocks leading to new ones
+// are touched, the rest of the node stays where it is. Each call writes the node and commits like FsCloseNodeWriter.
+
+// Writes szData bytes of pData at offset. Writing past the end grows the node, anything between the old end and offset
+// reads as zeroes.
+write_node_data_result_t FsWriteNodeAt(FileSystemOnDisk* pFs, nodeid_t nodeID, uint64_t offset, const void* pData, uint64_t szData);
+// Same as FsWriteNodeAt at the end of the node's data.
+write_node_data_result_t FsAppendNode(FileSystemOnDisk* pFs, nodeid_t nodeID, const void* pData, uint64_t szData);
+// Sets the size of the node's data. Shrinking frees the data and indirect blocks past the new end, growing adds zeroes.
+write_node_data_result_t FsTruncateNode(FileSystemOnDisk* pFs, nodeid_t nodeID, uint64_t size);
+
+typedef enum
+{
+    FS_READ_DATA_SUCCESSFUL          = 0,
+    FS_READ_DATA_NODE_DOES_NOT_EXIST = 1,
+    FS_READ_DATA_DISK_ERROR          = 2, // I/O failure or a block map that doesn't cover the size of the node.
+    FS_READ_DATA_ALLOCATION_ERROR    = 3  // FS unrelated, allocation error on host device.
+} read_node_data_result_t;
+const char* FsReadNodeDataResultToString(read_node_data_result_t result);
+
+#define FS_READ_DEFAULT_READAHEAD (UINT64_C(8) << 20) // Bytes hinted ahead of a sequential reader.
+
+/** Physically contiguous stretch of a node's data blocks. */
+typedef struct
+{
+    uint64_t Logical; // Logical index of the first data block.
+    block_t  Start;
+    uint64_t Length;  // Blocks.
+} data_run_t;
+
+/**
+ * Random access reads of a node's data. Opening walks the direct and indirect pointers once and merges neighbouring
+ * blocks into runs, a read then costs one device read per run it touches and no indirect block is read again. Holes
+ * between the runs are filled with zeroes without touching the device. Before reading, the device is asked to fetch the
+ * blocks of the read and ReadaheadBlocks past its end in the background, so a node read front to back keeps the device
+ * busy ahead of the reader. Reading from a compressed node reads and unpacks every cluster the read touches, the last
+ * one is kept so small reads within a cluster unpack it once.
+ * The node must not be changed while the reader is open.
+ */
+typedef struct
+{
+    FileSystemOnDisk* pFs;
+    FsNode            Node;
+    data_run_t*       pRuns;           // Sorted by Logical.
+    uint64_t          NumRuns;
+    uint64_t          MaxRuns;         // Capacity of pRuns.
+    uint64_t          ReadaheadBlocks; // Blocks hinted past the end of a read.
+    uint64_t          NextHinted;      // Logical block the last readahead hint ended at.
+    bool              bMapFailed;      // pRuns couldn't grow while the node was mapped.
+    uint8_t*          pCluster;        // Last cluster unpacked, only allocated for compressed nodes.
+    uint8_t*          pPacked;         // Stored blocks of the cluster being unpacked.
+    uint64_t          Cluster;         // Index of the cluster within pCluster, UINT64_MAX when there is none.
+} FsNodeReader;
+
+// Maps the blocks of the node. readahead is in bytes, with 0 only the blocks being read are hinted. Only a successfully opened reader has to be closed.
+read_node_data_result_t FsOpenNodeReader(FileSystemOnDisk* pFs, nodeid_t nodeID, uint64_t readahead, FsNodeReader* pReader);
+// Reads up to size bytes starting at offset, pRead receives how many there were, less than size only at the end of the data.
+read_node_data_result_t FsNodeReaderRead(FsNodeReader* pReader, uint64_t offset, void* pDest, uint64_t size, uint64_t* pRead);
+void FsCloseNodeReader(FsNodeReader* pReader);
+
+// Reads up to szData bytes of the node's data starting at offset in one go, nothing past them is read ahead.
+read_node_data_result_t FsReadNodeData(FileSystemOnDisk* pFs, nodeid_t nodeID, uint64_t offset, void* pDest, uint64_t szData, uint64_t* pRead);
 
 typedef enum
 {
@@ -57,18 +185,7 @@ typedef enum
 } create_node_result_t;
 const char* FsCreateNodeResultToString(create_node_result_t result);
 
-create_node_result_t FsMakeNode(FILE* pDisk, FsMeta* pMeta, FsNode* pNode, const void* pData, uint64_t szData);
-bool FsDeleteNode(FILE* pDisk, FsMeta* pMeta, nodeid_t nodeID);
-
-typedef enum
-{
-    FS_REGISTER_NODE_SUCCESSFUL               = 0,
-    FS_REGISTER_NODE_DIRECTORY_DOES_NOT_EXIST = 1, // The directory to enter to doesn't exist.
-    FS_REGISTER_NODE_DOES_NOT_EXIST           = 2, // The node to register doesn't exist.
-    FS_REGISTER_NODE_NOT_DIRECTORY            = 3, // Specified nodeID for the directory node is not a directory node.
-} register_node_result_t;
-
-// Registers the node to be apart of a directory.
-register_node_result_t FsRegisterNode(FILE* pDisk, FsMeta* pMeta, nodeid_t dirNodeID, nodeid_t nodeID);
+create_node_result_t FsMakeNode(FileSystemOnDisk* pFs, FsNode* pNode, const void* pData, uint64_t szData);
+bool FsDeleteNode(FileSystemOnDisk* pFs, nodeid_t nodeID);
 
 #endif // !MYTH_NODE_H
@@ -0,0 +1,177 @@
+#include "NodeIndex.h"
+
+#include "Group.h"
+#include "Node.h"
+#include "Utils/BitScan.h"
+#include "Utils/Math.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool FsNodeIndexInit(FsNodeIndex* pIndex, const FsMeta* pMeta)
+{
+    memset(pIndex, 0, sizeof(FsNodeIndex));
+
+    uint32_t nodesPerBlock = pMeta->BlockSize / FS_NODE_SIZE;
+    uint64_t numTables     = FsHasGroups(pMeta) ? pMeta->NumGroups : 1;
+    pIndex->NumNodes       = FsHasGroups(pMeta) ? (uint64_t) pMeta->NumGroups * pMeta->NodesPerGroup
+                                                : (pMeta->AddrData - pMeta->AddrNodeTable) * nodesPerBlock;
+    pIndex->NodesPerTable  = FsHasGroups(pMeta) ? pMeta->NodesPerGroup : pIndex->NumNodes;
+    pIndex->SegmentNodes   = FS_MAX(FS_NODE_INDEX_SEGMENT_SIZE / pMeta->BlockSize, 1) * nodesPerBlock;
+    pIndex->SegmentNodes   = FS_MIN(pIndex->SegmentNodes, pIndex->NodesPerTable);
+    pIndex->SegmentsPerTable = FS_DIV(pIndex->NodesPerTable, pIndex->SegmentNodes);
+
+    pIndex->pUsed   = calloc(FS_DIV(pIndex->NumNodes, 8), sizeof(uint8_t));
+    pIndex->pLoaded = calloc(FS_DIV(numTables * pIndex->SegmentsPerTable, 8), sizeof(uint8_t));
+    if (!pIndex->pUsed || !pIndex->pLoaded)
+    {
+        printf("FsNodeIndexInit failed, couldn't allocate the index of %lu nodes.\n", pIndex->NumNodes);
+        FsNodeIndexRelease(pIndex);
+        return false;
+    }
+
+    return true;
+}
+
+void FsNodeIndexRelease(FsNodeIndex* pIndex)
+{
+    free(pIndex->pUsed);
+    free(pIndex->pLoaded);
+    free(pIndex->pBuffer);
+    memset(pIndex, 0, sizeof(FsNodeIndex));
+}
+
+static uint64_t FsiNodeIndexSegment(const FsNodeIndex* pIndex, nodeid_t nodeID)
+{
+    return (nodeID / pIndex->NodesPerTable) * pIndex->SegmentsPerTable + (nodeID % pIndex->NodesPerTable) / pIndex->SegmentNodes;
+}
+
+// First node ID of the segment, pNumNodes receives how many it holds.
+static nodeid_t FsiNodeIndexSegmentStart(const FsNodeIndex* pIndex, uint64_t segment, uint64_t* pNumNodes)
+{
+    uint64_t table  = segment / pIndex->SegmentsPerTable;
+    uint64_t offset = (segment % pIndex->SegmentsPerTable) * pIndex->SegmentNodes;
+    *pNumNodes = FS_MIN(pIndex->SegmentNodes, pIndex->NodesPerTable - offset);
+    return (nodeid_t) (table * pIndex->NodesPerTable + offset);
+}
+
+// Scans the node table of the segment unless that happened already.
+static bool FsiNodeIndexLoad(FsNodeIndex* pIndex, FsDevice* pDevice, const FsMeta* pMeta, uint64_t segment)
+{
+    if (pIndex->pLoaded[segment / 8] & (1 << (segment % 8)))
+    {
+        return true;
+    }
+
+    if (!pDevice->pMapping && !pIndex->pBuffer && !(pIndex->pBuffer = malloc(pIndex->SegmentNodes * FS_NODE_SIZE)))
+    {
+        puts("FsNodeIndex failed, couldn't allocate memory to read the node table.");
+        return false;
+    }
+
+    uint64_t numNodes;
+    nodeid_t firstNode = FsiNodeIndexSegmentStart(pIndex, segment, &numNodes);
+    block_t  tableBlock = FsResolveNodePos(pMeta, firstNode).TableBlock;
+
+    // Slots past NodeWatermark are unused without looking, only the reserved node IDs among them count as used.
+    if (FsHasLazyInit(pMeta))
+    {
+        for (uint64_t nodeID = FS_MAX(firstNode, pMeta->NodeWatermark); nodeID < firstNode + numNodes && nodeID <= FS_NODE_ID_ROOT; nodeID++)
+        {
+            pIndex->pUsed[nodeID / 8] |= 1 << (nodeID % 8);
+        }
+        numNodes = pMeta->NodeWatermark > firstNode ? FS_MIN(numNodes, pMeta->NodeWatermark - firstNode) : 0;
+    }
+
+    // The nodes of a segment are laid out back to back, a segment starts on a node table block and never leaves its group.
+    const FsNode* pNodes = numNodes == 0 ? NULL : FsDeviceView(pDevice, tableBlock * pMeta->BlockSize, numNodes * FS_NODE_SIZE, pIndex->pBuffer);
+    if (numNodes && !pNodes)
+    {
+        printf("FsNodeIndex failed, couldn't read the node table from block %lu on for nodes %u to %lu.\n",
+               tableBlock, firstNode, firstNode + numNodes - 1);
+        return false;
+    }
+
+    for (uint64_t i = 0; i < numNodes; i++)
+    {
+        uint64_t nodeID = firstNode + i;
+        if (pNodes[i].ID != FS_NODE_ID_INVALID || nodeID <= FS_NODE_ID_ROOT)
+        {
+            pIndex->pUsed[nodeID / 8] |= 1 << (nodeID % 8);
+        }
+    }
+
+    pIndex->pLoaded[segment / 8] |= 1 << (segment % 8);
+    pIndex->SegmentsLoaded++;
+    return true;
+}
+
+nodeid_t FsNodeIndexFindFree(FsNodeIndex* pIndex, FsDevice* pDevice, const FsMeta* pMeta, nodeid_t from, nodeid_t to)
+{
+    uint64_t end = FS_MIN((uint64_t) to, pIndex->NumNodes);
+    for (uint64_t nodeID = from; nodeID < end;)
+    {
+        uint64_t segment = FsiNodeIndexSegment(pIndex, (nodeid_t) nodeID);
+        if (!FsiNodeIndexLoad(pIndex, pDevice, pMeta, segment))
+        {
+            return FS_NODE_ID_INVALID;
+        }
+
+        uint64_t numNodes;
+        uint64_t segmentEnd = FsiNodeIndexSegmentStart(pIndex, segment, &numNodes) + numNodes;
+        uint64_t scanEnd    = FS_MIN(segmentEnd, end);
+
+        uint64_t found = BitScanFindClear(pIndex->pUsed, nodeID, scanEnd);
+        if (found < scanEnd)
+        {
+            return (nodeid_t) found;
+        }
+        nodeID = scanEnd;
+    }
+
+    return FS_NODE_ID_INVALID;
+}
+
+bool FsNodeIndexCheck(FsNodeIndex* pIndex, FsDevice* pDevice, const FsMeta* pMeta, nodeid_t nodeID, bool* pbUsed)
+{
+    if (nodeID >= pIndex->NumNodes)
+    {
+        printf("FsNodeIndexCheck failed, node %u has no slot within the node table.\n", nodeID);
+        return false;
+    }
+    if (!FsiNodeIndexLoad(pIndex, pDevice, pMeta, FsiNodeIndexSegment(pIndex, nodeID)))
+    {
+        return false;
+    }
+
+    *pbUsed = (pIndex->pUsed[nodeID / 8] >> (nodeID % 8)) & 1;
+    return true;
+}
+
+bool FsNodeIndexSet(FsNodeIndex* pIndex, FsDevice* pDevice, const FsMeta* pMeta, nodeid_t nodeID, bool bUsed)
+{
+    if (nodeID <= FS_NODE_ID_ROOT)
+    {
+        return true;
+    }
+    if (nodeID >= pIndex->NumNodes)
+    {
+        printf("FsNodeIndexSet failed, node %u has no slot within the node table.\n", nodeID);
+        return false;
+    }
+    if (!FsiNodeIndexLoad(pIndex, pDevice, pMeta, FsiNodeIndexSegment(pIndex, nodeID)))
+    {
+        return false;
+    }
+
+    if (bUsed)
+    {
+        pIndex->pUsed[nodeID / 8] |= 1 << (nodeID % 8);
+    }
+    else
+    {
+        pIndex->pUsed[nodeID / 8] &= ~(1 << (nodeID % 8));
+    }
+    return true;
+}
@@ -0,0 +1,48 @@
+/**
+ * Header for the free node index, the in-memory record of which node IDs are in use.
+ */
+
+#ifndef MYTH_NODE_INDEX_H
+#define MYTH_NODE_INDEX_H
+
+#include "FileSystem.h"
+#include "Device.h"
+
+#include <stdbool.h>
+
+#define FS_NODE_INDEX_SEGMENT_SIZE (UINT64_C(1) << 20) // Bytes of node table scanned at once when a segment is loaded.
+
+/**
+ * One bit per node ID, set while the node is in use, so finding an unused node is a bit scan instead of reading node
+ * table blocks. Nothing of it is stored on the disk. The node table is split into segments that are scanned the first
+ * time anything within them is needed, every node created afterwards is entered by FsMakeNode. A segment is always
+ * loaded before a node within it is created, so what the disk holds for an unloaded segment is still current.
+ *
+ * The reserved node IDs up to FS_NODE_ID_ROOT always read as in use, they are never handed out.
+ */
+typedef struct
+{
+    uint8_t* pUsed;           // Bit n stands for node ID n.
+    uint8_t* pLoaded;         // Bit s is set once segment s was scanned.
+    uint64_t NumNodes;        // Node IDs with a slot in the node table.
+    uint64_t NodesPerTable;   // Node IDs of each group, every node ID for revision 0.
+    uint64_t SegmentNodes;    // Node IDs of a segment, segments never span two groups.
+    uint64_t SegmentsPerTable;
+    uint8_t* pBuffer;         // Node table of one segment, only allocated when the device isn't mapped.
+
+    uint64_t SegmentsLoaded;
+} FsNodeIndex;
+
+bool FsNodeIndexInit(FsNodeIndex* pIndex, const FsMeta* pMeta);
+void FsNodeIndexRelease(FsNodeIndex* pIndex);
+
+// Lowest unused node ID within [from, to), FS_NODE_ID_INVALID when there is none or a segment couldn't be read.
+nodeid_t FsNodeIndexFindFree(FsNodeIndex* pIndex, FsDevice* pDevice, const FsMeta* pMeta, nodeid_t from, nodeid_t to);
+
+// Reports whether nodeID is in use through pbUsed. Returns false when its segment couldn't be read.
+bool FsNodeIndexCheck(FsNodeIndex* pIndex, FsDevice* pDevice, const FsMeta* pMeta, nodeid_t nodeID, bool* pbUsed);
+
+// Marks nodeID as used or unused, reserved node IDs are left alone. Returns false when its segment couldn't be read.
+bool FsNodeIndexSet(FsNodeIndex* pIndex, FsDevice* pDevice, const FsMeta* pMeta, nodeid_t nodeID, bool bUsed);
+
+#endif // !MYTH_NODE_INDEX_H
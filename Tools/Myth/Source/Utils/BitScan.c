@@ -0,0 +1,286 @@
+#include "BitScan.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define BITSCAN_X86
+#endif
+
+// Skips over leading bytes equal to `value`, returns the number of bytes skipped.
+typedef size_t (*bitscan_skip_t)(const uint8_t* pBytes, size_t size, uint8_t value);
+
+// Skips over leading bytes two arrays have in common, returns the number of bytes skipped.
+typedef size_t (*bitscan_match_t)(const uint8_t* pA, const uint8_t* pB, size_t size);
+
+static uint64_t BitScaniLoad(const uint8_t* pBytes, size_t size)
+{
+    uint64_t word = 0;
+    memcpy(&word, pBytes, size < sizeof(uint64_t) ? size : sizeof(uint64_t));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+static size_t BitScaniSkipWords(const uint8_t* pBytes, size_t size, uint8_t value)
+{
+    uint64_t pattern = value ? UINT64_MAX : 0;
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        if (BitScaniLoad(pBytes + i, sizeof(uint64_t)) != pattern)
+        {
+            break;
+        }
+    }
+    while (i < size && pBytes[i] == value)
+    {
+        i++;
+    }
+
+    return i;
+}
+
+static size_t BitScaniMatchWords(const uint8_t* pA, const uint8_t* pB, size_t size)
+{
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        if (BitScaniLoad(pA + i, sizeof(uint64_t)) != BitScaniLoad(pB + i, sizeof(uint64_t)))
+        {
+            break;
+        }
+    }
+    while (i < size && pA[i] == pB[i])
+    {
+        i++;
+    }
+
+    return i;
+}
+
+#ifdef BITSCAN_X86
+__attribute__((target("sse2")))
+static size_t BitScaniSkipSSE2(const uint8_t* pBytes, size_t size, uint8_t value)
+{
+    const __m128i pattern = _mm_set1_epi8((char) value);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*) (pBytes + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern)) != 0xFFFF)
+        {
+            break;
+        }
+    }
+
+    return i + BitScaniSkipWords(pBytes + i, size - i, value);
+}
+
+__attribute__((target("avx2")))
+static size_t BitScaniSkipAVX2(const uint8_t* pBytes, size_t size, uint8_t value)
+{
+    const __m256i pattern = _mm256_set1_epi8((char) value);
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*) (pBytes + i));
+        if ((uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, pattern)) != UINT32_MAX)
+        {
+            break;
+        }
+    }
+
+    return i + BitScaniSkipWords(pBytes + i, size - i, value);
+}
+
+__attribute__((target("sse2")))
+static size_t BitScaniMatchSSE2(const uint8_t* pA, const uint8_t* pB, size_t size)
+{
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*) (pA + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (pB + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xFFFF)
+        {
+            break;
+        }
+    }
+
+    return i + BitScaniMatchWords(pA + i, pB + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static size_t BitScaniMatchAVX2(const uint8_t* pA, const uint8_t* pB, size_t size)
+{
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (pA + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (pB + i));
+        if ((uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) != UINT32_MAX)
+        {
+            break;
+        }
+    }
+
+    return i + BitScaniMatchWords(pA + i, pB + i, size - i);
+}
+#endif
+
+static bitscan_skip_t  BitScaniSkip     = BitScaniSkipWords;
+static bitscan_match_t BitScaniMatch    = BitScaniMatchWords;
+static const char*     BitScaniSkipName = "64-bit words";
+
+// Picks the widest implementation the CPU supports before main runs, so worker threads never race on the choice.
+__attribute__((constructor))
+static void BitScaniSelect(void)
+{
+#ifdef BITSCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        BitScaniSkip     = BitScaniSkipAVX2;
+        BitScaniMatch    = BitScaniMatchAVX2;
+        BitScaniSkipName = "AVX2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        BitScaniSkip     = BitScaniSkipSSE2;
+        BitScaniMatch    = BitScaniMatchSSE2;
+        BitScaniSkipName = "SSE2";
+    }
+#endif
+}
+
+static uint64_t BitScaniFind(const uint8_t* pBits, uint64_t from, uint64_t to, uint8_t skipValue)
+{
+    // Searching for a clear bit is searching for a set bit in the inverted word.
+    uint64_t invert = skipValue ? UINT64_MAX : 0;
+    uint64_t totalBytes = (to + 7) / 8;
+
+    uint64_t bit = from;
+    while (bit < to)
+    {
+        uint64_t byteIndex = bit / 8;
+        if (bit % 8 == 0)
+        {
+            // Whole bytes that can't contain a match are skipped in bulk.
+            bit += BitScaniSkip(pBits + byteIndex, (to - bit) / 8, skipValue) * 8;
+            if (bit >= to)
+            {
+                break;
+            }
+            byteIndex = bit / 8;
+        }
+
+        uint8_t  shift = bit % 8;
+        uint64_t word  = (BitScaniLoad(pBits + byteIndex, totalBytes - byteIndex) ^ invert) >> shift;
+
+        uint64_t span = 64 - shift;
+        if (span > to - bit)
+        {
+            span = to - bit;
+            word &= (UINT64_C(1) << span) - 1;
+        }
+
+        if (word)
+        {
+            return bit + __builtin_ctzll(word);
+        }
+        bit += span;
+    }
+
+    return to;
+}
+
+uint64_t BitScanFindClear(const uint8_t* pBits, uint64_t from, uint64_t to)
+{
+    return BitScaniFind(pBits, from, to, 0xFF);
+}
+
+uint64_t BitScanFindSet(const uint8_t* pBits, uint64_t from, uint64_t to)
+{
+    return BitScaniFind(pBits, from, to, 0x00);
+}
+
+uint64_t BitScanFindDifference(const uint8_t* pA, const uint8_t* pB, uint64_t from, uint64_t to)
+{
+    uint64_t totalBytes = (to + 7) / 8;
+
+    uint64_t bit = from;
+    while (bit < to)
+    {
+        uint64_t byteIndex = bit / 8;
+        if (bit % 8 == 0)
+        {
+            // Bytes both arrays agree on are skipped in bulk, like in BitScaniFind.
+            bit += BitScaniMatch(pA + byteIndex, pB + byteIndex, (to - bit) / 8) * 8;
+            if (bit >= to)
+            {
+                break;
+            }
+            byteIndex = bit / 8;
+        }
+
+        uint8_t  shift = bit % 8;
+        uint64_t word  = (BitScaniLoad(pA + byteIndex, totalBytes - byteIndex) ^ BitScaniLoad(pB + byteIndex, totalBytes - byteIndex)) >> shift;
+
+        uint64_t span = 64 - shift;
+        if (span > to - bit)
+        {
+            span = to - bit;
+            word &= (UINT64_C(1) << span) - 1;
+        }
+
+        if (word)
+        {
+            return bit + __builtin_ctzll(word);
+        }
+        bit += span;
+    }
+
+    return to;
+}
+
+uint64_t BitScanCountSet(const uint8_t* pBits, uint64_t from, uint64_t to)
+{
+    uint64_t totalBytes = (to + 7) / 8;
+    uint64_t count = 0;
+
+    uint64_t bit = from;
+    while (bit < to)
+    {
+        uint64_t byteIndex = bit / 8;
+        uint8_t  shift = bit % 8;
+        uint64_t word  = BitScaniLoad(pBits + byteIndex, totalBytes - byteIndex) >> shift;
+
+        uint64_t span = 64 - shift;
+        if (span > to - bit)
+        {
+            span = to - bit;
+            word &= (UINT64_C(1) << span) - 1;
+        }
+
+        count += __builtin_popcountll(word);
+        bit += span;
+    }
+
+    return count;
+}
+
+bool BitScanIsZero(const uint8_t* pBytes, uint64_t size)
+{
+    return BitScaniSkip(pBytes, size, 0x00) == size;
+}
+
+const char* BitScanImplementation(void)
+{
+    return BitScaniSkipName;
+}
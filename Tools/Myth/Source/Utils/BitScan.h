@@ -0,0 +1,27 @@
+#ifndef MYTH_UTILS_BIT_SCAN_H
+#define MYTH_UTILS_BIT_SCAN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Bit i of a bit array lives in byte i / 8 at bit position i % 8, the same layout the Myth bitmap uses on disk.
+
+// Returns the index of the first clear bit within [from, to), or `to` if every bit in the range is set.
+uint64_t BitScanFindClear(const uint8_t* pBits, uint64_t from, uint64_t to);
+
+// Returns the index of the first set bit within [from, to), or `to` if every bit in the range is clear.
+uint64_t BitScanFindSet(const uint8_t* pBits, uint64_t from, uint64_t to);
+
+// Returns the index of the first bit within [from, to) that differs between the two bit arrays, or `to` if they match.
+uint64_t BitScanFindDifference(const uint8_t* pA, const uint8_t* pB, uint64_t from, uint64_t to);
+
+// Counts the set bits within [from, to).
+uint64_t BitScanCountSet(const uint8_t* pBits, uint64_t from, uint64_t to);
+
+// Returns true if all `size` bytes are zero. Not bit based, it shares the vectorized skip the scans above use.
+bool BitScanIsZero(const uint8_t* pBytes, uint64_t size);
+
+// Name of the implementation selected for this CPU, for diagnostics.
+const char* BitScanImplementation(void);
+
+#endif // !MYTH_UTILS_BIT_SCAN_H
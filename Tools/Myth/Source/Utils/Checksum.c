@@ -1,27 +1,194 @@
 #include "Checksum.h"
 
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define CHECKSUM_X86
+#endif
+
 #define CRC32_POLYNOMINAL UINT32_C(0xEDB88320)
 
-uint32_t ChecksumCRC32(const void* data, size_t size)
+// Inputs shorter than this aren't worth setting up the carry-less multiplication for.
+#define CHECKSUM_CLMUL_MINIMUM 64
+
+typedef uint32_t (*checksum_update_t)(uint32_t state, const uint8_t* bytes, size_t size);
+
+// Slicing tables. Table k maps a byte to its CRC contribution when it is followed by k more bytes, so 16 bytes are
+// folded into the state with 16 independent lookups instead of 128 shift and xor steps.
+static uint32_t ChecksumiTables[16][256];
+
+static uint32_t ChecksumiLoad(const uint8_t* bytes)
 {
-    const uint8_t* bytes = (const uint8_t*) data;
-    uint32_t checksum = 0xffffffff;
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(uint32_t));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap32(word);
+#endif
+    return word;
+}
 
+static uint32_t ChecksumiBytes(uint32_t state, const uint8_t* bytes, size_t size)
+{
     while (size--)
     {
-        checksum ^= *bytes++;
+        state = (state >> 8) ^ ChecksumiTables[0][(state ^ *bytes++) & 0xFF];
+    }
+    return state;
+}
+
+static uint32_t ChecksumiSlicing(uint32_t state, const uint8_t* bytes, size_t size)
+{
+    const uint32_t (*t)[256] = ChecksumiTables;
+
+    for (; size >= 16; bytes += 16, size -= 16)
+    {
+        uint32_t a = ChecksumiLoad(bytes) ^ state;
+        uint32_t b = ChecksumiLoad(bytes + 4);
+        uint32_t c = ChecksumiLoad(bytes + 8);
+        uint32_t d = ChecksumiLoad(bytes + 12);
+
+        state = t[15][a & 0xFF] ^ t[14][(a >> 8) & 0xFF] ^ t[13][(a >> 16) & 0xFF] ^ t[12][a >> 24] ^
+                t[11][b & 0xFF] ^ t[10][(b >> 8) & 0xFF] ^ t[ 9][(b >> 16) & 0xFF] ^ t[ 8][b >> 24] ^
+                t[ 7][c & 0xFF] ^ t[ 6][(c >> 8) & 0xFF] ^ t[ 5][(c >> 16) & 0xFF] ^ t[ 4][c >> 24] ^
+                t[ 3][d & 0xFF] ^ t[ 2][(d >> 8) & 0xFF] ^ t[ 1][(d >> 16) & 0xFF] ^ t[ 0][d >> 24];
+    }
+
+    if (size >= 8)
+    {
+        uint32_t a = ChecksumiLoad(bytes) ^ state;
+        uint32_t b = ChecksumiLoad(bytes + 4);
+
+        state = t[7][a & 0xFF] ^ t[6][(a >> 8) & 0xFF] ^ t[5][(a >> 16) & 0xFF] ^ t[4][a >> 24] ^
+                t[3][b & 0xFF] ^ t[2][(b >> 8) & 0xFF] ^ t[1][(b >> 16) & 0xFF] ^ t[0][b >> 24];
+        bytes += 8;
+        size  -= 8;
+    }
+
+    return ChecksumiBytes(state, bytes, size);
+}
+
+#ifdef CHECKSUM_X86
+// Folds 64 bytes at a time with carry-less multiplication and Barrett-reduces the remainder, following Intel's "Fast
+// CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction". The constants are x^n mod P for the bit
+// reflected polynomial, shifted by one as the reflected domain requires.
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t ChecksumiClmul(uint32_t state, const uint8_t* bytes, size_t size)
+{
+    if (size < CHECKSUM_CLMUL_MINIMUM)
+    {
+        return ChecksumiSlicing(state, bytes, size);
+    }
+
+    const __m128i k1k2   = _mm_set_epi64x(INT64_C(0x01C6E41596), INT64_C(0x0154442BD4)); // Fold by 512 bits.
+    const __m128i k3k4   = _mm_set_epi64x(INT64_C(0x00CCAA009E), INT64_C(0x01751997D0)); // Fold by 128 bits.
+    const __m128i k5     = _mm_set_epi64x(0, INT64_C(0x0163CD6124));                     // 64 down to 32 bits.
+    const __m128i poly   = _mm_set_epi64x(INT64_C(0x01F7011641), INT64_C(0x01DB710641)); // P(x) and Barrett's mu.
+    const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+
+    __m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) bytes), _mm_cvtsi32_si128((int) state));
+    __m128i x2 = _mm_loadu_si128((const __m128i*) (bytes + 16));
+    __m128i x3 = _mm_loadu_si128((const __m128i*) (bytes + 32));
+    __m128i x4 = _mm_loadu_si128((const __m128i*) (bytes + 48));
+    bytes += 64;
+    size  -= 64;
+
+    // Four independent lanes keep the multipliers busy.
+    for (; size >= 64; bytes += 64, size -= 64)
+    {
+        __m128i l1 = _mm_clmulepi64_si128(x1, k1k2, 0x00), h1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        __m128i l2 = _mm_clmulepi64_si128(x2, k1k2, 0x00), h2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        __m128i l3 = _mm_clmulepi64_si128(x3, k1k2, 0x00), h3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        __m128i l4 = _mm_clmulepi64_si128(x4, k1k2, 0x00), h4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(l1, h1), _mm_loadu_si128((const __m128i*) bytes));
+        x2 = _mm_xor_si128(_mm_xor_si128(l2, h2), _mm_loadu_si128((const __m128i*) (bytes + 16)));
+        x3 = _mm_xor_si128(_mm_xor_si128(l3, h3), _mm_loadu_si128((const __m128i*) (bytes + 32)));
+        x4 = _mm_xor_si128(_mm_xor_si128(l4, h4), _mm_loadu_si128((const __m128i*) (bytes + 48)));
+    }
+
+    // Fold the lanes into one, then any remaining whole 16 byte chunks into it.
+    __m128i lanes[3] = { x2, x3, x4 };
+    for (int i = 0; i < 3; i++)
+    {
+        __m128i low = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), low), lanes[i]);
+    }
+    for (; size >= 16; bytes += 16, size -= 16)
+    {
+        __m128i low = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), low), _mm_loadu_si128((const __m128i*) bytes));
+    }
+
+    // 128 bits down to 64, then to 32 + 32.
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, k3k4, 0x10));
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 4), _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5, 0x00));
+
+    // Barrett reduction to the final 32 bit remainder.
+    __m128i t = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+    t = _mm_clmulepi64_si128(_mm_and_si128(t, mask32), poly, 0x00);
+    state = (uint32_t) _mm_extract_epi32(_mm_xor_si128(x1, t), 1);
+
+    return ChecksumiSlicing(state, bytes, size);
+}
+#endif
+
+static checksum_update_t ChecksumiUpdate = ChecksumiSlicing;
+static const char*       ChecksumiName   = "slice-by-16";
+
+// Builds the tables and picks the fastest implementation before main runs, so worker threads never race on either.
+__attribute__((constructor))
+static void ChecksumiSelect(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
         for (uint8_t j = 0; j < 8; j++)
         {
-            if (checksum & 1)
-            {
-                checksum = (checksum >> 1) ^ CRC32_POLYNOMINAL;
-            }
-            else
-            {
-                checksum >>= 1;
-            }
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32_POLYNOMINAL : crc >> 1;
+        }
+        ChecksumiTables[0][i] = crc;
+    }
+    for (uint32_t k = 1; k < 16; k++)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t previous = ChecksumiTables[k - 1][i];
+            ChecksumiTables[k][i] = (previous >> 8) ^ ChecksumiTables[0][previous & 0xFF];
         }
     }
 
-    return checksum ^ 0xffffffff;
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+    {
+        ChecksumiUpdate = ChecksumiClmul;
+        ChecksumiName   = "PCLMULQDQ";
+    }
+#endif
+}
+
+uint32_t ChecksumCRC32Init(void)
+{
+    return 0xffffffff;
+}
+
+uint32_t ChecksumCRC32Update(uint32_t state, const void* data, size_t size)
+{
+    return ChecksumiUpdate(state, (const uint8_t*) data, size);
+}
+
+uint32_t ChecksumCRC32Final(uint32_t state)
+{
+    return state ^ 0xffffffff;
+}
+
+uint32_t ChecksumCRC32(const void* data, size_t size)
+{
+    return ChecksumCRC32Final(ChecksumCRC32Update(ChecksumCRC32Init(), data, size));
+}
+
+const char* ChecksumImplementation(void)
+{
+    return ChecksumiName;
 }
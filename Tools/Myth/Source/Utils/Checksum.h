@@ -4,6 +4,16 @@
 #include <stdint.h>
 #include <stddef.h>
 
+// CRC32 with the reflected polynomial 0xEDB88320, the one every Myth checksum uses.
 uint32_t ChecksumCRC32(const void* data, size_t size);
 
+// Incremental form for data that arrives in pieces. Init, Update any number of times and Final produce the same value
+// as ChecksumCRC32 over the concatenated pieces.
+uint32_t ChecksumCRC32Init(void);
+uint32_t ChecksumCRC32Update(uint32_t state, const void* data, size_t size);
+uint32_t ChecksumCRC32Final(uint32_t state);
+
+// Name of the implementation selected for this CPU, for diagnostics.
+const char* ChecksumImplementation(void);
+
 #endif // !MYTH_UTILS_CHECKSUM_H
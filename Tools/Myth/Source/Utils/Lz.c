@@ -0,0 +1,250 @@
+#include "Lz.h"
+
+#include <string.h>
+
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+
+static uint32_t LziLoad32(const uint8_t* pBytes)
+{
+    uint32_t word;
+    memcpy(&word, pBytes, sizeof(uint32_t));
+    return word;
+}
+
+static uint32_t LziHash(uint32_t sequence)
+{
+    return (sequence * UINT32_C(2654435761)) >> (32 - LZ_HASH_BITS);
+}
+
+// Number of bytes pA and pB have in common, up to pLimit.
+static size_t LziMatchLength(const uint8_t* pA, const uint8_t* pB, const uint8_t* pLimit)
+{
+    const uint8_t* pStart = pA;
+    while (pA + sizeof(uint64_t) <= pLimit)
+    {
+        uint64_t a, b;
+        memcpy(&a, pA, sizeof(uint64_t));
+        memcpy(&b, pB, sizeof(uint64_t));
+        if (a != b)
+        {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            return (size_t) (pA - pStart) + __builtin_clzll(a ^ b) / 8;
+#else
+            return (size_t) (pA - pStart) + __builtin_ctzll(a ^ b) / 8;
+#endif
+        }
+        pA += sizeof(uint64_t);
+        pB += sizeof(uint64_t);
+    }
+    while (pA < pLimit && *pA == *pB)
+    {
+        pA++;
+        pB++;
+    }
+    return (size_t) (pA - pStart);
+}
+
+// Writes the 255 continuation bytes of a length that didn't fit into its nibble. Returns NULL when pDestEnd is reached.
+static uint8_t* LziWriteLength(uint8_t* pOut, const uint8_t* pDestEnd, size_t length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        if (pOut == pDestEnd)
+        {
+            return NULL;
+        }
+        *pOut++ = 255;
+    }
+    if (pOut == pDestEnd)
+    {
+        return NULL;
+    }
+    *pOut++ = (uint8_t) length;
+    return pOut;
+}
+
+// Writes one sequence, matchLength 0 for the closing one that only has literals. Returns NULL when it doesn't fit.
+static uint8_t* LziWriteSequence(uint8_t* pOut, const uint8_t* pDestEnd, const uint8_t* pLiterals, size_t numLiterals,
+                                 size_t offset, size_t matchLength)
+{
+    if (pOut == pDestEnd)
+    {
+        return NULL;
+    }
+
+    uint8_t* pToken = pOut++;
+    *pToken = (uint8_t) ((numLiterals < 15 ? numLiterals : 15) << 4);
+    if (numLiterals >= 15 && !(pOut = LziWriteLength(pOut, pDestEnd, numLiterals - 15)))
+    {
+        return NULL;
+    }
+
+    if ((size_t) (pDestEnd - pOut) < numLiterals)
+    {
+        return NULL;
+    }
+    memcpy(pOut, pLiterals, numLiterals);
+    pOut += numLiterals;
+
+    if (!matchLength)
+    {
+        return pOut;
+    }
+
+    if (pDestEnd - pOut < 2)
+    {
+        return NULL;
+    }
+    *pOut++ = (uint8_t) offset;
+    *pOut++ = (uint8_t) (offset >> 8);
+
+    size_t extra = matchLength - LZ_MIN_MATCH;
+    *pToken |= (uint8_t) (extra < 15 ? extra : 15);
+    if (extra >= 15 && !(pOut = LziWriteLength(pOut, pDestEnd, extra - 15)))
+    {
+        return NULL;
+    }
+
+    return pOut;
+}
+
+size_t LzCompress(const uint8_t* pSource, size_t size, uint8_t* pDest, size_t capacity)
+{
+    const uint8_t* pEnd     = pSource + size;
+    const uint8_t* pAnchor  = pSource; // Start of the literals not written yet.
+    const uint8_t* pDestEnd = pDest + capacity;
+    uint8_t*       pOut     = pDest;
+
+    // Offset into pSource of the last position seen with each hash. An empty slot points at position 0, a candidate like any other.
+    uint32_t table[LZ_HASH_SIZE];
+    memset(table, 0, sizeof(table));
+
+    if (size > LZ_MATCH_LIMIT)
+    {
+        const uint8_t* pMatchEnd = pEnd - LZ_LAST_LITERALS;
+        const uint8_t* pLast     = pEnd - LZ_MATCH_LIMIT;
+
+        for (const uint8_t* pIn = pSource + 1; pIn <= pLast; )
+        {
+            uint32_t       sequence = LziLoad32(pIn);
+            uint32_t       hash     = LziHash(sequence);
+            const uint8_t* pRef     = pSource + table[hash];
+            table[hash] = (uint32_t) (pIn - pSource);
+
+            if (pRef >= pIn || (size_t) (pIn - pRef) > LZ_MAX_OFFSET || LziLoad32(pRef) != sequence)
+            {
+                // The longer nothing matched, the larger the steps, so data that doesn't compress is passed over quickly.
+                pIn += 1 + ((size_t) (pIn - pAnchor) >> 6);
+                continue;
+            }
+
+            while (pIn > pAnchor && pRef > pSource && pIn[-1] == pRef[-1])
+            {
+                pIn--;
+                pRef--;
+            }
+
+            size_t matchLength = LZ_MIN_MATCH + LziMatchLength(pIn + LZ_MIN_MATCH, pRef + LZ_MIN_MATCH, pMatchEnd);
+            pOut = LziWriteSequence(pOut, pDestEnd, pAnchor, (size_t) (pIn - pAnchor), (size_t) (pIn - pRef), matchLength);
+            if (!pOut)
+            {
+                return 0;
+            }
+
+            pIn    += matchLength;
+            pAnchor = pIn;
+            if (pIn - 2 > pSource && pIn - 2 <= pLast)
+            {
+                table[LziHash(LziLoad32(pIn - 2))] = (uint32_t) (pIn - 2 - pSource);
+            }
+        }
+    }
+
+    pOut = LziWriteSequence(pOut, pDestEnd, pAnchor, (size_t) (pEnd - pAnchor), 0, 0);
+    return pOut ? (size_t) (pOut - pDest) : 0;
+}
+
+// Reads the 255 continuation bytes of a length. Returns false when the input ends before the length does.
+static bool LziReadLength(const uint8_t** ppIn, const uint8_t* pInEnd, size_t* pLength)
+{
+    uint8_t byte;
+    do
+    {
+        if (*ppIn == pInEnd)
+        {
+            return false;
+        }
+        byte = *(*ppIn)++;
+        *pLength += byte;
+    } while (byte == 255);
+
+    return true;
+}
+
+bool LzDecompress(const uint8_t* pSource, size_t size, uint8_t* pDest, size_t expected)
+{
+    const uint8_t* pIn     = pSource;
+    const uint8_t* pInEnd  = pSource + size;
+    uint8_t*       pOut    = pDest;
+    uint8_t*       pOutEnd = pDest + expected;
+
+    while (pIn < pInEnd)
+    {
+        uint8_t token = *pIn++;
+
+        size_t numLiterals = token >> 4;
+        if (numLiterals == 15 && !LziReadLength(&pIn, pInEnd, &numLiterals))
+        {
+            return false;
+        }
+        if (numLiterals > (size_t) (pInEnd - pIn) || numLiterals > (size_t) (pOutEnd - pOut))
+        {
+            return false;
+        }
+        memcpy(pOut, pIn, numLiterals);
+        pIn  += numLiterals;
+        pOut += numLiterals;
+
+        // The closing sequence has no match.
+        if (pIn == pInEnd)
+        {
+            break;
+        }
+
+        if (pInEnd - pIn < 2)
+        {
+            return false;
+        }
+        size_t offset = (size_t) pIn[0] | ((size_t) pIn[1] << 8);
+        pIn += 2;
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !LziReadLength(&pIn, pInEnd, &matchLength))
+        {
+            return false;
+        }
+        matchLength += LZ_MIN_MATCH;
+
+        if (!offset || offset > (size_t) (pOut - pDest) || matchLength > (size_t) (pOutEnd - pOut))
+        {
+            return false;
+        }
+
+        // A match may overlap the bytes it produces, a short offset repeats them.
+        const uint8_t* pRef = pOut - offset;
+        if (offset >= matchLength)
+        {
+            memcpy(pOut, pRef, matchLength);
+            pOut += matchLength;
+        }
+        else
+        {
+            for (size_t i = 0; i < matchLength; i++)
+            {
+                *pOut++ = *pRef++;
+            }
+        }
+    }
+
+    return pOut == pOutEnd;
+}
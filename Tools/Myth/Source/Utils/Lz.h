@@ -0,0 +1,26 @@
+#ifndef MYTH_UTILS_LZ_H
+#define MYTH_UTILS_LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte oriented LZ77 codec using the LZ4 block format: each sequence is a token holding the number of literals and the
+// match length in its two nibbles, the literals, a 16 bit little endian offset back into the output and the rest of the
+// match length. Either length continues in bytes after the token or offset while they read 255. The last sequence is
+// literals only. Compression is a single greedy pass over a hash table of 4 byte prefixes, meant for speed over ratio.
+
+#define LZ_MIN_MATCH     4
+#define LZ_MAX_OFFSET    UINT32_C(65535)
+#define LZ_HASH_BITS     12
+#define LZ_LAST_LITERALS 5  // Bytes at the end that are always literals.
+#define LZ_MATCH_LIMIT   12 // A match never starts within this many bytes of the end.
+
+// Compresses size bytes of pSource into pDest. Returns the compressed size, or 0 when it doesn't fit into capacity bytes.
+size_t LzCompress(const uint8_t* pSource, size_t size, uint8_t* pDest, size_t capacity);
+
+// Decompresses size bytes of pSource into pDest. Returns true when they decode to exactly expected bytes, never reads or
+// writes outside of either buffer when the data is corrupt.
+bool LzDecompress(const uint8_t* pSource, size_t size, uint8_t* pDest, size_t expected);
+
+#endif // !MYTH_UTILS_LZ_H
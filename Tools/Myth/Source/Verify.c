@@ -0,0 +1,587 @@
+#include "Verify.h"
+
+#include "Bitmap.h"
+#include "BlockMap.h"
+#include "Compression.h"
+#include "Group.h"
+#include "Node.h"
+
+#include "Utils/BitScan.h"
+#include "Utils/Math.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define FS_VERIFY_CHUNK_SIZE (UINT64_C(1) << 20) // Bytes of node table a worker takes at a time.
+
+typedef struct
+{
+    FileSystemOnDisk* pFs;
+    uint8_t*          pShadow;        // Blocks found in use, laid out like FsBitmapCache.pBitmap.
+    uint32_t*         pTableNodes;    // Nodes in use per node table, reserved node IDs aren't counted.
+    uint64_t          NumTables;      // One node table per group, a single one for revision 0.
+    uint64_t          TableBlocks;    // Blocks of each node table.
+    uint64_t          ChunkBlocks;
+    uint64_t          ChunksPerTable;
+    uint64_t          NumChunks;
+    uint64_t          NextChunk;      // Next chunk no worker took yet, atomic.
+    uint32_t          NumPrinted;     // Problems printed so far, atomic.
+} verify_state_t;
+
+typedef struct
+{
+    verify_state_t* pState;
+    pthread_t       Thread;
+    uint8_t*        pTable;                           // One chunk of the node table.
+    uint8_t*        pIndirect[FS_BLOCK_LEVEL_TRIPLY]; // One indirect block per level, they are walked depth first.
+    FsVerifyReport  Report;                           // What this worker found, summed up once every worker is done.
+} verify_worker_t;
+
+typedef struct
+{
+    nodeid_t NodeID;
+    uint64_t NumData; // Data blocks the node's size calls for.
+    uint64_t Next;    // Logical index of the next data block expected.
+    bool     bHoles;  // Zero pointers are holes rather than missing blocks.
+} verify_walk_t;
+
+uint64_t FsVerifyProblems(const FsVerifyReport* pReport)
+{
+    return pReport->BadNodes + pReport->BadPointers + pReport->MissingPointers + pReport->CrossLinked + pReport->UnmarkedBlocks +
+           pReport->LeakedBlocks + pReport->BadTableHints + pReport->BadCounters + pReport->ReadErrors;
+}
+
+// True while problems may still be printed in detail, says so once the limit is reached.
+static bool FsiVerifyPrint(verify_state_t* pState)
+{
+    uint32_t numPrinted = __atomic_fetch_add(&pState->NumPrinted, 1, __ATOMIC_RELAXED);
+    if (numPrinted == FS_VERIFY_MAX_PRINTED)
+    {
+        puts("FsVerify: too many problems, the rest are only counted.");
+    }
+    return numPrinted < FS_VERIFY_MAX_PRINTED;
+}
+
+static block_t FsiVerifyTableStart(const FsMeta* pMeta, uint64_t table)
+{
+    return FsHasGroups(pMeta) ? FsGroupStart(pMeta, (uint32_t) table) + 1 : pMeta->AddrNodeTable;
+}
+
+static nodeid_t FsiVerifyTableFirstNode(const FsMeta* pMeta, uint64_t table)
+{
+    return FsHasGroups(pMeta) ? (nodeid_t) table * pMeta->NodesPerGroup : 0;
+}
+
+static bool FsiVerifyInDataArea(const FsMeta* pMeta, block_t block)
+{
+    if (block >= pMeta->Size)
+    {
+        return false;
+    }
+    if (FsHasGroups(pMeta))
+    {
+        return block >= pMeta->AddrBitmap && block >= FsGroupData(pMeta, FsGroupOfBlock(pMeta, block));
+    }
+    return block >= pMeta->AddrData;
+}
+
+static void FsiVerifyMark(verify_state_t* pState, block_t block)
+{
+    uint64_t bit = block - FsBitmapFirstBlock(&pState->pFs->Meta);
+    __atomic_fetch_or(&pState->pShadow[bit / 8], (uint8_t) (1 << (bit % 8)), __ATOMIC_RELAXED);
+}
+
+// Records that nodeID uses block. Returns false when the block can't belong to any node, it mustn't be followed then.
+static bool FsiVerifyClaim(verify_worker_t* pWorker, nodeid_t nodeID, block_t block)
+{
+    verify_state_t* pState = pWorker->pState;
+    const FsMeta* pMeta = &pState->pFs->Meta;
+
+    if (!FsiVerifyInDataArea(pMeta, block))
+    {
+        pWorker->Report.BadPointers++;
+        if (FsiVerifyPrint(pState))
+        {
+            printf("FsVerify: node %u points at block %lu, which is outside of the data area.\n", nodeID, block);
+        }
+        return false;
+    }
+
+    uint64_t bit  = block - FsBitmapFirstBlock(pMeta);
+    uint8_t  mask = (uint8_t) (1 << (bit % 8));
+    if (__atomic_fetch_or(&pState->pShadow[bit / 8], mask, __ATOMIC_RELAXED) & mask)
+    {
+        pWorker->Report.CrossLinked++;
+        if (FsiVerifyPrint(pState))
+        {
+            printf("FsVerify: block %lu of node %u is used by another node or twice by the same one.\n", block, nodeID);
+        }
+    }
+    return true;
+}
+
+// Reports the zero pointer the walk is at unless the node may have holes, numSkipped data blocks would have been reached
+// through it.
+static void FsiVerifyMissing(verify_worker_t* pWorker, verify_walk_t* pWalk, uint64_t numSkipped)
+{
+    if (!pWalk->bHoles)
+    {
+        pWorker->Report.MissingPointers++;
+        if (FsiVerifyPrint(pWorker->pState))
+        {
+            printf("FsVerify: node %u has no block for its data block %lu.\n", pWalk->NodeID, pWalk->Next);
+        }
+    }
+    pWalk->Next += FS_MIN(numSkipped, pWalk->NumData - pWalk->Next);
+}
+
+// Follows an indirect block and everything underneath it, span is the number of data blocks behind each of its pointers.
+static void FsiVerifyIndirect(verify_worker_t* pWorker, verify_walk_t* pWalk, block_t block, uint8_t level, uint64_t span)
+{
+    FileSystemOnDisk* pFs = pWorker->pState->pFs;
+    uint64_t ptrsPerBlock = pFs->Meta.BlockSize / sizeof(block_t);
+
+    if (!block)
+    {
+        FsiVerifyMissing(pWorker, pWalk, span * ptrsPerBlock);
+        return;
+    }
+    if (!FsiVerifyClaim(pWorker, pWalk->NodeID, block))
+    {
+        pWalk->Next += FS_MIN(span * ptrsPerBlock, pWalk->NumData - pWalk->Next);
+        return;
+    }
+
+    const block_t* pPointers = FsDeviceView(pFs->pDevice, block * pFs->Meta.BlockSize, pFs->Meta.BlockSize, pWorker->pIndirect[level - 1]);
+    if (!pPointers)
+    {
+        pWorker->Report.ReadErrors++;
+        printf("FsVerify: couldn't read indirect block %lu of node %u.\n", block, pWalk->NodeID);
+        pWalk->Next += FS_MIN(span * ptrsPerBlock, pWalk->NumData - pWalk->Next);
+        return;
+    }
+
+    for (uint64_t i = 0; i < ptrsPerBlock && pWalk->Next < pWalk->NumData; i++)
+    {
+        if (level > FS_BLOCK_LEVEL_SINGLY)
+        {
+            FsiVerifyIndirect(pWorker, pWalk, pPointers[i], level - 1, span / ptrsPerBlock);
+            continue;
+        }
+
+        if (!pPointers[i])
+        {
+            FsiVerifyMissing(pWorker, pWalk, 1);
+            continue;
+        }
+        FsiVerifyClaim(pWorker, pWalk->NodeID, pPointers[i]);
+        pWalk->Next++;
+    }
+}
+
+static void FsiVerifyNode(verify_worker_t* pWorker, nodeid_t nodeID, const FsNode* pNode)
+{
+    verify_state_t* pState = pWorker->pState;
+    const FsMeta* pMeta = &pState->pFs->Meta;
+    uint64_t ptrsPerBlock = pMeta->BlockSize / sizeof(block_t);
+
+    const char* pProblem = NULL;
+    uint64_t maxBlocks = FS_NODE_DIRECT_DATA_BLOCKS + ptrsPerBlock + ptrsPerBlock * ptrsPerBlock + ptrsPerBlock * ptrsPerBlock * ptrsPerBlock;
+    if (pNode->ID != nodeID)
+    {
+        pProblem = "its record carries a different ID";
+    }
+    else if (pNode->Type < FS_NODE_TYPE_FILE || pNode->Type > FS_NODE_TYPE_SOFT_LINK)
+    {
+        pProblem = "its type is unknown";
+    }
+    else if (FsNodeDataBlocks(pMeta, pNode->Size) > maxBlocks)
+    {
+        pProblem = "it is larger than its pointers can address";
+    }
+    else if (nodeID == FS_NODE_ID_ROOT && pNode->Type != FS_NODE_TYPE_DIRECTORY)
+    {
+        pProblem = "the root isn't a directory";
+    }
+    else if (pNode->Type == FS_NODE_TYPE_DIRECTORY && (pNode->Flags & FS_NODE_FLAG_INDEXED) &&
+             (pNode->Size < FS_NODE_INLINE_DATA_SIZE || (pNode->Size - FS_NODE_INLINE_DATA_SIZE) % pMeta->BlockSize))
+    {
+        pProblem = "its directory index doesn't end on a block boundary";
+    }
+    else if ((pNode->Flags & FS_NODE_FLAG_COMPRESSED) && !FsNodeIsCompressed(pMeta, pNode))
+    {
+        pProblem = "it is flagged as compressed but can't be";
+    }
+
+    if (pProblem)
+    {
+        pWorker->Report.BadNodes++;
+        if (FsiVerifyPrint(pState))
+        {
+            printf("FsVerify: node %u is broken, %s.\n", nodeID, pProblem);
+        }
+        return;
+    }
+
+    verify_walk_t walk;
+    walk.NodeID  = nodeID;
+    walk.NumData = FsNodeDataBlocks(pMeta, pNode->Size);
+    walk.Next    = 0;
+    walk.bHoles  = FsNodeMayHaveHoles(pMeta, pNode);
+
+    while (walk.Next < walk.NumData && walk.Next < FS_NODE_DIRECT_DATA_BLOCKS)
+    {
+        if (!pNode->DirectData[walk.Next])
+        {
+            FsiVerifyMissing(pWorker, &walk, 1);
+            continue;
+        }
+        FsiVerifyClaim(pWorker, nodeID, pNode->DirectData[walk.Next]);
+        walk.Next++;
+    }
+
+    const block_t roots[FS_BLOCK_LEVEL_TRIPLY] = { pNode->AddrSinglyIndirect, pNode->AddrDoublyIndirect, pNode->AddrTriplyIndirect };
+    uint64_t span = 1;
+    for (uint8_t level = FS_BLOCK_LEVEL_SINGLY; level <= FS_BLOCK_LEVEL_TRIPLY && walk.Next < walk.NumData; level++)
+    {
+        FsiVerifyIndirect(pWorker, &walk, roots[level - 1], level, span);
+        span *= ptrsPerBlock;
+    }
+}
+
+static void FsiVerifyChunk(verify_worker_t* pWorker, uint64_t chunk)
+{
+    verify_state_t* pState = pWorker->pState;
+    FileSystemOnDisk* pFs = pState->pFs;
+    const FsMeta* pMeta = &pFs->Meta;
+    uint32_t nodesPerBlock = pMeta->BlockSize / FS_NODE_SIZE;
+
+    uint64_t table     = chunk / pState->ChunksPerTable;
+    uint64_t offset    = (chunk % pState->ChunksPerTable) * pState->ChunkBlocks;
+    uint64_t numBlocks = FS_MIN(pState->ChunkBlocks, pState->TableBlocks - offset);
+    block_t  start     = FsiVerifyTableStart(pMeta, table) + offset;
+
+    // Node table blocks past NodeWatermark were never written, their nodes are unused.
+    if (FsHasLazyInit(pMeta))
+    {
+        nodeid_t tableFirst = FsiVerifyTableFirstNode(pMeta, table);
+        uint64_t numInitialized = pMeta->NodeWatermark > tableFirst ? FS_DIV(pMeta->NodeWatermark - tableFirst, nodesPerBlock) : 0;
+        if (offset >= numInitialized)
+        {
+            return;
+        }
+        numBlocks = FS_MIN(numBlocks, numInitialized - offset);
+    }
+
+    const FsNode* pNodes = FsDeviceView(pFs->pDevice, start * pMeta->BlockSize, numBlocks * pMeta->BlockSize, pWorker->pTable);
+    if (!pNodes)
+    {
+        pWorker->Report.ReadErrors++;
+        printf("FsVerify: couldn't read node table blocks %lu to %lu.\n", start, start + numBlocks - 1);
+        return;
+    }
+
+    nodeid_t firstNode = FsiVerifyTableFirstNode(pMeta, table) + (nodeid_t) (offset * nodesPerBlock);
+    uint32_t numUsed = 0;
+    for (uint64_t i = 0; i < numBlocks; i++)
+    {
+        bool bFull = true;
+        for (uint32_t nest = 0; nest < nodesPerBlock; nest++)
+        {
+            nodeid_t nodeID = firstNode + (nodeid_t) (i * nodesPerBlock + nest);
+            const FsNode* pNode = &pNodes[i * nodesPerBlock + nest];
+
+            if (nodeID == FS_NODE_ID_INVALID || !pNode->ID)
+            {
+                bool bRequired = nodeID == FS_NODE_ID_ROOT || (nodeID == FS_NODE_ID_JOURNAL && (pMeta->Flags & FS_FLAG_JOURNALED));
+                if (pNode->ID || bRequired)
+                {
+                    pWorker->Report.BadNodes++;
+                    if (FsiVerifyPrint(pState))
+                    {
+                        printf("FsVerify: node %u is %s.\n", nodeID, pNode->ID ? "in use, node 0 is reserved" : "missing");
+                    }
+                }
+                bFull = bFull && nodeID == FS_NODE_ID_INVALID;
+                continue;
+            }
+
+            pWorker->Report.NodesInUse++;
+            numUsed += nodeID > FS_NODE_ID_ROOT;
+            FsiVerifyNode(pWorker, nodeID, pNode);
+        }
+
+        // Revision 0 marks node table blocks without free nests, the mark may lag behind but must never be early.
+        if (!FsHasGroups(pMeta) && FsBitmapCheckBlock(&pFs->Bitmap, pMeta, start + i) == FS_BITMAP_BLOCK_ALLOCATED)
+        {
+            if (bFull)
+            {
+                FsiVerifyMark(pState, start + i);
+            }
+            else
+            {
+                pWorker->Report.BadTableHints++;
+                if (FsiVerifyPrint(pState))
+                {
+                    printf("FsVerify: node table block %lu is marked full but has free nodes.\n", start + i);
+                }
+            }
+        }
+    }
+
+    __atomic_fetch_add(&pState->pTableNodes[table], numUsed, __ATOMIC_RELAXED);
+}
+
+static void* FsiVerifyWorker(void* pArgument)
+{
+    verify_worker_t* pWorker = (verify_worker_t*) pArgument;
+    verify_state_t*  pState  = pWorker->pState;
+
+    uint64_t chunk;
+    while ((chunk = __atomic_fetch_add(&pState->NextChunk, 1, __ATOMIC_RELAXED)) < pState->NumChunks)
+    {
+        FsiVerifyChunk(pWorker, chunk);
+    }
+    return NULL;
+}
+
+// Marks what is in use without belonging to a node: the bits past the end of the volume and, with groups, the bitmap and
+// node table blocks of every group.
+static void FsiVerifyMarkMetadata(verify_state_t* pState)
+{
+    const FsMeta* pMeta = &pState->pFs->Meta;
+    block_t firstBlock = FsBitmapFirstBlock(pMeta);
+    uint64_t totalBits = pState->pFs->Bitmap.NumBlocks * pMeta->BlockSize * 8;
+
+    for (uint64_t bit = pMeta->Size - firstBlock; bit < totalBits; bit++)
+    {
+        pState->pShadow[bit / 8] |= 1 << (bit % 8);
+    }
+
+    if (FsHasGroups(pMeta))
+    {
+        for (uint32_t group = 0; group < pMeta->NumGroups; group++)
+        {
+            for (block_t block = FsGroupStart(pMeta, group); block < FsGroupData(pMeta, group); block++)
+            {
+                FsiVerifyMark(pState, block);
+            }
+        }
+    }
+}
+
+static void FsiVerifyBitmap(verify_state_t* pState, FsVerifyReport* pReport)
+{
+    const FsMeta* pMeta = &pState->pFs->Meta;
+    const uint8_t* pBitmap = pState->pFs->Bitmap.pBitmap;
+    block_t firstBlock = FsBitmapFirstBlock(pMeta);
+    uint64_t totalBits = pState->pFs->Bitmap.NumBlocks * pMeta->BlockSize * 8;
+
+    for (uint64_t bit = BitScanFindDifference(pState->pShadow, pBitmap, 0, totalBits); bit < totalBits;
+         bit = BitScanFindDifference(pState->pShadow, pBitmap, bit + 1, totalBits))
+    {
+        block_t block = firstBlock + bit;
+        if (pState->pShadow[bit / 8] & (1 << (bit % 8)))
+        {
+            pReport->UnmarkedBlocks++;
+            if (FsiVerifyPrint(pState))
+            {
+                printf("FsVerify: block %lu is in use but free in the bitmap.\n", block);
+            }
+        }
+        else if (FsHasGroups(pMeta) || block >= pMeta->AddrData)
+        {
+            // Revision 0 node table blocks marked too early were reported already.
+            pReport->LeakedBlocks++;
+            if (FsiVerifyPrint(pState))
+            {
+                printf("FsVerify: block %lu is allocated in the bitmap but not in use.\n", block);
+            }
+        }
+    }
+}
+
+static void FsiVerifyCounter(verify_state_t* pState, FsVerifyReport* pReport, const char* pName, uint64_t stored, uint64_t found)
+{
+    if (stored == found)
+    {
+        return;
+    }
+
+    pReport->BadCounters++;
+    if (FsiVerifyPrint(pState))
+    {
+        printf("FsVerify: %s is %lu but should be %lu.\n", pName, stored, found);
+    }
+}
+
+static bool FsiVerifyCounters(verify_state_t* pState, FsVerifyReport* pReport)
+{
+    FileSystemOnDisk* pFs = pState->pFs;
+    const FsMeta* pMeta = &pFs->Meta;
+    block_t firstBlock = FsBitmapFirstBlock(pMeta);
+
+    // Revision 0 counts everything before the node table as allocated and its node table blocks not at all.
+    block_t firstCounted = FsHasGroups(pMeta) ? firstBlock : pMeta->AddrData;
+    pReport->BlocksInUse = firstBlock + BitScanCountSet(pState->pShadow, firstCounted - firstBlock, pMeta->Size - firstBlock);
+
+    FsiVerifyCounter(pState, pReport, "NumAllocatedBlocks", pMeta->NumAllocatedBlocks, pReport->BlocksInUse);
+    FsiVerifyCounter(pState, pReport, "NumAllocatedNodes", pMeta->NumAllocatedNodes, pReport->NodesInUse);
+    if (pMeta->LastAllocatedNodeID > pMeta->NodeCapacity || pMeta->LastAllocatedDataBlock >= pMeta->Size)
+    {
+        pReport->BadCounters++;
+        if (FsiVerifyPrint(pState))
+        {
+            printf("FsVerify: the allocation cursors (node %u, block %lu) are outside of the file system.\n",
+                   pMeta->LastAllocatedNodeID, pMeta->LastAllocatedDataBlock);
+        }
+    }
+
+    if (!FsHasGroups(pMeta))
+    {
+        return true;
+    }
+
+    for (uint32_t group = 0; group < pMeta->NumGroups; group++)
+    {
+        FsGroupDescriptor descriptor;
+        if (!FsReadGroup(pFs, group, &descriptor))
+        {
+            pReport->ReadErrors++;
+            return false;
+        }
+
+        block_t start = FsGroupStart(pMeta, group);
+        block_t end   = FsGroupEnd(pMeta, group);
+        uint64_t freeBlocks = (end - start) - BitScanCountSet(pState->pShadow, start - firstBlock, end - firstBlock);
+
+        nodeid_t firstNode = group * pMeta->NodesPerGroup;
+        uint32_t numReserved = firstNode <= FS_NODE_ID_ROOT ? FS_MIN(FS_NODE_ID_ROOT + 1 - firstNode, pMeta->NodesPerGroup) : 0;
+        uint64_t freeNodes = pMeta->NodesPerGroup - numReserved - pState->pTableNodes[group];
+
+        char name[48];
+        snprintf(name, sizeof(name), "FreeBlocks of group %u", group);
+        FsiVerifyCounter(pState, pReport, name, descriptor.FreeBlocks, freeBlocks);
+        snprintf(name, sizeof(name), "FreeNodes of group %u", group);
+        FsiVerifyCounter(pState, pReport, name, descriptor.FreeNodes, freeNodes);
+    }
+
+    return true;
+}
+
+bool FsVerify(FileSystemOnDisk* pFs, uint32_t numThreads, FsVerifyReport* pReport)
+{
+    memset(pReport, 0, sizeof(FsVerifyReport));
+    const FsMeta* pMeta = &pFs->Meta;
+
+    // The workers read the disk directly, nothing may be left in memory or only in the journal.
+    if (!FsSync(pFs) || (pFs->Journal.Start && pFs->Journal.Head > 1 &&
+                         !FsJournalCheckpoint(&pFs->Journal, pFs->pDevice, &pFs->Meta, &pFs->Cache, &pFs->Bitmap)))
+    {
+        puts("FsVerify failed, couldn't write pending changes home.");
+        return false;
+    }
+
+    if (!numThreads)
+    {
+        long numProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = numProcessors > 0 ? (uint32_t) numProcessors : 1;
+    }
+
+    verify_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.pFs            = pFs;
+    state.NumTables      = FsHasGroups(pMeta) ? pMeta->NumGroups : 1;
+    state.TableBlocks    = FsHasGroups(pMeta) ? FsGroupNodeTableBlocks(pMeta) : pMeta->AddrData - pMeta->AddrNodeTable;
+    state.ChunkBlocks    = FS_MAX(FS_VERIFY_CHUNK_SIZE / pMeta->BlockSize, 1);
+    state.ChunksPerTable = FS_DIV(state.TableBlocks, state.ChunkBlocks);
+    state.NumChunks      = state.NumTables * state.ChunksPerTable;
+    if (FsHasLazyInit(pMeta))
+    {
+        state.NumChunks = FS_MIN(FS_DIV(pMeta->NodeWatermark, pMeta->NodesPerGroup), state.NumTables) * state.ChunksPerTable;
+    }
+    state.pShadow        = calloc(pFs->Bitmap.NumBlocks, pMeta->BlockSize);
+    state.pTableNodes    = calloc(state.NumTables, sizeof(uint32_t));
+
+    numThreads = (uint32_t) FS_MAX(FS_MIN(numThreads, state.NumChunks), 1);
+    verify_worker_t* pWorkers = calloc(numThreads, sizeof(verify_worker_t));
+    if (!state.pShadow || !state.pTableNodes || !pWorkers)
+    {
+        puts("FsVerify failed, couldn't allocate memory for the shadow bitmap.");
+        free(state.pShadow);
+        free(state.pTableNodes);
+        free(pWorkers);
+        return false;
+    }
+
+    FsiVerifyMarkMetadata(&state);
+
+    bool bResult = true;
+    uint32_t numStarted = 0;
+    for (uint32_t i = 0; i < numThreads && bResult; i++)
+    {
+        verify_worker_t* pWorker = &pWorkers[i];
+        pWorker->pState = &state;
+        pWorker->pTable = malloc(state.ChunkBlocks * pMeta->BlockSize);
+        bResult = pWorker->pTable != NULL;
+        for (uint8_t level = 0; level < FS_BLOCK_LEVEL_TRIPLY; level++)
+        {
+            bResult = bResult && (pWorker->pIndirect[level] = malloc(pMeta->BlockSize)) != NULL;
+        }
+
+        // The calling thread is the first worker, it starts once every other one did.
+        if (bResult && i > 0)
+        {
+            bResult = pthread_create(&pWorker->Thread, NULL, FsiVerifyWorker, pWorker) == 0;
+            numStarted += bResult;
+        }
+    }
+    if (bResult)
+    {
+        FsiVerifyWorker(&pWorkers[0]);
+    }
+    else
+    {
+        // Whatever was started runs to completion, the chunks are just never handed out.
+        __atomic_store_n(&state.NextChunk, state.NumChunks, __ATOMIC_RELAXED);
+        printf("FsVerify failed, couldn't start %u worker threads.\n", numThreads);
+    }
+
+    for (uint32_t i = 0; i < numThreads; i++)
+    {
+        verify_worker_t* pWorker = &pWorkers[i];
+        if (i > 0 && i <= numStarted)
+        {
+            pthread_join(pWorker->Thread, NULL);
+        }
+
+        pReport->NodesInUse      += pWorker->Report.NodesInUse;
+        pReport->BadNodes        += pWorker->Report.BadNodes;
+        pReport->BadPointers     += pWorker->Report.BadPointers;
+        pReport->MissingPointers += pWorker->Report.MissingPointers;
+        pReport->CrossLinked     += pWorker->Report.CrossLinked;
+        pReport->BadTableHints   += pWorker->Report.BadTableHints;
+        pReport->ReadErrors      += pWorker->Report.ReadErrors;
+
+        free(pWorker->pTable);
+        for (uint8_t level = 0; level < FS_BLOCK_LEVEL_TRIPLY; level++)
+        {
+            free(pWorker->pIndirect[level]);
+        }
+    }
+    pReport->NumThreads = numThreads;
+
+    if (bResult)
+    {
+        FsiVerifyBitmap(&state, pReport);
+        bResult = FsiVerifyCounters(&state, pReport);
+    }
+
+    free(pWorkers);
+    free(state.pShadow);
+    free(state.pTableNodes);
+    return bResult;
+}
@@ -0,0 +1,44 @@
+/**
+ * Header for the consistency check of a whole file system.
+ *
+ * The node table is split into chunks that worker threads take turns on. Every node in use is checked on its own and
+ * all of its direct and indirect pointers are followed, each referenced block is claimed in a shadow bitmap built from
+ * scratch. The shadow bitmap is compared against the bitmap of the file system afterwards and the counters of the
+ * metadata and the group descriptors are recomputed from it. Only node records and indirect blocks are read, never
+ * file data, and the walk bypasses the block cache so the workers don't share anything but the shadow bitmap.
+ */
+
+#ifndef MYTH_VERIFY_H
+#define MYTH_VERIFY_H
+
+#include "FileSystem.h"
+#include "Disk.h"
+
+#include <stdbool.h>
+
+#define FS_VERIFY_MAX_PRINTED UINT32_C(32) // Problems printed in detail, the rest are only counted.
+
+typedef struct
+{
+    uint32_t NumThreads;
+    uint64_t NodesInUse;
+    uint64_t BlocksInUse;      // Recomputed NumAllocatedBlocks.
+    uint64_t BadNodes;         // Node records that can't be right, their blocks aren't walked.
+    uint64_t BadPointers;      // Pointers outside of the data area, they aren't followed.
+    uint64_t MissingPointers;  // Zero pointers where the size of a node says there is data, unless they are holes.
+    uint64_t CrossLinked;      // Blocks referenced more than once.
+    uint64_t UnmarkedBlocks;   // Blocks in use but free in the bitmap, they would be handed out a second time.
+    uint64_t LeakedBlocks;     // Blocks set in the bitmap nothing uses, they are lost until fixed but harmless.
+    uint64_t BadTableHints;    // Revision 0 node table blocks marked full while they still have free nodes.
+    uint64_t BadCounters;      // Metadata and group descriptor counters that disagree with what was found.
+    uint64_t ReadErrors;
+} FsVerifyReport;
+
+// Number of problems within pReport, leaked blocks included.
+uint64_t FsVerifyProblems(const FsVerifyReport* pReport);
+
+// Writes any pending changes of pFs home and checks it with numThreads threads, 0 uses one per online processor.
+// pFs is not modified otherwise. Returns false when the check couldn't be carried out, pReport tells what was found.
+bool FsVerify(FileSystemOnDisk* pFs, uint32_t numThreads, FsVerifyReport* pReport);
+
+#endif // !MYTH_VERIFY_H